@@ -0,0 +1,265 @@
+//
+// cdcore.cpp
+//
+// Runs the USB CD gadget's data path on its own CPU core.
+//
+// Copyright (C) 2025 Ian Cass, Dani Sarfati
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include "cdcore.h"
+
+#include <assert.h>
+#include <circle/logger.h>
+#include <circle/sched/scheduler.h>
+#include <circle/sched/task.h>
+#include <circle/timer.h>
+#include <circle/util.h>
+#include <usbcdgadget/usbcdgadget.h>
+
+LOGMODULE("cdcore");
+
+// How long core 1 naps between polls when the gadget has nothing for it.
+// Short enough to be invisible next to a USB microframe (125 us), long
+// enough that an idle drive is not hammering the bus with loads.
+#define IDLE_POLL_US 20
+
+CCDCore *CCDCore::s_pThis = nullptr;
+
+CCDCore::CCDCore(CMemorySystem *pMemorySystem)
+#ifdef ARM_ALLOW_MULTI_CORE
+    : CMultiCoreSupport(pMemorySystem),
+      m_pGadget(nullptr),
+#else
+    : m_pGadget(nullptr),
+#endif
+      m_bStarted(FALSE),
+      m_nStorageOwner(0),
+      m_bStorageWanted(0),
+      m_nStorageWantedTicks(0),
+      m_nTimedTasks(0),
+      m_pRunningSlot(nullptr),
+      m_nLastSwitchTicks(0)
+{
+    // I am the one and only!
+    assert(s_pThis == nullptr);
+    s_pThis = this;
+
+    memset(&m_StorageWait, 0, sizeof(m_StorageWait));
+
+    // Core 0 owns storage until core 1 asks, so the handler can be in place
+    // long before core 1 sees the gadget.
+    CScheduler::Get()->RegisterTaskSwitchHandler(TaskSwitchHandler);
+}
+
+CCDCore::~CCDCore(void)
+{
+    s_pThis = nullptr;
+}
+
+boolean CCDCore::Initialize(void)
+{
+#ifdef ARM_ALLOW_MULTI_CORE
+    if (m_bStarted)
+    {
+        return TRUE;
+    }
+
+    if (!CMultiCoreSupport::Initialize())
+    {
+        LOGERR("Cannot start secondary cores - USB CD stays on core 0");
+        return FALSE;
+    }
+
+    m_bStarted = TRUE;
+    LOGNOTE("Secondary cores started, core 1 reserved for the USB CD data path");
+    return TRUE;
+#else
+    LOGNOTE("Single-core build - USB CD data path stays on core 0");
+    return FALSE;
+#endif
+}
+
+boolean CCDCore::Attach(CUSBCDGadget *pGadget)
+{
+    if (!m_bStarted || pGadget == nullptr)
+    {
+        return FALSE;
+    }
+
+    assert(m_pGadget == nullptr);
+
+    __atomic_store_n(&m_pGadget, pGadget, __ATOMIC_RELEASE);
+
+    LOGNOTE("USB CD data path handed to core 1");
+    return TRUE;
+}
+
+#ifdef ARM_ALLOW_MULTI_CORE
+
+void CCDCore::Run(unsigned nCore)
+{
+    // Cores 2 and 3 have nothing to do; returning halts them.
+    if (nCore != 1)
+    {
+        return;
+    }
+
+    while (true)
+    {
+        CUSBCDGadget *pGadget = __atomic_load_n(&m_pGadget, __ATOMIC_ACQUIRE);
+        if (pGadget == nullptr || !pGadget->HasDataPathWork())
+        {
+            CTimer::SimpleusDelay(IDLE_POLL_US);
+            continue;
+        }
+
+        AcquireStorage();
+        pGadget->UpdateDataPath();
+        ReleaseStorage();
+    }
+}
+
+#endif
+
+void CCDCore::AcquireStorage(void)
+{
+    __atomic_store_n(&m_nStorageWantedTicks, CTimer::Get()->GetClockTicks(), __ATOMIC_RELAXED);
+    __atomic_store_n(&m_bStorageWanted, 1, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&m_nStorageOwner, __ATOMIC_ACQUIRE) != 1)
+    {
+        // Core 0 grants at its next task switch.
+    }
+}
+
+void CCDCore::ReleaseStorage(void)
+{
+    __atomic_store_n(&m_bStorageWanted, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&m_nStorageOwner, 0, __ATOMIC_RELEASE);
+}
+
+// IRQs stay enabled while waiting, so the USB IRQ keeps parsing commands and
+// the SD card driver keeps getting its completion interrupts.
+void CCDCore::GrantStorage(void)
+{
+    if (!__atomic_load_n(&m_bStorageWanted, __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+
+    // The task that had core 0 until now: the one switched away from, or
+    // the one calling
+    u32 nWait = CTimer::Get()->GetClockTicks() - __atomic_load_n(&m_nStorageWantedTicks, __ATOMIC_RELAXED);
+    m_StorageWait.nGrants++;
+    m_StorageWait.nTotalUs += nWait;
+    if (nWait > m_StorageWait.nMaxUs)
+    {
+        m_StorageWait.nMaxUs = nWait;
+        const char *pName = m_pRunningSlot != nullptr ? m_pRunningSlot->Time.Name : "";
+        strncpy(m_StorageWait.MaxHolder, pName, sizeof(m_StorageWait.MaxHolder) - 1);
+        m_StorageWait.MaxHolder[sizeof(m_StorageWait.MaxHolder) - 1] = '\0';
+    }
+
+    __atomic_store_n(&m_nStorageOwner, 1, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&m_nStorageOwner, __ATOMIC_ACQUIRE) != 0)
+    {
+        // Core 1 gives it back as soon as its read is done.
+    }
+}
+
+// GrantStorage() runs in the task switch handler or from a core 0 task, so
+// the counters never change under the copy.
+void CCDCore::GetStorageWait(TStorageWait *pWait) const
+{
+    assert(pWait != nullptr);
+    *pWait = m_StorageWait;
+}
+
+// Runs on core 0 between two tasks, where none of them can be inside FatFs.
+void CCDCore::TaskSwitchHandler(CTask *pNewTask)
+{
+    CCDCore *pThis = s_pThis;
+    if (pThis != nullptr)
+    {
+        pThis->GrantStorage();
+        pThis->AccountTaskSwitch(pNewTask);
+    }
+}
+
+// Tasks are found by pointer; a name that no longer matches means the task
+// was deleted and another one took its place, which starts the count again.
+void CCDCore::AccountTaskSwitch(CTask *pNewTask)
+{
+    unsigned nNow = CTimer::Get()->GetClockTicks();
+    if (m_pRunningSlot != nullptr)
+    {
+        u32 nSlice = nNow - m_nLastSwitchTicks;
+        TTaskTime &Time = m_pRunningSlot->Time;
+        Time.nRunUs += nSlice;
+        if (nSlice > Time.nMaxSliceUs)
+        {
+            Time.nMaxSliceUs = nSlice;
+        }
+    }
+    m_nLastSwitchTicks = nNow;
+
+    const char *pName = pNewTask->GetName();
+    if (pName == nullptr || *pName == '\0')
+    {
+        pName = "(unnamed)";
+    }
+
+    m_pRunningSlot = nullptr;
+    for (unsigned i = 0; i < m_nTimedTasks; i++)
+    {
+        if (m_TaskTimes[i].pTask == pNewTask)
+        {
+            m_pRunningSlot = &m_TaskTimes[i];
+            break;
+        }
+    }
+    if (m_pRunningSlot == nullptr && m_nTimedTasks < MaxTimedTasks)
+    {
+        m_pRunningSlot = &m_TaskTimes[m_nTimedTasks++];
+        m_pRunningSlot->pTask = pNewTask;
+        m_pRunningSlot->Time.Name[0] = '\0';
+    }
+    if (m_pRunningSlot == nullptr)
+    {
+        return;
+    }
+
+    TTaskTime &Time = m_pRunningSlot->Time;
+    if (strncmp(Time.Name, pName, sizeof(Time.Name) - 1) != 0)
+    {
+        strncpy(Time.Name, pName, sizeof(Time.Name) - 1);
+        Time.Name[sizeof(Time.Name) - 1] = '\0';
+        Time.nRunUs = 0;
+        Time.nSwitches = 0;
+        Time.nMaxSliceUs = 0;
+    }
+    Time.nSwitches++;
+}
+
+// The handler runs on core 0 between tasks and this from a core 0 task, so
+// the table never changes under the copy.
+unsigned CCDCore::GetTaskTimes(TTaskTime *pTimes, unsigned nMax) const
+{
+    unsigned nCount = m_nTimedTasks < nMax ? m_nTimedTasks : nMax;
+    for (unsigned i = 0; i < nCount; i++)
+    {
+        pTimes[i] = m_TaskTimes[i].Time;
+    }
+    return nCount;
+}
@@ -0,0 +1,162 @@
+//
+// cdcore.h
+//
+// Runs the USB CD gadget's data path on its own CPU core.
+//
+// Everything else in USBODE shares core 0 through the cooperative scheduler,
+// so with the gadget serviced from a task, a READ that is waiting for the SD
+// card also waits for every task queued ahead of CDROMService - a mustache
+// render or a JPEG decode shows up directly as host-visible read latency.
+// CCDCore moves CUSBCDGadget::UpdateDataPath() (image reads and the disc-swap
+// timer) to core 1. SCSI command parsing stays in the USB IRQ on core 0,
+// which already preempts any task, and the services the gadget talks to stay
+// on core 0 behind lock-free handoff queues (see handoffqueue.h).
+//
+// FatFs and the SD card driver are not re-entrant, so the two cores take
+// turns on storage: core 0 owns it while its tasks run and hands it over,
+// whenever core 1 asks, at a point where no core 0 task is inside FatFs -
+// every task switch, and the grant points below. Core 1 gives storage back
+// as soon as its read completes, so neither side ever sees the other
+// mid-call.
+//
+// The scheduler is cooperative and has no time slices, so this does not
+// make read latency independent of core 0: core 1 waits until the task
+// running on core 0 yields or reaches a grant point. What it removes is the
+// wait for every other task queued ahead of CDROMService. Work that runs
+// long without yielding calls GrantStorage() itself (CDROMService while
+// reads are pending, the disc art JPEG decoder per block). The wait is
+// measured (GetStorageWait()) together with the task that caused the
+// longest one, so a task that needs a grant point shows up in the metrics.
+//
+// Nothing that runs on core 1 may call CLogger or the scheduler. CLogger
+// wakes the log daemon by setting a CSynchronizationEvent, which runs the
+// scheduler on the calling core, and core 1 has none of its own. The data
+// path and the image devices under it log through CBinLog (see
+// tracelab/binlog.h), whose records core 0 formats; CBinLog::Drain() and
+// CUSBCDGadget::UpdateTaskLevel() assert that they are on core 0.
+//
+// Copyright (C) 2025 Ian Cass, Dani Sarfati
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _cdcore_cdcore_h
+#define _cdcore_cdcore_h
+
+#include <circle/types.h>
+#include <circle/memory.h>
+#ifdef ARM_ALLOW_MULTI_CORE
+#include <circle/multicore.h>
+#endif
+
+class CUSBCDGadget;
+class CTask;
+
+#ifdef ARM_ALLOW_MULTI_CORE
+class CCDCore : public CMultiCoreSupport
+#else
+class CCDCore
+#endif
+{
+public:
+    CCDCore(CMemorySystem *pMemorySystem);
+    ~CCDCore(void);
+
+    static CCDCore *Get(void) { return s_pThis; }
+
+    // Starts the secondary cores. Core 0 only, once, before Attach(). FALSE
+    // on a single-core build, where the gadget stays on the CDROMService task.
+    boolean Initialize(void);
+
+    // Hands the gadget's data path to core 1. From then on the caller must
+    // not call the gadget's Update()/UpdateDataPath() itself. FALSE if the
+    // core is not running, in which case nothing changed.
+    boolean Attach(CUSBCDGadget *pGadget);
+
+    boolean IsActive(void) const { return m_pGadget != nullptr; }
+
+    // Core 0: hands storage to core 1 if it is waiting, and takes it back
+    // once its read is done. Called on every task switch, and by tasks at
+    // points where they are not inside FatFs, because a lone runnable task
+    // never switches and a long computation holds core 0 until it ends.
+    void GrantStorage(void);
+
+    // How long core 1 waited for storage, from asking to being granted it
+    struct TStorageWait
+    {
+        u32 nGrants;
+        u64 nTotalUs;
+        u32 nMaxUs;
+        char MaxHolder[16];     // the core 0 task that caused the longest
+    };
+
+    // Core 0 task level
+    void GetStorageWait(TStorageWait *pWait) const;
+
+#ifdef ARM_ALLOW_MULTI_CORE
+    void Run(unsigned nCore) override;
+#endif
+
+    // Core 0 run time per task, measured between task switches. The task
+    // switch hook is taken here because Circle has only one, so the times
+    // are kept from construction on, whether or not core 1 ever starts.
+    struct TTaskTime
+    {
+        char Name[16];
+        u64 nRunUs;         // total time the task ran
+        u32 nSwitches;      // times it was switched in
+        u32 nMaxSliceUs;    // longest run without yielding
+    };
+
+    // Copies out up to nMax entries, returns how many. Core 0 task level.
+    unsigned GetTaskTimes(TTaskTime *pTimes, unsigned nMax) const;
+
+private:
+    // Core 1 side of the storage turn. Blocks (spinning) until core 0 has
+    // reached a task switch and handed storage over.
+    void AcquireStorage(void);
+    void ReleaseStorage(void);
+
+    // Core 0 side, called by the scheduler on every task switch.
+    static void TaskSwitchHandler(CTask *pNewTask);
+
+    // Charges the time since the last switch to the task that had core 0
+    void AccountTaskSwitch(CTask *pNewTask);
+
+private:
+    CUSBCDGadget *volatile m_pGadget;
+    boolean m_bStarted;
+
+    // Which core may touch storage right now (0 or 1), and whether core 1
+    // is waiting for it. Only core 1 raises the request; only core 0 grants.
+    unsigned m_nStorageOwner;
+    unsigned m_bStorageWanted;
+    unsigned m_nStorageWantedTicks;     // set by core 1 before it asks
+    TStorageWait m_StorageWait;         // core 0 only
+
+    // Tasks beyond this many are not timed
+    static const unsigned MaxTimedTasks = 24;
+    struct TTaskSlot
+    {
+        CTask *pTask;
+        TTaskTime Time;
+    };
+    TTaskSlot m_TaskTimes[MaxTimedTasks];
+    unsigned m_nTimedTasks;
+    TTaskSlot *m_pRunningSlot;
+    unsigned m_nLastSwitchTicks;
+
+    static CCDCore *s_pThis;
+};
+
+#endif
@@ -0,0 +1,110 @@
+//
+// handoffqueue.h
+//
+// Lock-free single-producer/single-consumer queue for handing small records
+// from one execution context to another: from the dedicated USB CD core to
+// the tasks that stay on core 0, or from the USB IRQ to a task.
+//
+// Exactly one context may Put() and exactly one may Get(). Neither side ever
+// waits for the other: a full queue makes Put() fail, an empty one makes
+// Get() fail, and the caller decides what that means (drop and count, or
+// retry on its next pass). A producer that can be preempted by another
+// producer on the same core (task vs. IRQ) must bracket Put() with
+// EnterCritical()/LeaveCritical() so the two stay one producer.
+//
+// Copyright (C) 2025 Ian Cass, Dani Sarfati
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _cdcore_handoffqueue_h
+#define _cdcore_handoffqueue_h
+
+#include <circle/types.h>
+#ifdef ARM_ALLOW_MULTI_CORE
+#include <circle/multicore.h>
+#endif
+
+template <typename T, unsigned N>
+class THandoffQueue
+{
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "queue size must be a power of two");
+
+public:
+    THandoffQueue(void) : m_nHead(0), m_nTail(0) {}
+
+    // Producer side. FALSE when full; the item is not queued.
+    boolean Put(const T &rItem)
+    {
+        unsigned nHead = __atomic_load_n(&m_nHead, __ATOMIC_RELAXED);
+        unsigned nTail = __atomic_load_n(&m_nTail, __ATOMIC_ACQUIRE);
+        if (nHead - nTail >= N)
+        {
+            return FALSE;
+        }
+
+        m_Items[nHead & (N - 1)] = rItem;
+
+        // Release: the consumer must see the item before it sees the index.
+        __atomic_store_n(&m_nHead, nHead + 1, __ATOMIC_RELEASE);
+        return TRUE;
+    }
+
+    // Consumer side. FALSE when empty.
+    boolean Get(T *pItem)
+    {
+        unsigned nTail = __atomic_load_n(&m_nTail, __ATOMIC_RELAXED);
+        unsigned nHead = __atomic_load_n(&m_nHead, __ATOMIC_ACQUIRE);
+        if (nTail == nHead)
+        {
+            return FALSE;
+        }
+
+        *pItem = m_Items[nTail & (N - 1)];
+
+        // Release: the slot is only reusable once the copy above is done.
+        __atomic_store_n(&m_nTail, nTail + 1, __ATOMIC_RELEASE);
+        return TRUE;
+    }
+
+    // Either side; a snapshot that may be stale by the time it is used.
+    boolean IsEmpty(void) const
+    {
+        return __atomic_load_n(&m_nHead, __ATOMIC_ACQUIRE) ==
+               __atomic_load_n(&m_nTail, __ATOMIC_ACQUIRE);
+    }
+
+    unsigned GetCount(void) const
+    {
+        return __atomic_load_n(&m_nHead, __ATOMIC_ACQUIRE) -
+               __atomic_load_n(&m_nTail, __ATOMIC_ACQUIRE);
+    }
+
+private:
+    T m_Items[N];
+    unsigned m_nHead; // written only by the producer
+    unsigned m_nTail; // written only by the consumer
+};
+
+// The core the caller runs on. Always 0 in a single-core build, so code that
+// picks a queue by core compiles unchanged either way.
+inline unsigned HandoffThisCore(void)
+{
+#ifdef ARM_ALLOW_MULTI_CORE
+    return CMultiCoreSupport::ThisCore();
+#else
+    return 0;
+#endif
+}
+
+#endif
@@ -23,6 +23,7 @@
 #include <circle/string.h>
 #include <circle/synchronize.h>
 #include <circle/util.h>
+#include <ioscheduler/ioscheduler.h>
 
 LOGMODULE("cdplayer");
 
@@ -90,15 +91,28 @@ boolean CCDPlayer::SetDevice(IImageDevice *pBinFileDevice) {
         // CRITICAL: Give I2S hardware FIFO time to drain
         // The hardware FIFO can't be instantly cleared - samples already
         // clocked into the I2S peripheral need time to be transmitted
-        // At 44.1kHz, ~100ms ensures all samples are clocked out
-        LOGNOTE("Waiting for I2S hardware FIFO to drain...");
-        CTimer::Get()->MsDelay(100);
-
-        // Double-flush to catch any samples that were mid-transfer
-        LOGNOTE("Performing secondary flush");
-        m_pSound->Flush();
+        // At 44.1kHz, ~100ms ensures all samples are clocked out.
+        // Nothing was clocked in unless audio was running, and a swap
+        // between the discs of a game should not wait on a silent FIFO.
+        if (bNeedRestart) {
+            LOGNOTE("Waiting for I2S hardware FIFO to drain...");
+            CTimer::Get()->MsDelay(100);
+
+            // Double-flush to catch any samples that were mid-transfer
+            LOGNOTE("Performing secondary flush");
+            m_pSound->Flush();
+        }
     }
     
+    // Anything still queued was meant for the old disc, except the volume
+    TPlayerCommand stale;
+    while (m_Commands.Get(&stale)) {
+        if (stale.type == PlayerCommandVolume) {
+            ApplyCommand(stale);
+        }
+        m_nApplied++;
+    }
+
     // STEP 4: Reset ALL address pointers
     address = 0;
     end_address = 0;
@@ -251,41 +265,19 @@ boolean CCDPlayer::SetDefaultVolume(u8 vol) {
 }
 
 boolean CCDPlayer::SetVolume(u8 vol) {
-    LOGNOTE("Setting volume to 0x%02x", vol);
-    volumeByte = vol;
-    return true;
+    return QueueCommand(PlayerCommandVolume, 0, vol);
 }
 
 boolean CCDPlayer::Pause() {
-    // Only allow pause when currently playing
-    if (state != PLAYING) {
-        LOGNOTE("CD Player: Pause requested in invalid state (%u)", state);
-        return false;
-    }
-
-    LOGNOTE("CD Player pausing");
-    state = PAUSED;
-    return true;
+    return QueueCommand(PlayerCommandPause);
 }
 
 boolean CCDPlayer::Resume() {
-    // Resume only valid from paused state
-    if (state != PAUSED) {
-        LOGNOTE("CD Player: Resume requested in invalid state (%u)", state);
-        return false;
-    }
-
-    LOGNOTE("CD Player resuming");
-    state = PLAYING;
-    return true;
+    return QueueCommand(PlayerCommandResume);
 }
 
 boolean CCDPlayer::Seek(u32 lba) {
-    // See to the new lba
-    LOGNOTE("CD Player seeking to %u", lba);
-    address = lba;
-    state = SEEKING;
-    return true;
+    return QueueCommand(PlayerCommandSeek, lba);
 }
 
 // READ SUB-CHANNEL response differentiates between
@@ -293,15 +285,41 @@ boolean CCDPlayer::Seek(u32 lba) {
 // doing nothing. Stopped is a one time reported status
 // and then we change to NONE
 unsigned int CCDPlayer::GetState() {
-    unsigned int s = state;
+    EnterCritical();
+    unsigned int s;
+    if (m_nQueued != m_nApplied) {
+        // A queued Stop is reported now; Run() will not report it again
+        s = m_QueuedState;
+        if (m_QueuedState == STOPPED_OK) {
+            m_QueuedState = NONE;
+            m_bQueuedStopReported = true;
+        }
+    } else {
+        s = state;
+        if (state == STOPPED_ERROR || state == STOPPED_OK)
+            state = NONE;
+    }
+    LeaveCritical();
+    return s;
+}
 
-    if (state == STOPPED_ERROR || state == STOPPED_OK)
-        state = NONE;
+// The same state for a status display, leaving a stop for the host to read
+unsigned int CCDPlayer::PeekState() {
+    EnterCritical();
+    unsigned int s = m_nQueued != m_nApplied ? m_QueuedState : state;
+    LeaveCritical();
     return s;
 }
 
 u32 CCDPlayer::GetCurrentAddress() {
-    return address;
+    EnterCritical();
+    u32 a = m_nQueued != m_nApplied && m_bQueuedAddress ? m_QueuedAddress : address;
+    LeaveCritical();
+    return a;
+}
+
+u32 CCDPlayer::GetUnderrunCount() const {
+    return __atomic_load_n(&m_nUnderruns, __ATOMIC_RELAXED);
 }
 
 // Loads a sample from "system/test.pcm" and plays it
@@ -360,30 +378,150 @@ boolean CCDPlayer::SoundTest() {
 }
 
 boolean CCDPlayer::Play(u32 lba, u32 num_blocks) {
-    LOGNOTE("CD Player playing from %u for %u blocks (previous state=%u)", lba, num_blocks, state);
+    return QueueCommand(PlayerCommandPlay, lba, num_blocks);
+}
 
-    // Validate media presence
-    if (m_pBinFileDevice == nullptr) {
-        LOGERR("CD Player: Play requested but no device set");
-        return false;
+boolean CCDPlayer::PlaybackStop() {
+    return QueueCommand(PlayerCommandStop);
+}
+
+boolean CCDPlayer::NextState(TPlayerCommandType type, PlayState From, PlayState *pTo) {
+    switch (type) {
+        case PlayerCommandPlay:
+            *pTo = SEEKING_PLAYING;  // seek then transition to PLAYING in Run()
+            return true;
+
+        case PlayerCommandPause:
+            // Only allow pause when currently playing
+            *pTo = PAUSED;
+            return From == PLAYING;
+
+        case PlayerCommandResume:
+            // Resume only valid from paused state
+            *pTo = PLAYING;
+            return From == PAUSED;
+
+        case PlayerCommandSeek:
+            *pTo = SEEKING;
+            return true;
+
+        case PlayerCommandStop:
+            // Stop only valid if playing or paused
+            *pTo = STOPPED_OK;
+            return From == PLAYING || From == PAUSED || From == SEEKING_PLAYING;
+
+        case PlayerCommandVolume:
+            *pTo = From;
+            return true;
     }
 
-    address = lba;
-    end_address = address + num_blocks;
-    state = SEEKING_PLAYING; // seek then transition to PLAYING in Run()
-    return true;
+    return false;
 }
 
-boolean CCDPlayer::PlaybackStop() {
-    // Stop only valid if playing or paused
-    if (state != PLAYING && state != PAUSED && state != SEEKING_PLAYING) {
-        LOGNOTE("CD Player: Stop requested in invalid state (%u)", state);
-        return false;
+// Called from the USB IRQ as well as from tasks, so the two are kept to a
+// single producer with a critical section. A command is checked against the
+// state the commands ahead of it will leave, and returns false, as it did
+// when it was applied at once, if it is not valid there, if there is no
+// disc to play, or if the player has fallen so far behind that the queue
+// is full.
+boolean CCDPlayer::QueueCommand(TPlayerCommandType type, u32 lba, u32 num_blocks) {
+    TPlayerCommand command;
+    command.type = type;
+    command.lba = lba;
+    command.num_blocks = num_blocks;
+
+    EnterCritical();
+    boolean pending = m_nQueued != m_nApplied;
+    PlayState from = pending ? m_QueuedState : state;
+    PlayState to;
+    boolean valid = NextState(type, from, &to)
+                    && (type != PlayerCommandPlay || m_pBinFileDevice != nullptr);
+    boolean queued = valid && m_Commands.Put(command);
+    if (queued) {
+        if (!pending) {
+            m_bQueuedAddress = false;
+            m_bQueuedStopReported = false;
+        }
+        m_QueuedState = to;
+        if (type == PlayerCommandPlay || type == PlayerCommandSeek) {
+            m_QueuedAddress = lba;
+            m_bQueuedAddress = true;
+        }
+        m_nQueued++;
     }
+    LeaveCritical();
 
-    LOGNOTE("CD Player stopping playback");
-    state = STOPPED_OK;
-    return true;
+    if (!valid) {
+        LOGNOTE("CD Player: command %u requested in invalid state (%u)", type, from);
+    }
+    return queued;
+}
+
+// The count goes up only once a command has been applied, so the status
+// queries never see a gap between the queued state and the real one.
+void CCDPlayer::ApplyCommands() {
+    TPlayerCommand command;
+    while (m_Commands.Get(&command)) {
+        ApplyCommand(command);
+        m_nApplied++;
+    }
+}
+
+void CCDPlayer::ApplyCommand(const TPlayerCommand &command) {
+    // Run() may have moved on since the command was checked
+    PlayState next;
+    if (!NextState(command.type, state, &next)) {
+        LOGNOTE("CD Player: command %u no longer valid in state (%u)", command.type, state);
+        return;
+    }
+
+    switch (command.type) {
+        case PlayerCommandPlay:
+            LOGNOTE("CD Player playing from %u for %u blocks (previous state=%u)",
+                    command.lba, command.num_blocks, state);
+
+            // Validate media presence
+            if (m_pBinFileDevice == nullptr) {
+                LOGERR("CD Player: Play requested but no device set");
+                return;
+            }
+
+            address = command.lba;
+            end_address = address + command.num_blocks;
+            break;
+
+        case PlayerCommandPause:
+            LOGNOTE("CD Player pausing");
+            break;
+
+        case PlayerCommandResume:
+            LOGNOTE("CD Player resuming");
+            break;
+
+        case PlayerCommandSeek:
+            // See to the new lba
+            LOGNOTE("CD Player seeking to %u", command.lba);
+            address = command.lba;
+            break;
+
+        case PlayerCommandStop:
+            LOGNOTE("CD Player stopping playback");
+            // The host may have been told already, while it was queued
+            EnterCritical();
+            if (m_bQueuedStopReported) {
+                next = NONE;
+                m_bQueuedStopReported = false;
+            }
+            LeaveCritical();
+            break;
+
+        case PlayerCommandVolume:
+            LOGNOTE("Setting volume to 0x%02x", command.num_blocks);
+            volumeByte = (u8)command.num_blocks;
+            break;
+    }
+
+    state = next;
 }
 
 
@@ -426,6 +564,10 @@ void CCDPlayer::Run(void) {
     unsigned int total_frames = 0;
 
     while (true) {
+        // Commands queued by the USB IRQ since the last pass. Applied even
+        // before audio is up so a volume set at boot is not lost.
+        ApplyCommands();
+
         // STATE 1: Wait for audio initialization (triggered by USB endpoint activation)
         if (!m_bAudioInitialized) {
             CScheduler::Get()->Yield();
@@ -497,7 +639,9 @@ void CCDPlayer::Run(void) {
                 }
 
                 //LOGDBG("Buffer exhausted. Reading %d bytes from file.", bytes_to_read);
+                CIOScheduler::Get()->BeginRealTime(IOClassAudio);
                 int readCount = m_pBinFileDevice->Read(m_ReadBuffer, bytes_to_read);
+                CIOScheduler::Get()->EndRealTime(IOClassAudio, readCount > 0 ? (u32)readCount : 0);
 
                 if (readCount < 0) {
                     LOGERR("File read error.");
@@ -517,7 +661,12 @@ void CCDPlayer::Run(void) {
 
             // Feed the sound device from our buffer, if we have valid data.
             if (m_BufferBytesValid > 0 && state == PLAYING) {
-                unsigned int available_queue_size = total_frames - m_pSound->GetQueueFramesAvail();
+                unsigned int queued_frames = m_pSound->GetQueueFramesAvail();
+                if (m_bQueuePrimed && queued_frames == 0) {
+                    __atomic_fetch_add(&m_nUnderruns, 1, __ATOMIC_RELAXED);
+                    m_bQueuePrimed = false;
+                }
+                unsigned int available_queue_size = total_frames - queued_frames;
                 unsigned int bytes_for_sound_device = available_queue_size * BYTES_PER_FRAME;
 
                 unsigned int bytes_available_in_buffer = m_BufferBytesValid - m_BufferReadPos;
@@ -543,6 +692,9 @@ void CCDPlayer::Run(void) {
                         }
 
                         m_BufferReadPos += writeCount;
+                        if (writeCount > 0) {
+                            m_bQueuePrimed = true;
+                        }
 
                         m_BytesProcessedInSector += writeCount;
                         if (m_BytesProcessedInSector >= SECTOR_SIZE) {
@@ -558,6 +710,9 @@ void CCDPlayer::Run(void) {
                 }
             }
         }
+        if (state != PLAYING) {
+            m_bQueuePrimed = false;
+        }
         CScheduler::Get()->Yield();
     }
 }
@@ -35,6 +35,7 @@
 #include <fatfs/ff.h>
 #include <linux/kernel.h>
 #include <discimage/imagedevice.h>
+#include <cdcore/handoffqueue.h>
 
 #define SECTOR_SIZE 2352
 #define BATCH_SIZE 16 
@@ -54,6 +55,9 @@
 
 #define AUDIO_BUFFER_SIZE  DAC_BUFFER_SIZE_FRAMES * BYTES_PER_FRAME
 
+// Player commands arrive from the USB IRQ and are applied by Run()
+#define PLAYER_COMMAND_QUEUE_SIZE 16
+
 class CCDPlayer : public CTask {
    public:
     CCDPlayer(const char *pSoundDevice);
@@ -67,6 +71,7 @@ class CCDPlayer : public CTask {
     boolean SetDefaultVolume(u8 vol);
     u8 GetVolume();
     unsigned int GetState();
+    unsigned int PeekState();
     boolean HadError();
     u32 GetCurrentAddress();
     boolean Seek(u32 lba);
@@ -75,6 +80,8 @@ class CCDPlayer : public CTask {
     boolean SoundTest();
     size_t buffer_available();
     size_t buffer_free_space();
+    // Times the sound queue ran dry mid-playback since boot. Any core.
+    u32 GetUnderrunCount() const;
     void Run(void);
 
     enum PlayState {
@@ -88,6 +95,28 @@ class CCDPlayer : public CTask {
     };
 
    private:
+    enum TPlayerCommandType {
+        PlayerCommandPlay,
+        PlayerCommandPause,
+        PlayerCommandResume,
+        PlayerCommandSeek,
+        PlayerCommandStop,
+        PlayerCommandVolume
+    };
+
+    struct TPlayerCommand {
+        TPlayerCommandType type;
+        u32 lba;
+        u32 num_blocks;  // Play: block count; Volume: the volume byte
+    };
+
+    // The state a command leaves the player in, FALSE if it is not valid in
+    // From
+    static boolean NextState(TPlayerCommandType type, PlayState From, PlayState *pTo);
+
+    boolean QueueCommand(TPlayerCommandType type, u32 lba = 0, u32 num_blocks = 0);
+    void ApplyCommands();
+    void ApplyCommand(const TPlayerCommand &command);
     void ScaleVolume(u8 *buffer, u32 byteCount);
     
    private:
@@ -105,11 +134,32 @@ class CCDPlayer : public CTask {
     u8 defaultVolumeByte = 255;
     boolean m_bAudioInitialized = false;  // NEW
 
+    // Play/Pause/Resume/Seek/PlaybackStop/SetVolume only queue a command, so
+    // the USB IRQ never changes the play state in the middle of Run()
+    THandoffQueue<TPlayerCommand, PLAYER_COMMAND_QUEUE_SIZE> m_Commands;
+
+    // What the queued commands will leave the player in, so GetState() and
+    // GetCurrentAddress() answer a READ SUB-CHANNEL sent straight after a
+    // PLAY AUDIO as if it had been applied. Valid while commands are queued
+    // (m_nQueued != m_nApplied); written with the queue, under a critical
+    // section.
+    volatile u32 m_nQueued = 0;
+    volatile u32 m_nApplied = 0;
+    PlayState m_QueuedState = NONE;
+    u32 m_QueuedAddress = 0;
+    boolean m_bQueuedAddress = false;   // a queued Play or Seek moves it
+    boolean m_bQueuedStopReported = false;
+
     u8 *m_ReadBuffer;  // CHANGED: removed = new u8[AUDIO_BUFFER_SIZE]
     u8 *m_WriteChunk;
     unsigned int m_BufferBytesValid = 0;
     unsigned int m_BufferReadPos = 0;
     unsigned int m_BytesProcessedInSector = 0;
+
+    // Set once playback has queued audio, so an empty queue after that is an
+    // underrun rather than the start of a track
+    boolean m_bQueuePrimed = false;
+    u32 m_nUnderruns = 0;
 };
 
 #endif
\ No newline at end of file
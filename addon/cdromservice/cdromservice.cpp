@@ -25,10 +25,15 @@
 #include <circle/synchronize.h>
 #include <circle/util.h>
 #include <circle/logger.h>
+#include <cdcore/cdcore.h>
 
 // TODO reduce stack size of USBCDGadget
 #define CDROM_STACK_SIZE TASK_STACK_SIZE * 1.5
 
+// Sleeping between USB transfers, the task still wakes this often to keep
+// plug-and-play detection going
+#define CDROM_IDLE_POLL_US 10000
+
 LOGMODULE("cdrom");
 
 CDROMService *CDROMService::s_pThis = nullptr;
@@ -99,6 +104,16 @@ void CDROMService::DisarmBootEject(void)
         m_CDGadget->DisarmBootEject();
 }
 
+u32 CDROMService::GetServedKiB(FileType Type) const
+{
+    return m_CDGadget ? m_CDGadget->GetServedKiB(Type) : 0;
+}
+
+bool CDROMService::IsFullSpeed(void) const
+{
+    return m_CDGadget && m_CDGadget->IsFullSpeed();
+}
+
 boolean CDROMService::Initialize()
 {
     LOGNOTE("CDROM Initializing");
@@ -126,10 +141,57 @@ void CDROMService::Run(void)
 {
     LOGNOTE("CDROM Run Loop entered");
 
+    m_CDGadget->RegisterUpdateNotificationHandler(UpdateNotificationHandler, this);
+
+    // With a CD core the host's reads are served from core 1 and this task
+    // only keeps the core 0 half: plug-and-play and the audio bring-up.
+    CCDCore *pCDCore = CCDCore::Get();
+    if (pCDCore != nullptr && pCDCore->Attach(m_CDGadget))
+    {
+        while (true)
+        {
+            m_Event.Clear();
+            m_CDGadget->UpdatePlugAndPlay();
+            m_CDGadget->UpdateTaskLevel();
+
+            // Core 1 only gets storage when core 0 lets go of it, so stay
+            // runnable while it has reads to do, even if nothing else is.
+            if (m_CDGadget->HasDataPathWork())
+            {
+                pCDCore->GrantStorage();
+                CScheduler::Get()->Yield();
+            }
+            else
+            {
+                m_Event.WaitWithTimeout(CDROM_IDLE_POLL_US);
+            }
+        }
+    }
+
     while (true)
     {
+        // Cleared before Update() so a transfer completing while it runs
+        // still wakes the wait below.
+        m_Event.Clear();
         m_CDGadget->UpdatePlugAndPlay();
         m_CDGadget->Update();
-        CScheduler::Get()->Yield();
+
+        if (m_CDGadget->HasDataPathWork())
+        {
+            // The disc-swap timer is still running
+            CScheduler::Get()->Yield();
+        }
+        else
+        {
+            m_Event.WaitWithTimeout(CDROM_IDLE_POLL_US);
+        }
     }
 }
+
+void CDROMService::UpdateNotificationHandler(void *pParam)
+{
+    CDROMService *pThis = static_cast<CDROMService *>(pParam);
+    assert(pThis != nullptr);
+
+    pThis->m_Event.Set();
+}
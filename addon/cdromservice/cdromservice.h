@@ -22,6 +22,7 @@
 
 #include <circle/machineinfo.h>
 #include <circle/sched/task.h>
+#include <circle/sched/synchronizationevent.h>
 #include <circle/time.h>
 #include <circle/timer.h>
 #include <circle/types.h>
@@ -46,10 +47,18 @@ public:
     // was last powered off. Must be armed before the first SetDevice().
     void ArmBootEject(void);
     void DisarmBootEject(void);
+
+    // For the metrics page: see CUSBCDGadget
+    u32 GetServedKiB(FileType Type) const;
+    bool IsFullSpeed(void) const;
     void Run(void);
 
+private:
+    static void UpdateNotificationHandler(void *pParam);
+
 private:
     CUSBCDGadget* m_CDGadget = nullptr;
+    CSynchronizationEvent m_Event;
     static CDROMService *s_pThis;
     bool isInitialized = false;
     u16 m_vid = 0;
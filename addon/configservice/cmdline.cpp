@@ -158,6 +158,7 @@ bool CmdLine::SetValue(const char* key, const char* value) {
         strncpy(pairs[i].value, value, MAX_VALUE_LEN - 1);
         pairs[i].value[MAX_VALUE_LEN - 1] = '\0';
 	dirty = true;
+	changes++;
 	return true;
     } else if (count < MAX_PAIRS) {
         strncpy(pairs[count].key, key, MAX_KEY_LEN - 1);
@@ -166,6 +167,7 @@ bool CmdLine::SetValue(const char* key, const char* value) {
         pairs[count].value[MAX_VALUE_LEN - 1] = '\0';
         ++count;
 	dirty = true;
+	changes++;
 	return true;
     }
     return false;
@@ -189,5 +191,6 @@ void CmdLine::DeleteValue(const char* key) {
         }
         --count;
         dirty = true;
+        changes++;
     }
 }
\ No newline at end of file
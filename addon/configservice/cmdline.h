@@ -23,6 +23,7 @@ public:
     const char* GetValue(const char* key) const;
     bool SetValue(const char* key, const char* value);
     bool IsDirty();
+    unsigned GetChangeCount() const { return changes; }
     void DeleteValue(const char* key);
 
     /*
@@ -34,6 +35,7 @@ private:
     Pair pairs[MAX_PAIRS];
     int count;
     bool dirty = false;
+    unsigned changes = 0;   // since boot, unlike dirty
     int find_index(const char* key) const;
 };
 
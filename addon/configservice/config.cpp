@@ -27,6 +27,7 @@ void Config::SetString(const char* key, const char* value, const char* section)
     if (strcmp(current, value) != 0) {
         m_properties.SetValue(section, key, value);
         dirty = true;
+        changes++;
     }
 }
 
@@ -34,6 +35,7 @@ void Config::SetNumber(const char* key, unsigned value, const char* section)
 {
     m_properties.SetLongValue(section, key, value);
     dirty = true;
+    changes++;
 }
 
 unsigned Config::GetNumber(const char* key, unsigned defaultValue, const char* section)
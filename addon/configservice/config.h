@@ -19,9 +19,11 @@ public:
     bool Load(const char* filename);
     bool Save();
     bool IsDirty();
+    unsigned GetChangeCount() const { return changes; }
 private:
     CSimpleIniA m_properties;
     bool dirty = false;
+    unsigned changes = 0;   // since boot, unlike dirty
 
 };
 
@@ -5,6 +5,7 @@
 #include <assert.h>
 #include <circle/logger.h>
 #include <circle/sched/scheduler.h>
+#include <ioscheduler/ioscheduler.h>
 #include "simpleini.hpp"
 
 LOGMODULE("configservice");
@@ -309,12 +310,20 @@ bool ConfigService::IsDirty() {
 	return m_config->IsDirty() || m_cmdline->IsDirty();
 }
 
+unsigned ConfigService::GetGeneration() {
+	return m_config->GetChangeCount() + m_cmdline->GetChangeCount();
+}
+
 bool ConfigService::Save() {
+	// Both files are written through stdio, so the I/O scheduler only gets
+	// to pick the moment, not to slice the writes.
+	CIOScheduler::Get()->WaitForTurn(IOClassConfig);
 	bool ok = m_config->Save();
 
 	if (ok) {
 		ok = m_cmdline->Save();
 	}
+	CIOScheduler::Get()->Account(IOClassConfig, 0);
 
 	return ok;
 }
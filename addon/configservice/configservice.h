@@ -72,6 +72,8 @@ public:
     void SetProperty(const char* property, const char* value, const char* section="usbode");
 
     bool IsDirty();
+    // Goes up with every setting changed since boot, saved or not
+    unsigned GetGeneration();
 
     void Run(void);
 
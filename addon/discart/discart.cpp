@@ -7,6 +7,7 @@
 #include "tjpgd.h"
 
 #include <circle/logger.h>
+#include <cdcore/cdcore.h>
 #include <fatfs/ff.h>
 #include <string.h>
 #include <cstdio>
@@ -73,6 +74,13 @@ static int jpeg_output_func(JDEC* jd, void* bitmap, JRECT* rect) {
         }
     }
 
+    // Decoding a whole image takes longer than a host will wait for a
+    // READ, and between blocks this task is not inside FatFs
+    CCDCore* cdCore = CCDCore::Get();
+    if (cdCore != nullptr) {
+        cdCore->GrantStorage();
+    }
+
     return 1; // Continue decompression
 }
 
@@ -1,17 +1,25 @@
 #include "chdfile.h"
 #include <circle/logger.h>
+#include <circle/timer.h>
 #include <string.h>
 #include <stdio.h>
+#include <tracelab/binlog.h>
 
 LOGMODULE("chdfile");
 
+u32 CCHDFileDevice::s_hunkHits = 0;
+u32 CCHDFileDevice::s_hunkMisses = 0;
+u32 CCHDFileDevice::s_decodeMs = 0;
+
 CCHDFileDevice::CCHDFileDevice(const char *chd_filename, MEDIA_TYPE mediaType)
     : m_chd_filename(chd_filename),
       m_mediaType(mediaType),
+      m_numHunkSlots(0),
+      m_hunkUseCounter(0),
       m_hunkBuffer(nullptr),
       m_hunkSize(0),
-      m_cachedHunkNum(UINT32_MAX), 
-      m_lastTrackIndex(0)
+      m_lastTrackIndex(0),
+      m_decodeRemainderUs(0)
 {
     LOGNOTE("CCHDFileDevice created for: %s", chd_filename);
     memset(m_tracks, 0, sizeof(m_tracks));
@@ -29,11 +37,13 @@ CCHDFileDevice::~CCHDFileDevice()
         delete[] m_cue_sheet;
         m_cue_sheet = nullptr;
     }
-    if (m_hunkBuffer)
+    for (int i = 0; i < m_numHunkSlots; i++)
     {
-        delete[] m_hunkBuffer;
-        m_hunkBuffer = nullptr;
+        delete[] m_hunkSlots[i].pBuffer;
+        m_hunkSlots[i].pBuffer = nullptr;
     }
+    m_numHunkSlots = 0;
+    m_hunkBuffer = nullptr;
 }
 
 bool CCHDFileDevice::ParseTrackMetadata()
@@ -167,8 +177,15 @@ bool CCHDFileDevice::Init()
             header->version, header->hunkbytes);
 
     m_hunkSize = header->hunkbytes;
-    m_hunkBuffer = new u8[m_hunkSize];
-    if (!m_hunkBuffer)
+    u32 slots = m_hunkSize > 0 ? HunkCacheSize / m_hunkSize : 1;
+    slots = slots < 1 ? 1 : slots > MaxHunkSlots ? MaxHunkSlots : slots;
+    for (m_numHunkSlots = 0; m_numHunkSlots < (int)slots; m_numHunkSlots++)
+    {
+        m_hunkSlots[m_numHunkSlots].pBuffer = new u8[m_hunkSize];
+        if (!m_hunkSlots[m_numHunkSlots].pBuffer)
+            break;
+    }
+    if (m_numHunkSlots == 0)
     {
         LOGERR("Failed to allocate hunk buffer");
         chd_close(m_chd);
@@ -283,6 +300,54 @@ void CCHDFileDevice::GenerateCueSheet()
     LOGNOTE("Generated CUE sheet with %d tracks", m_numTracks);
 }
 
+// From here on the reads serve the gadget's data path, which may run on the
+// CD core (see cdcore.h), so they log through CBinLog.
+chd_error CCHDFileDevice::LoadHunk(u32 hunkNum)
+{
+    HunkSlot *victim = &m_hunkSlots[0];
+    for (int i = 0; i < m_numHunkSlots; i++)
+    {
+        HunkSlot &slot = m_hunkSlots[i];
+        if (slot.nHunk == hunkNum)
+        {
+            slot.nLastUse = ++m_hunkUseCounter;
+            m_hunkBuffer = slot.pBuffer;
+            __atomic_fetch_add(&s_hunkHits, 1, __ATOMIC_RELAXED);
+            return CHDERR_NONE;
+        }
+        if (slot.nLastUse < victim->nLastUse)
+            victim = &slot;
+    }
+    __atomic_fetch_add(&s_hunkMisses, 1, __ATOMIC_RELAXED);
+
+    unsigned start = CTimer::Get()->GetClockTicks();
+    chd_error err = chd_read(m_chd, hunkNum, victim->pBuffer);
+    m_decodeRemainderUs += CTimer::Get()->GetClockTicks() - start;
+    __atomic_fetch_add(&s_decodeMs, m_decodeRemainderUs / 1000, __ATOMIC_RELAXED);
+    m_decodeRemainderUs %= 1000;
+
+    // A failed read may have left the buffer half written
+    victim->nHunk = err == CHDERR_NONE ? hunkNum : UINT32_MAX;
+    victim->nLastUse = ++m_hunkUseCounter;
+    m_hunkBuffer = victim->pBuffer;
+    return err;
+}
+
+u32 CCHDFileDevice::GetHunkHits(void)
+{
+    return __atomic_load_n(&s_hunkHits, __ATOMIC_RELAXED);
+}
+
+u32 CCHDFileDevice::GetHunkMisses(void)
+{
+    return __atomic_load_n(&s_hunkMisses, __ATOMIC_RELAXED);
+}
+
+u32 CCHDFileDevice::GetDecodeMs(void)
+{
+    return __atomic_load_n(&s_decodeMs, __ATOMIC_RELAXED);
+}
+
 int CCHDFileDevice::Read(void *pBuffer, size_t nCount)
 {
     if (!m_chd || !pBuffer)
@@ -308,15 +373,11 @@ int CCHDFileDevice::Read(void *pBuffer, size_t nCount)
         u32 frameInHunk = absoluteFrame % framesPerHunk;
 
         // Read the hunk if it's not already cached
-        if (hunkNum != m_cachedHunkNum)
+        chd_error err = LoadHunk(hunkNum);
+        if (err != CHDERR_NONE)
         {
-            chd_error err = chd_read(m_chd, hunkNum, m_hunkBuffer);
-            if (err != CHDERR_NONE)
-            {
-                LOGERR("CHD read error at hunk %u: %d", hunkNum, err);
-                return bytesRead > 0 ? bytesRead : -1;
-            }
-            m_cachedHunkNum = hunkNum;
+            BINLOG_ERROR(From, "CHD read error at hunk %u: %d", hunkNum, err);
+            return bytesRead > 0 ? bytesRead : -1;
         }
 
         // Position within hunk: frame start + offset within sector
@@ -445,15 +506,11 @@ int CCHDFileDevice::ReadSubchannel(u32 lba, u8 *subchannel)
     u32 frameInHunk = lba % framesPerHunk;
 
     // Read the hunk if it's not already cached
-    if (hunkNum != m_cachedHunkNum)
+    chd_error err = LoadHunk(hunkNum);
+    if (err != CHDERR_NONE)
     {
-        chd_error err = chd_read(m_chd, hunkNum, m_hunkBuffer);
-        if (err != CHDERR_NONE)
-        {
-            LOGERR("CHD read error at hunk %u: %d", hunkNum, err);
-            return -1;
-        }
-        m_cachedHunkNum = hunkNum;
+        BINLOG_ERROR(From, "CHD read error at hunk %u: %d", hunkNum, err);
+        return -1;
     }
 
     // Subchannel data is at the end of each frame
@@ -462,7 +519,7 @@ int CCHDFileDevice::ReadSubchannel(u32 lba, u8 *subchannel)
 
     // DEBUG: Log first subchannel read
     if (lba == 0) {
-        LOGNOTE("ReadSubchannel LBA=0, first 16 bytes: %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x",
+        BINLOG_NOTE(From, "ReadSubchannel LBA=0, first 16 bytes: %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x",
                 subchannel[0], subchannel[1], subchannel[2], subchannel[3],
                 subchannel[4], subchannel[5], subchannel[6], subchannel[7],
                 subchannel[8], subchannel[9], subchannel[10], subchannel[11],
@@ -56,6 +56,12 @@ class CCHDFileDevice : public ICHDDevice {
     /// Get a generated CUE sheet for backward compatibility
     const char* GetCueSheet() const override { return m_cue_sheet; }
 
+    /// Hunk cache lookups of all CHD images since boot, and the hunks the
+    /// misses decompressed with the time that took, for the metrics page
+    static u32 GetHunkHits(void);
+    static u32 GetHunkMisses(void);
+    static u32 GetDecodeMs(void);
+
    private:
     const char* m_chd_filename;
     MEDIA_TYPE m_mediaType;
@@ -70,11 +76,31 @@ class CCHDFileDevice : public ICHDDevice {
     CHDTrackInfo m_tracks[CD_MAX_TRACKS];
     int m_numTracks;
 
-    // Hunk cache
-    u8* m_hunkBuffer;
+    // Hunk cache: a few hunks, the least recently used replaced, so the
+    // file system hunks read at mount (volumewarmup.h) are still there for
+    // the host's first directory listing after it has read a file or two
+    struct HunkSlot {
+        u8* pBuffer = nullptr;
+        u32 nHunk = UINT32_MAX;
+        unsigned nLastUse = 0;
+    };
+    static constexpr int MaxHunkSlots = 4;
+    static constexpr u32 HunkCacheSize = 128 * 1024;
+    HunkSlot m_hunkSlots[MaxHunkSlots];
+    int m_numHunkSlots;
+    unsigned m_hunkUseCounter;
+    u8* m_hunkBuffer;   // the slot LoadHunk() last returned
     u32 m_hunkSize;
-    u32 m_cachedHunkNum;
     int m_lastTrackIndex;
+
+    // Makes hunkNum the current hunk, decompressing it on a miss
+    chd_error LoadHunk(u32 hunkNum);
+
+    // Decode time below a millisecond, carried to the next miss
+    u32 m_decodeRemainderUs;
+    static u32 s_hunkHits;
+    static u32 s_hunkMisses;
+    static u32 s_decodeMs;
     
     // Helper to parse CHD track metadata
     bool ParseTrackMetadata();
@@ -25,10 +25,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <circle/timer.h>
+#include "mountmanifest.h"
+#include <tracelab/binlog.h>
+#include <tracelab/boottimeline.h>
 
 LOGMODULE("CCueBinFileDevice");
 
-CCueBinFileDevice::CCueBinFileDevice(FIL *pFile, char *cue_str, MEDIA_TYPE mediaType)
+u32 CCueBinFileDevice::s_nCacheHits = 0;
+u32 CCueBinFileDevice::s_nCacheMisses = 0;
+
+CCueBinFileDevice::CCueBinFileDevice(FIL *pFile, const char *cue_str, MEDIA_TYPE mediaType)
     : m_mediaType(mediaType)
 {
     m_pFile = pFile;
@@ -56,7 +62,9 @@ CCueBinFileDevice::CCueBinFileDevice(FIL *pFile, char *cue_str, MEDIA_TYPE media
         m_FileSizes[0] = m_Files[0].nSize;
         m_nFileCount = 1;
         m_nVirtualSize = m_Files[0].nSize;
+        CBootTimeline::Get()->Begin(BootStageMountCLMT);
         FatFsOptimizer::EnableFastSeek(m_pFile, &m_Files[0].pCLMT, 256, "BIN/ISO: ");
+        CBootTimeline::Get()->End(BootStageMountCLMT);
         m_nLogicalPos = f_tell(m_pFile);
     }
 
@@ -121,6 +129,78 @@ bool CCueBinFileDevice::AddDataFile(FIL *pFile) {
     return true;
 }
 
+void CCueBinFileDevice::ExportLayout(CMountManifest *pManifest) const {
+    pManifest->CueSheet = m_cue_str;
+    pManifest->Files.resize(m_nFileCount);
+    for (int i = 0; i < m_nFileCount; i++) {
+        CMountManifest::TDataFile &file = pManifest->Files[i];
+        file.nSize = m_Files[i].nSize;
+        file.nBase = m_Files[i].nBase;
+        file.nFirstCluster = m_Files[i].pFile->obj.sclust;
+        // After CREATE_LINKMAP element 0 holds how many words the map uses
+        const DWORD *pCLMT = m_Files[i].pCLMT;
+        if (pCLMT != nullptr) {
+            file.LinkMap.assign(pCLMT, pCLMT + pCLMT[0]);
+        } else {
+            file.LinkMap.clear();
+        }
+    }
+
+    pManifest->Holes.resize(m_nSparseCount);
+    for (int i = 0; i < m_nSparseCount; i++) {
+        CMountManifest::THole &hole = pManifest->Holes[i];
+        hole.nStartLBA = m_Sparse[i].nStartLBA;
+        hole.nEndLBA = m_Sparse[i].nEndLBA;
+        hole.nBase = m_Sparse[i].nBase;
+        hole.nLength = m_Sparse[i].nLength;
+        hole.nSectorLength = m_Sparse[i].nSectorLength;
+    }
+    pManifest->nVirtualSize = m_nVirtualSize;
+}
+
+CCueBinFileDevice *CCueBinFileDevice::FromManifest(const CMountManifest &Manifest, FIL *const *ppFiles,
+                                                   MEDIA_TYPE mediaType) {
+    const int nFiles = (int)Manifest.Files.size();
+    if (nFiles < 1 || nFiles > MaxDataFiles || Manifest.Holes.size() > MaxDataFiles) {
+        return nullptr;
+    }
+    for (int i = 0; i < nFiles; i++) {
+        if (ppFiles[i] == nullptr) {
+            return nullptr;
+        }
+    }
+
+    CCueBinFileDevice *pDevice = new CCueBinFileDevice(nullptr, Manifest.CueSheet.c_str(), mediaType);
+    for (int i = 0; i < nFiles; i++) {
+        const CMountManifest::TDataFile &saved = Manifest.Files[i];
+        DataFile &file = pDevice->m_Files[i];
+        file.pFile = ppFiles[i];
+        file.nBase = saved.nBase;
+        file.nSize = saved.nSize;
+        pDevice->m_FileSizes[i] = saved.nSize;
+        if (!saved.LinkMap.empty()) {
+            file.pCLMT = new DWORD[saved.LinkMap.size()];
+            memcpy(file.pCLMT, saved.LinkMap.data(), saved.LinkMap.size() * sizeof(DWORD));
+            file.pFile->cltbl = file.pCLMT;
+        }
+    }
+    pDevice->m_nFileCount = nFiles;
+    pDevice->m_pFile = ppFiles[0];
+
+    for (size_t i = 0; i < Manifest.Holes.size(); i++) {
+        const CMountManifest::THole &saved = Manifest.Holes[i];
+        SparseRange &hole = pDevice->m_Sparse[i];
+        hole.nStartLBA = saved.nStartLBA;
+        hole.nEndLBA = saved.nEndLBA;
+        hole.nBase = saved.nBase;
+        hole.nLength = saved.nLength;
+        hole.nSectorLength = saved.nSectorLength;
+    }
+    pDevice->m_nSparseCount = (int)Manifest.Holes.size();
+    pDevice->m_nVirtualSize = Manifest.nVirtualSize;
+    return pDevice;
+}
+
 namespace {
 
 // Where one file's stored frames begin and end on the disc.
@@ -258,9 +338,11 @@ u64 CCueBinFileDevice::SparseBytesAt(u64 nOffset) const {
     return 0;
 }
 
+// Read(), Seek() and what they call serve the gadget's data path, which may
+// run on the CD core (see cdcore.h), so they log through CBinLog.
 int CCueBinFileDevice::Read(void *pBuffer, size_t nSize) {
     if (m_nFileCount == 0) {
-        LOGERR("Read !m_pFile");
+        BINLOG_ERROR(From, "Read !m_pFile");
         return -1;
     }
 
@@ -291,6 +373,7 @@ int CCueBinFileDevice::ReadWithinFile(void *pBuffer, size_t nSize) {
             memcpy(pBuffer, win.pBuffer + (m_nLogicalPos - win.nStart), nSize);
             m_nLogicalPos += nSize;
             win.nLastUse = ++m_nCacheUseCounter;
+            __atomic_fetch_add(&s_nCacheHits, 1, __ATOMIC_RELAXED);
             return nSize;
         }
     }
@@ -311,7 +394,7 @@ int CCueBinFileDevice::ReadWithinFile(void *pBuffer, size_t nSize) {
         if (m_nLogicalPos == GetSize()) {
             return 0;
         }
-        LOGERR("Read at offset %llu past end of image", m_nLogicalPos);
+        BINLOG_ERROR(From, "Read at offset %llu past end of image", m_nLogicalPos);
         return -1;
     }
     FIL *pDataFile = m_Files[nFile].pFile;
@@ -325,14 +408,14 @@ int CCueBinFileDevice::ReadWithinFile(void *pBuffer, size_t nSize) {
     if (!m_CacheWindows[0].pBuffer || nSize > CacheSize) {
         FRESULT result = f_lseek(pDataFile, nInFile);
         if (result != FR_OK) {
-            LOGERR("Seek to offset %llu failed, err %d", nInFile, result);
+            BINLOG_ERROR(From, "Seek to offset %llu failed, err %d", nInFile, result);
             return -1;
         }
 
         UINT nBytesRead = 0;
         result = f_read(pDataFile, pBuffer, nSize, &nBytesRead);
         if (result != FR_OK) {
-            LOGERR("Failed to read %d bytes into memory, err %d", nSize, result);
+            BINLOG_ERROR(From, "Failed to read %d bytes into memory, err %d", nSize, result);
             return -1;
         }
         m_nLogicalPos += nBytesRead;
@@ -345,6 +428,7 @@ int CCueBinFileDevice::ReadWithinFile(void *pBuffer, size_t nSize) {
     // of - plain LRU would pick the other stream's window here, since our
     // own was touched most recently - and fall back to least recently
     // used, so the window the other stream is running in is left alone.
+    __atomic_fetch_add(&s_nCacheMisses, 1, __ATOMIC_RELAXED);
     CacheWindow *pVictim = nullptr;
     for (int i = 0; i < NumCacheWindows; i++) {
         CacheWindow &win = m_CacheWindows[i];
@@ -364,7 +448,7 @@ int CCueBinFileDevice::ReadWithinFile(void *pBuffer, size_t nSize) {
 
     FRESULT result = f_lseek(pDataFile, nInFile);
     if (result != FR_OK) {
-        LOGERR("Seek to offset %llu failed, err %d", nInFile, result);
+        BINLOG_ERROR(From, "Seek to offset %llu failed, err %d", nInFile, result);
         return -1;
     }
 
@@ -372,7 +456,7 @@ int CCueBinFileDevice::ReadWithinFile(void *pBuffer, size_t nSize) {
     UINT nBytesRead = 0;
     result = f_read(pDataFile, pVictim->pBuffer, nFill, &nBytesRead);
     if (result != FR_OK) {
-        LOGERR("Failed to read %d bytes into memory, err %d", (int)nFill, result);
+        BINLOG_ERROR(From, "Failed to read %d bytes into memory, err %d", (int)nFill, result);
         pVictim->nLen = 0;
         return -1;
     }
@@ -387,6 +471,14 @@ int CCueBinFileDevice::ReadWithinFile(void *pBuffer, size_t nSize) {
     return nServe;
 }
 
+u32 CCueBinFileDevice::GetCacheHits(void) {
+    return __atomic_load_n(&s_nCacheHits, __ATOMIC_RELAXED);
+}
+
+u32 CCueBinFileDevice::GetCacheMisses(void) {
+    return __atomic_load_n(&s_nCacheMisses, __ATOMIC_RELAXED);
+}
+
 int CCueBinFileDevice::Write(const void *pBuffer, size_t nSize) {
     // Read-only device
     return -1;
@@ -394,7 +486,7 @@ int CCueBinFileDevice::Write(const void *pBuffer, size_t nSize) {
 
 u64 CCueBinFileDevice::Tell() const {
     if (!m_pFile) {
-        LOGERR("Tell !m_pFile");
+        BINLOG_ERROR(From, "Tell !m_pFile");
         return static_cast<u64>(-1);
     }
 
@@ -403,7 +495,7 @@ u64 CCueBinFileDevice::Tell() const {
 
 u64 CCueBinFileDevice::Seek(u64 nOffset) {
     if (!m_pFile) {
-        LOGERR("Seek !m_pFile");
+        BINLOG_ERROR(From, "Seek !m_pFile");
         return static_cast<u64>(-1);
     }
 
@@ -411,7 +503,7 @@ u64 CCueBinFileDevice::Seek(u64 nOffset) {
     // only come from a wrong LBA-to-byte translation, and failing here
     // (callers handle it) beats stalling in short reads later.
     if (nOffset > GetSize()) {
-        LOGERR("Seek to offset %llu beyond image size %llu", nOffset, GetSize());
+        BINLOG_ERROR(From, "Seek to offset %llu beyond image size %llu", nOffset, GetSize());
         return static_cast<u64>(-1);
     }
 
@@ -457,7 +549,7 @@ u64 CCueBinFileDevice::GetByteOffsetForLBA(u32 lba) const {
 
 u64 CCueBinFileDevice::GetSize(void) const {
     if (m_nFileCount == 0) {
-        LOGERR("GetSize !m_pFile");
+        BINLOG_ERROR(From, "GetSize !m_pFile");
         return 0;
     }
 
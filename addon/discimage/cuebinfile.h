@@ -16,15 +16,27 @@
 
 #define DEFAULT_IMAGE_FILENAME "image.iso"
 
+class CMountManifest;
+
 /// Implementation of CUE/BIN and ISO image support
 class CCueBinFileDevice : public ICueDevice {
    public:
-    CCueBinFileDevice(FIL* pFile, char* cue_str = nullptr, MEDIA_TYPE mediaType = MEDIA_TYPE::CD);
+    CCueBinFileDevice(FIL* pFile, const char* cue_str = nullptr, MEDIA_TYPE mediaType = MEDIA_TYPE::CD);
     ~CCueBinFileDevice(void);
 
     // Appends the next .bin in FILE order and takes ownership.
     bool AddDataFile(FIL* pFile);
 
+    // The cue sheet, layout and link maps worked out for this image, for a
+    // manifest; the paths and timestamps of the files are the caller's.
+    void ExportLayout(CMountManifest* pManifest) const;
+
+    // A device on the open files of a manifest, one per manifest file in the
+    // same order, taking the layout and link maps as they are instead of
+    // working them out again. Takes ownership of the files on success only.
+    static CCueBinFileDevice* FromManifest(const CMountManifest& Manifest, FIL* const* ppFiles,
+                                           MEDIA_TYPE mediaType = MEDIA_TYPE::CD);
+
     // ========================================================================
     // CDevice interface
     // ========================================================================
@@ -61,6 +73,11 @@ class CCueBinFileDevice : public ICueDevice {
     const char* GetCueSheet() const override;
     int GetDataFileCount() const override { return m_nFileCount; }
     const u64* GetDataFileSizes() const override { return m_FileSizes; }
+
+    // Read-ahead cache hits and misses of all CUE/BIN and ISO images since
+    // boot, for the metrics page. Reads too big for the cache count as neither.
+    static u32 GetCacheHits(void);
+    static u32 GetCacheMisses(void);
     
    private:
     // Split files form one logical image; each FIL owns its CLMT. nBase is the
@@ -136,6 +153,8 @@ class CCueBinFileDevice : public ICueDevice {
     static constexpr int NumCacheWindows = 2;
     CacheWindow m_CacheWindows[NumCacheWindows];
     unsigned m_nCacheUseCounter = 0;
+    static u32 s_nCacheHits;
+    static u32 s_nCacheMisses;
     u64 m_nLogicalPos = 0;
     
     static constexpr const char* default_cue_sheet =
@@ -0,0 +1,192 @@
+//
+// What an image holds, read from the image itself
+//
+// Copyright (C) 2025 Dani Sarfati
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+#include "imageinfo.h"
+#include <cueparser/cueparser.h>
+
+#include <string.h>
+
+#define MAX_TRACKS 99
+#define USER_DATA_SIZE 2048
+
+int getUserDataOffset(CUETrackMode mode) {
+    switch (mode) {
+        case CUETrack_MODE1_2048:
+        case CUETrack_MODE2_2048:
+            return 0;
+        case CUETrack_MODE1_2352:
+            return 16;
+        case CUETrack_MODE2_2352:
+        case CUETrack_CDI_2352:
+            return 24;
+        case CUETrack_MODE2_2336:
+        case CUETrack_CDI_2336:
+            return 8;
+        default:
+            return -1;
+    }
+}
+
+static bool readUserData(IImageDevice* device, const CUETrackInfo& track, u32 lba, u8* buffer) {
+    int skip = getUserDataOffset(track.track_mode);
+    if (skip < 0 || (u32)skip + USER_DATA_SIZE > track.sector_length)
+        return false;
+
+    u64 offset = device->GetByteOffsetForLBA(lba);
+    if (device->Seek(offset) != offset)
+        return false;
+
+    u8 raw[2352];
+    int length = skip + USER_DATA_SIZE;
+    if (device->Read(raw, length) != length)
+        return false;
+    memcpy(buffer, raw + skip, USER_DATA_SIZE);
+    return true;
+}
+
+// Copies a space-padded label, dropping the padding
+static void copyLabel(char* out, const u8* label, size_t length) {
+    size_t n = length < 32 ? length : 32;
+    memcpy(out, label, n);
+    while (n > 0 && (out[n - 1] == ' ' || out[n - 1] == '\0'))
+        n--;
+    out[n] = '\0';
+}
+
+// The same rule as CDUtils::GetLeadoutLBA(): the last track runs to the end
+// of its file.
+static u32 leadoutFor(IImageDevice* device, const CUETrackInfo& last) {
+    u64 fileSize = device->GetSize();
+    const int fileCount = device->GetDataFileCount();
+    const u64* fileSizes = device->GetDataFileSizes();
+    if (fileCount > 1 && fileSizes != nullptr && last.file_index >= 1 && last.file_index <= fileCount)
+        fileSize = fileSizes[last.file_index - 1];
+
+    if (last.sector_length == 0 || fileSize < last.file_offset)
+        return last.data_start;
+    u64 frames = (fileSize - last.file_offset) / last.sector_length;
+    return last.data_start + (u32)(frames < 0xFFFFFFFF ? frames : 0xFFFFFFFF);
+}
+
+static ImagePlatform detectPlatform(const u8* system, bool haveSystem, const u8* descriptor,
+                                    bool haveDescriptor, bool* iso, bool* hfs) {
+    *iso = haveDescriptor && descriptor[0] == 1 && memcmp(descriptor + 1, "CD001", 5) == 0;
+    *hfs = haveSystem && ((system[0] == 'E' && system[1] == 'R') ||
+                          (system[1024] == 'B' && system[1025] == 'D'));
+
+    // Console boot sectors come first: most of them are ISO 9660 as well
+    if (haveSystem) {
+        if (memcmp(system, "SEGA SEGASATURN ", 16) == 0)
+            return ImagePlatform::SATURN;
+        if (memcmp(system, "SEGA SEGAKATANA ", 16) == 0)
+            return ImagePlatform::DREAMCAST;
+        if (memcmp(system, "SEGADISCSYSTEM", 14) == 0 || memcmp(system, "SEGABOOTDISC", 12) == 0)
+            return ImagePlatform::SEGACD;
+        // Opera volume header: record type 1, five sync bytes, version 1
+        static const u8 opera[7] = {0x01, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x01};
+        if (memcmp(system, opera, sizeof(opera)) == 0)
+            return ImagePlatform::THREEDO;
+    }
+    if (haveDescriptor && descriptor[0] == 1 && memcmp(descriptor + 1, "CD-I ", 5) == 0)
+        return ImagePlatform::CDI;
+
+    if (*iso) {
+        if (memcmp(descriptor + 8, "PLAYSTATION", 11) == 0)
+            return ImagePlatform::PLAYSTATION;
+        return *hfs ? ImagePlatform::HYBRID : ImagePlatform::PC;
+    }
+    return *hfs ? ImagePlatform::MAC : ImagePlatform::UNKNOWN;
+}
+
+bool readImageInfo(IImageDevice* device, ImageInfo* info) {
+    memset(info, 0, sizeof(*info));
+    info->platform = ImagePlatform::UNKNOWN;
+
+    const char* cueSheet = device ? device->GetCueSheet() : nullptr;
+    if (cueSheet == nullptr)
+        return false;
+
+    CUEParser parser(cueSheet);
+    if (device->GetDataFileCount() > 1 && device->GetDataFileSizes() != nullptr)
+        parser.set_file_sizes(device->GetDataFileSizes(), device->GetDataFileCount());
+
+    // Each audio track runs to the start of the next one, or the lead-out
+    u32 trackStarts[MAX_TRACKS];
+    bool trackIsAudio[MAX_TRACKS];
+    CUETrackInfo last = {};
+    CUETrackInfo firstData = {};
+    bool haveData = false;
+    int count = 0;
+
+    const CUETrackInfo* track;
+    while ((track = parser.next_track()) != nullptr && count < MAX_TRACKS) {
+        trackStarts[count] = track->track_start;
+        trackIsAudio[count] = track->track_mode == CUETrack_AUDIO;
+        if (!trackIsAudio[count] && !haveData) {
+            firstData = *track;
+            haveData = true;
+        }
+        last = *track;
+        count++;
+    }
+    if (count == 0)
+        return false;
+
+    info->numTracks = (u8)count;
+    info->discFrames = leadoutFor(device, last);
+    for (int i = 0; i < count; i++) {
+        if (!trackIsAudio[i])
+            continue;
+        u32 end = i + 1 < count ? trackStarts[i + 1] : info->discFrames;
+        info->numAudioTracks++;
+        if (end > trackStarts[i])
+            info->audioFrames += end - trackStarts[i];
+    }
+
+    if (!haveData) {
+        info->platform = ImagePlatform::AUDIO;
+        return true;
+    }
+
+    // The system area's first sector and the primary volume descriptor.
+    // Static: task stacks are small, and only the metadata task reads these.
+    static u8 system[USER_DATA_SIZE];
+    static u8 descriptor[USER_DATA_SIZE];
+    bool haveSystem = readUserData(device, firstData, firstData.data_start, system);
+    bool haveDescriptor = readUserData(device, firstData, firstData.data_start + 16, descriptor);
+
+    bool iso, hfs;
+    info->platform = detectPlatform(system, haveSystem, descriptor, haveDescriptor, &iso, &hfs);
+
+    if (iso || info->platform == ImagePlatform::CDI) {
+        copyLabel(info->volumeLabel, descriptor + 40, 32);
+    } else if (hfs && system[1024] == 'B') {
+        // Master directory block: the volume name is a Pascal string
+        u8 length = system[1024 + 36];
+        copyLabel(info->volumeLabel, system + 1024 + 37, length < 27 ? length : 27);
+    }
+    return true;
+}
+
+const char* getImagePlatformName(ImagePlatform platform) {
+    switch (platform) {
+        case ImagePlatform::AUDIO:       return "Audio CD";
+        case ImagePlatform::PC:          return "PC";
+        case ImagePlatform::MAC:         return "Mac";
+        case ImagePlatform::HYBRID:      return "PC/Mac";
+        case ImagePlatform::PLAYSTATION: return "PlayStation";
+        case ImagePlatform::SATURN:      return "Saturn";
+        case ImagePlatform::SEGACD:      return "Sega CD";
+        case ImagePlatform::DREAMCAST:   return "Dreamcast";
+        case ImagePlatform::THREEDO:     return "3DO";
+        case ImagePlatform::CDI:         return "CD-i";
+        default:                         return "Unknown";
+    }
+}
@@ -0,0 +1,55 @@
+//
+// What an image holds, read from the image itself: the volume label, the
+// platform it was mastered for, its tracks and how long it plays. Small
+// enough to keep for every image in the library, so the web UI and the
+// display can show it without opening the image again.
+//
+// Copyright (C) 2025 Dani Sarfati
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+#ifndef _IMAGEINFO_H
+#define _IMAGEINFO_H
+
+#include <circle/types.h>
+#include <cueparser/cueparser.h>
+#include "imagedevice.h"
+
+enum class ImagePlatform : u8 {
+    UNKNOWN,        // data we do not recognise
+    AUDIO,          // no data track
+    PC,             // ISO 9660
+    MAC,            // HFS only
+    HYBRID,         // ISO 9660 and HFS
+    PLAYSTATION,
+    SATURN,
+    SEGACD,
+    DREAMCAST,
+    THREEDO,
+    CDI,
+};
+
+struct ImageInfo {
+    char volumeLabel[33];   // ISO 9660 volume id or HFS volume name, trimmed
+    ImagePlatform platform;
+    u8 numTracks;
+    u8 numAudioTracks;
+    u32 discFrames;         // lead-out LBA: the disc's length in sectors
+    u32 audioFrames;        // of all audio tracks, 75 per second
+};
+
+// Fills info from an open device. Only reads a few sectors of the first
+// data track. False if the device has no usable cue sheet.
+bool readImageInfo(IImageDevice* device, ImageInfo* info);
+
+// "PlayStation", "Audio CD", ...
+const char* getImagePlatformName(ImagePlatform platform);
+
+// Where the 2048 bytes of user data start in a stored sector of a track in
+// this mode, or -1 for a track with none
+int getUserDataOffset(CUETrackMode mode);
+
+#endif
@@ -6,6 +6,7 @@
 #include <string.h>
 #include <stdio.h>
 #include "util.h"
+#include <tracelab/binlog.h>
 #include "../mdsparser/mdsparser.h"
 
 LOGMODULE("CMDSFileDevice");
@@ -336,6 +337,8 @@ CMDSFileDevice::~CMDSFileDevice(void) {
     delete m_parser;
 }
 
+// The reads, seeks and lookups they use serve the gadget's data path, which
+// may run on the CD core (see cdcore.h), so they log through CBinLog.
 bool CMDSFileDevice::TouchesUnstoredGap(u32 firstLBA, size_t nSectors) const {
     if (!m_parser || !m_bHasUnstoredGaps) {
         return false;
@@ -375,14 +378,14 @@ int CMDSFileDevice::ReadAcrossGaps(void *pBuffer, size_t nSize) {
             u64 offset = track->start_offset +
                          (u64)(m_nCurrentLBA - track->start_sector) * track->sector_size;
             if (f_lseek(m_pFile, offset) != FR_OK) {
-                LOGERR("Gap-aware read: seek to %llu for LBA %u failed",
+                BINLOG_ERROR(From, "Gap-aware read: seek to %llu for LBA %u failed",
                        (unsigned long long)offset, m_nCurrentLBA);
                 return total_read > 0 ? (int)total_read : -1;
             }
             UINT bytes_read = 0;
             FRESULT result = f_read(m_pFile, dest, chunk, &bytes_read);
             if (result != FR_OK || bytes_read != chunk) {
-                LOGERR("Gap-aware read: LBA %u returned %u bytes (err %d)",
+                BINLOG_ERROR(From, "Gap-aware read: LBA %u returned %u bytes (err %d)",
                        m_nCurrentLBA, bytes_read, result);
                 return total_read > 0 ? (int)total_read : -1;
             }
@@ -401,7 +404,7 @@ int CMDSFileDevice::ReadAcrossGaps(void *pBuffer, size_t nSize) {
 
 int CMDSFileDevice::Read(void *pBuffer, size_t nSize) {
     if (!m_pFile) {
-        LOGERR("Read !m_pFile");
+        BINLOG_ERROR(From, "Read !m_pFile");
         return -1;
     }
 
@@ -445,14 +448,14 @@ int CMDSFileDevice::Read(void *pBuffer, size_t nSize) {
                 // Read 2352 bytes of user data
                 FRESULT result = f_read(m_pFile, dest, 2352, &bytes_read);
                 if (result != FR_OK || bytes_read != 2352) {
-                    LOGERR("Failed to read sector %u user data (got %u bytes)", i, bytes_read);
+                    BINLOG_ERROR(From, "Failed to read sector %u user data (got %u bytes)", i, bytes_read);
                     return total_read > 0 ? total_read : -1;
                 }
                 
                 // Skip 96 bytes of subchannel data
                 result = f_lseek(m_pFile, f_tell(m_pFile) + 96);
                 if (result != FR_OK) {
-                    LOGERR("Failed to skip subchannel data at sector %u", i);
+                    BINLOG_ERROR(From, "Failed to skip subchannel data at sector %u", i);
                     return total_read > 0 ? total_read : -1;
                 }
                 
@@ -469,7 +472,7 @@ int CMDSFileDevice::Read(void *pBuffer, size_t nSize) {
     UINT nBytesRead = 0;
     FRESULT result = f_read(m_pFile, pBuffer, nSize, &nBytesRead);
     if (result != FR_OK) {
-        LOGERR("Failed to read %d bytes into memory, err %d", nSize, result);
+        BINLOG_ERROR(From, "Failed to read %d bytes into memory, err %d", nSize, result);
         return -1;
     }
 
@@ -487,7 +490,7 @@ int CMDSFileDevice::Write(const void *pBuffer, size_t nSize) {
 
 u64 CMDSFileDevice::Tell() const {
     if (!m_pFile) {
-        LOGERR("Tell !m_pFile");
+        BINLOG_ERROR(From, "Tell !m_pFile");
         return static_cast<u64>(-1);
     }
 
@@ -496,7 +499,7 @@ u64 CMDSFileDevice::Tell() const {
 
 u64 CMDSFileDevice::Seek(u64 nOffset) {
     if (!m_pFile) {
-        LOGERR("Seek !m_pFile");
+        BINLOG_ERROR(From, "Seek !m_pFile");
         return static_cast<u64>(-1);
     }
 
@@ -512,7 +515,7 @@ u64 CMDSFileDevice::Seek(u64 nOffset) {
     if (m_bFlatOffsets) {
         FRESULT flat = f_lseek(m_pFile, nOffset);
         if (flat != FR_OK) {
-            LOGERR("Seek to flat offset %llu failed, err %d",
+            BINLOG_ERROR(From, "Seek to flat offset %llu failed, err %d",
                    (unsigned long long)nOffset, flat);
             return static_cast<u64>(-1);
         }
@@ -533,7 +536,7 @@ u64 CMDSFileDevice::Seek(u64 nOffset) {
         if (lba < m_nTotalFrames) {
             return nOffset;
         }
-        LOGERR("Seek: LBA %u not found in any track", lba);
+        BINLOG_ERROR(From, "Seek: LBA %u not found in any track", lba);
         return static_cast<u64>(-1);
     }
 
@@ -554,7 +557,7 @@ u64 CMDSFileDevice::Seek(u64 nOffset) {
 
     FRESULT result = f_lseek(m_pFile, actual_file_offset);
     if (result != FR_OK) {
-        LOGERR("Seek to file offset %llu failed, err %d", actual_file_offset, result);
+        BINLOG_ERROR(From, "Seek to file offset %llu failed, err %d", actual_file_offset, result);
         return static_cast<u64>(-1);
     }
 
@@ -564,7 +567,7 @@ u64 CMDSFileDevice::Seek(u64 nOffset) {
 
 u64 CMDSFileDevice::GetSize(void) const {
     if (!m_pFile) {
-        LOGERR("GetSize !m_pFile");
+        BINLOG_ERROR(From, "GetSize !m_pFile");
         return 0;
     }
 
@@ -762,7 +765,7 @@ int CMDSFileDevice::ReadSubchannel(u32 lba, u8* subchannel) {
             memset(subchannel, 0, 96);
             return 96;
         }
-        LOGERR("LBA %u not found in any track", lba);
+        BINLOG_ERROR(From, "LBA %u not found in any track", lba);
         return -1;
     }
 
@@ -782,7 +785,7 @@ int CMDSFileDevice::ReadSubchannel(u32 lba, u8* subchannel) {
     // Seek to subchannel position
     FRESULT result = f_lseek(m_pFile, subchannel_offset);
     if (result != FR_OK) {
-        LOGERR("Failed to seek to subchannel at LBA %u (offset %llu)", lba, subchannel_offset);
+        BINLOG_ERROR(From, "Failed to seek to subchannel at LBA %u (offset %llu)", lba, subchannel_offset);
         return -1;
     }
     
@@ -790,7 +793,7 @@ int CMDSFileDevice::ReadSubchannel(u32 lba, u8* subchannel) {
     UINT bytes_read;
     result = f_read(m_pFile, subchannel, 96, &bytes_read);
     if (result != FR_OK || bytes_read != 96) {
-        LOGERR("Failed to read subchannel at LBA %u (read %u bytes)", lba, bytes_read);
+        BINLOG_ERROR(From, "Failed to read subchannel at LBA %u (read %u bytes)", lba, bytes_read);
         return -1;
     }
     
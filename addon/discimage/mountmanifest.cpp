@@ -0,0 +1,288 @@
+//
+// mountmanifest.cpp
+//
+// Copyright (C) 2025 Ian Cass
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include "mountmanifest.h"
+
+#include <circle/logger.h>
+#include <stdio.h>
+#include <string.h>
+
+LOGMODULE("mountmanifest");
+
+static const u32 SaveMagic = 0x464E4D55;  // "UMNF"
+static const u32 SaveVersion = 1;
+
+// Larger than any manifest of a sane image: 99 files with fragmented link maps
+static const size_t MaxManifestSize = 4 * 1024 * 1024;
+
+static char s_Directory[64] = {0};
+
+static u32 Checksum(const u8* pData, size_t nLength) {
+    u32 nHash = 2166136261u;  // FNV-1a
+    for (size_t i = 0; i < nLength; i++) {
+        nHash ^= pData[i];
+        nHash *= 16777619u;
+    }
+    return nHash;
+}
+
+CMountManifest::CMountManifest() {
+    Clear();
+}
+
+void CMountManifest::Clear() {
+    ImagePath.clear();
+    nCueSize = 0;
+    nCueTime = 0;
+    CueSheet.clear();
+    Files.clear();
+    Holes.clear();
+    nVirtualSize = 0;
+}
+
+void CMountManifest::SetDirectory(const char* pDirectory) {
+    if (pDirectory == nullptr) {
+        s_Directory[0] = '\0';
+        return;
+    }
+    strncpy(s_Directory, pDirectory, sizeof(s_Directory) - 1);
+    s_Directory[sizeof(s_Directory) - 1] = '\0';
+}
+
+bool CMountManifest::IsEnabled() {
+    return s_Directory[0] != '\0';
+}
+
+// One file per image, named for a hash of its path; the path inside tells
+// two images with the same hash apart
+void CMountManifest::GetManifestPath(const char* pImagePath, char* pPath, size_t nSize) {
+    snprintf(pPath, nSize, "%s/%08x.mnf", s_Directory,
+             (unsigned)Checksum((const u8*)pImagePath, strlen(pImagePath)));
+}
+
+bool CMountManifest::Read(const char* pImagePath) {
+    Clear();
+    if (!IsEnabled())
+        return false;
+
+    char Path[128];
+    GetManifestPath(pImagePath, Path, sizeof(Path));
+    FIL File;
+    if (f_open(&File, Path, FA_READ) != FR_OK)
+        return false;
+
+    std::vector<u8> Buffer;
+    FRESULT Result = FR_INVALID_OBJECT;
+    UINT nRead = 0;
+    if (f_size(&File) <= MaxManifestSize) {
+        Buffer.resize((size_t)f_size(&File));
+        Result = Buffer.empty() ? FR_OK : f_read(&File, Buffer.data(), (UINT)Buffer.size(), &nRead);
+    }
+    f_close(&File);
+    if (Result != FR_OK || nRead != Buffer.size())
+        return false;
+
+    if (!Load(Buffer.data(), Buffer.size())) {
+        LOGWARN("Mount manifest %s is damaged, ignoring it", Path);
+        return false;
+    }
+    if (ImagePath != pImagePath) {
+        Clear();
+        return false;
+    }
+    return true;
+}
+
+bool CMountManifest::Write() const {
+    if (!IsEnabled())
+        return false;
+
+    FRESULT Result = f_mkdir(s_Directory);
+    if (Result != FR_OK && Result != FR_EXIST) {
+        LOGWARN("Can't create %s (error %d)", s_Directory, (int)Result);
+        return false;
+    }
+
+    std::vector<u8> Buffer;
+    Save(Buffer);
+
+    // A write cut short is caught by the checksum on the next read
+    char Path[128];
+    GetManifestPath(ImagePath.c_str(), Path, sizeof(Path));
+    FIL File;
+    Result = f_open(&File, Path, FA_WRITE | FA_CREATE_ALWAYS);
+    if (Result != FR_OK) {
+        LOGWARN("Can't write %s (error %d)", Path, (int)Result);
+        return false;
+    }
+    UINT nWritten = 0;
+    Result = f_write(&File, Buffer.data(), (UINT)Buffer.size(), &nWritten);
+    FRESULT CloseResult = f_close(&File);
+    if (Result != FR_OK || CloseResult != FR_OK || nWritten != Buffer.size()) {
+        LOGWARN("Writing %s failed (error %d)", Path, (int)(Result != FR_OK ? Result : CloseResult));
+        f_unlink(Path);
+        return false;
+    }
+    return true;
+}
+
+void CMountManifest::Save(std::vector<u8>& Buffer) const {
+    size_t nLinkMapWords = 0;
+    size_t nPool = ImagePath.size() + 1 + CueSheet.size() + 1;
+    for (const TDataFile& File : Files) {
+        nLinkMapWords += File.LinkMap.size();
+        nPool += File.Path.size() + 1;
+    }
+
+    Buffer.assign(sizeof(TSaveHeader) + Files.size() * sizeof(TSavedFile) + Holes.size() * sizeof(TSavedHole)
+                  + nLinkMapWords * sizeof(u32) + nPool, 0);
+    u8* pFiles = Buffer.data() + sizeof(TSaveHeader);
+    u8* pHoles = pFiles + Files.size() * sizeof(TSavedFile);
+    u8* pLinkMaps = pHoles + Holes.size() * sizeof(TSavedHole);
+    char* pPool = (char*)pLinkMaps + nLinkMapWords * sizeof(u32);
+
+    u32 nPoolUsed = 0;
+    auto AddString = [&](const std::string& String) {
+        u32 nOffset = nPoolUsed;
+        memcpy(pPool + nPoolUsed, String.c_str(), String.size() + 1);
+        nPoolUsed += String.size() + 1;
+        return nOffset;
+    };
+
+    u32 nWord = 0;
+    for (size_t i = 0; i < Files.size(); i++) {
+        const TDataFile& File = Files[i];
+        TSavedFile Saved;
+        Saved.nPath = AddString(File.Path);
+        Saved.nSizeLow = (u32)File.nSize;
+        Saved.nSizeHigh = (u32)(File.nSize >> 32);
+        Saved.nFileTime = File.nFileTime;
+        Saved.nFirstCluster = File.nFirstCluster;
+        Saved.nBaseLow = (u32)File.nBase;
+        Saved.nBaseHigh = (u32)(File.nBase >> 32);
+        Saved.nLinkMap = nWord;
+        Saved.nLinkMapWords = (u32)File.LinkMap.size();
+        memcpy(pFiles + i * sizeof(TSavedFile), &Saved, sizeof(Saved));
+
+        for (DWORD Word : File.LinkMap) {
+            u32 nValue = (u32)Word;
+            memcpy(pLinkMaps + nWord++ * sizeof(u32), &nValue, sizeof(nValue));
+        }
+    }
+
+    for (size_t i = 0; i < Holes.size(); i++) {
+        const THole& Hole = Holes[i];
+        TSavedHole Saved;
+        Saved.nStartLBA = Hole.nStartLBA;
+        Saved.nEndLBA = Hole.nEndLBA;
+        Saved.nBaseLow = (u32)Hole.nBase;
+        Saved.nBaseHigh = (u32)(Hole.nBase >> 32);
+        Saved.nLengthLow = (u32)Hole.nLength;
+        Saved.nLengthHigh = (u32)(Hole.nLength >> 32);
+        Saved.nSectorLength = Hole.nSectorLength;
+        memcpy(pHoles + i * sizeof(TSavedHole), &Saved, sizeof(Saved));
+    }
+
+    TSaveHeader Header;
+    Header.nMagic = SaveMagic;
+    Header.nVersion = SaveVersion;
+    Header.nFiles = (u32)Files.size();
+    Header.nHoles = (u32)Holes.size();
+    Header.nLinkMapWords = (u32)nLinkMapWords;
+    Header.nPool = (u32)nPool;
+    Header.nImagePath = AddString(ImagePath);
+    Header.nCueSheet = AddString(CueSheet);
+    Header.nCueSizeLow = (u32)nCueSize;
+    Header.nCueSizeHigh = (u32)(nCueSize >> 32);
+    Header.nCueTime = nCueTime;
+    Header.nVirtualSizeLow = (u32)nVirtualSize;
+    Header.nVirtualSizeHigh = (u32)(nVirtualSize >> 32);
+    Header.nChecksum = Checksum(Buffer.data() + sizeof(Header), Buffer.size() - sizeof(Header));
+    memcpy(Buffer.data(), &Header, sizeof(Header));
+}
+
+bool CMountManifest::Load(const void* pBuffer, size_t nLength) {
+    Clear();
+
+    TSaveHeader Header;
+    if (pBuffer == nullptr || nLength < sizeof(Header))
+        return false;
+    memcpy(&Header, pBuffer, sizeof(Header));
+    if (Header.nMagic != SaveMagic || Header.nVersion != SaveVersion)
+        return false;
+
+    const u64 nExpected = sizeof(Header) + (u64)Header.nFiles * sizeof(TSavedFile)
+                          + (u64)Header.nHoles * sizeof(TSavedHole)
+                          + (u64)Header.nLinkMapWords * sizeof(u32) + Header.nPool;
+    if (nExpected != nLength)
+        return false;
+    const u8* pData = (const u8*)pBuffer + sizeof(Header);
+    if (Checksum(pData, nLength - sizeof(Header)) != Header.nChecksum)
+        return false;
+
+    const u8* pFiles = pData;
+    const u8* pHoles = pFiles + Header.nFiles * sizeof(TSavedFile);
+    const u8* pLinkMaps = pHoles + Header.nHoles * sizeof(TSavedHole);
+    const char* pPool = (const char*)pLinkMaps + Header.nLinkMapWords * sizeof(u32);
+    if (Header.nPool == 0 || pPool[Header.nPool - 1] != '\0'
+        || Header.nImagePath >= Header.nPool || Header.nCueSheet >= Header.nPool)
+        return false;
+
+    std::vector<TDataFile> LoadedFiles(Header.nFiles);
+    for (u32 i = 0; i < Header.nFiles; i++) {
+        TSavedFile Saved;
+        memcpy(&Saved, pFiles + i * sizeof(TSavedFile), sizeof(Saved));
+        if (Saved.nPath >= Header.nPool || Saved.nLinkMap > Header.nLinkMapWords
+            || Saved.nLinkMapWords > Header.nLinkMapWords - Saved.nLinkMap)
+            return false;
+
+        TDataFile& File = LoadedFiles[i];
+        File.Path = pPool + Saved.nPath;
+        File.nSize = (u64)Saved.nSizeHigh << 32 | Saved.nSizeLow;
+        File.nFileTime = Saved.nFileTime;
+        File.nFirstCluster = Saved.nFirstCluster;
+        File.nBase = (u64)Saved.nBaseHigh << 32 | Saved.nBaseLow;
+        File.LinkMap.resize(Saved.nLinkMapWords);
+        for (u32 j = 0; j < Saved.nLinkMapWords; j++) {
+            u32 nValue;
+            memcpy(&nValue, pLinkMaps + (Saved.nLinkMap + j) * sizeof(u32), sizeof(nValue));
+            File.LinkMap[j] = nValue;
+        }
+    }
+
+    std::vector<THole> LoadedHoles(Header.nHoles);
+    for (u32 i = 0; i < Header.nHoles; i++) {
+        TSavedHole Saved;
+        memcpy(&Saved, pHoles + i * sizeof(TSavedHole), sizeof(Saved));
+        THole& Hole = LoadedHoles[i];
+        Hole.nStartLBA = Saved.nStartLBA;
+        Hole.nEndLBA = Saved.nEndLBA;
+        Hole.nBase = (u64)Saved.nBaseHigh << 32 | Saved.nBaseLow;
+        Hole.nLength = (u64)Saved.nLengthHigh << 32 | Saved.nLengthLow;
+        Hole.nSectorLength = Saved.nSectorLength;
+    }
+
+    ImagePath = pPool + Header.nImagePath;
+    CueSheet = pPool + Header.nCueSheet;
+    nCueSize = (u64)Header.nCueSizeHigh << 32 | Header.nCueSizeLow;
+    nCueTime = Header.nCueTime;
+    nVirtualSize = (u64)Header.nVirtualSizeHigh << 32 | Header.nVirtualSizeLow;
+    Files.swap(LoadedFiles);
+    Holes.swap(LoadedHoles);
+    return true;
+}
@@ -0,0 +1,134 @@
+//
+// mountmanifest.h
+//
+// What mounting a CUE/BIN image works out, kept on the card so the next
+// mount of the same image can skip the work: the cue sheet, where each data
+// file starts in the image's seek space and the holes between them, and the
+// fast-seek link map of every file. Working those out means reading the cue,
+// parsing it again for each file of a split rip and walking the FAT chain of
+// every file; a manifest is one read.
+//
+// A manifest is trusted only while the cue and each data file still have
+// the size and timestamp they had when it was written, and each data file
+// the same first cluster, since a link map of another cluster chain reads
+// another file's data. Otherwise the image loads the long way and the
+// manifest is written again. Manifests are off until SetDirectory() names
+// where they go.
+//
+// Copyright (C) 2025 Ian Cass
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _discimage_mountmanifest_h
+#define _discimage_mountmanifest_h
+
+#include <circle/types.h>
+#include <fatfs/ff.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+class CMountManifest {
+public:
+    struct TDataFile {
+        std::string Path;
+        u64 nSize;
+        u32 nFileTime;          // FatFs fdate << 16 | ftime
+        u32 nFirstCluster;
+        u64 nBase;              // start in the image's seek space
+        std::vector<DWORD> LinkMap;     // as FatFs built it; empty without fast seek
+    };
+
+    // Frames between two files that no file stores (see CCueBinFileDevice)
+    struct THole {
+        u32 nStartLBA;
+        u32 nEndLBA;
+        u64 nBase;
+        u64 nLength;
+        u32 nSectorLength;
+    };
+
+    CMountManifest();
+
+    // Where manifests are kept, such as "0:/usbode-mount"; nullptr turns
+    // them off. Created when the first manifest is written.
+    static void SetDirectory(const char* pDirectory);
+    static bool IsEnabled();
+
+    // The saved manifest of the image whose cue is pImagePath, if there is an
+    // intact one. Whether it still matches the files is for the loader to
+    // check as it opens them.
+    bool Read(const char* pImagePath);
+    bool Write() const;
+
+    // The manifest as one block; Load() leaves it empty if the block is not
+    // an intact one.
+    void Save(std::vector<u8>& Buffer) const;
+    bool Load(const void* pBuffer, size_t nLength);
+
+    static u32 GetFileTime(const FILINFO& Info) { return (u32)Info.fdate << 16 | Info.ftime; }
+
+    std::string ImagePath;
+    u64 nCueSize;
+    u32 nCueTime;
+    std::string CueSheet;
+    std::vector<TDataFile> Files;
+    std::vector<THole> Holes;
+    u64 nVirtualSize;
+
+private:
+    void Clear();
+    static void GetManifestPath(const char* pImagePath, char* pPath, size_t nSize);
+
+    struct TSaveHeader {
+        u32 nMagic;
+        u32 nVersion;
+        u32 nFiles;
+        u32 nHoles;
+        u32 nLinkMapWords;
+        u32 nPool;
+        u32 nImagePath;         // offsets in the pool
+        u32 nCueSheet;
+        u32 nCueSizeLow;
+        u32 nCueSizeHigh;
+        u32 nCueTime;
+        u32 nVirtualSizeLow;
+        u32 nVirtualSizeHigh;
+        u32 nChecksum;          // of everything after the header
+    };
+
+    struct TSavedFile {
+        u32 nPath;
+        u32 nSizeLow;
+        u32 nSizeHigh;
+        u32 nFileTime;
+        u32 nFirstCluster;
+        u32 nBaseLow;
+        u32 nBaseHigh;
+        u32 nLinkMap;           // first word in the link map area
+        u32 nLinkMapWords;
+    };
+
+    struct TSavedHole {
+        u32 nStartLBA;
+        u32 nEndLBA;
+        u32 nBaseLow;
+        u32 nBaseHigh;
+        u32 nLengthLow;
+        u32 nLengthHigh;
+        u32 nSectorLength;
+    };
+};
+
+#endif
@@ -24,12 +24,16 @@
 #include "cuebinfile.h"
 #include <cueparser/cueutil.h>
 #include "mdsfile.h"
+#include "mountmanifest.h"
+#include <tracelab/boottimeline.h>
 // The host test suite has a build without libchdr; everything else keeps CHD.
 #ifndef USBODE_NO_CHD
 #include "chdfile.h"
 #endif
 
 #include <stdarg.h>
+#include <string>
+#include <vector>
 
 LOGMODULE("discimage-util");
 
@@ -41,6 +45,20 @@ const char* GetLastImageLoadError() {
     return s_LastImageLoadError;
 }
 
+void getImageCacheStats(ImageCacheStats* stats) {
+    stats->cueBinHits = CCueBinFileDevice::GetCacheHits();
+    stats->cueBinMisses = CCueBinFileDevice::GetCacheMisses();
+#ifdef USBODE_NO_CHD
+    stats->chdHunkHits = 0;
+    stats->chdHunkMisses = 0;
+    stats->chdDecodeMs = 0;
+#else
+    stats->chdHunkHits = CCHDFileDevice::GetHunkHits();
+    stats->chdHunkMisses = CCHDFileDevice::GetHunkMisses();
+    stats->chdDecodeMs = CCHDFileDevice::GetDecodeMs();
+#endif
+}
+
 static void ClearImageLoadError() {
     s_LastImageLoadError[0] = '\0';
 }
@@ -292,6 +310,85 @@ static void resolveSiblingPath(const char* cuePath, const char* name,
 // ============================================================================
 // CUE/BIN/ISO Plugin Loader
 // ============================================================================
+// The device a saved manifest describes, if the cue and every data file are
+// still the ones it was written for; nullptr sends the load the long way.
+static IImageDevice* loadFromManifest(const char* cuePath, MEDIA_TYPE mediaType) {
+    CMountManifest manifest;
+    if (!manifest.Read(cuePath)) {
+        return nullptr;
+    }
+
+    FILINFO info;
+    bool bCurrent = f_stat(cuePath, &info) == FR_OK && info.fsize == manifest.nCueSize &&
+                    CMountManifest::GetFileTime(info) == manifest.nCueTime;
+
+    std::vector<FIL*> files;
+    for (size_t i = 0; bCurrent && i < manifest.Files.size(); i++) {
+        const CMountManifest::TDataFile& saved = manifest.Files[i];
+        if (f_stat(saved.Path.c_str(), &info) != FR_OK || info.fsize != saved.nSize ||
+            CMountManifest::GetFileTime(info) != saved.nFileTime) {
+            bCurrent = false;
+            break;
+        }
+
+        FIL* file = new FIL();
+        if (f_open(file, saved.Path.c_str(), FA_READ) != FR_OK) {
+            delete file;
+            bCurrent = false;
+            break;
+        }
+        files.push_back(file);
+        // Same size and time can still be another file in the same place
+        if (f_size(file) != saved.nSize || file->obj.sclust != saved.nFirstCluster) {
+            bCurrent = false;
+        }
+    }
+
+    CCueBinFileDevice* device = nullptr;
+    if (bCurrent) {
+        device = CCueBinFileDevice::FromManifest(manifest, files.data(), mediaType);
+    }
+    if (device == nullptr) {
+        for (FIL* file : files) {
+            f_close(file);
+            delete file;
+        }
+        LOGNOTE("Mount manifest of %s is out of date", cuePath);
+        return nullptr;
+    }
+
+    LOGNOTE("Loaded %s from its mount manifest", cuePath);
+    return device;
+}
+
+static void writeManifest(const char* cuePath, const CCueBinFileDevice* device,
+                          const std::vector<std::string>& dataPaths) {
+    CMountManifest manifest;
+    FILINFO info;
+    if (f_stat(cuePath, &info) != FR_OK) {
+        return;
+    }
+    manifest.ImagePath = cuePath;
+    manifest.nCueSize = info.fsize;
+    manifest.nCueTime = CMountManifest::GetFileTime(info);
+
+    device->ExportLayout(&manifest);
+    if (manifest.Files.size() != dataPaths.size()) {
+        return;
+    }
+    for (size_t i = 0; i < dataPaths.size(); i++) {
+        if (f_stat(dataPaths[i].c_str(), &info) != FR_OK) {
+            return;
+        }
+        manifest.Files[i].Path = dataPaths[i];
+        manifest.Files[i].nFileTime = CMountManifest::GetFileTime(info);
+    }
+
+    if (manifest.Write()) {
+        LOGNOTE("Wrote mount manifest of %s", cuePath);
+    }
+}
+
 IImageDevice* loadCueBinIsoFileDevice(const char* imagePath) {
     LOGNOTE("Loading CUE/BIN/ISO image: %s", imagePath);
 
@@ -315,7 +412,16 @@ IImageDevice* loadCueBinIsoFileDevice(const char* imagePath) {
     char cuePath[512];
     cuePath[0] = '\0';
     if (hasCueExtension(fullPath)) {
+        CBootTimeline::Get()->Begin(BootStageMountManifest);
+        IImageDevice* device = loadFromManifest(fullPath, mediaType);
+        CBootTimeline::Get()->End(BootStageMountManifest);
+        if (device != nullptr) {
+            delete imageFile;
+            return device;
+        }
+
         LOGNOTE("Loading CUE sheet from: %s", fullPath);
+        CBootTimeline::Get()->Begin(BootStageMountCueParse);
         if (!ReadFileToString(fullPath, &cue_str)) {
             LOGERR("Failed to read CUE file: %s", fullPath);
             SetImageLoadError("Could not read the cue sheet for this image.");
@@ -333,6 +439,7 @@ IImageDevice* loadCueBinIsoFileDevice(const char* imagePath) {
 
     // Single-FILE cues retain the same-stem BIN fallback.
     int nCueFiles = (cue_str != nullptr) ? CueCountFiles(cue_str) : 0;
+    CBootTimeline::Get()->End(BootStageMountCueParse);
     bool bSplitRip = (nCueFiles > 1 && cuePath[0] != '\0');
     if (bSplitRip) {
         char name[CUE_MAX_FILENAME + 1];
@@ -356,7 +463,9 @@ IImageDevice* loadCueBinIsoFileDevice(const char* imagePath) {
 
     // Open the data file (BIN or ISO)
     LOGNOTE("Opening data file: %s", fullPath);
+    CBootTimeline::Get()->Begin(BootStageMountFileOpen);
     FRESULT result = f_open(imageFile, fullPath, FA_READ);
+    CBootTimeline::Get()->End(BootStageMountFileOpen);
     if (result != FR_OK) {
         LOGERR("Cannot open data file for reading: %s (error %d)", fullPath, result);
         // "Missing" sends the user looking for a file that may be sitting right
@@ -385,7 +494,13 @@ IImageDevice* loadCueBinIsoFileDevice(const char* imagePath) {
 
     // Create device
     CCueBinFileDevice* device = new CCueBinFileDevice(imageFile, cue_str, mediaType);
+    std::vector<std::string> dataPaths;
+    dataPaths.push_back(fullPath);
 
+    // Each further file moves the layout of the ones before it
+    if (bSplitRip) {
+        CBootTimeline::Get()->Begin(BootStageMountLayout);
+    }
     for (int i = 1; bSplitRip && i < nCueFiles; i++) {
         char name[CUE_MAX_FILENAME + 1];
         char binPath[512];
@@ -437,6 +552,12 @@ IImageDevice* loadCueBinIsoFileDevice(const char* imagePath) {
             if (cue_str != nullptr) delete[] cue_str;
             return nullptr;
         }
+        dataPaths.push_back(binPath);
+    }
+    CBootTimeline::Get()->End(BootStageMountLayout);
+
+    if (cuePath[0] != '\0' && CMountManifest::IsEnabled()) {
+        writeManifest(cuePath, device, dataPaths);
     }
 
     // Cleanup - CCueBinFileDevice takes ownership of cue_str if provided
@@ -548,6 +669,64 @@ void FatFsOptimizer::DisableFastSeek(DWORD** ppCLMT) {
     }
 }
 
+// Growing a file cluster by cluster interleaves its chain with every other
+// file written at the same time (the log, config saves, a second upload).
+// Extending it a large step at a time claims a run of free clusters in one
+// go. Big enough that an image needs few steps, small enough that one step
+// is not a long stall on a slow card.
+static constexpr u64 ReserveExtentBytes = 32 * 1024 * 1024;
+
+boolean FatFsOptimizer::Preallocate(FIL* pFile, u64 nSize, const char* logPrefix) {
+    if (!pFile || nSize == 0 || f_size(pFile) != 0) {
+        return false;
+    }
+
+#if FF_USE_EXPAND
+    // opt 1 allocates now; FR_DENIED means no free run is that long
+    FRESULT result = f_expand(pFile, (FSIZE_t)nSize, 1);
+    if (result == FR_OK) {
+        LOGNOTE("%sPreallocated %llu contiguous bytes", logPrefix, nSize);
+        return true;
+    }
+    LOGNOTE("%sNo contiguous run of %llu bytes (err %d), growing in extents",
+            logPrefix, nSize, result);
+#endif
+    return false;
+}
+
+void FatFsOptimizer::ReserveExtent(FIL* pFile, u64 nEnd, u64 nLimit) {
+    u64 nSize = f_size(pFile);
+    if (nEnd <= nSize) {
+        return;
+    }
+
+    u64 nTarget = nSize + ReserveExtentBytes;
+    if (nLimit != 0 && nTarget > nLimit) {
+        nTarget = nLimit;
+    }
+    if (nTarget < nEnd) {
+        nTarget = nEnd;
+    }
+
+    // Seeking past the end of a file open for writing allocates up to there.
+    // On a full volume FatFs stops short, and the write that follows comes
+    // up short too, which the caller already treats as a full card.
+    FSIZE_t nPos = f_tell(pFile);
+    f_lseek(pFile, (FSIZE_t)nTarget);
+    f_lseek(pFile, nPos);
+}
+
+FRESULT FatFsOptimizer::TrimToLength(FIL* pFile, u64 nLength) {
+    if (f_size(pFile) == nLength) {
+        return FR_OK;
+    }
+    FRESULT result = f_lseek(pFile, (FSIZE_t)nLength);
+    if (result == FR_OK) {
+        result = f_truncate(pFile);
+    }
+    return result;
+}
+
 // ============================================================================
 // Main Entry Point - Plugin Selection
 // ============================================================================
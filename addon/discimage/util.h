@@ -28,6 +28,18 @@ IImageDevice* loadImageDevice(const char* imageName);
 // succeeded. Written by the loaders, read by SCSITBService when a mount is refused.
 const char* GetLastImageLoadError();
 
+// Read cache counters of all images since boot, for the metrics page: the
+// CUE/BIN/ISO read-ahead windows, and the CHD hunk cache with the time spent
+// decompressing the hunks it missed (zeros in a build without CHD).
+struct ImageCacheStats {
+    u32 cueBinHits;
+    u32 cueBinMisses;
+    u32 chdHunkHits;
+    u32 chdHunkMisses;
+    u32 chdDecodeMs;
+};
+void getImageCacheStats(ImageCacheStats* stats);
+
 // Format-specific loaders
 IImageDevice* loadMDSFileDevice(const char* imageName);
 IImageDevice* loadCueBinIsoFileDevice(const char* imageName);
@@ -46,6 +58,28 @@ public:
     /// Disable fast seek and free CLMT memory
     /// \param ppCLMT Pointer to CLMT pointer (will be freed and nulled)
     static void DisableFastSeek(DWORD** ppCLMT);
+
+    /// Reserve space for a file about to be written front to back (an
+    /// upload), so its clusters end up in one run rather than interleaved
+    /// with whatever else writes to the card meanwhile, and fast seek later
+    /// needs a handful of CLMT entries instead of thousands.
+    /// \param pFile Empty file open for writing
+    /// \param nSize Final size if known, else 0
+    /// \return true if the whole file got contiguous clusters (f_expand).
+    /// Otherwise the writer grows it with ReserveExtent() as it goes.
+    /// \note Either way f_size() runs ahead of the data; call TrimToLength()
+    /// when the last byte is written. Do not f_sync() the file before then:
+    /// the reserved size would reach its directory entry, and after a reboot
+    /// the file would claim the reserved clusters as data.
+    static boolean Preallocate(FIL* pFile, u64 nSize, const char* logPrefix = "");
+
+    /// Make sure the file reaches nEnd before writing up to there, growing it
+    /// by a large extent at a time (never past nLimit, if not 0). Leaves the
+    /// file pointer where it was. A full volume shows up as a short write.
+    static void ReserveExtent(FIL* pFile, u64 nEnd, u64 nLimit = 0);
+
+    /// Cut a preallocated file back to the nLength bytes actually written.
+    static FRESULT TrimToLength(FIL* pFile, u64 nLength);
 };
 
 
@@ -0,0 +1,137 @@
+//
+// The sectors a host reads first from a newly inserted disc, read ahead
+//
+// Copyright (C) 2025 Dani Sarfati
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+#include "volumewarmup.h"
+#include "imageinfo.h"
+#include <cueparser/cueparser.h>
+
+#include <string.h>
+
+#define USER_DATA_SIZE 2048
+#define RAW_SECTOR_SIZE 2352
+#define FIRST_DESCRIPTOR 16
+// Hybrid and Joliet discs carry a few descriptors before the terminator
+#define MAX_DESCRIPTORS 8
+// One CUE/BIN read-ahead window of 2048-byte sectors. A directory bigger
+// than that is read as the host walks it, as before.
+#define MAX_WARM_SECTORS 64
+
+namespace {
+
+struct Warmup {
+    IImageDevice* device;
+    CUETrackInfo track;
+    int skip;
+    u32 sectors;
+    u8 raw[RAW_SECTOR_SIZE];
+    u8 descriptors[MAX_DESCRIPTORS][USER_DATA_SIZE];
+};
+
+u32 le32(const u8* p) {
+    return (u32)p[0] | (u32)p[1] << 8 | (u32)p[2] << 16 | (u32)p[3] << 24;
+}
+
+// Reads one stored sector, the way the gadget does for a host READ
+bool readSector(Warmup& w, u32 lba) {
+    if (w.sectors >= MAX_WARM_SECTORS)
+        return false;
+
+    u32 length = w.track.sector_length < RAW_SECTOR_SIZE ? w.track.sector_length : RAW_SECTOR_SIZE;
+    u64 offset = w.device->GetByteOffsetForLBA(lba);
+    if (w.device->Seek(offset) != offset || w.device->Read(w.raw, length) != (int)length)
+        return false;
+
+    w.sectors++;
+    return true;
+}
+
+void readExtent(Warmup& w, u32 lba, u32 bytes) {
+    u32 count = (bytes + USER_DATA_SIZE - 1) / USER_DATA_SIZE;
+    for (u32 i = 0; i < count; i++) {
+        if (!readSector(w, lba + i))
+            return;
+    }
+}
+
+// The path table and root directory of a primary or supplementary volume
+void readVolume(Warmup& w, const u8* descriptor) {
+    // Both-endian; anything but 2048 is a volume no host here reads
+    if (descriptor[128] != (USER_DATA_SIZE & 0xFF) || descriptor[129] != USER_DATA_SIZE >> 8)
+        return;
+
+    // Little-endian path table, then the root directory record at 156
+    readExtent(w, le32(descriptor + 140), le32(descriptor + 132));
+    readExtent(w, le32(descriptor + 156 + 2), le32(descriptor + 156 + 10));
+}
+
+bool isJoliet(const u8* descriptor) {
+    // UCS-2 level 1, 2 or 3 escape sequence
+    const u8* escape = descriptor + 88;
+    return escape[0] == '%' && escape[1] == '/' &&
+           (escape[2] == '@' || escape[2] == 'C' || escape[2] == 'E');
+}
+
+}  // namespace
+
+u32 warmImageVolume(IImageDevice* device) {
+    const char* cueSheet = device ? device->GetCueSheet() : nullptr;
+    if (cueSheet == nullptr)
+        return 0;
+
+    CUEParser parser(cueSheet);
+    if (device->GetDataFileCount() > 1 && device->GetDataFileSizes() != nullptr)
+        parser.set_file_sizes(device->GetDataFileSizes(), device->GetDataFileCount());
+
+    // Heap, not stack: this runs on small task stacks
+    Warmup* w = new Warmup();
+    w->device = device;
+    w->skip = -1;
+    const CUETrackInfo* track;
+    while ((track = parser.next_track()) != nullptr) {
+        if (track->track_mode != CUETrack_AUDIO) {
+            w->track = *track;
+            w->skip = getUserDataOffset(track->track_mode);
+            break;
+        }
+    }
+    if (w->skip < 0 || (u32)w->skip + USER_DATA_SIZE > w->track.sector_length) {
+        delete w;
+        return 0;
+    }
+
+    // The start of the system area, where an HFS or console disc keeps what
+    // its host reads first; then the descriptors, as the host reads them.
+    // Each is copied out because reading its extents reuses the buffer.
+    readSector(*w, w->track.data_start);
+    int count = 0;
+    for (; count < MAX_DESCRIPTORS; count++) {
+        if (!readSector(*w, w->track.data_start + FIRST_DESCRIPTOR + count))
+            break;
+        const u8* descriptor = w->raw + w->skip;
+        if (memcmp(descriptor + 1, "CD001", 5) != 0)
+            break;
+        memcpy(w->descriptors[count], descriptor, USER_DATA_SIZE);
+        if (descriptor[0] == 255)
+            break;
+    }
+
+    for (int i = 0; i < count; i++) {
+        const u8* descriptor = w->descriptors[i];
+        if (descriptor[0] == 1 || (descriptor[0] == 2 && isJoliet(descriptor))) {
+            readVolume(*w, descriptor);
+        } else if (descriptor[0] == 0 && memcmp(descriptor + 7, "EL TORITO SPECIFICATION", 23) == 0) {
+            readSector(*w, le32(descriptor + 71));
+        }
+    }
+
+    u32 sectors = w->sectors;
+    delete w;
+    return sectors;
+}
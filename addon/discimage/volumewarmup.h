@@ -0,0 +1,28 @@
+//
+// The sectors a host reads first from a newly inserted disc, read ahead at
+// mount time so they come from the device's cache: the start of the system
+// area, the volume descriptors at LBA 16, the path tables and root
+// directories of the primary and Joliet volumes, and the El Torito boot
+// catalog.
+//
+// Copyright (C) 2025 Dani Sarfati
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+#ifndef _VOLUMEWARMUP_H
+#define _VOLUMEWARMUP_H
+
+#include <circle/types.h>
+#include "imagedevice.h"
+
+// Reads those sectors of the first data track through the device, so they
+// land in its read-ahead windows (CUE/BIN/ISO) or hunk cache (CHD). MDS/MDF
+// has no cache of its own and gains nothing. Returns the sectors read, 0
+// for an audio disc. Leaves the device's position anywhere: callers Seek()
+// before they Read().
+u32 warmImageVolume(IImageDevice* device);
+
+#endif
@@ -7,6 +7,10 @@
 
 LOGMODULE("imagespage");
 
+// What Left/Right cycle through in search mode; a space separates words
+static const char SearchAlphabet[] = " ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-";
+static const size_t SearchAlphabetLength = sizeof(SearchAlphabet) - 1;
+
 SH1106ImagesPage::SH1106ImagesPage(CSH1106Display* display, C2DGraphics* graphics)
     : m_Display(display),
       m_Graphics(graphics) {
@@ -17,6 +21,7 @@ SH1106ImagesPage::SH1106ImagesPage(CSH1106Display* display, C2DGraphics* graphic
     maxTextPx = m_Display->GetWidth();
 
     m_CurrentPath[0] = '\0';
+    m_Query[0] = '\0';
 }
 
 SH1106ImagesPage::~SH1106ImagesPage() {
@@ -30,6 +35,7 @@ void SH1106ImagesPage::OnEnter() {
 
     const char* currentPath = m_Service->GetCurrentCDPath();
     m_CurrentPath[0] = '\0';
+    m_Searching = false;
 
     // In folder mode, navigate to the folder containing the current image
     if (!flatFileList && currentPath && currentPath[0] != '\0') {
@@ -80,6 +86,7 @@ void SH1106ImagesPage::OnEnter() {
 
 void SH1106ImagesPage::OnExit() {
     m_ShouldChangePage = false;
+    m_Searching = false;
 }
 
 bool SH1106ImagesPage::shouldChangePage() {
@@ -96,6 +103,70 @@ void SH1106ImagesPage::OnButtonPress(Button button) {
     ConfigService* config = ConfigService::Get();
     bool flatFileList = config ? config->GetFlatFileList() : false;
 
+    if (m_Searching) {
+        switch (button) {
+            case Button::Up:
+                MoveSelection(-1);
+                break;
+
+            case Button::Down:
+                MoveSelection(+1);
+                break;
+
+            case Button::Left:
+                m_Candidate = (m_Candidate + SearchAlphabetLength - 1) % SearchAlphabetLength;
+                dirty = true;
+                break;
+
+            case Button::Right:
+                m_Candidate = (m_Candidate + 1) % SearchAlphabetLength;
+                dirty = true;
+                break;
+
+            case Button::Center:
+                if (m_QueryLength < SEARCH_MAX_QUERY - 1) {
+                    m_Query[m_QueryLength++] = SearchAlphabet[m_Candidate];
+                    m_Query[m_QueryLength] = '\0';
+                    m_SelectedIndex = 0;
+                    RunSearch();
+                }
+                break;
+
+            case Button::Ok:
+                if (m_SelectedIndex < m_ResultCount) {
+                    size_t cacheIdx = m_Results[m_SelectedIndex];
+                    const char* relativePath = m_Service->GetRelativePath(cacheIdx);
+                    if (m_Service->IsDirectory(cacheIdx)) {
+                        m_Searching = false;
+                        NavigateToFolder(relativePath);
+                    } else {
+                        m_Service->SetNextCDByName(relativePath);
+                        m_NextPageName = "homepage";
+                        m_ShouldChangePage = true;
+                    }
+                }
+                break;
+
+            case Button::Cancel:
+                if (m_QueryLength > 0) {
+                    m_Query[--m_QueryLength] = '\0';
+                    m_SelectedIndex = 0;
+                    RunSearch();
+                } else {
+                    EndSearch();
+                }
+                break;
+
+            case Button::Key3:
+                EndSearch();
+                break;
+
+            default:
+                break;
+        }
+        return;
+    }
+
     switch (button) {
         case Button::Up:
             MoveSelection(-1);
@@ -105,6 +176,10 @@ void SH1106ImagesPage::OnButtonPress(Button button) {
             MoveSelection(+1);
             break;
 
+        case Button::Key3:
+            StartSearch();
+            break;
+
         case Button::Left:
             MoveSelection(-5);
             break;
@@ -189,38 +264,61 @@ void SH1106ImagesPage::NavigateUp() {
     dirty = true;
 }
 
-// Returns how many visible items there are in the current view
-size_t SH1106ImagesPage::GetVisibleCount() {
+void SH1106ImagesPage::StartSearch() {
+    m_SavedSelectedIndex = m_SelectedIndex;
+    m_SavedMountedIndex = m_MountedIndex;
+
+    m_Searching = true;
+    m_Query[0] = '\0';
+    m_QueryLength = 0;
+    m_Candidate = 1;  // 'A'
+    m_ResultCount = 0;
+    m_SelectedIndex = 0;
+    m_MountedIndex = (size_t)-1;
+    dirty = true;
+}
+
+void SH1106ImagesPage::EndSearch() {
+    m_Searching = false;
+    m_SelectedIndex = m_SavedSelectedIndex;
+    m_MountedIndex = m_SavedMountedIndex;
+    dirty = true;
+}
+
+// Asks the library again; also run before each redraw, so the results
+// never refer to entries from before an upload or a rescan.
+void SH1106ImagesPage::RunSearch() {
     ConfigService* config = ConfigService::Get();
     bool flatFileList = config ? config->GetFlatFileList() : false;
-    bool isRoot = (m_CurrentPath[0] == '\0');
-    size_t pathLen = strlen(m_CurrentPath);
 
-    size_t count = 0;
+    // Flat mode has no folders to open
+    size_t total = m_Service->Search(m_Query, flatFileList, m_Results, SEARCH_MAX_RESULTS);
+    m_ResultCount = MIN(total, (size_t)SEARCH_MAX_RESULTS);
+    if (m_SelectedIndex >= m_ResultCount)
+        m_SelectedIndex = 0;
+    dirty = true;
+}
 
-    // Add ".." if not at root and not in flat mode
-    if (!flatFileList && !isRoot) {
-        count++;
+// Returns how many visible items there are in the current view
+size_t SH1106ImagesPage::GetVisibleCount() {
+    if (m_Searching) {
+        return m_ResultCount;
     }
 
-    size_t totalEntries = m_Service->GetCount();
-    for (size_t i = 0; i < totalEntries; ++i) {
-        const char* entryPath = m_Service->GetRelativePath(i);
-        if (!entryPath) continue;
+    ConfigService* config = ConfigService::Get();
+    bool flatFileList = config ? config->GetFlatFileList() : false;
 
-        bool showEntry = false;
-        if (flatFileList) {
-            showEntry = !m_Service->IsDirectory(i);
-        } else if (isRoot) {
-            showEntry = (strchr(entryPath, '/') == nullptr);
-        } else {
-            if (strncmp(entryPath, m_CurrentPath, pathLen) == 0 && entryPath[pathLen] == '/') {
-                const char* remainder = entryPath + pathLen + 1;
-                showEntry = (strchr(remainder, '/') == nullptr);
-            }
-        }
+    if (flatFileList) {
+        // Flat mode: every image, and images follow all the folders
+        return m_Service->GetCount() - m_Service->GetDirectoryCount();
+    }
+
+    size_t count = 0;
+    m_Service->GetFolderEntries(m_CurrentPath, &count);
 
-        if (showEntry) count++;
+    // Add ".." if not at root
+    if (m_CurrentPath[0] != '\0') {
+        count++;
     }
 
     return count;
@@ -228,6 +326,10 @@ size_t SH1106ImagesPage::GetVisibleCount() {
 
 // Returns true if the visible index is the ".." parent directory entry
 bool SH1106ImagesPage::IsParentDirEntry(size_t visibleIndex) {
+    if (m_Searching) {
+        return false;
+    }
+
     ConfigService* config = ConfigService::Get();
     bool flatFileList = config ? config->GetFlatFileList() : false;
     bool isRoot = (m_CurrentPath[0] == '\0');
@@ -241,45 +343,29 @@ bool SH1106ImagesPage::IsParentDirEntry(size_t visibleIndex) {
 
 // Returns the cache index for the given visible index
 size_t SH1106ImagesPage::GetCacheIndex(size_t visibleIndex) {
+    if (m_Searching) {
+        return visibleIndex < m_ResultCount ? m_Results[visibleIndex] : (size_t)-1;
+    }
+
     ConfigService* config = ConfigService::Get();
     bool flatFileList = config ? config->GetFlatFileList() : false;
-    bool isRoot = (m_CurrentPath[0] == '\0');
-    size_t pathLen = strlen(m_CurrentPath);
 
-    // Account for ".." entry
-    size_t offset = 0;
-    if (!flatFileList && !isRoot) {
-        if (visibleIndex == 0) return (size_t)-1;  // ".." entry
-        offset = 1;
+    if (flatFileList) {
+        size_t index = m_Service->GetDirectoryCount() + visibleIndex;
+        return index < m_Service->GetCount() ? index : (size_t)-1;
     }
 
-    size_t targetIndex = visibleIndex - offset;
-    size_t count = 0;
-
-    size_t totalEntries = m_Service->GetCount();
-    for (size_t i = 0; i < totalEntries; ++i) {
-        const char* entryPath = m_Service->GetRelativePath(i);
-        if (!entryPath) continue;
-
-        bool showEntry = false;
-        if (flatFileList) {
-            showEntry = !m_Service->IsDirectory(i);
-        } else if (isRoot) {
-            showEntry = (strchr(entryPath, '/') == nullptr);
-        } else {
-            if (strncmp(entryPath, m_CurrentPath, pathLen) == 0 && entryPath[pathLen] == '/') {
-                const char* remainder = entryPath + pathLen + 1;
-                showEntry = (strchr(remainder, '/') == nullptr);
-            }
-        }
-
-        if (showEntry) {
-            if (count == targetIndex) return i;
-            count++;
-        }
+    // Account for ".." entry
+    if (m_CurrentPath[0] != '\0') {
+        if (visibleIndex == 0) return (size_t)-1;
+        visibleIndex--;
     }
 
-    return (size_t)-1;
+    size_t count = 0;
+    const u32* entries = m_Service->GetFolderEntries(m_CurrentPath, &count);
+    if (entries == nullptr || visibleIndex >= count)
+        return (size_t)-1;
+    return entries[visibleIndex];
 }
 
 // Returns the display name for the given visible index
@@ -294,7 +380,7 @@ const char* SH1106ImagesPage::GetDisplayName(size_t visibleIndex) {
     ConfigService* config = ConfigService::Get();
     bool flatFileList = config ? config->GetFlatFileList() : false;
 
-    if (flatFileList) {
+    if (flatFileList && !m_Searching) {
         return m_Service->GetRelativePath(cacheIdx);
     } else {
         return m_Service->GetName(cacheIdx);
@@ -400,14 +486,32 @@ void SH1106ImagesPage::Refresh() {
 void SH1106ImagesPage::Draw() {
     if (!m_Service) return;
 
+    if (m_Searching && m_QueryLength > 0) {
+        RunSearch();
+    }
+
     size_t visibleCount = GetVisibleCount();
-    if (visibleCount == 0) return;
+    if (visibleCount == 0 && !m_Searching) return;
 
     dirty = false;
 
     m_Graphics->ClearScreen(COLOR2D(0, 0, 0));
     m_Graphics->DrawRect(0, 0, m_Display->GetWidth(), 10, COLOR2D(255, 255, 255));
-    m_Graphics->DrawText(2, 1, COLOR2D(0, 0, 0), "Images", C2DGraphics::AlignLeft, Font8x8);
+    if (m_Searching) {
+        // The end of the query, then the character Center would add
+        const size_t shown = 7;
+        const char* tail = m_Query + (m_QueryLength > shown ? m_QueryLength - shown : 0);
+        char header[24];
+        snprintf(header, sizeof(header), "Find:%s[%c]", tail, SearchAlphabet[m_Candidate]);
+        m_Graphics->DrawText(2, 1, COLOR2D(0, 0, 0), header, C2DGraphics::AlignLeft, Font8x8);
+        if (visibleCount == 0) {
+            DrawText(0, 16, COLOR2D(255, 255, 255), m_QueryLength > 0 ? "No matches" : "Type a name", Font6x7);
+            m_Graphics->UpdateDisplay();
+            return;
+        }
+    } else {
+        m_Graphics->DrawText(2, 1, COLOR2D(0, 0, 0), "Images", C2DGraphics::AlignLeft, Font8x8);
+    }
 
     if (m_SelectedIndex != m_PreviousSelectedIndex) {
         m_ScrollOffsetPx = 0;
@@ -483,9 +587,12 @@ void SH1106ImagesPage::Draw() {
 
     RefreshScroll();
 
-    char pageText[16];
-    snprintf(pageText, sizeof(pageText), "%d/%d", (short)currentPage + 1, (short)totalPages);
-    m_Graphics->DrawText(85, 1, COLOR2D(0, 0, 0), pageText, C2DGraphics::AlignLeft, Font6x7);
+    // The search header needs the whole width
+    if (!m_Searching) {
+        char pageText[16];
+        snprintf(pageText, sizeof(pageText), "%d/%d", (short)currentPage + 1, (short)totalPages);
+        m_Graphics->DrawText(85, 1, COLOR2D(0, 0, 0), pageText, C2DGraphics::AlignLeft, Font6x7);
+    }
 
     m_Graphics->UpdateDisplay();
 }
@@ -9,6 +9,8 @@
 #include <scsitbservice/scsitbservice.h>
 
 #define ITEMS_PER_PAGE 5
+#define SEARCH_MAX_QUERY 32
+#define SEARCH_MAX_RESULTS 50
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #define MAX(a, b) (((a) > (b)) ? (a) : (b))
 
@@ -29,6 +31,12 @@ class SH1106ImagesPage : public IPage {
     void NavigateToFolder(const char* path);
     void NavigateUp();
 
+    // Search mode (Key3): Left/Right pick a character, Center adds it,
+    // Cancel takes one back off; the list shows the matches as you type.
+    void StartSearch();
+    void EndSearch();
+    void RunSearch();
+
     // Helper functions to iterate visible entries on-the-fly
     size_t GetVisibleCount();
     bool IsParentDirEntry(size_t visibleIndex);
@@ -60,5 +68,15 @@ class SH1106ImagesPage : public IPage {
 
     // Folder navigation state
     char m_CurrentPath[MAX_PATH_LEN];  // Current folder path (e.g., "Games/RPG" or "" for root)
+
+    // Search state
+    bool m_Searching = false;
+    char m_Query[SEARCH_MAX_QUERY];
+    size_t m_QueryLength = 0;
+    size_t m_Candidate = 0;  // into the search alphabet
+    u32 m_Results[SEARCH_MAX_RESULTS];
+    size_t m_ResultCount = 0;
+    size_t m_SavedSelectedIndex = 0;  // the folder view to go back to
+    size_t m_SavedMountedIndex = 0;
 };
 #endif
@@ -193,34 +193,18 @@ void SSD1306ImagesPage::NavigateUp() {
 size_t SSD1306ImagesPage::GetVisibleCount() {
     ConfigService* config = ConfigService::Get();
     bool flatFileList = config ? config->GetFlatFileList() : false;
-    bool isRoot = (m_CurrentPath[0] == '\0');
-    size_t pathLen = strlen(m_CurrentPath);
-
-    size_t count = 0;
 
-    // Add ".." if not at root and not in flat mode
-    if (!flatFileList && !isRoot) {
-        count++;
+    if (flatFileList) {
+        // Flat mode: every image, and images follow all the folders
+        return m_Service->GetCount() - m_Service->GetDirectoryCount();
     }
 
-    size_t totalEntries = m_Service->GetCount();
-    for (size_t i = 0; i < totalEntries; ++i) {
-        const char* entryPath = m_Service->GetRelativePath(i);
-        if (!entryPath) continue;
-
-        bool showEntry = false;
-        if (flatFileList) {
-            showEntry = !m_Service->IsDirectory(i);
-        } else if (isRoot) {
-            showEntry = (strchr(entryPath, '/') == nullptr);
-        } else {
-            if (strncmp(entryPath, m_CurrentPath, pathLen) == 0 && entryPath[pathLen] == '/') {
-                const char* remainder = entryPath + pathLen + 1;
-                showEntry = (strchr(remainder, '/') == nullptr);
-            }
-        }
+    size_t count = 0;
+    m_Service->GetFolderEntries(m_CurrentPath, &count);
 
-        if (showEntry) count++;
+    // Add ".." if not at root
+    if (m_CurrentPath[0] != '\0') {
+        count++;
     }
 
     return count;
@@ -243,43 +227,23 @@ bool SSD1306ImagesPage::IsParentDirEntry(size_t visibleIndex) {
 size_t SSD1306ImagesPage::GetCacheIndex(size_t visibleIndex) {
     ConfigService* config = ConfigService::Get();
     bool flatFileList = config ? config->GetFlatFileList() : false;
-    bool isRoot = (m_CurrentPath[0] == '\0');
-    size_t pathLen = strlen(m_CurrentPath);
 
-    // Account for ".." entry
-    size_t offset = 0;
-    if (!flatFileList && !isRoot) {
-        if (visibleIndex == 0) return (size_t)-1;  // ".." entry
-        offset = 1;
+    if (flatFileList) {
+        size_t index = m_Service->GetDirectoryCount() + visibleIndex;
+        return index < m_Service->GetCount() ? index : (size_t)-1;
     }
 
-    size_t targetIndex = visibleIndex - offset;
-    size_t count = 0;
-
-    size_t totalEntries = m_Service->GetCount();
-    for (size_t i = 0; i < totalEntries; ++i) {
-        const char* entryPath = m_Service->GetRelativePath(i);
-        if (!entryPath) continue;
-
-        bool showEntry = false;
-        if (flatFileList) {
-            showEntry = !m_Service->IsDirectory(i);
-        } else if (isRoot) {
-            showEntry = (strchr(entryPath, '/') == nullptr);
-        } else {
-            if (strncmp(entryPath, m_CurrentPath, pathLen) == 0 && entryPath[pathLen] == '/') {
-                const char* remainder = entryPath + pathLen + 1;
-                showEntry = (strchr(remainder, '/') == nullptr);
-            }
-        }
-
-        if (showEntry) {
-            if (count == targetIndex) return i;
-            count++;
-        }
+    // Account for ".." entry
+    if (m_CurrentPath[0] != '\0') {
+        if (visibleIndex == 0) return (size_t)-1;
+        visibleIndex--;
     }
 
-    return (size_t)-1;
+    size_t count = 0;
+    const u32* entries = m_Service->GetFolderEntries(m_CurrentPath, &count);
+    if (entries == nullptr || visibleIndex >= count)
+        return (size_t)-1;
+    return entries[visibleIndex];
 }
 
 // Returns the display name for the given visible index
@@ -26,10 +26,19 @@
 #include <circle/string.h>
 #include <circle/synchronize.h>
 #include <circle/util.h>
+#include <ioscheduler/ioscheduler.h>
 
 static const char FromFileLogDaemon[] = "filelogd";
 LOGMODULE("filelogdaemon");
 
+// Buffered entries are written once this much has collected...
+#define LOG_FLUSH_BYTES 4096
+// ...or once the oldest has waited this long.
+#define LOG_FLUSH_INTERVAL_US 1000000
+// f_sync() rewrites the directory entry and the FAT, so it is the expensive
+// part; written data is committed at most this often.
+#define LOG_SYNC_INTERVAL_US 5000000
+
 CFileLogDaemon *CFileLogDaemon::s_pThis = nullptr;
 
 CFileLogDaemon::CFileLogDaemon(const char *pLogFilePath, unsigned uiLogLevel)
@@ -86,6 +95,7 @@ boolean CFileLogDaemon::Initialize() {
         return FALSE;
     }
     f_sync(&m_LogFile);
+    m_nLastSyncTicks = CTimer::Get()->GetClockTicks();
 
     // All good!
     LOGNOTE("Enhanced logger initialized successfully");
@@ -132,8 +142,10 @@ void CFileLogDaemon::GetStdioPath(char *pBuffer, size_t nBufferSize) const {
 CFileLogDaemon::~CFileLogDaemon(void) {
     s_pThis = nullptr;
 
-    if (m_bFileInitialized)
+    if (m_bFileInitialized) {
+        Flush();
         f_close(&m_LogFile);
+    }
 }
 
 void CFileLogDaemon::Run(void) {
@@ -147,7 +159,12 @@ void CFileLogDaemon::Run(void) {
     while (true) {
         m_Event.Clear();
         DrainOnce();
-        m_Event.Wait();
+        // Something still waits for its timer, so do not sleep past it.
+        if (m_nBuffered > 0 || m_bSyncPending) {
+            m_Event.WaitWithTimeout(LOG_FLUSH_INTERVAL_US);
+        } else {
+            m_Event.Wait();
+        }
     }
 }
 
@@ -169,30 +186,67 @@ void CFileLogDaemon::DrainOnce(void) {
             continue;
         }
 
-        const LogResult result =
-            LogMessage(Severity, Time, nHundredthTime, nTimeZone, Source, Message);
-
-        if (result == LogResult::Written) {
-            m_nConsecutiveWriteFailures = 0;
-            continue;
-        }
-        if (result != LogResult::WriteFailed) {
-            continue;
+        // A panic is the last thing this boot logs, so it cannot wait for a timer.
+        if (Severity == LogPanic) {
+            m_bFlushRequested = TRUE;
         }
 
-        // Back off for a busy card, but a full one fails every write, and 20 ms
-        // per event starves the scheduler exactly as the no-file case used to.
-        if (++m_nConsecutiveWriteFailures >= MaxConsecutiveWriteFailures) {
-            if (!m_bWritesGaveUp) {
-                m_bWritesGaveUp = TRUE;
-                m_bFileInitialized = FALSE;
-                f_close(&m_LogFile);
-            }
-            continue;
+        NoteWriteResult(
+            LogMessage(Severity, Time, nHundredthTime, nTimeZone, Source, Message));
+    }
+
+    NoteWriteResult(FlushIfDue());
+}
+
+boolean CFileLogDaemon::Flush(void) {
+    if (!m_bFileInitialized || m_bWriting) {
+        return FALSE;
+    }
+
+    return WriteBuffered(m_nBuffered) == LogResult::Written && Sync() == LogResult::Written;
+}
+
+boolean CFileLogDaemon::RequestFlush(unsigned nWaitMs) {
+    if (!m_bFileInitialized) {
+        return FALSE;
+    }
+
+    // As the panic handler does: the daemon task is the only writer
+    const unsigned nDone = m_nRequestedFlushes;
+    m_bFlushRequested = TRUE;
+    m_Event.Set();
+    for (unsigned nWaited = 0; m_nRequestedFlushes == nDone; nWaited += 10) {
+        if (nWaited >= nWaitMs) {
+            return FALSE;
         }
+        CScheduler::Get()->MsSleep(10);
+    }
+    return TRUE;
+}
 
-        CScheduler::Get()->Sleep(20);
+void CFileLogDaemon::NoteWriteResult(LogResult Result) {
+    if (Result == LogResult::Written) {
+        m_nConsecutiveWriteFailures = 0;
+        return;
+    }
+    if (Result != LogResult::WriteFailed) {
+        return;  // nothing was asked of the card
     }
+
+    // Back off for a busy card, but a full one fails every write, and 20 ms
+    // per attempt starves the scheduler exactly as the no-file case used to.
+    if (++m_nConsecutiveWriteFailures >= MaxConsecutiveWriteFailures) {
+        if (!m_bWritesGaveUp) {
+            m_bWritesGaveUp = TRUE;
+            m_bFileInitialized = FALSE;
+            m_nBuffered = 0;
+            m_bSyncPending = FALSE;
+            f_close(&m_LogFile);
+        }
+        return;
+    }
+
+    CScheduler::Get()->Sleep(20);
 }
 
 CFileLogDaemon::LogResult CFileLogDaemon::LogMessage(TLogSeverity Severity,
@@ -232,29 +286,126 @@ CFileLogDaemon::LogResult CFileLogDaemon::LogMessage(TLogSeverity Severity,
     snprintf(LogEntry, sizeof(LogEntry), "[%lu] [%s] %s: %s\n",
              FullTime, pAppName, pSeverityName, pMsg);
 
-    // Write to file. A short write means a full card, which f_write reports as
-    // success, and an unchecked f_sync would then call the lost entry written.
-    const UINT EntryLength = strlen(LogEntry);
-    UINT BytesWritten;
-    FRESULT Result = f_write(&m_LogFile, LogEntry, EntryLength, &BytesWritten);
-    if (Result != FR_OK || BytesWritten != EntryLength) {
-        // Not logged: this runs while draining the log queue, so a message here
-        // would queue another event that fails the same way.
-        return LogResult::WriteFailed;
+    unsigned nEntryLength = strlen(LogEntry);
+
+    // Make room by writing out what is there. If the card will not take it
+    // the entry is lost, as it always was when a write failed.
+    LogResult Result = LogResult::Buffered;
+    if (m_nBuffered + nEntryLength > LogBufferSize) {
+        Result = WriteBuffered(m_nBuffered);
+        if (m_nBuffered + nEntryLength > LogBufferSize) {
+            return LogResult::WriteFailed;
+        }
+    }
+
+    if (m_nBuffered == 0) {
+        m_nBufferedSinceTicks = CTimer::Get()->GetClockTicks();
+    }
+    memcpy(m_Buffer + m_nBuffered, LogEntry, nEntryLength);
+    m_nBuffered += nEntryLength;
+
+    return Result;
+}
+
+CFileLogDaemon::LogResult CFileLogDaemon::FlushIfDue(void) {
+    if (!m_bFileInitialized) {
+        return LogResult::NoFile;
+    }
+
+    if (m_bFlushRequested) {
+        m_bFlushRequested = FALSE;
+        const boolean bFlushed = Flush();
+        m_nRequestedFlushes = m_nRequestedFlushes + 1;
+        return bFlushed ? LogResult::Written : LogResult::WriteFailed;
+    }
+
+    const unsigned nNow = CTimer::Get()->GetClockTicks();
+    LogResult Result = LogResult::Buffered;
+    if (m_nBuffered > 0 && nNow - m_nBufferedSinceTicks >= LOG_FLUSH_INTERVAL_US) {
+        // Too old to wait for the sector to fill
+        Result = WriteBuffered(m_nBuffered);
+    } else if (m_nBuffered >= LOG_FLUSH_BYTES) {
+        // Whole sectors only; the tail waits for more to join it.
+        Result = WriteBuffered(GetSectorAlignedLength());
+    }
+
+    if (Result != LogResult::WriteFailed && m_bSyncPending
+        && nNow - m_nLastSyncTicks >= LOG_SYNC_INTERVAL_US) {
+        Result = Sync();
+    }
+
+    return Result;
+}
+
+// A short write means a full card, which f_write reports as success. What did
+// not land stays buffered for the next attempt.
+CFileLogDaemon::LogResult CFileLogDaemon::WriteBuffered(unsigned nBytes) {
+    assert(nBytes <= m_nBuffered);
+    if (nBytes == 0) {
+        return LogResult::Written;
+    }
+    if (m_bWriting) {
+        return LogResult::Buffered;
+    }
+
+    UINT nWritten = 0;
+    m_bWriting = TRUE;
+    FRESULT Result = CIOScheduler::Get()->Write(IOClassLog, &m_LogFile, m_Buffer, nBytes, &nWritten);
+    m_bWriting = FALSE;
+    if (nWritten > 0) {
+        m_nBuffered -= nWritten;
+        memmove(m_Buffer, m_Buffer + nWritten, m_nBuffered);
+        m_nBufferedSinceTicks = CTimer::Get()->GetClockTicks();
+        m_bSyncPending = TRUE;
     }
 
-    if (f_sync(&m_LogFile) != FR_OK) {
+    // Not logged: this runs while draining the log queue, so a message here
+    // would queue another event that fails the same way.
+    return Result == FR_OK && nWritten == nBytes ? LogResult::Written : LogResult::WriteFailed;
+}
+
+// f_write() can take every byte and the data still be lost if this fails, so
+// it is checked like a write.
+CFileLogDaemon::LogResult CFileLogDaemon::Sync(void) {
+    if (!m_bSyncPending) {
+        return LogResult::Written;
+    }
+    if (m_bWriting) {
+        return LogResult::Buffered;
+    }
+
+    m_bWriting = TRUE;
+    const FRESULT Result = f_sync(&m_LogFile);
+    m_bWriting = FALSE;
+    if (Result != FR_OK) {
         return LogResult::WriteFailed;
     }
 
+    m_bSyncPending = FALSE;
+    m_nLastSyncTicks = CTimer::Get()->GetClockTicks();
     return LogResult::Written;
 }
 
+unsigned CFileLogDaemon::GetSectorAlignedLength(void) const {
+    const unsigned nOffset = (unsigned)(f_tell(&m_LogFile) % LogSectorSize);
+    const unsigned nHead = nOffset == 0 ? 0 : LogSectorSize - nOffset;
+    if (m_nBuffered < nHead) {
+        return 0;
+    }
+
+    return nHead + (m_nBuffered - nHead) / LogSectorSize * LogSectorSize;
+}
+
 void CFileLogDaemon::EventNotificationHandler(void) {
     s_pThis->m_Event.Set();
 }
 
 void CFileLogDaemon::PanicHandler(void) {
+    // The panic event is already queued; the daemon writes it and syncs as
+    // soon as it runs, which the sleep below gives it the chance to do.
+    s_pThis->m_bFlushRequested = TRUE;
+    s_pThis->m_Event.Set();
+
     EnableIRQs();  // may be called on IRQ_LEVEL, where we cannot sleep
 
     CScheduler::Get()->Sleep(5);
@@ -45,6 +45,15 @@ class CFileLogDaemon : public CTask {
     // One pass of Run()'s loop, split out so it can be tested; Run() never returns.
     void DrainOnce(void);
 
+    // Writes out and syncs whatever is buffered, so a reader of the file sees
+    // every line logged so far. Does not back off on failure. While a write
+    // is under way (it can yield) this writes nothing and returns FALSE.
+    boolean Flush(void);
+
+    // For other tasks: has the daemon flush, and waits up to nWaitMs for it
+    // to finish. FALSE if it did not in that time.
+    boolean RequestFlush(unsigned nWaitMs);
+
     // The constructor cannot report a failed open, so callers ask afterwards.
     boolean IsFileLogging(void) const { return m_bFileInitialized; }
     const char *GetLogFilePath(void) const { return m_LogFilePath; }
@@ -67,14 +76,28 @@ class CFileLogDaemon : public CTask {
     enum class LogResult
     {
         Written,
+        Buffered,     // kept in memory for a later write: says nothing about the card
         WriteFailed,  // transient: the file is open, this write did not land
         NoFile        // permanent for this boot: there is nothing to write to
     };
 
+    // Formats one entry into the buffer, writing the buffer out first if the
+    // entry does not fit.
     LogResult LogMessage(TLogSeverity Severity,
                          time_t FullTime, unsigned nPartialTime, int nTimeNumOffset,
                          const char *pAppName, const char *pMsg);
 
+    // Writes when the buffer holds enough or has held it too long, and syncs
+    // when the last sync is old enough.
+    LogResult FlushIfDue(void);
+    // Writes the first nBytes of the buffer and keeps the rest.
+    LogResult WriteBuffered(unsigned nBytes);
+    LogResult Sync(void);
+    // How much of the buffer ends on a sector boundary of the file.
+    unsigned GetSectorAlignedLength(void) const;
+    // Counts failures, backs off and finally gives up on the file.
+    void NoteWriteResult(LogResult Result);
+
     static void EventNotificationHandler(void);
     static void PanicHandler(void);
 
@@ -93,6 +116,23 @@ class CFileLogDaemon : public CTask {
     static const unsigned MaxConsecutiveWriteFailures = 8;
     boolean m_bWritesGaveUp = FALSE;
 
+    // Entries collect here and go to the card in sector-sized writes rather
+    // than one small write and sync each, which costs the host its read
+    // throughput exactly when debug logging is on.
+    static const unsigned LogBufferSize = 16384;
+    static const unsigned LogSectorSize = 512;
+    char m_Buffer[LogBufferSize];
+    unsigned m_nBuffered = 0;
+    unsigned m_nBufferedSinceTicks = 0;  // when the oldest buffered byte arrived
+    boolean m_bSyncPending = FALSE;      // written, but not yet f_sync()ed
+    unsigned m_nLastSyncTicks = 0;
+    // Set by the panic handler: write and sync now, whatever the timers say.
+    volatile boolean m_bFlushRequested = FALSE;
+    volatile unsigned m_nRequestedFlushes = 0;  // done since boot
+    // A write or sync is in the I/O scheduler, which can yield: the buffer
+    // and the file belong to it until it returns.
+    boolean m_bWriting = FALSE;
+
     FIL m_LogFile;
 };
 
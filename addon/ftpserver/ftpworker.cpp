@@ -30,7 +30,9 @@
 #include <gitinfo/gitinfo.h>
 #include <scsitbservice/scsitbservice.h>
 #include <discimage/util.h>
+#include <ioscheduler/ioscheduler.h>
 #include "ftpworker.h"
+#include "readahead.h"
 #include "utility.h"
 
 // Use a per-instance name for the log macros
@@ -53,7 +55,7 @@ enum class TDirectoryListEntryType {
 struct TDirectoryListEntry {
     char Name[FF_LFN_BUF + 1];
     TDirectoryListEntryType Type;
-    u32 nSize;
+    u64 nSize;
     u16 nLastModifedDate;
     u16 nLastModifedTime;
 };
@@ -75,6 +77,7 @@ const TFTPCommand CFTPWorker::Commands[] =
         {"PORT", &CFTPWorker::Port},
         {"RETR", &CFTPWorker::Retrieve},
         {"STOR", &CFTPWorker::Store},
+        {"ALLO", &CFTPWorker::Allocate},
         {"DELE", &CFTPWorker::Delete},
         {"RMD", &CFTPWorker::Delete},
         {"MKD", &CFTPWorker::MakeDirectory},
@@ -88,11 +91,38 @@ const TFTPCommand CFTPWorker::Commands[] =
         {"BYE", &CFTPWorker::Bye},
         {"QUIT", &CFTPWorker::Bye},
         {"NOOP", &CFTPWorker::NoOp},
+        {"FEAT", &CFTPWorker::Features},
+        {"REST", &CFTPWorker::Restart},
+        {"SIZE", &CFTPWorker::FileSize},
+        {"MDTM", &CFTPWorker::ModificationTime},
+        {"MLSD", &CFTPWorker::MachineListDirectory},
+        {"MLST", &CFTPWorker::MachineListEntry},
 };
 
 u8 CFTPWorker::s_nInstanceCount = 0;
 u8 CFTPWorker::s_nSlotsInUse = 0;
 
+// Listings of image volume directories, shared by all sessions: clients list
+// a folder every time they enter it. One holds while the library and what
+// FTP itself changed on the card are as they were, and for ListingCacheSecs
+// at most, which bounds how long another writer (a web upload under way)
+// can leave it out of date.
+constexpr size_t ListingCacheSlots = 4;
+constexpr unsigned ListingCacheSecs = 30;
+
+struct TCachedListing {
+    CString Path;
+    TDirectoryListEntry* pEntries;
+    size_t nEntries;
+    u32 nLibraryGeneration;
+    u32 nChangeCount;
+    unsigned nReadTicks;
+};
+
+static TCachedListing s_ListingCache[ListingCacheSlots];
+static size_t s_nNextListingSlot = 0;
+static u32 s_nListingChanges = 0;  // goes up with every change FTP makes
+
 // Volume names from ffconf.h
 // TODO: Share with soundfontmanager.cpp
 const char* const VolumeNames[] = {FF_VOLUME_STRS};
@@ -132,7 +162,9 @@ CFTPWorker::CFTPWorker(CSocket* pControlSocket, const char* pExpectedUser, const
       m_DataType(TDataType::ASCII),
       m_TransferMode(TTransferMode::Active),
       m_CurrentPath("1:"),
-      m_RenameFrom() {
+      m_RenameFrom(),
+      m_nAllocateHint(0),
+      m_nRestartOffset(0) {
     ++s_nInstanceCount;
 
     // Claim the lowest free session slot; it determines the passive-mode
@@ -360,6 +392,17 @@ bool CFTPWorker::SendStatus(TFTPStatus StatusCode, const char* pMessage, bool mu
     return true;
 }
 
+bool CFTPWorker::SendText(const char* pText) {
+    assert(m_pControlSocket != nullptr);
+
+    if (m_pControlSocket->Send(pText, strlen(pText), 0) < 0) {
+        LOGERR("Failed to send reply");
+        return false;
+    }
+
+    return true;
+}
+
 bool CFTPWorker::CheckLoggedIn() {
 #ifdef FTPDAEMON_DEBUG
     LOGDBG("Username compare: expected '%s', actual '%s'", static_cast<const char*>(m_pExpectedUser), static_cast<const char*>(m_User));
@@ -395,7 +438,51 @@ CString CFTPWorker::RealPath(const char* pInBuffer) const {
     return Path;
 }
 
-const TDirectoryListEntry* CFTPWorker::BuildDirectoryList(size_t& nOutEntries) const {
+const TDirectoryListEntry* CFTPWorker::BuildDirectoryList(const char* pPath, size_t& nOutEntries) const {
+    if (strncmp(pPath, "1:", 2) != 0)
+        return ReadDirectory(pPath, nOutEntries);
+
+    SCSITBService* svc = static_cast<SCSITBService*>(CScheduler::Get()->GetTask("scsitbservice"));
+    const u32 nGeneration = svc ? svc->GetGeneration() : 0;
+    const unsigned nNow = CTimer::Get()->GetTicks();
+
+    TCachedListing* pSlot = nullptr;
+    for (TCachedListing& Listing : s_ListingCache) {
+        if (Listing.pEntries != nullptr && Listing.Path.Compare(pPath) == 0) {
+            pSlot = &Listing;
+            break;
+        }
+    }
+
+    if (pSlot && pSlot->nLibraryGeneration == nGeneration && pSlot->nChangeCount == s_nListingChanges
+        && nNow - pSlot->nReadTicks < ListingCacheSecs * HZ) {
+        TDirectoryListEntry* pEntries = new TDirectoryListEntry[pSlot->nEntries];
+        memcpy(pEntries, pSlot->pEntries, pSlot->nEntries * sizeof(TDirectoryListEntry));
+        nOutEntries = pSlot->nEntries;
+        return pEntries;
+    }
+
+    const TDirectoryListEntry* pEntries = ReadDirectory(pPath, nOutEntries);
+    if (pEntries == nullptr)
+        return nullptr;
+
+    if (pSlot == nullptr) {
+        pSlot = &s_ListingCache[s_nNextListingSlot];
+        s_nNextListingSlot = (s_nNextListingSlot + 1) % ListingCacheSlots;
+    }
+    delete[] pSlot->pEntries;
+    pSlot->Path = pPath;
+    pSlot->pEntries = new TDirectoryListEntry[nOutEntries];
+    memcpy(pSlot->pEntries, pEntries, nOutEntries * sizeof(TDirectoryListEntry));
+    pSlot->nEntries = nOutEntries;
+    pSlot->nLibraryGeneration = nGeneration;
+    pSlot->nChangeCount = s_nListingChanges;
+    pSlot->nReadTicks = nNow;
+
+    return pEntries;
+}
+
+const TDirectoryListEntry* CFTPWorker::ReadDirectory(const char* pPath, size_t& nOutEntries) const {
     DIR Dir;
     FILINFO FileInfo;
     FRESULT Result;
@@ -404,7 +491,7 @@ const TDirectoryListEntry* CFTPWorker::BuildDirectoryList(size_t& nOutEntries) c
     nOutEntries = 0;
 
     // Volume list
-    if (m_CurrentPath.GetLength() == 0) {
+    if (pPath[0] == '\0') {
         constexpr size_t nVolumes = Utility::ArraySize(VolumeNames);
         bool VolumesAvailable[nVolumes] = {false};
 
@@ -441,7 +528,7 @@ const TDirectoryListEntry* CFTPWorker::BuildDirectoryList(size_t& nOutEntries) c
     }
 
     // Directory list
-    Result = f_findfirst(&Dir, &FileInfo, m_CurrentPath, "*");
+    Result = f_findfirst(&Dir, &FileInfo, pPath, "*");
     if (Result == FR_OK && *FileInfo.fname) {
         // Count how many entries we need
         do {
@@ -453,7 +540,7 @@ const TDirectoryListEntry* CFTPWorker::BuildDirectoryList(size_t& nOutEntries) c
 
         if (nOutEntries && (pEntries = new TDirectoryListEntry[nOutEntries])) {
             size_t nCurrentEntry = 0;
-            Result = f_findfirst(&Dir, &FileInfo, m_CurrentPath, "*");
+            Result = f_findfirst(&Dir, &FileInfo, pPath, "*");
             while (Result == FR_OK && *FileInfo.fname) {
                 TDirectoryListEntry& Entry = pEntries[nCurrentEntry++];
                 strncpy(Entry.Name, FileInfo.fname, sizeof(Entry.Name));
@@ -647,6 +734,10 @@ bool CFTPWorker::Retrieve(const char* pArgs) {
     if (!CheckLoggedIn())
         return false;
 
+    // A REST before this resumes a download that broke off
+    const u64 nOffset = m_nRestartOffset;
+    m_nRestartOffset = 0;
+
     FIL File;
     CString Path = RealPath(pArgs);
     if (f_open(&File, Path, FA_READ) != FR_OK) {
@@ -657,6 +748,13 @@ bool CFTPWorker::Retrieve(const char* pArgs) {
     // NEW: Enable Fast Seek for download
     DWORD* pCLMT = nullptr;
     FatFsOptimizer::EnableFastSeek(&File, &pCLMT, 256, "FTP Download: ");
+
+    if (nOffset > f_size(&File) || (nOffset > 0 && f_lseek(&File, nOffset) != FR_OK)) {
+        FatFsOptimizer::DisableFastSeek(&pCLMT);
+        f_close(&File);
+        SendStatus(TFTPStatus::InvalidRestartPosition, "Invalid REST parameter.");
+        return false;
+    }
     
     if (!SendStatus(TFTPStatus::FileStatusOk, "Command OK."))
         return false;
@@ -665,24 +763,28 @@ bool CFTPWorker::Retrieve(const char* pArgs) {
     if (pDataSocket == nullptr)
         return false;
 
-    size_t nSize = f_size(&File);
-    size_t nSent = 0;
-
-    while (nSent < nSize) {
-        UINT nBytesRead;
+    // The next buffer is read while the one before is being sent
+    CReadAhead ReadAhead(&File);
+    bool bSuccess = ReadAhead.Start();
+    while (bSuccess) {
+        unsigned nLength;
+        const u8* pData = ReadAhead.GetNext(&nLength);
+        if (pData == nullptr)
+            break;
 #ifdef FTPDAEMON_DEBUG
         LOGDBG("Sending data");
 #endif
-        if (f_read(&File, m_DataBuffer, NETWORK_BUFFER_SIZE, &nBytesRead) != FR_OK || pDataSocket->Send(m_DataBuffer, nBytesRead, 0) < 0) {
-            delete pDataSocket;
-            FatFsOptimizer::DisableFastSeek(&pCLMT);  // NEW: Cleanup on error
-            f_close(&File);
-            SendStatus(TFTPStatus::ActionAborted, "File action aborted, local error.");
-            return false;
-        }
+        bSuccess = pDataSocket->Send(pData, nLength, 0) >= 0;
+        ReadAhead.Release();
+    }
+    ReadAhead.Stop();
 
-        nSent += nBytesRead;
-        assert(nSent <= nSize);
+    if (!bSuccess || ReadAhead.GetResult() != FR_OK) {
+        delete pDataSocket;
+        FatFsOptimizer::DisableFastSeek(&pCLMT);  // NEW: Cleanup on error
+        f_close(&File);
+        SendStatus(TFTPStatus::ActionAborted, "File action aborted, local error.");
+        return false;
     }
 
     // Clean up data socket
@@ -702,29 +804,69 @@ bool CFTPWorker::Retrieve(const char* pArgs) {
     return true;
 }
 
+// Trims a stored file to the nLength bytes written and closes it. One whose
+// reservation cannot be given back is removed: closed as it is, its
+// directory entry would claim the reserved clusters as data.
+static bool CloseStoredFile(FIL* pFile, const char* pPath, u64 nLength) {
+    const bool bTrimmed = FatFsOptimizer::TrimToLength(pFile, nLength) == FR_OK;
+    const bool bClosed = f_close(pFile) == FR_OK;
+    if (!bTrimmed)
+        f_unlink(pPath);
+    return bTrimmed && bClosed;
+}
+
 bool CFTPWorker::Store(const char* pArgs) {
     if (!CheckLoggedIn())
         return false;
 
+    // A REST before this resumes an upload that broke off: the file is kept
+    // up to there and written on from that point
+    const u64 nOffset = m_nRestartOffset;
+    m_nRestartOffset = 0;
+    // A size from ALLO lets the whole image go down in one run of clusters
+    u64 nExpectedSize = m_nAllocateHint;
+    m_nAllocateHint = 0;
+
     FIL File;
     CString Path = RealPath(pArgs);
-    if (f_open(&File, Path, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) {
+    const BYTE nMode = nOffset > 0 ? FA_OPEN_EXISTING | FA_WRITE : FA_CREATE_ALWAYS | FA_WRITE;
+    if (f_open(&File, Path, nMode) != FR_OK) {
         SendStatus(TFTPStatus::FileActionNotTaken, "Could not open file for writing.");
         return false;
     }
 
+    // The directory entry goes to the card now, with the size the data has.
+    // It is not synced again until the reservation is trimmed off, so after
+    // a reboot mid-transfer SIZE and REST still see only real data.
     f_sync(&File);
-    if (!SendStatus(TFTPStatus::FileStatusOk, "Command OK."))
+
+    if (nOffset > 0) {
+        if (nOffset > f_size(&File) || f_lseek(&File, nOffset) != FR_OK) {
+            f_close(&File);
+            SendStatus(TFTPStatus::InvalidRestartPosition, "Invalid REST parameter.");
+            return false;
+        }
+    } else
+        FatFsOptimizer::Preallocate(&File, nExpectedSize, "FTP: ");
+
+    // No data is coming: give back the reservation, so the file does not
+    // look like a complete image of stale clusters to a listing or SIZE
+    if (!SendStatus(TFTPStatus::FileStatusOk, "Command OK.")) {
+        CloseStoredFile(&File, Path, nOffset);
         return false;
+    }
 
     CSocket* pDataSocket = OpenDataConnection();
-    if (pDataSocket == nullptr)
+    if (pDataSocket == nullptr) {
+        CloseStoredFile(&File, Path, nOffset);
         return false;
+    }
 
     bool bSuccess = true;
     CTimer* const pTimer = CTimer::Get();
     unsigned int nTimeout = pTimer->GetTicks();
     unsigned int WriteBufferUsed = 0;
+    u64 nTotalWritten = nOffset;    // the file up to here is wanted
 
     while (true) {
 #ifdef FTPDAEMON_DEBUG
@@ -765,11 +907,13 @@ bool CFTPWorker::Store(const char* pArgs) {
             remaining -= toCopy;
 
             if (WriteBufferUsed == WRITE_BUFFER_SIZE) {
-                if ((nWriteResult = f_write(&File, WriteBuffer, WRITE_BUFFER_SIZE, &nWritten)) != FR_OK) {
+                FatFsOptimizer::ReserveExtent(&File, nTotalWritten + WRITE_BUFFER_SIZE, nExpectedSize);
+                if ((nWriteResult = CIOScheduler::Get()->Write(IOClassUpload, &File, WriteBuffer, WRITE_BUFFER_SIZE, &nWritten)) != FR_OK) {
                     LOGERR("Buffered write FAILED, return code %d", nWriteResult);
                     bSuccess = false;
                     break;
                 }
+                nTotalWritten += nWritten;
                 WriteBufferUsed = 0;
                 CScheduler::Get()->Yield();
             }
@@ -784,14 +928,20 @@ bool CFTPWorker::Store(const char* pArgs) {
     // flush any remaining data
     if (WriteBufferUsed > 0) {
         UINT nWritten;
-        FRESULT nWriteResult = f_write(&File, WriteBuffer, WriteBufferUsed, &nWritten);
+        FatFsOptimizer::ReserveExtent(&File, nTotalWritten + WriteBufferUsed, nExpectedSize);
+        FRESULT nWriteResult = CIOScheduler::Get()->Write(IOClassUpload, &File, WriteBuffer, WriteBufferUsed, &nWritten);
         if (nWriteResult != FR_OK) {
             LOGERR("Final buffered write FAILED, return code %d", nWriteResult);
             bSuccess = false;
         }
+        nTotalWritten += nWritten;
     }
 
-    f_sync(&File);
+    // Drop whatever was reserved beyond the data
+    if (!CloseStoredFile(&File, Path, nTotalWritten)) {
+        LOGERR("Could not trim file to %llu bytes", (unsigned long long)nTotalWritten);
+        bSuccess = false;
+    }
 
     if (bSuccess)
         SendStatus(TFTPStatus::TransferComplete, "Transfer complete.");
@@ -814,11 +964,11 @@ bool CFTPWorker::Store(const char* pArgs) {
         m_pDataSocket = nullptr;
     }
 
-    f_close(&File);
+    ++s_nListingChanges;
 
     SCSITBService* svc = static_cast<SCSITBService*>(CScheduler::Get()->GetTask("scsitbservice"));
     if (svc != nullptr)
-        svc->RefreshCache();
+        svc->AddEntry(Path);
 
     return true;
 }
@@ -833,11 +983,13 @@ bool CFTPWorker::Delete(const char* pArgs) {
         SendStatus(TFTPStatus::FileActionNotTaken, "File was not deleted.");
 	LOGERR("Couldn't delete %s", pArgs);
     }
-    else
+    else {
         SendStatus(TFTPStatus::FileActionOk, "File deleted.");
+        ++s_nListingChanges;
 
-    SCSITBService* svc = static_cast<SCSITBService*>(CScheduler::Get()->GetTask("scsitbservice"));
-    svc->RefreshCache();
+        SCSITBService* svc = static_cast<SCSITBService*>(CScheduler::Get()->GetTask("scsitbservice"));
+        svc->RemoveEntry(Path);
+    }
 
     return true;
 }
@@ -855,6 +1007,10 @@ bool CFTPWorker::MakeDirectory(const char* pArgs) {
         FatFsPathToFTPPath(Path, Buffer, sizeof(Buffer));
         strcat(Buffer, " directory created.");
         SendStatus(TFTPStatus::PathCreated, Buffer);
+        ++s_nListingChanges;
+
+        SCSITBService* svc = static_cast<SCSITBService*>(CScheduler::Get()->GetTask("scsitbservice"));
+        svc->AddEntry(Path);
     }
 
     return true;
@@ -984,7 +1140,7 @@ bool CFTPWorker::List(const char* pArgs) {
     char Time[8];
 
     size_t nEntries;
-    const TDirectoryListEntry* pDirEntries = BuildDirectoryList(nEntries);
+    const TDirectoryListEntry* pDirEntries = BuildDirectoryList(m_CurrentPath, nEntries);
 
     if (pDirEntries) {
         for (size_t i = 0; i < nEntries; ++i) {
@@ -998,7 +1154,8 @@ bool CFTPWorker::List(const char* pArgs) {
             if (Entry.Type == TDirectoryListEntryType::Directory)
                 nLength = snprintf(Buffer, sizeof(Buffer), "%-9s %-13s %-14s %s\r\n", Date, Time, "<DIR>", Entry.Name);
             else
-                nLength = snprintf(Buffer, sizeof(Buffer), "%-9s %-13s %14d %s\r\n", Date, Time, Entry.nSize, Entry.Name);
+                nLength = snprintf(Buffer, sizeof(Buffer), "%-9s %-13s %14llu %s\r\n", Date, Time,
+                                   (unsigned long long)Entry.nSize, Entry.Name);
 
             if (pDataSocket->Send(Buffer, nLength, 0) < 0) {
                 delete[] pDirEntries;
@@ -1037,7 +1194,7 @@ bool CFTPWorker::ListFileNames(const char* pArgs) {
 
     char Buffer[TextBufferSize];
     size_t nEntries;
-    const TDirectoryListEntry* pDirEntries = BuildDirectoryList(nEntries);
+    const TDirectoryListEntry* pDirEntries = BuildDirectoryList(m_CurrentPath, nEntries);
 
     if (pDirEntries) {
         for (size_t i = 0; i < nEntries; ++i) {
@@ -1094,13 +1251,15 @@ bool CFTPWorker::RenameTo(const char* pArgs) {
 
     if (f_rename(SourcePath, DestPath) != FR_OK)
         SendStatus(TFTPStatus::FileNameNotAllowed, "File name not allowed.");
-    else
+    else {
         SendStatus(TFTPStatus::FileActionOk, "File renamed.");
+        ++s_nListingChanges;
 
-    m_RenameFrom = "";
+        SCSITBService* svc = static_cast<SCSITBService*>(CScheduler::Get()->GetTask("scsitbservice"));
+        svc->RenameEntry(SourcePath, DestPath);
+    }
 
-    SCSITBService* svc = static_cast<SCSITBService*>(CScheduler::Get()->GetTask("scsitbservice"));
-    svc->RefreshCache();
+    m_RenameFrom = "";
 
     return true;
 }
@@ -1112,6 +1271,183 @@ bool CFTPWorker::Bye(const char* pArgs) {
     return true;
 }
 
+bool CFTPWorker::Allocate(const char* pArgs) {
+    if (!CheckLoggedIn())
+        return false;
+
+    // Only a hint for the next STOR; an unparsable size just means none
+    char* pEnd = nullptr;
+    unsigned long long nSize = strtoull(pArgs, &pEnd, 10);
+    m_nAllocateHint = (pEnd != pArgs) ? nSize : 0;
+    SendStatus(TFTPStatus::Success, "Command OK.");
+
+    return true;
+}
+
+bool CFTPWorker::Features(const char* pArgs) {
+    return SendText("211-Features:\r\n"
+                    " MDTM\r\n"
+                    " MLST type*;size*;modify*;\r\n"
+                    " REST STREAM\r\n"
+                    " SIZE\r\n"
+                    "211 End\r\n");
+}
+
+bool CFTPWorker::Restart(const char* pArgs) {
+    if (!CheckLoggedIn())
+        return false;
+
+    char* pEnd = nullptr;
+    const unsigned long long nOffset = strtoull(pArgs, &pEnd, 10);
+    if (pEnd == pArgs) {
+        SendStatus(TFTPStatus::SyntaxError, "Syntax error in parameters or arguments.");
+        return false;
+    }
+
+    // Checked against the file by the RETR or STOR that follows
+    m_nRestartOffset = nOffset;
+
+    char Buffer[TextBufferSize];
+    snprintf(Buffer, sizeof(Buffer), "Restarting at %llu. Send STORE or RETRIEVE to initiate transfer.", nOffset);
+    SendStatus(TFTPStatus::PendingFurtherInfo, Buffer);
+
+    return true;
+}
+
+bool CFTPWorker::FileSize(const char* pArgs) {
+    if (!CheckLoggedIn())
+        return false;
+
+    FILINFO FileInfo;
+    CString Path = RealPath(pArgs);
+    if (f_stat(Path, &FileInfo) != FR_OK || (FileInfo.fattrib & AM_DIR)) {
+        SendStatus(TFTPStatus::FileNotFound, "Could not get file size.");
+        return false;
+    }
+
+    char Buffer[TextBufferSize];
+    snprintf(Buffer, sizeof(Buffer), "%llu", (unsigned long long)FileInfo.fsize);
+    SendStatus(TFTPStatus::FileStatus, Buffer);
+
+    return true;
+}
+
+bool CFTPWorker::ModificationTime(const char* pArgs) {
+    if (!CheckLoggedIn())
+        return false;
+
+    FILINFO FileInfo;
+    CString Path = RealPath(pArgs);
+    if (f_stat(Path, &FileInfo) != FR_OK) {
+        SendStatus(TFTPStatus::FileNotFound, "Could not get file modification time.");
+        return false;
+    }
+
+    char Buffer[16];
+    FormatMachineTime(FileInfo.fdate, FileInfo.ftime, Buffer, sizeof(Buffer));
+    SendStatus(TFTPStatus::FileStatus, Buffer);
+
+    return true;
+}
+
+bool CFTPWorker::MachineListDirectory(const char* pArgs) {
+    if (!CheckLoggedIn())
+        return false;
+
+    CString Path = pArgs[0] != '\0' ? RealPath(pArgs) : m_CurrentPath;
+    DIR Dir;
+    if (Path.GetLength() > 0) {
+        if (f_opendir(&Dir, Path) != FR_OK) {
+            SendStatus(TFTPStatus::FileNotFound, "Directory not found.");
+            return false;
+        }
+        f_closedir(&Dir);
+    }
+
+    if (!SendStatus(TFTPStatus::FileStatusOk, "Command OK."))
+        return false;
+
+    CSocket* pDataSocket = OpenDataConnection();
+    if (pDataSocket == nullptr)
+        return false;
+
+    size_t nEntries;
+    const TDirectoryListEntry* pDirEntries = BuildDirectoryList(Path, nEntries);
+
+    // Many entries to a send rather than one
+    bool bSuccess = true;
+    size_t nUsed = 0;
+    for (size_t i = 0; i < nEntries && bSuccess; ++i) {
+        const TDirectoryListEntry& Entry = pDirEntries[i];
+        char Buffer[TextBufferSize];
+        int nLength = FormatFacts(Entry, Buffer, sizeof(Buffer));
+        nLength += snprintf(Buffer + nLength, sizeof(Buffer) - nLength, " %s\r\n", Entry.Name);
+
+        if (nUsed + nLength > NETWORK_BUFFER_SIZE) {
+            bSuccess = pDataSocket->Send(m_DataBuffer, nUsed, 0) >= 0;
+            nUsed = 0;
+        }
+        memcpy(m_DataBuffer + nUsed, Buffer, nLength);
+        nUsed += nLength;
+    }
+    if (bSuccess && nUsed > 0)
+        bSuccess = pDataSocket->Send(m_DataBuffer, nUsed, 0) >= 0;
+
+    delete[] pDirEntries;
+
+    // Clean up data socket
+    delete pDataSocket;
+
+    // Clean up passive listening socket
+    if (m_TransferMode == TTransferMode::Passive && m_pDataSocket != nullptr) {
+        delete m_pDataSocket;
+        m_pDataSocket = nullptr;
+    }
+
+    if (!bSuccess) {
+        SendStatus(TFTPStatus::DataConnectionFailed, "Transfer error.");
+        return false;
+    }
+
+    SendStatus(TFTPStatus::TransferComplete, "Transfer complete.");
+    return true;
+}
+
+bool CFTPWorker::MachineListEntry(const char* pArgs) {
+    if (!CheckLoggedIn())
+        return false;
+
+    CString Path = pArgs[0] != '\0' ? RealPath(pArgs) : m_CurrentPath;
+
+    // A volume's root has no directory entry of its own
+    TDirectoryListEntry Entry;
+    memset(&Entry, 0, sizeof(Entry));
+    FILINFO FileInfo;
+    DIR Dir;
+    if (f_stat(Path, &FileInfo) == FR_OK) {
+        Entry.Type = (FileInfo.fattrib & AM_DIR) ? TDirectoryListEntryType::Directory : TDirectoryListEntryType::File;
+        Entry.nSize = (FileInfo.fattrib & AM_DIR) ? 0 : FileInfo.fsize;
+        Entry.nLastModifedDate = FileInfo.fdate;
+        Entry.nLastModifedTime = FileInfo.ftime;
+    } else if (Path.GetLength() == 0 || f_opendir(&Dir, Path) == FR_OK) {
+        if (Path.GetLength() > 0)
+            f_closedir(&Dir);
+        Entry.Type = TDirectoryListEntryType::Directory;
+    } else {
+        SendStatus(TFTPStatus::FileNotFound, "File not found.");
+        return false;
+    }
+
+    char FTPPath[TextBufferSize];
+    FatFsPathToFTPPath(Path, FTPPath, sizeof(FTPPath));
+    char Facts[TextBufferSize];
+    FormatFacts(Entry, Facts, sizeof(Facts));
+
+    char Buffer[TextBufferSize * 3];
+    snprintf(Buffer, sizeof(Buffer), "250-Listing %s\r\n %s %s\r\n250 End\r\n", FTPPath, Facts, FTPPath);
+    return SendText(Buffer);
+}
+
 bool CFTPWorker::NoOp(const char* pArgs) {
     SendStatus(TFTPStatus::Success, "Command OK.");
     return true;
@@ -1257,3 +1593,32 @@ void CFTPWorker::FormatLastModifiedTime(u16 nDate, char* pOutBuffer, size_t nSiz
 
     snprintf(pOutBuffer, nSize, "%02d:%02d%s", nHour, nMinute, pSuffix);
 }
+
+void CFTPWorker::FormatMachineTime(u16 nDate, u16 nTime, char* pOutBuffer, size_t nSize) {
+    const unsigned nYear = 1980 + (nDate >> 9);
+    const unsigned nMonth = (nDate >> 5) & 0x0F;
+    const unsigned nDay = nDate & 0x1F;
+    const unsigned nHour = (nTime >> 11) & 0x1F;
+    const unsigned nMinute = (nTime >> 5) & 0x3F;
+    const unsigned nSecond = (nTime & 0x1F) * 2;
+
+    snprintf(pOutBuffer, nSize, "%04u%02u%02u%02u%02u%02u", nYear, nMonth ? nMonth : 1, nDay ? nDay : 1,
+             nHour, nMinute, nSecond);
+}
+
+int CFTPWorker::FormatFacts(const TDirectoryListEntry& Entry, char* pOutBuffer, size_t nSize) {
+    int nLength;
+    if (Entry.Type == TDirectoryListEntryType::Directory)
+        nLength = snprintf(pOutBuffer, nSize, "type=dir;");
+    else
+        nLength = snprintf(pOutBuffer, nSize, "type=file;size=%llu;", (unsigned long long)Entry.nSize);
+
+    // Volumes have no date
+    if (Entry.nLastModifedDate != 0) {
+        char Time[16];
+        FormatMachineTime(Entry.nLastModifedDate, Entry.nLastModifedTime, Time, sizeof(Time));
+        nLength += snprintf(pOutBuffer + nLength, nSize - nLength, "modify=%s;", Time);
+    }
+
+    return nLength;
+}
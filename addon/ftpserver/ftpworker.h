@@ -39,6 +39,8 @@ enum TFTPStatus {
     FileStatusOk = 150,
 
     Success = 200,
+    SystemStatus = 211,
+    FileStatus = 213,
     SystemType = 215,
     ReadyForNewUser = 220,
     ClosingControl = 221,
@@ -64,6 +66,7 @@ enum TFTPStatus {
     NotLoggedIn = 530,
     FileNotFound = 550,
     FileNameNotAllowed = 553,
+    InvalidRestartPosition = 554,
 };
 
 enum class TTransferMode {
@@ -98,11 +101,17 @@ class CFTPWorker : protected CTask {
 
     bool SendStatus(TFTPStatus StatusCode, const char* pMessage, boolean multiline=false);
 
+    // Raw reply text, for the multi-line replies that are not one status
+    bool SendText(const char* pText);
     bool CheckLoggedIn();
 
     // Directory navigation
     CString RealPath(const char* pInBuffer) const;
-    const TDirectoryListEntry* BuildDirectoryList(size_t& nOutEntries) const;
+    // The entries of a directory ("" for the volume list); the caller
+    // delete[]s them. On the image volume, served from the listing cache
+    // while nothing has changed.
+    const TDirectoryListEntry* BuildDirectoryList(const char* pPath, size_t& nOutEntries) const;
+    const TDirectoryListEntry* ReadDirectory(const char* pPath, size_t& nOutEntries) const;
 
     // FTP command handlers
     bool System(const char* pArgs);
@@ -113,6 +122,7 @@ class CFTPWorker : protected CTask {
     bool Type(const char* pArgs);
     bool Retrieve(const char* pArgs);
     bool Store(const char* pArgs);
+    bool Allocate(const char* pArgs);
     bool Delete(const char* pArgs);
     bool MakeDirectory(const char* pArgs);
     bool ChangeWorkingDirectory(const char* pArgs);
@@ -124,6 +134,12 @@ class CFTPWorker : protected CTask {
     bool RenameTo(const char* pArgs);
     bool Bye(const char* pArgs);
     bool NoOp(const char* pArgs);
+    bool Features(const char* pArgs);
+    bool Restart(const char* pArgs);
+    bool FileSize(const char* pArgs);
+    bool ModificationTime(const char* pArgs);
+    bool MachineListDirectory(const char* pArgs);
+    bool MachineListEntry(const char* pArgs);
 
     CString m_LogName;
 
@@ -153,6 +169,8 @@ class CFTPWorker : protected CTask {
     TTransferMode m_TransferMode;
     CString m_CurrentPath;
     CString m_RenameFrom;
+    u64 m_nAllocateHint;    // bytes announced by ALLO for the next STOR
+    u64 m_nRestartOffset;   // from REST, for the next RETR or STOR
 
     static void FatFsPathToFTPPath(const char* pInBuffer, char* pOutBuffer, size_t nSize);
     static void FTPPathToFatFsPath(const char* pInBuffer, char* pOutBuffer, size_t nSize);
@@ -161,6 +179,10 @@ class CFTPWorker : protected CTask {
 
     static void FormatLastModifiedDate(u16 nDate, char* pOutBuffer, size_t nSize);
     static void FormatLastModifiedTime(u16 nDate, char* pOutBuffer, size_t nSize);
+    // YYYYMMDDHHMMSS, as MDTM and MLSD give it
+    static void FormatMachineTime(u16 nDate, u16 nTime, char* pOutBuffer, size_t nSize);
+    // The MLSD/MLST facts of an entry
+    static int FormatFacts(const TDirectoryListEntry& Entry, char* pOutBuffer, size_t nSize);
 
     static const TFTPCommand Commands[];
     static u8 s_nInstanceCount;
@@ -0,0 +1,125 @@
+#include "readahead.h"
+
+#include <circle/new.h>
+#include <circle/sched/scheduler.h>
+#include <ioscheduler/ioscheduler.h>
+
+#define READ_AHEAD_SLICE (16 * 1024)
+
+// Ends when the file is read or CReadAhead stops it. The scheduler deletes
+// a task whose Run() has returned, so it holds nothing of its own.
+class CReadAheadTask : public CTask {
+public:
+    CReadAheadTask(CReadAhead* pReadAhead) : m_pReadAhead(pReadAhead) {
+        SetName("ftpreadahead");
+    }
+
+    void Run(void) { m_pReadAhead->Fill(); }
+
+private:
+    CReadAhead* m_pReadAhead;
+};
+
+CReadAhead::CReadAhead(FIL* pFile)
+    : m_pFile(pFile),
+      m_nNext(0),
+      m_Result(FR_OK),
+      m_bStarted(FALSE),
+      m_bStop(FALSE),
+      m_bFinished(FALSE) {
+    for (TBuffer& Buffer : m_Buffers) {
+        Buffer.pData = nullptr;
+        Buffer.nLength = 0;
+        Buffer.bFull = FALSE;
+    }
+}
+
+CReadAhead::~CReadAhead() {
+    Stop();
+    for (TBuffer& Buffer : m_Buffers)
+        delete[] Buffer.pData;
+}
+
+boolean CReadAhead::Start() {
+    for (TBuffer& Buffer : m_Buffers) {
+        Buffer.pData = new (HEAP_LOW) u8[READ_AHEAD_SIZE];
+        if (Buffer.pData == nullptr)
+            return FALSE;
+    }
+
+    m_bStarted = TRUE;
+    new CReadAheadTask(this);
+    return TRUE;
+}
+
+const u8* CReadAhead::GetNext(unsigned* pLength) {
+    TBuffer& Buffer = m_Buffers[m_nNext];
+    while (!Buffer.bFull && !m_bFinished) {
+        m_Filled.Clear();
+        m_Filled.Wait();
+    }
+
+    // The task fills the buffers in turn, so once it has finished, the
+    // ones still full come before any that are not
+    if (!Buffer.bFull)
+        return nullptr;
+
+    *pLength = Buffer.nLength;
+    return Buffer.pData;
+}
+
+void CReadAhead::Release() {
+    m_Buffers[m_nNext].bFull = FALSE;
+    m_nNext = (m_nNext + 1) % READ_AHEAD_BUFFERS;
+    m_Released.Set();
+}
+
+void CReadAhead::Stop() {
+    if (!m_bStarted)
+        return;
+
+    m_bStop = TRUE;
+    m_Released.Set();
+    while (!m_bFinished) {
+        m_Filled.Clear();
+        m_Filled.Wait();
+    }
+    m_bStarted = FALSE;
+}
+
+void CReadAhead::Fill() {
+    for (unsigned i = 0; !m_bStop; i = (i + 1) % READ_AHEAD_BUFFERS) {
+        TBuffer& Buffer = m_Buffers[i];
+        while (Buffer.bFull && !m_bStop) {
+            m_Released.Clear();
+            m_Released.Wait();
+        }
+        if (m_bStop)
+            break;
+
+        // In pieces, letting the network task move the other buffer along
+        // in between (the I/O scheduler slices further while the host reads)
+        unsigned nLength = 0;
+        UINT nRead = READ_AHEAD_SLICE;
+        while (nLength < READ_AHEAD_SIZE && nRead == READ_AHEAD_SLICE) {
+            m_Result = CIOScheduler::Get()->Read(IOClassDownload, m_pFile, Buffer.pData + nLength,
+                                                 READ_AHEAD_SLICE, &nRead);
+            if (m_Result != FR_OK)
+                break;
+            nLength += nRead;
+            CScheduler::Get()->Yield();
+        }
+        if (m_Result != FR_OK || nLength == 0)
+            break;
+
+        Buffer.nLength = nLength;
+        Buffer.bFull = TRUE;
+        m_Filled.Set();
+        if (nLength < READ_AHEAD_SIZE)
+            break;
+    }
+
+    // Nothing here is touched after this; CReadAhead may go at once
+    m_bFinished = TRUE;
+    m_Filled.Set();
+}
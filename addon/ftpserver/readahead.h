@@ -0,0 +1,65 @@
+//
+// readahead.h
+//
+// Reads a file for RETR ahead of the FTP worker sending it. The worker used
+// to read 8 KB, then wait in Send() for it to go out, then read the next 8 KB,
+// so the card and the network took turns. Here a task of its own fills large
+// buffers in file order while the worker sends the ones already full; the
+// worker's wait in Send() is when the next buffer gets read.
+//
+// Task context on core 0 only. The two sides hand buffers over with events,
+// and tasks switch only where they wait, so there is no locking.
+//
+#ifndef _ftpserver_readahead_h
+#define _ftpserver_readahead_h
+
+#include <circle/sched/synchronizationevent.h>
+#include <circle/sched/task.h>
+#include <circle/types.h>
+#include <fatfs/ff.h>
+
+#define READ_AHEAD_BUFFERS 2
+#define READ_AHEAD_SIZE (64 * 1024)
+
+class CReadAhead {
+public:
+    CReadAhead(FIL* pFile);
+    // Stops the reading task first
+    ~CReadAhead();
+
+    // FALSE if the buffers could not be had
+    boolean Start();
+
+    // The next part of the file, waiting for it if need be; nullptr at the
+    // end of the file or after a read failed (see GetResult())
+    const u8* GetNext(unsigned* pLength);
+    // Done with what GetNext() returned; the buffer can take more
+    void Release();
+
+    // Waits for the reading task to finish what it is doing and end
+    void Stop();
+
+    FRESULT GetResult() const { return m_Result; }
+
+private:
+    friend class CReadAheadTask;
+    void Fill();
+
+    struct TBuffer {
+        u8* pData;
+        unsigned nLength;
+        boolean bFull;
+    };
+
+    FIL* m_pFile;
+    TBuffer m_Buffers[READ_AHEAD_BUFFERS];
+    unsigned m_nNext;           // the buffer GetNext() hands out
+    FRESULT m_Result;
+    boolean m_bStarted;
+    volatile boolean m_bStop;
+    volatile boolean m_bFinished;
+    CSynchronizationEvent m_Filled;
+    CSynchronizationEvent m_Released;
+};
+
+#endif
@@ -0,0 +1,278 @@
+//
+// ioscheduler.cpp
+//
+// Arbitrates SD card I/O between the subsystems that share the card.
+//
+// Copyright (C) 2025 Ian Cass, Dani Sarfati
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include "ioscheduler.h"
+
+#include <assert.h>
+#include <circle/sched/scheduler.h>
+#include <circle/timer.h>
+
+// A host streaming from the drive issues its next READ within a few
+// milliseconds of the last one completing, and the gaps between the USB
+// transfers of one READ are shorter still. Treating real-time work as active
+// for this long after it finishes covers those gaps.
+#define REALTIME_HOLDOFF_US 20000
+
+// Largest background slice while real-time work is active: 16 sectors, a
+// couple of milliseconds of SD card time.
+#define BACKGROUND_SLICE_BYTES 8192
+
+static const char *const s_ClassNames[IOClassCount] =
+{
+    "hostdata",
+    "audio",
+    "upload",
+    "download",
+    "log",
+    "config",
+    "metadata"
+};
+
+CIOScheduler::CIOScheduler(void)
+    : m_nRealTimeInFlight(0),
+      m_nLastRealTimeTicks(0),
+      m_SpinLock(TASK_LEVEL)
+{
+    for (unsigned i = 0; i < IOClassCount; i++)
+    {
+        m_Stats[i].nBytes = 0;
+        m_Stats[i].nRequests = 0;
+        m_Stats[i].nThrottled = 0;
+        m_Stats[i].nMaxLatencyUs = 0;
+        for (unsigned j = 0; j < IO_LATENCY_BUCKETS; j++)
+        {
+            m_Stats[i].nLatency[j] = 0;
+        }
+        m_nRealTimeStartTicks[i] = 0;
+    }
+}
+
+CIOScheduler *CIOScheduler::Get(void)
+{
+    static CIOScheduler s_Scheduler;
+    return &s_Scheduler;
+}
+
+const char *CIOScheduler::GetClassName(TIOClass Class)
+{
+    assert(Class < IOClassCount);
+    return s_ClassNames[Class];
+}
+
+void CIOScheduler::BeginRealTime(TIOClass Class)
+{
+    assert(IsRealTime(Class));
+
+    m_SpinLock.Acquire();
+    m_nRealTimeInFlight++;
+    m_nRealTimeStartTicks[Class] = CTimer::Get()->GetClockTicks();
+    m_SpinLock.Release();
+}
+
+void CIOScheduler::EndRealTime(TIOClass Class, u32 nBytes)
+{
+    assert(IsRealTime(Class));
+
+    m_SpinLock.Acquire();
+    assert(m_nRealTimeInFlight > 0);
+    m_nRealTimeInFlight--;
+    m_nLastRealTimeTicks = CTimer::Get()->GetClockTicks();
+    m_Stats[Class].nBytes += nBytes;
+    m_Stats[Class].nRequests++;
+    RecordLatency(Class, m_nRealTimeStartTicks[Class]);
+    m_SpinLock.Release();
+}
+
+boolean CIOScheduler::IsRealTimeActive(void) const
+{
+    m_SpinLock.Acquire();
+    boolean bActive = m_nRealTimeInFlight > 0
+        || (m_nLastRealTimeTicks != 0
+            && CTimer::Get()->GetClockTicks() - m_nLastRealTimeTicks < REALTIME_HOLDOFF_US);
+    m_SpinLock.Release();
+
+    return bActive;
+}
+
+FRESULT CIOScheduler::Read(TIOClass Class, FIL *pFile, void *pBuffer, UINT nBytes, UINT *pBytesRead)
+{
+    assert(pBytesRead != nullptr);
+    *pBytesRead = 0;
+
+    unsigned nStartTicks = CTimer::Get()->GetClockTicks();
+    boolean bThrottled = FALSE;
+    FRESULT Result = FR_OK;
+    u8 *pDest = static_cast<u8 *>(pBuffer);
+    while (*pBytesRead < nBytes)
+    {
+        UINT nRemaining = nBytes - *pBytesRead;
+        UINT nSlice = GetSliceSize(Class, nRemaining);
+        bThrottled |= nSlice < nRemaining;
+
+        UINT nRead = 0;
+        Result = f_read(pFile, pDest + *pBytesRead, nSlice, &nRead);
+        *pBytesRead += nRead;
+        if (Result != FR_OK || nRead < nSlice)
+        {
+            break; // error or end of file
+        }
+    }
+
+    m_SpinLock.Acquire();
+    m_Stats[Class].nBytes += *pBytesRead;
+    m_Stats[Class].nRequests++;
+    if (bThrottled)
+    {
+        m_Stats[Class].nThrottled++;
+    }
+    RecordLatency(Class, nStartTicks);
+    m_SpinLock.Release();
+
+    return Result;
+}
+
+FRESULT CIOScheduler::Write(TIOClass Class, FIL *pFile, const void *pBuffer, UINT nBytes, UINT *pBytesWritten)
+{
+    assert(pBytesWritten != nullptr);
+    *pBytesWritten = 0;
+
+    unsigned nStartTicks = CTimer::Get()->GetClockTicks();
+    boolean bThrottled = FALSE;
+    FRESULT Result = FR_OK;
+    const u8 *pSource = static_cast<const u8 *>(pBuffer);
+    while (*pBytesWritten < nBytes)
+    {
+        UINT nRemaining = nBytes - *pBytesWritten;
+        UINT nSlice = GetSliceSize(Class, nRemaining);
+        bThrottled |= nSlice < nRemaining;
+
+        UINT nWritten = 0;
+        Result = f_write(pFile, pSource + *pBytesWritten, nSlice, &nWritten);
+        *pBytesWritten += nWritten;
+        if (Result != FR_OK || nWritten < nSlice)
+        {
+            break; // error or volume full
+        }
+    }
+
+    m_SpinLock.Acquire();
+    m_Stats[Class].nBytes += *pBytesWritten;
+    m_Stats[Class].nRequests++;
+    if (bThrottled)
+    {
+        m_Stats[Class].nThrottled++;
+    }
+    RecordLatency(Class, nStartTicks);
+    m_SpinLock.Release();
+
+    return Result;
+}
+
+void CIOScheduler::WaitForTurn(TIOClass Class)
+{
+    if (!IsRealTime(Class) && IsRealTimeActive())
+    {
+        CScheduler::Get()->Yield();
+
+        m_SpinLock.Acquire();
+        m_Stats[Class].nThrottled++;
+        m_SpinLock.Release();
+    }
+}
+
+void CIOScheduler::Account(TIOClass Class, u64 nBytes)
+{
+    m_SpinLock.Acquire();
+    m_Stats[Class].nBytes += nBytes;
+    m_Stats[Class].nRequests++;
+    m_SpinLock.Release();
+}
+
+void CIOScheduler::GetStats(TIOClass Class, TIOClassStats *pStats) const
+{
+    assert(Class < IOClassCount);
+    assert(pStats != nullptr);
+
+    m_SpinLock.Acquire();
+    *pStats = m_Stats[Class];
+    m_SpinLock.Release();
+}
+
+u32 CIOScheduler::GetLatencyPercentile(const TIOClassStats &Stats, unsigned nPercent)
+{
+    u64 nTotal = 0;
+    for (unsigned i = 0; i < IO_LATENCY_BUCKETS; i++)
+    {
+        nTotal += Stats.nLatency[i];
+    }
+    if (nTotal == 0)
+    {
+        return 0;
+    }
+
+    // The smallest bucket boundary with at least nPercent of the requests
+    // below it; the last bucket is bounded by the slowest request seen
+    u64 nWanted = (nTotal * nPercent + 99) / 100;
+    u64 nSeen = 0;
+    for (unsigned i = 0; i < IO_LATENCY_BUCKETS - 1; i++)
+    {
+        nSeen += Stats.nLatency[i];
+        if (nSeen >= nWanted)
+        {
+            u32 nBound = 1u << i;
+            return nBound < Stats.nMaxLatencyUs ? nBound : Stats.nMaxLatencyUs;
+        }
+    }
+
+    return Stats.nMaxLatencyUs;
+}
+
+void CIOScheduler::RecordLatency(TIOClass Class, unsigned nStartTicks)
+{
+    // Clock ticks are microseconds
+    u32 nUs = CTimer::Get()->GetClockTicks() - nStartTicks;
+
+    unsigned nBucket = 0;
+    while (nBucket < IO_LATENCY_BUCKETS - 1 && nUs >= (1u << nBucket))
+    {
+        nBucket++;
+    }
+
+    m_Stats[Class].nLatency[nBucket]++;
+    if (nUs > m_Stats[Class].nMaxLatencyUs)
+    {
+        m_Stats[Class].nMaxLatencyUs = nUs;
+    }
+}
+
+// Yielding first hands the card to whatever real-time work is waiting (the
+// CDROMService task, or core 1 at the task switch) before this slice takes
+// it. Outside real-time activity requests go through whole.
+UINT CIOScheduler::GetSliceSize(TIOClass Class, UINT nBytes)
+{
+    if (IsRealTime(Class) || !IsRealTimeActive())
+    {
+        return nBytes;
+    }
+
+    CScheduler::Get()->Yield();
+
+    return nBytes < BACKGROUND_SLICE_BYTES ? nBytes : BACKGROUND_SLICE_BYTES;
+}
@@ -0,0 +1,125 @@
+//
+// ioscheduler.h
+//
+// Arbitrates SD card I/O between the subsystems that share the card.
+//
+// Host reads from the CD gadget and CD audio are real-time: a late sector is
+// a stalled game or a gap in the music. Uploads (web, FTP), the file log and
+// config saves are background work that can always wait a little. FatFs does
+// one request at a time and a big write holds the card for as long as it
+// takes, so without arbitration a 1 MB upload chunk sits between the host and
+// its next sector.
+//
+// Real-time callers bracket their reads with BeginRealTime()/EndRealTime().
+// Background callers go through Read()/Write(), which split the request into
+// small pieces and yield before each one for as long as real-time work is in
+// flight or happened within the last few milliseconds, so a pending host read
+// gets the card after at most one small background piece. Background work is
+// never refused or parked, only sliced, so it cannot starve.
+//
+// Every class keeps byte, request and throttle counters for diagnostics, and
+// a histogram of how long its requests took.
+//
+// Copyright (C) 2025 Ian Cass, Dani Sarfati
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _ioscheduler_ioscheduler_h
+#define _ioscheduler_ioscheduler_h
+
+#include <circle/types.h>
+#include <circle/spinlock.h>
+#include <fatfs/ff.h>
+
+enum TIOClass
+{
+    // Real-time
+    IOClassHostData,  // CD gadget reads for the USB host
+    IOClassAudio,     // CD player reads
+    // Background
+    IOClassUpload,    // web uploads, FTP STOR
+    IOClassDownload,  // FTP RETR
+    IOClassLog,       // file log daemon
+    IOClassConfig,    // config.txt / cmdline.txt saves, the saved image index
+    IOClassMetadata,  // reading images for their label, platform and tracks
+    IOClassCount
+};
+
+// Latency bucket n counts requests that took less than 2^n microseconds (and
+// at least half that); the last one takes everything slower.
+#define IO_LATENCY_BUCKETS 21
+
+struct TIOClassStats
+{
+    u64 nBytes;         // bytes transferred
+    u32 nRequests;      // calls (a sliced background request counts once)
+    u32 nThrottled;     // background requests sliced because real-time was active
+    u32 nMaxLatencyUs;  // slowest request
+    u32 nLatency[IO_LATENCY_BUCKETS];
+};
+
+class CIOScheduler
+{
+public:
+    CIOScheduler(void);
+
+    // Always valid; the scheduler needs no setup.
+    static CIOScheduler *Get(void);
+
+    static boolean IsRealTime(TIOClass Class) { return Class <= IOClassAudio; }
+    static const char *GetClassName(TIOClass Class);
+
+    // Real-time side. Safe on either core, not from IRQ.
+    void BeginRealTime(TIOClass Class);
+    void EndRealTime(TIOClass Class, u32 nBytes);
+
+    // TRUE while real-time I/O is in flight or finished less than
+    // REALTIME_HOLDOFF_US ago.
+    boolean IsRealTimeActive(void) const;
+
+    // Background side, task level on core 0 only (may yield). FatFs
+    // f_read()/f_write() with the same contract, sliced while real-time
+    // work is active. A real-time class passes straight through.
+    FRESULT Read(TIOClass Class, FIL *pFile, void *pBuffer, UINT nBytes, UINT *pBytesRead);
+    FRESULT Write(TIOClass Class, FIL *pFile, const void *pBuffer, UINT nBytes, UINT *pBytesWritten);
+
+    // For background I/O that does not map onto one f_read()/f_write() (a
+    // config save through stdio): waits for its turn like Read()/Write() do
+    // before each slice, and counts the request.
+    void WaitForTurn(TIOClass Class);
+    void Account(TIOClass Class, u64 nBytes);
+
+    void GetStats(TIOClass Class, TIOClassStats *pStats) const;
+
+    // Upper bound in microseconds of the latency nPercent of the requests in
+    // pStats stayed under, 0 if there were none.
+    static u32 GetLatencyPercentile(const TIOClassStats &Stats, unsigned nPercent);
+
+private:
+    // How big a background slice may be while real-time work is active
+    UINT GetSliceSize(TIOClass Class, UINT nBytes);
+
+    // With the spin lock held
+    void RecordLatency(TIOClass Class, unsigned nStartTicks);
+
+private:
+    TIOClassStats m_Stats[IOClassCount];
+    unsigned m_nRealTimeInFlight;
+    unsigned m_nLastRealTimeTicks;
+    unsigned m_nRealTimeStartTicks[IOClassCount];   // one request per class at a time
+
+    mutable CSpinLock m_SpinLock;
+};
+
+#endif
@@ -0,0 +1,110 @@
+//
+// discset.cpp
+//
+// Copyright (C) 2025 Ian Cass
+// Copyright (C) 2025 Dani Sarfati
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include "discset.h"
+
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+
+// Length of the disc word at p, or 0
+static size_t DiscWordLength(const char* p) {
+    if (strncasecmp(p, "disc", 4) == 0 || strncasecmp(p, "disk", 4) == 0)
+        return 4;
+    if (strncasecmp(p, "cd", 2) == 0)
+        return 2;
+    return 0;
+}
+
+bool GetDiscSetKey(const char* pName, char* pKey, size_t nKeySize) {
+    size_t nLength = strlen(pName);
+    if (nLength >= nKeySize)
+        return false;
+
+    // "Disc 2", "Disc_2", "Disk-2", "CD2"; not "abcd2", nor "CD2X"
+    const char* pNumber = nullptr;
+    const char* pNumberEnd = nullptr;
+    for (const char* p = pName; *p != '\0'; p++) {
+        if (p > pName && isalnum((unsigned char)p[-1]))
+            continue;
+        size_t nWord = DiscWordLength(p);
+        if (nWord == 0)
+            continue;
+
+        const char* pDigits = p + nWord;
+        if (*pDigits == ' ' || *pDigits == '_' || *pDigits == '-')
+            pDigits++;
+        const char* pEnd = pDigits;
+        while (isdigit((unsigned char)*pEnd))
+            pEnd++;
+        if (pEnd == pDigits || pEnd - pDigits > 2 || isalpha((unsigned char)*pEnd))
+            continue;
+
+        pNumber = pDigits;
+        pNumberEnd = pEnd;
+    }
+    if (pNumber == nullptr)
+        return false;
+
+    size_t nKey = 0;
+    for (const char* p = pName; *p != '\0'; p++) {
+        if (p == pNumber) {
+            pKey[nKey++] = '#';
+            p = pNumberEnd - 1;
+            continue;
+        }
+        pKey[nKey++] = (char)tolower((unsigned char)*p);
+    }
+    pKey[nKey] = '\0';
+    return true;
+}
+
+void ParseM3U(const char* pText, std::vector<std::string>& Entries) {
+    Entries.clear();
+    const char* pLine = pText;
+    while (*pLine != '\0') {
+        const char* pEnd = pLine;
+        while (*pEnd != '\0' && *pEnd != '\n' && *pEnd != '\r')
+            pEnd++;
+
+        const char* pFrom = pLine;
+        const char* pTo = pEnd;
+        // A playlist saved with a byte order mark
+        if (pFrom == pText && (unsigned char)pFrom[0] == 0xEF && (unsigned char)pFrom[1] == 0xBB
+            && (unsigned char)pFrom[2] == 0xBF)
+            pFrom += 3;
+        while (pFrom < pTo && isspace((unsigned char)*pFrom))
+            pFrom++;
+        while (pTo > pFrom && isspace((unsigned char)pTo[-1]))
+            pTo--;
+
+        if (pFrom < pTo && *pFrom != '#') {
+            std::string Entry(pFrom, pTo - pFrom);
+            for (char& c : Entry) {
+                if (c == '\\')
+                    c = '/';
+            }
+            Entries.push_back(Entry);
+        }
+
+        pLine = pEnd;
+        while (*pLine == '\n' || *pLine == '\r')
+            pLine++;
+    }
+}
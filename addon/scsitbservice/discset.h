@@ -0,0 +1,42 @@
+//
+// discset.h
+//
+// Which images are discs of one game, so SCSITBService can open the rest
+// of a set ahead of a disc swap. A set is the images an .m3u playlist in
+// the folder names, or failing that the images of the folder whose names
+// differ only in their disc number: "Game (Disc 1).cue", "Game (Disc 2).cue".
+//
+// Copyright (C) 2025 Ian Cass
+// Copyright (C) 2025 Dani Sarfati
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _scsitbservice_discset_h
+#define _scsitbservice_discset_h
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// The name with its disc number left out, in lower case: "Game (Disc 2).cue"
+// and "game (disc 3).cue" both give "game (disc #).cue". The number is the
+// last one following a "Disc", "Disk" or "CD" word. False if the name has
+// none, or the key does not fit.
+bool GetDiscSetKey(const char* pName, char* pKey, size_t nKeySize);
+
+// The entries of an .m3u playlist in order, as written: blank lines and
+// #-comments skipped, surrounding blanks trimmed, '\' turned into '/'.
+void ParseM3U(const char* pText, std::vector<std::string>& Entries);
+
+#endif
@@ -0,0 +1,788 @@
+//
+// imageindex.cpp
+//
+// Copyright (C) 2025 Ian Cass
+// Copyright (C) 2025 Dani Sarfati
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include "imageindex.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+
+const u32 CImageIndex::None;
+
+CImageIndex::CImageIndex()
+    : m_nDirectories(0),
+      m_nRootFirst(0),
+      m_nRootCount(0),
+      m_nRootStamp(0),
+      m_bSearchBuilt(false) {
+}
+
+void CImageIndex::Clear() {
+    // clear() keeps the capacity, which a rescan mostly needs again anyway,
+    // but a library that shrank should give its memory back.
+    std::vector<char>().swap(m_Pool);
+    std::vector<TNode>().swap(m_Nodes);
+    std::vector<u32>().swap(m_Children);
+    m_nDirectories = 0;
+    m_nRootFirst = 0;
+    m_nRootCount = 0;
+    m_nRootStamp = 0;
+    DropSearch();
+}
+
+u32 CImageIndex::Add(u32 nParent, const char* pName, u32 nSize, bool bDirectory) {
+    assert(pName != nullptr && pName[0] != '\0');
+    return Add(nParent, pName, strlen(pName), nSize, bDirectory);
+}
+
+u32 CImageIndex::Add(u32 nParent, const char* pName, size_t nNameLength, u32 nSize, bool bDirectory) {
+    assert(nNameLength > 0);
+    assert(nParent == None || (nParent < m_Nodes.size() && m_Nodes[nParent].bDirectory));
+
+    size_t nParentLength = 0;
+    if (nParent != None) {
+        nParentLength = strlen(PathOf(m_Nodes[nParent]));
+    }
+    const size_t nNameOffset = nParent != None ? nParentLength + 1 : 0;
+    if (nNameOffset > 0xFFFF) {
+        return None;  // deeper than any path FatFs will open
+    }
+
+    TNode Node;
+    Node.nPath = (u32)m_Pool.size();
+    Node.nNameOffset = (u16)nNameOffset;
+    Node.bDirectory = bDirectory;
+    Node.nReserved = 0;
+    Node.nSize = nSize;
+    Node.nParent = nParent;
+    Node.nFirstChild = 0;
+    Node.nChildCount = 0;
+
+    // "parent/name", the parent's path read back out of the pool
+    m_Pool.resize(m_Pool.size() + nNameOffset + nNameLength + 1);
+    char* pPath = &m_Pool[Node.nPath];
+    if (nParent != None) {
+        memcpy(pPath, PathOf(m_Nodes[nParent]), nParentLength);
+        pPath[nParentLength] = '/';
+    }
+    memcpy(pPath + nNameOffset, pName, nNameLength);
+    pPath[nNameOffset + nNameLength] = '\0';
+
+    m_Nodes.push_back(Node);
+    return (u32)(m_Nodes.size() - 1);
+}
+
+void CImageIndex::Finish() {
+    const size_t nCount = m_Nodes.size();
+
+    // Folders first, then images, alphabetically by relative path: the order
+    // the flat list has always had. Siblings share their path up to the name,
+    // so each folder's children come out of this sorted by name as well.
+    std::vector<u32> Order(nCount);
+    for (size_t i = 0; i < nCount; i++) {
+        Order[i] = (u32)i;
+    }
+    std::sort(Order.begin(), Order.end(), [this](u32 a, u32 b) {
+        const TNode& A = m_Nodes[a];
+        const TNode& B = m_Nodes[b];
+        if (A.bDirectory != B.bDirectory) {
+            return A.bDirectory > B.bDirectory;
+        }
+        int nCompare = strcasecmp(PathOf(A), PathOf(B));
+        return nCompare != 0 ? nCompare < 0 : a < b;
+    });
+
+    std::vector<u32> NewIndex(nCount);
+    for (size_t i = 0; i < nCount; i++) {
+        NewIndex[Order[i]] = (u32)i;
+    }
+
+    std::vector<TNode> Sorted(nCount);
+    m_nDirectories = 0;
+    for (size_t i = 0; i < nCount; i++) {
+        Sorted[i] = m_Nodes[Order[i]];
+        if (Sorted[i].nParent != None) {
+            Sorted[i].nParent = NewIndex[Sorted[i].nParent];
+        }
+        m_nDirectories += Sorted[i].bDirectory;
+    }
+    m_Nodes.swap(Sorted);
+
+    // Children laid out folder by folder: count, place each run, then fill
+    // it in index order, which is already display order.
+    m_nRootCount = 0;
+    for (size_t i = 0; i < nCount; i++) {
+        if (m_Nodes[i].nParent == None) {
+            m_nRootCount++;
+        } else {
+            m_Nodes[m_Nodes[i].nParent].nChildCount++;
+        }
+    }
+
+    u32 nNext = 0;
+    m_nRootFirst = nNext;
+    nNext += m_nRootCount;
+    for (size_t i = 0; i < m_nDirectories; i++) {
+        m_Nodes[i].nFirstChild = nNext;
+        nNext += m_Nodes[i].nChildCount;
+        m_Nodes[i].nChildCount = 0;
+    }
+
+    m_Children.assign(nCount, 0);
+    u32 nRootFilled = 0;
+    for (size_t i = 0; i < nCount; i++) {
+        const u32 nParent = m_Nodes[i].nParent;
+        if (nParent == None) {
+            m_Children[m_nRootFirst + nRootFilled++] = (u32)i;
+        } else {
+            TNode& Parent = m_Nodes[nParent];
+            m_Children[Parent.nFirstChild + Parent.nChildCount++] = (u32)i;
+        }
+    }
+
+    DropSearch();
+
+    // The pool was sized by repeated resize(); hand the slack back.
+    m_Pool.shrink_to_fit();
+    m_Nodes.shrink_to_fit();
+}
+
+void CImageIndex::Swap(CImageIndex& Other) {
+    m_Pool.swap(Other.m_Pool);
+    m_Nodes.swap(Other.m_Nodes);
+    m_Children.swap(Other.m_Children);
+    std::swap(m_nDirectories, Other.m_nDirectories);
+    std::swap(m_nRootFirst, Other.m_nRootFirst);
+    std::swap(m_nRootCount, Other.m_nRootCount);
+    std::swap(m_nRootStamp, Other.m_nRootStamp);
+    std::swap(m_bSearchBuilt, Other.m_bSearchBuilt);
+    m_SearchKeys.swap(Other.m_SearchKeys);
+    m_SearchFirst.swap(Other.m_SearchFirst);
+    m_SearchEntries.swap(Other.m_SearchEntries);
+}
+
+bool CImageIndex::Contains(u32 nFolder, u32 nIndex) const {
+    for (u32 n = nIndex; n != None; n = m_Nodes[n].nParent) {
+        if (n == nFolder)
+            return true;
+    }
+    return false;
+}
+
+// Source's index order has every folder before its entries, so each entry's
+// parent has been added by the time the entry is.
+void CImageIndex::AddFrom(const CImageIndex& Source, u32 nSkip, bool bKeepSkipped, std::vector<u32>& Map) {
+    // Folder stamps come along in each folder's nSize; the top level's is
+    // held apart.
+    m_nRootStamp = Source.m_nRootStamp;
+    Map.assign(Source.GetCount(), None);
+    for (u32 i = 0; i < Source.GetCount(); i++) {
+        if (nSkip != None && Source.Contains(nSkip, i) && !(bKeepSkipped && i == nSkip))
+            continue;
+
+        const TNode& Node = Source.m_Nodes[i];
+        u32 nParent = None;
+        if (Node.nParent != None) {
+            nParent = Map[Node.nParent];
+            if (nParent == None)
+                continue;  // the parent could not be added
+        }
+        Map[i] = Add(nParent, Source.NameOf(Node), Node.nSize, Node.bDirectory);
+    }
+}
+
+bool CImageIndex::AddFolders(const CImageIndex& Source, const std::vector<u32>& Map,
+                             const char* pFolderPath, size_t nLength, u32* pFolder) {
+    u32 nFolder = None;
+    u32 nSourceFolder = None;
+    bool bInSource = true;  // so far, the path is a folder Source has
+
+    const char* p = pFolderPath;
+    const char* pEnd = pFolderPath + nLength;
+    while (p < pEnd) {
+        const char* pSlash = (const char*)memchr(p, '/', pEnd - p);
+        const size_t nComponent = (pSlash != nullptr ? pSlash : pEnd) - p;
+        if (nComponent == 0)
+            return false;
+
+        u32 nFound = None;
+        if (bInSource) {
+            nSourceFolder = Source.FindChild(nSourceFolder, p, nComponent, true, false);
+            if (nSourceFolder != None)
+                nFound = Map[nSourceFolder];
+            bInSource = nFound != None;
+        }
+        if (nFound == None) {
+            nFound = Add(nFolder, p, nComponent, 0, true);
+            if (nFound == None)
+                return false;
+        }
+        nFolder = nFound;
+
+        p += nComponent + 1;
+    }
+
+    *pFolder = nFolder;
+    return true;
+}
+
+bool CImageIndex::Insert(const char* pRelativePath, u32 nSize, bool bDirectory) {
+    if (pRelativePath == nullptr || pRelativePath[0] == '\0')
+        return false;
+
+    u32 nFound = Find(pRelativePath);
+    if (nFound != None && m_Nodes[nFound].bDirectory == bDirectory) {
+        if (bDirectory || m_Nodes[nFound].nSize == nSize)
+            return false;
+        m_Nodes[nFound].nSize = nSize;  // rewritten in place: nothing moves
+        return true;
+    }
+
+    const char* pName = strrchr(pRelativePath, '/');
+    pName = pName != nullptr ? pName + 1 : pRelativePath;
+    if (pName[0] == '\0')
+        return false;
+
+    // A folder where there was a file of that name, or the other way round,
+    // replaces it.
+    CImageIndex Fresh;
+    std::vector<u32> Map;
+    Fresh.AddFrom(*this, nFound, false, Map);
+
+    u32 nParent;
+    if (!Fresh.AddFolders(*this, Map, pRelativePath, pName > pRelativePath ? pName - pRelativePath - 1 : 0, &nParent)
+        || Fresh.Add(nParent, pName, nSize, bDirectory) == None)
+        return false;
+
+    Fresh.Finish();
+    Swap(Fresh);
+    return true;
+}
+
+bool CImageIndex::Remove(const char* pRelativePath) {
+    u32 nFound = Find(pRelativePath);
+    if (nFound == None)
+        return false;
+
+    CImageIndex Fresh;
+    std::vector<u32> Map;
+    Fresh.AddFrom(*this, nFound, false, Map);
+    Fresh.Finish();
+    Swap(Fresh);
+    return true;
+}
+
+bool CImageIndex::Rename(const char* pFromPath, const char* pToPath) {
+    u32 nFound = Find(pFromPath);
+    if (nFound == None || pToPath == nullptr || pToPath[0] == '\0')
+        return false;
+
+    // Not into itself
+    const size_t nFromLength = strlen(pFromPath);
+    if (strncmp(pToPath, pFromPath, nFromLength) == 0
+        && (pToPath[nFromLength] == '\0' || pToPath[nFromLength] == '/'))
+        return false;
+
+    // Nor over a folder it is in, which would go first and take it along
+    const size_t nToLength = strlen(pToPath);
+    if (strncmp(pFromPath, pToPath, nToLength) == 0 && pFromPath[nToLength] == '/')
+        return false;
+
+    // Whatever the new name replaces goes first
+    if (Find(pToPath) != None) {
+        Remove(pToPath);
+        nFound = Find(pFromPath);
+        if (nFound == None)
+            return false;
+    }
+
+    const char* pName = strrchr(pToPath, '/');
+    pName = pName != nullptr ? pName + 1 : pToPath;
+    if (pName[0] == '\0')
+        return false;
+
+    CImageIndex Fresh;
+    std::vector<u32> Map;
+    Fresh.AddFrom(*this, nFound, false, Map);
+
+    u32 nParent;
+    if (!Fresh.AddFolders(*this, Map, pToPath, pName > pToPath ? pName - pToPath - 1 : 0, &nParent))
+        return false;
+    const TNode& Moved = m_Nodes[nFound];
+    Map[nFound] = Fresh.Add(nParent, pName, Moved.nSize, Moved.bDirectory);
+    if (Map[nFound] == None)
+        return false;
+
+    // A folder's entries all come after it
+    for (u32 i = nFound + 1; Moved.bDirectory && i < m_Nodes.size(); i++) {
+        const TNode& Node = m_Nodes[i];
+        if (!Contains(nFound, i) || Map[Node.nParent] == None)
+            continue;
+        Map[i] = Fresh.Add(Map[Node.nParent], NameOf(Node), Node.nSize, Node.bDirectory);
+    }
+
+    Fresh.Finish();
+    Swap(Fresh);
+    return true;
+}
+
+void CImageIndex::ReplaceFolder(const char* pFolderPath, CImageIndex& Contents) {
+    if (pFolderPath == nullptr || pFolderPath[0] == '\0') {
+        Swap(Contents);
+        Contents.Clear();
+        return;
+    }
+
+    // The folder itself stays (or is added); everything in it goes.
+    u32 nFolder = FindFolder(pFolderPath);
+    CImageIndex Fresh;
+    std::vector<u32> Map;
+    if (nFolder != None) {
+        Fresh.AddFrom(*this, nFolder, true, Map);
+        nFolder = Map[nFolder];
+    } else {
+        Fresh.AddFrom(*this, Find(pFolderPath), false, Map);
+        if (!Fresh.AddFolders(*this, Map, pFolderPath, strlen(pFolderPath), &nFolder))
+            return;
+    }
+
+    Fresh.m_Nodes[nFolder].nSize = Contents.m_nRootStamp;
+
+    std::vector<u32> ContentsMap(Contents.GetCount(), None);
+    for (u32 i = 0; i < Contents.GetCount(); i++) {
+        const TNode& Node = Contents.m_Nodes[i];
+        u32 nParent = Node.nParent == None ? nFolder : ContentsMap[Node.nParent];
+        if (nParent == None)
+            continue;
+        ContentsMap[i] = Fresh.Add(nParent, Contents.NameOf(Node), Node.nSize, Node.bDirectory);
+    }
+
+    Fresh.Finish();
+    Swap(Fresh);
+    Contents.Clear();
+}
+
+const char* CImageIndex::GetName(size_t nIndex) const {
+    if (nIndex >= m_Nodes.size())
+        return nullptr;
+    return NameOf(m_Nodes[nIndex]);
+}
+
+const char* CImageIndex::GetRelativePath(size_t nIndex) const {
+    if (nIndex >= m_Nodes.size())
+        return nullptr;
+    return PathOf(m_Nodes[nIndex]);
+}
+
+u32 CImageIndex::GetSize(size_t nIndex) const {
+    if (nIndex >= m_Nodes.size() || m_Nodes[nIndex].bDirectory)
+        return 0;
+    return m_Nodes[nIndex].nSize;
+}
+
+bool CImageIndex::IsDirectory(size_t nIndex) const {
+    if (nIndex >= m_Nodes.size())
+        return false;
+    return m_Nodes[nIndex].bDirectory;
+}
+
+u32 CImageIndex::GetParent(size_t nIndex) const {
+    if (nIndex >= m_Nodes.size())
+        return None;
+    return m_Nodes[nIndex].nParent;
+}
+
+const u32* CImageIndex::GetChildren(u32 nFolder, size_t* pCount) const {
+    assert(pCount != nullptr);
+    *pCount = 0;
+
+    u32 nFirst;
+    if (nFolder == None) {
+        nFirst = m_nRootFirst;
+        *pCount = m_nRootCount;
+    } else if (nFolder < m_Nodes.size() && m_Nodes[nFolder].bDirectory) {
+        nFirst = m_Nodes[nFolder].nFirstChild;
+        *pCount = m_Nodes[nFolder].nChildCount;
+    } else {
+        return nullptr;
+    }
+
+    // Never nullptr for a real folder, even an empty one
+    static const u32 s_nNoChildren = 0;
+    return *pCount > 0 ? &m_Children[nFirst] : &s_nNoChildren;
+}
+
+// Children are sorted folders first, then by name ignoring case, so the run
+// of names equal to pName ignoring case is found by binary search; an exact
+// match, if asked for, is within that run.
+u32 CImageIndex::FindChild(u32 nFolder, const char* pName, size_t nLength,
+                           bool bDirectory, bool bIgnoreCase) const {
+    size_t nCount;
+    const u32* pChildren = GetChildren(nFolder, &nCount);
+    if (pChildren == nullptr || nCount == 0)
+        return None;
+
+    auto Compare = [&](u32 nIndex) -> int {
+        const TNode& Node = m_Nodes[nIndex];
+        if (Node.bDirectory != bDirectory)
+            return Node.bDirectory ? -1 : 1;
+        const char* pOther = NameOf(Node);
+        int nCompare = strncasecmp(pOther, pName, nLength);
+        if (nCompare == 0 && pOther[nLength] != '\0')
+            nCompare = 1;  // pName is a prefix of this name
+        return nCompare;
+    };
+
+    size_t nLow = 0;
+    size_t nHigh = nCount;
+    while (nLow < nHigh) {
+        size_t nMid = nLow + (nHigh - nLow) / 2;
+        if (Compare(pChildren[nMid]) < 0)
+            nLow = nMid + 1;
+        else
+            nHigh = nMid;
+    }
+
+    for (size_t i = nLow; i < nCount && Compare(pChildren[i]) == 0; i++) {
+        if (bIgnoreCase || strncmp(NameOf(m_Nodes[pChildren[i]]), pName, nLength) == 0)
+            return pChildren[i];
+    }
+
+    return None;
+}
+
+u32 CImageIndex::FindFolder(const char* pRelativePath) const {
+    if (pRelativePath == nullptr || pRelativePath[0] == '\0')
+        return None;
+    u32 nFound = Find(pRelativePath);
+    return IsDirectory(nFound) ? nFound : None;
+}
+
+u32 CImageIndex::Find(const char* pRelativePath, bool bIgnoreCase) const {
+    if (pRelativePath == nullptr || pRelativePath[0] == '\0')
+        return None;
+
+    u32 nFolder = None;
+    const char* p = pRelativePath;
+    while (true) {
+        const char* pSlash = strchr(p, '/');
+        const size_t nLength = pSlash != nullptr ? (size_t)(pSlash - p) : strlen(p);
+        if (nLength == 0)
+            return None;
+
+        if (pSlash != nullptr) {
+            nFolder = FindChild(nFolder, p, nLength, true, bIgnoreCase);
+            if (nFolder == None)
+                return None;
+            p = pSlash + 1;
+            continue;
+        }
+
+        // The last component may be either
+        u32 nFound = FindChild(nFolder, p, nLength, false, bIgnoreCase);
+        if (nFound == None)
+            nFound = FindChild(nFolder, p, nLength, true, bIgnoreCase);
+        return nFound;
+    }
+}
+
+size_t CImageIndex::GetMemoryUsage() const {
+    return m_Pool.capacity() + m_Nodes.capacity() * sizeof(TNode)
+           + m_Children.capacity() * sizeof(u32)
+           + (m_SearchKeys.capacity() + m_SearchFirst.capacity() + m_SearchEntries.capacity()) * sizeof(u32);
+}
+
+void CImageIndex::SetFolderStamp(u32 nFolder, u32 nStamp) {
+    if (nFolder == None) {
+        m_nRootStamp = nStamp;
+    } else if (nFolder < m_Nodes.size() && m_Nodes[nFolder].bDirectory) {
+        m_Nodes[nFolder].nSize = nStamp;
+    }
+}
+
+u32 CImageIndex::GetFolderStamp(u32 nFolder) const {
+    if (nFolder == None)
+        return m_nRootStamp;
+    if (nFolder < m_Nodes.size() && m_Nodes[nFolder].bDirectory)
+        return m_Nodes[nFolder].nSize;
+    return 0;
+}
+
+u32 CImageIndex::GetNextFolder(const char* pAfterPath) const {
+    // Folders are [0, m_nDirectories), sorted by path ignoring case
+    size_t nLow = 0;
+    size_t nHigh = m_nDirectories;
+    if (pAfterPath != nullptr && pAfterPath[0] != '\0') {
+        while (nLow < nHigh) {
+            size_t nMid = nLow + (nHigh - nLow) / 2;
+            if (strcasecmp(PathOf(m_Nodes[nMid]), pAfterPath) <= 0)
+                nLow = nMid + 1;
+            else
+                nHigh = nMid;
+        }
+    }
+    return nLow < m_nDirectories ? (u32)nLow : None;
+}
+
+// "UIDX": nodes, then child lists, then the path pool, each as held.
+static const u32 SaveMagic = 0x58444955;
+static const u32 SaveVersion = 1;
+
+static u32 Checksum(const u8* pData, size_t nLength) {
+    u32 nHash = 2166136261u;  // FNV-1a
+    for (size_t i = 0; i < nLength; i++) {
+        nHash ^= pData[i];
+        nHash *= 16777619u;
+    }
+    return nHash;
+}
+
+size_t CImageIndex::GetSaveSize() const {
+    return sizeof(TSaveHeader) + m_Nodes.size() * sizeof(TNode)
+           + m_Children.size() * sizeof(u32) + m_Pool.size();
+}
+
+void CImageIndex::Save(void* pBuffer) const {
+    assert(pBuffer != nullptr);
+    assert(m_Children.size() == m_Nodes.size());
+
+    u8* p = (u8*)pBuffer + sizeof(TSaveHeader);
+    if (!m_Nodes.empty()) {
+        memcpy(p, m_Nodes.data(), m_Nodes.size() * sizeof(TNode));
+        p += m_Nodes.size() * sizeof(TNode);
+        memcpy(p, m_Children.data(), m_Children.size() * sizeof(u32));
+        p += m_Children.size() * sizeof(u32);
+    }
+    if (!m_Pool.empty()) {
+        memcpy(p, m_Pool.data(), m_Pool.size());
+    }
+
+    TSaveHeader Header;
+    Header.nMagic = SaveMagic;
+    Header.nVersion = SaveVersion;
+    Header.nNodes = (u32)m_Nodes.size();
+    Header.nPool = (u32)m_Pool.size();
+    Header.nDirectories = (u32)m_nDirectories;
+    Header.nRootFirst = m_nRootFirst;
+    Header.nRootCount = m_nRootCount;
+    Header.nRootStamp = m_nRootStamp;
+    Header.nChecksum = Checksum((const u8*)pBuffer + sizeof(TSaveHeader),
+                                GetSaveSize() - sizeof(TSaveHeader));
+    memcpy(pBuffer, &Header, sizeof(Header));
+}
+
+bool CImageIndex::Load(const void* pBuffer, size_t nLength) {
+    Clear();
+
+    TSaveHeader Header;
+    if (pBuffer == nullptr || nLength < sizeof(Header))
+        return false;
+    memcpy(&Header, pBuffer, sizeof(Header));
+    if (Header.nMagic != SaveMagic || Header.nVersion != SaveVersion)
+        return false;
+
+    const u64 nNodes = Header.nNodes;
+    const u64 nExpected = sizeof(Header) + nNodes * sizeof(TNode) + nNodes * sizeof(u32) + Header.nPool;
+    if (nExpected != nLength)
+        return false;
+    const u8* pData = (const u8*)pBuffer + sizeof(Header);
+    if (Checksum(pData, nLength - sizeof(Header)) != Header.nChecksum)
+        return false;
+
+    // Everything the accessors rely on, so a stale or damaged file can never
+    // index outside what was loaded.
+    if (Header.nDirectories > nNodes || (Header.nPool > 0 && pData[nLength - sizeof(Header) - 1] != '\0')
+        || (u64)Header.nRootFirst + Header.nRootCount > nNodes)
+        return false;
+
+    std::vector<TNode> Nodes(nNodes);
+    std::vector<u32> Children(nNodes);
+    if (nNodes > 0) {
+        memcpy(Nodes.data(), pData, nNodes * sizeof(TNode));
+        memcpy(Children.data(), pData + nNodes * sizeof(TNode), nNodes * sizeof(u32));
+    }
+    for (u64 i = 0; i < nNodes; i++) {
+        const TNode& Node = Nodes[i];
+        if ((u64)Node.nPath + Node.nNameOffset >= Header.nPool
+            || (Node.bDirectory != 0) != (i < Header.nDirectories)
+            || (Node.nParent != None && (Node.nParent >= nNodes || !Nodes[Node.nParent].bDirectory))
+            || (Node.bDirectory && (u64)Node.nFirstChild + Node.nChildCount > nNodes)
+            || Children[i] >= nNodes)
+            return false;
+    }
+
+    m_Nodes.swap(Nodes);
+    m_Children.swap(Children);
+    m_Pool.assign((const char*)pData + nNodes * (sizeof(TNode) + sizeof(u32)),
+                  (const char*)pData + nLength - sizeof(Header));
+    m_nDirectories = Header.nDirectories;
+    m_nRootFirst = Header.nRootFirst;
+    m_nRootCount = Header.nRootCount;
+    m_nRootStamp = Header.nRootStamp;
+    DropSearch();
+    return true;
+}
+
+static inline u8 Fold(char c) {
+    return (u8)tolower((unsigned char)c);
+}
+
+static inline u32 Trigram(const char* p) {
+    return (u32)Fold(p[0]) << 16 | (u32)Fold(p[1]) << 8 | Fold(p[2]);
+}
+
+void CImageIndex::BuildSearch() const {
+    // (trigram, entry) pairs, sorted: each trigram's entries end up together
+    // and in index order.
+    std::vector<u64> Pairs;
+    for (u32 i = 0; i < m_Nodes.size(); i++) {
+        const char* pName = NameOf(m_Nodes[i]);
+        const size_t nLength = strlen(pName);
+        for (size_t j = 0; j + 3 <= nLength; j++) {
+            Pairs.push_back((u64)Trigram(pName + j) << 32 | i);
+        }
+    }
+    std::sort(Pairs.begin(), Pairs.end());
+    Pairs.erase(std::unique(Pairs.begin(), Pairs.end()), Pairs.end());
+
+    m_SearchKeys.clear();
+    m_SearchFirst.clear();
+    m_SearchEntries.resize(Pairs.size());
+    for (size_t i = 0; i < Pairs.size(); i++) {
+        const u32 nKey = (u32)(Pairs[i] >> 32);
+        if (m_SearchKeys.empty() || m_SearchKeys.back() != nKey) {
+            m_SearchKeys.push_back(nKey);
+            m_SearchFirst.push_back((u32)i);
+        }
+        m_SearchEntries[i] = (u32)Pairs[i];
+    }
+    m_SearchFirst.push_back((u32)Pairs.size());
+
+    m_SearchKeys.shrink_to_fit();
+    m_SearchFirst.shrink_to_fit();
+    m_bSearchBuilt = true;
+}
+
+// A trigram index of entries that have changed is no use; give its memory
+// back rather than hold it until the next search.
+void CImageIndex::DropSearch() {
+    m_bSearchBuilt = false;
+    std::vector<u32>().swap(m_SearchKeys);
+    std::vector<u32>().swap(m_SearchFirst);
+    std::vector<u32>().swap(m_SearchEntries);
+}
+
+const u32* CImageIndex::GetPostings(u32 nKey, size_t* pCount) const {
+    auto It = std::lower_bound(m_SearchKeys.begin(), m_SearchKeys.end(), nKey);
+    if (It == m_SearchKeys.end() || *It != nKey) {
+        *pCount = 0;
+        return nullptr;
+    }
+    const size_t nKeyIndex = It - m_SearchKeys.begin();
+    *pCount = m_SearchFirst[nKeyIndex + 1] - m_SearchFirst[nKeyIndex];
+    return &m_SearchEntries[m_SearchFirst[nKeyIndex]];
+}
+
+// Where the folded pWord (nLength characters) first occurs in pText, or -1
+static int FindFolded(const char* pText, const char* pWord, size_t nLength) {
+    for (const char* p = pText; *p != '\0'; p++) {
+        size_t i = 0;
+        while (i < nLength && p[i] != '\0' && Fold(p[i]) == (u8)pWord[i])
+            i++;
+        if (i == nLength)
+            return (int)(p - pText);
+    }
+    return -1;
+}
+
+size_t CImageIndex::Search(const char* pQuery, bool bImagesOnly, u32* pResults, size_t nMax) const {
+    static const unsigned MaxWords = 8;
+    static const size_t MaxWordLength = 64;
+
+    // Words, folded
+    char Words[MaxWords][MaxWordLength];
+    size_t WordLengths[MaxWords];
+    unsigned nWords = 0;
+    for (const char* p = pQuery != nullptr ? pQuery : ""; *p != '\0' && nWords < MaxWords;) {
+        while (*p == ' ')
+            p++;
+        size_t nLength = 0;
+        while (*p != '\0' && *p != ' ') {
+            if (nLength < MaxWordLength)
+                Words[nWords][nLength++] = (char)Fold(*p);
+            p++;
+        }
+        if (nLength > 0)
+            WordLengths[nWords++] = nLength;
+    }
+    if (nWords == 0)
+        return 0;
+
+    // Candidates: the entries with the rarest trigram of any word. Words too
+    // short for a trigram leave every entry a candidate.
+    if (!m_bSearchBuilt)
+        BuildSearch();
+    const u32* pCandidates = nullptr;
+    size_t nCandidates = m_Nodes.size();
+    bool bHaveTrigram = false;
+    for (unsigned w = 0; w < nWords; w++) {
+        for (size_t j = 0; j + 3 <= WordLengths[w]; j++) {
+            size_t nCount;
+            const u32* pPostings = GetPostings(Trigram(Words[w] + j), &nCount);
+            if (!bHaveTrigram || nCount < nCandidates) {
+                pCandidates = pPostings;
+                nCandidates = nCount;
+                bHaveTrigram = true;
+            }
+        }
+    }
+
+    // Rank, then index: both fit in one sortable value
+    std::vector<u64> Matches;
+    for (size_t c = 0; c < nCandidates; c++) {
+        const u32 nIndex = bHaveTrigram ? pCandidates[c] : (u32)c;
+        const TNode& Node = m_Nodes[nIndex];
+        if (bImagesOnly && Node.bDirectory)
+            continue;
+
+        const char* pName = NameOf(Node);
+        int nFirst = FindFolded(pName, Words[0], WordLengths[0]);
+        bool bAll = nFirst >= 0;
+        for (unsigned w = 1; bAll && w < nWords; w++)
+            bAll = FindFolded(pName, Words[w], WordLengths[w]) >= 0;
+        if (!bAll)
+            continue;
+
+        u32 nRank = 2;
+        if (nFirst == 0)
+            nRank = 0;
+        else if (!isalnum((unsigned char)pName[nFirst - 1]))
+            nRank = 1;
+        Matches.push_back((u64)nRank << 32 | nIndex);
+    }
+
+    const size_t nReturned = std::min(nMax, Matches.size());
+    std::partial_sort(Matches.begin(), Matches.begin() + nReturned, Matches.end());
+    for (size_t i = 0; i < nReturned; i++)
+        pResults[i] = (u32)Matches[i];
+
+    return Matches.size();
+}
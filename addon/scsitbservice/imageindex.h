@@ -0,0 +1,197 @@
+//
+// imageindex.h
+//
+// The image library as a tree: one node per listed folder or image, each
+// relative path stored once in a shared string pool (the name is the tail of
+// its path, so it costs nothing extra), and per-folder child lists kept in
+// display order. Listing a folder is a walk over its children, and there is
+// no fixed limit on the number of entries.
+//
+// Entries are numbered in the order the library has always been listed in:
+// folders first, then images, each alphabetically by relative path. That
+// number is the index SCSITBService hands out (SetNextCD(), the toolbox), so
+// all folders come before all images and images are [GetDirectoryCount(),
+// GetCount()).
+//
+// Built in two steps: Add() every entry while scanning, then Finish(). After
+// that, Insert(), Remove(), Rename() and ReplaceFolder() apply one change on
+// the card without scanning it again: each rebuilds the index in memory
+// from the entries it already has, so indices may shift.
+//
+// Each folder (and the top level) also keeps a stamp: a hash of its
+// directory entries as the scan read them. A saved index (Save()/Load())
+// is checked against the card one folder at a time by comparing stamps,
+// and only the folders whose stamp changed are scanned again.
+//
+// Search() finds entries by name through a trigram index: for each run of
+// three characters of a name (ignoring case), the entries whose name has
+// it. A query only looks at the entries sharing its rarest trigram, so a
+// keystroke costs the same with ten images or ten thousand. The trigram
+// index is built on the first search after a change, not on every change:
+// a change rebuilds the whole index anyway (entries are renumbered), and
+// building it there too would make every upload pay for it and hold it,
+// about as big again as the rest, in a library nobody searches.
+//
+// Copyright (C) 2025 Ian Cass
+// Copyright (C) 2025 Dani Sarfati
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _scsitbservice_imageindex_h
+#define _scsitbservice_imageindex_h
+
+#include <circle/types.h>
+#include <stddef.h>
+#include <vector>
+
+class CImageIndex {
+public:
+    // Parent of top-level entries, and "not found"
+    static const u32 None = 0xFFFFFFFF;
+
+    CImageIndex();
+
+    // Building. Add() returns an id to pass as nParent for the entries of a
+    // folder; ids are only meaningful until Finish().
+    void Clear();
+    u32 Add(u32 nParent, const char* pName, u32 nSize, bool bDirectory);
+    void Finish();
+
+    void Swap(CImageIndex& Other);
+
+    // Changes to a finished index. Paths are relative ("Games/RPG/x.iso");
+    // folders missing from a new entry's path are added. Insert() of an
+    // entry already listed only updates its size; Remove() and Rename() take
+    // a folder's entries with it. False if there was nothing to change.
+    bool Insert(const char* pRelativePath, u32 nSize, bool bDirectory);
+    bool Remove(const char* pRelativePath);
+    bool Rename(const char* pFromPath, const char* pToPath);
+    // Replaces everything inside a folder with Contents, a finished index
+    // of a scan of just that folder; "" replaces the whole index. Contents
+    // is left empty.
+    void ReplaceFolder(const char* pFolderPath, CImageIndex& Contents);
+
+    // Entries by index, valid until the index is cleared or swapped out
+    size_t GetCount() const { return m_Nodes.size(); }
+    size_t GetDirectoryCount() const { return m_nDirectories; }
+    const char* GetName(size_t nIndex) const;
+    const char* GetRelativePath(size_t nIndex) const;
+    u32 GetSize(size_t nIndex) const;
+    bool IsDirectory(size_t nIndex) const;
+    u32 GetParent(size_t nIndex) const;
+
+    // The entries of a folder (None for the top level), as indices in
+    // display order. Returns nullptr for an index that is not a folder.
+    const u32* GetChildren(u32 nFolder, size_t* pCount) const;
+
+    // Folder by relative path ("" is the top level): None if there is none.
+    u32 FindFolder(const char* pRelativePath) const;
+    // Entry by relative path, matched exactly or, with bIgnoreCase, the way
+    // FatFs would. None if there is none.
+    u32 Find(const char* pRelativePath, bool bIgnoreCase = false) const;
+
+    // Bytes held, for the log
+    size_t GetMemoryUsage() const;
+
+    // Entries whose name contains every word of pQuery, ignoring case. Best
+    // first: the name starts with the first word, then a word of the name
+    // does, then anywhere; ties in index order. Up to nMax go to pResults;
+    // returns how many matched in all.
+    size_t Search(const char* pQuery, bool bImagesOnly, u32* pResults, size_t nMax) const;
+
+    // Folder stamps (None for the top level). A folder added by Insert() or
+    // Rename() has stamp 0, which a check will always find changed.
+    void SetFolderStamp(u32 nFolder, u32 nStamp);
+    u32 GetFolderStamp(u32 nFolder) const;
+    // The first folder whose path sorts after pAfterPath ("" for the first
+    // folder), or None: walks the folders in index order by path, which
+    // stays valid while the folders are rescanned.
+    u32 GetNextFolder(const char* pAfterPath) const;
+
+    // The finished index as one block, to be loaded back in one read. Load()
+    // checks the block throughout and leaves the index empty if it is not an
+    // intact one.
+    size_t GetSaveSize() const;
+    void Save(void* pBuffer) const;
+    bool Load(const void* pBuffer, size_t nLength);
+
+private:
+    struct TSaveHeader {
+        u32 nMagic;
+        u32 nVersion;
+        u32 nNodes;
+        u32 nPool;
+        u32 nDirectories;
+        u32 nRootFirst;
+        u32 nRootCount;
+        u32 nRootStamp;
+        u32 nChecksum;    // of everything after the header
+    };
+
+    struct TNode {
+        u32 nPath;        // offset of the relative path in m_Pool
+        u16 nNameOffset;  // where the name starts within the path
+        u8 bDirectory;
+        u8 nReserved;
+        u32 nSize;        // a folder's stamp
+        u32 nParent;      // index, or None
+        u32 nFirstChild;  // into m_Children (folders only)
+        u32 nChildCount;
+    };
+
+    const char* PathOf(const TNode& Node) const { return &m_Pool[Node.nPath]; }
+    const char* NameOf(const TNode& Node) const { return &m_Pool[Node.nPath] + Node.nNameOffset; }
+
+    // Index of the child of nFolder called pName (nLength characters).
+    u32 FindChild(u32 nFolder, const char* pName, size_t nLength, bool bDirectory, bool bIgnoreCase) const;
+
+    u32 Add(u32 nParent, const char* pName, size_t nNameLength, u32 nSize, bool bDirectory);
+
+    // True if nIndex is nFolder or inside it
+    bool Contains(u32 nFolder, u32 nIndex) const;
+
+    // For the changes: a new index is built from Source, a finished one.
+    // AddFrom() adds Source's entries and its top-level stamp, leaving out
+    // nSkip and its entries (or just its entries, with bKeepSkipped); Map
+    // gets each one's new id.
+    // AddFolders() then finds or adds the folder at the first nLength
+    // characters of pFolderPath, returning its id in *pFolder.
+    void AddFrom(const CImageIndex& Source, u32 nSkip, bool bKeepSkipped, std::vector<u32>& Map);
+    bool AddFolders(const CImageIndex& Source, const std::vector<u32>& Map,
+                    const char* pFolderPath, size_t nLength, u32* pFolder);
+
+    void BuildSearch() const;
+    void DropSearch();
+    // The entries with trigram nKey, in index order
+    const u32* GetPostings(u32 nKey, size_t* pCount) const;
+
+private:
+    std::vector<char> m_Pool;
+    std::vector<TNode> m_Nodes;
+    std::vector<u32> m_Children;
+    size_t m_nDirectories;
+    u32 m_nRootFirst;
+    u32 m_nRootCount;
+    u32 m_nRootStamp;
+
+    // Trigram index: entries of m_SearchKeys[i] are m_SearchEntries from
+    // m_SearchFirst[i] to m_SearchFirst[i + 1]. Built on demand, by
+    // Search(); it does not yield, so no other task sees it half built.
+    mutable bool m_bSearchBuilt;
+    mutable std::vector<u32> m_SearchKeys;
+    mutable std::vector<u32> m_SearchFirst;
+    mutable std::vector<u32> m_SearchEntries;
+};
+
+#endif
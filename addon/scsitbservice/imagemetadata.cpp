@@ -0,0 +1,179 @@
+//
+// imagemetadata.cpp
+//
+// Copyright (C) 2025 Ian Cass
+// Copyright (C) 2025 Dani Sarfati
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include "imagemetadata.h"
+#include "imageindex.h"
+
+#include <string.h>
+
+static const u32 SaveMagic = 0x54454D55;  // "UMET"
+static const u32 SaveVersion = 1;
+
+static u32 Checksum(const u8* pData, size_t nLength) {
+    u32 nHash = 2166136261u;  // FNV-1a
+    for (size_t i = 0; i < nLength; i++) {
+        nHash ^= pData[i];
+        nHash *= 16777619u;
+    }
+    return nHash;
+}
+
+CImageMetadata::CImageMetadata() {
+}
+
+const CImageMetadata::TRecord* CImageMetadata::Find(const char* pRelativePath) const {
+    auto It = m_Entries.find(pRelativePath);
+    return It != m_Entries.end() ? &It->second.Record : nullptr;
+}
+
+void CImageMetadata::Set(const char* pRelativePath, const TRecord& Record) {
+    TEntry& Entry = m_Entries[pRelativePath];
+    Entry.Record = Record;
+    Entry.bChecked = true;
+}
+
+bool CImageMetadata::IsChecked(const char* pRelativePath) const {
+    auto It = m_Entries.find(pRelativePath);
+    return It != m_Entries.end() && It->second.bChecked;
+}
+
+void CImageMetadata::MarkChecked(const char* pRelativePath) {
+    auto It = m_Entries.find(pRelativePath);
+    if (It != m_Entries.end())
+        It->second.bChecked = true;
+}
+
+void CImageMetadata::Rename(const char* pFromPath, const char* pToPath) {
+    const std::string From(pFromPath);
+    const std::string Prefix = From + "/";
+
+    // The folder's records sort right after it (or right after its prefix)
+    std::vector<std::pair<std::string, TEntry>> Moved;
+    for (auto It = m_Entries.lower_bound(From); It != m_Entries.end();) {
+        if (It->first != From && It->first.compare(0, Prefix.size(), Prefix) != 0) {
+            if (It->first.compare(0, From.size(), From) != 0)
+                break;
+            ++It;  // "Games A" between "Games" and "Games/"
+            continue;
+        }
+        Moved.emplace_back(pToPath + It->first.substr(From.size()), It->second);
+        It = m_Entries.erase(It);
+    }
+    for (auto& Entry : Moved)
+        m_Entries[Entry.first] = Entry.second;
+}
+
+void CImageMetadata::Prune(const CImageIndex& Index) {
+    for (auto It = m_Entries.begin(); It != m_Entries.end();) {
+        u32 nFound = Index.Find(It->first.c_str());
+        if (nFound == CImageIndex::None || Index.IsDirectory(nFound))
+            It = m_Entries.erase(It);
+        else
+            ++It;
+    }
+}
+
+void CImageMetadata::Save(std::vector<u8>& Buffer) const {
+    size_t nPool = 0;
+    for (const auto& Entry : m_Entries)
+        nPool += Entry.first.size() + 1;
+
+    const size_t nRecords = m_Entries.size();
+    Buffer.assign(sizeof(TSaveHeader) + nRecords * sizeof(TSavedRecord) + nPool, 0);
+    u8* pRecords = Buffer.data() + sizeof(TSaveHeader);
+    char* pPool = (char*)pRecords + nRecords * sizeof(TSavedRecord);
+
+    size_t i = 0;
+    u32 nPath = 0;
+    for (const auto& Entry : m_Entries) {
+        const TRecord& Record = Entry.second.Record;
+        TSavedRecord Saved;
+        memset(&Saved, 0, sizeof(Saved));
+        Saved.nPath = nPath;
+        Saved.nFileSizeLow = (u32)Record.nFileSize;
+        Saved.nFileSizeHigh = (u32)(Record.nFileSize >> 32);
+        Saved.nFileTime = Record.nFileTime;
+        Saved.nDiscFrames = Record.Info.discFrames;
+        Saved.nAudioFrames = Record.Info.audioFrames;
+        Saved.bValid = Record.bValid;
+        Saved.nPlatform = (u8)Record.Info.platform;
+        Saved.nTracks = Record.Info.numTracks;
+        Saved.nAudioTracks = Record.Info.numAudioTracks;
+        memcpy(Saved.Label, Record.Info.volumeLabel, sizeof(Record.Info.volumeLabel));
+        memcpy(pRecords + i++ * sizeof(TSavedRecord), &Saved, sizeof(Saved));
+
+        memcpy(pPool + nPath, Entry.first.c_str(), Entry.first.size() + 1);
+        nPath += Entry.first.size() + 1;
+    }
+
+    TSaveHeader Header;
+    Header.nMagic = SaveMagic;
+    Header.nVersion = SaveVersion;
+    Header.nRecords = (u32)nRecords;
+    Header.nPool = (u32)nPool;
+    Header.nChecksum = Checksum(Buffer.data() + sizeof(Header), Buffer.size() - sizeof(Header));
+    memcpy(Buffer.data(), &Header, sizeof(Header));
+}
+
+bool CImageMetadata::Load(const void* pBuffer, size_t nLength) {
+    m_Entries.clear();
+
+    TSaveHeader Header;
+    if (pBuffer == nullptr || nLength < sizeof(Header))
+        return false;
+    memcpy(&Header, pBuffer, sizeof(Header));
+    if (Header.nMagic != SaveMagic || Header.nVersion != SaveVersion)
+        return false;
+
+    const u64 nRecords = Header.nRecords;
+    if (sizeof(Header) + nRecords * sizeof(TSavedRecord) + Header.nPool != nLength)
+        return false;
+    const u8* pData = (const u8*)pBuffer + sizeof(Header);
+    if (Checksum(pData, nLength - sizeof(Header)) != Header.nChecksum)
+        return false;
+
+    const char* pPool = (const char*)pData + nRecords * sizeof(TSavedRecord);
+    if (Header.nPool > 0 && pPool[Header.nPool - 1] != '\0')
+        return false;
+
+    std::map<std::string, TEntry> Entries;
+    for (u64 i = 0; i < nRecords; i++) {
+        TSavedRecord Saved;
+        memcpy(&Saved, pData + i * sizeof(TSavedRecord), sizeof(Saved));
+        if (Saved.nPath >= Header.nPool || Saved.nPlatform > (u8)ImagePlatform::CDI)
+            return false;
+
+        TEntry Entry;
+        memset(&Entry, 0, sizeof(Entry));
+        Entry.Record.nFileSize = (u64)Saved.nFileSizeHigh << 32 | Saved.nFileSizeLow;
+        Entry.Record.nFileTime = Saved.nFileTime;
+        Entry.Record.bValid = Saved.bValid != 0;
+        Entry.Record.Info.platform = (ImagePlatform)Saved.nPlatform;
+        Entry.Record.Info.numTracks = Saved.nTracks;
+        Entry.Record.Info.numAudioTracks = Saved.nAudioTracks;
+        Entry.Record.Info.discFrames = Saved.nDiscFrames;
+        Entry.Record.Info.audioFrames = Saved.nAudioFrames;
+        memcpy(Entry.Record.Info.volumeLabel, Saved.Label, sizeof(Entry.Record.Info.volumeLabel) - 1);
+        Entry.bChecked = false;
+        Entries[pPool + Saved.nPath] = Entry;
+    }
+
+    m_Entries.swap(Entries);
+    return true;
+}
@@ -0,0 +1,105 @@
+//
+// imagemetadata.h
+//
+// What each image in the library holds (volume label, platform, tracks,
+// audio length; see discimage/imageinfo.h), by relative path. Reading it
+// means opening the image, so SCSITBService's metadata task fills this in
+// the background and it is saved to the card; an entry is read again only
+// when the image's size or timestamp changes.
+//
+// Kept beside CImageIndex rather than in it: the index renumbers its
+// entries on every change, and a path stays put unless it is renamed.
+//
+// Copyright (C) 2025 Ian Cass
+// Copyright (C) 2025 Dani Sarfati
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _scsitbservice_imagemetadata_h
+#define _scsitbservice_imagemetadata_h
+
+#include <circle/types.h>
+#include <discimage/imageinfo.h>
+#include <stddef.h>
+#include <map>
+#include <string>
+#include <vector>
+
+class CImageIndex;
+
+class CImageMetadata {
+public:
+    struct TRecord {
+        u64 nFileSize;   // of the image file when it was read
+        u32 nFileTime;   // FatFs fdate << 16 | ftime
+        bool bValid;     // false if the image would not open
+        ImageInfo Info;
+    };
+
+    CImageMetadata();
+
+    // nullptr if the image has not been read
+    const TRecord* Find(const char* pRelativePath) const;
+
+    // A record set or confirmed since boot counts as checked; the rest are
+    // what the metadata task still has to look at.
+    void Set(const char* pRelativePath, const TRecord& Record);
+    bool IsChecked(const char* pRelativePath) const;
+    void MarkChecked(const char* pRelativePath);
+
+    // Moves a record, or every record inside a folder
+    void Rename(const char* pFromPath, const char* pToPath);
+    // Drops the records of images the index no longer lists
+    void Prune(const CImageIndex& Index);
+
+    size_t GetCount() const { return m_Entries.size(); }
+
+    // The records as one block; Load() leaves the store empty if the block
+    // is not an intact one.
+    void Save(std::vector<u8>& Buffer) const;
+    bool Load(const void* pBuffer, size_t nLength);
+
+private:
+    struct TEntry {
+        TRecord Record;
+        bool bChecked;
+    };
+
+    struct TSaveHeader {
+        u32 nMagic;
+        u32 nVersion;
+        u32 nRecords;
+        u32 nPool;
+        u32 nChecksum;    // of everything after the header
+    };
+
+    struct TSavedRecord {
+        u32 nPath;        // offset of the relative path in the pool
+        u32 nFileSizeLow;
+        u32 nFileSizeHigh;
+        u32 nFileTime;
+        u32 nDiscFrames;
+        u32 nAudioFrames;
+        u8 bValid;
+        u8 nPlatform;
+        u8 nTracks;
+        u8 nAudioTracks;
+        char Label[36];
+    };
+
+private:
+    std::map<std::string, TEntry> m_Entries;
+};
+
+#endif
@@ -24,23 +24,53 @@
 #include <circle/logger.h>
 #include "scsitbservice.h"
 #include <circle/sched/scheduler.h>
+#include <circle/synchronize.h>
 #include <cstdlib>
 #include <string.h>
 #include <ctype.h>
 #include <assert.h>
 #include <discimage/cuebinfile.h>
 #include <discimage/cuedevice.h>
+#include <discimage/mountmanifest.h>
 #include <discimage/util.h>
+#include <discimage/volumewarmup.h>
+#include <circle/timer.h>
+#include <scsitbservice/discset.h>
+#include <ioscheduler/ioscheduler.h>
+#include <tracelab/boottimeline.h>
+#include <vector>
 
 LOGMODULE("scsitbservice");
 
-static size_t my_strnlen(const char *s, size_t maxlen) {
-    size_t i;
-    for (i = 0; i < maxlen; i++) {
-        if (s[i] == '\0') break;
-    }
-    return i;
-}
+// The image index saved at the end of each change, so the next boot can list
+// the library straight away and check it against the card in the background.
+#define INDEX_CACHE_FILE "0:/usbode-index.bin"
+#define INDEX_CACHE_TEMP "0:/usbode-index.tmp"
+
+// Changes settle this long before the index is saved again
+#define INDEX_SAVE_DELAY_US 3000000
+
+// How long each Run() pass may spend checking saved folders against the card
+#define INDEX_CHECK_SLICE_US 20000
+
+// What each image holds, saved when a pass of the metadata task read anything
+#define METADATA_CACHE_FILE "0:/usbode-meta.bin"
+#define METADATA_CACHE_TEMP "0:/usbode-meta.tmp"
+
+// What mounting each CUE/BIN image worked out, so the next mount is one read.
+// The metadata task's loads write them for new and changed images.
+#define MOUNT_MANIFEST_DIR "0:/usbode-mount"
+
+// An .m3u longer than this is not a disc set's playlist
+#define PLAYLIST_MAX_SIZE 8192
+
+// The metadata task's pace: between images, once the library has all been
+// read, and while real-time reads have the card
+#define METADATA_STEP_MS 20
+#define METADATA_IDLE_MS 2000
+#define METADATA_BACKOFF_MS 100
+
+static bool WriteCacheFile(const char* path, const char* tempPath, const std::vector<u8>& data);
 
 static bool iequals(const char* a, const char* b) {
     while (*a && *b) {
@@ -51,23 +81,103 @@ static bool iequals(const char* a, const char* b) {
     return *a == *b;
 }
 
-int compareFileEntries(const void* a, const void* b) {
-    const FileEntry* fa = (const FileEntry*)a;
-    const FileEntry* fb = (const FileEntry*)b;
-    return strcasecmp(fa->name, fb->name);
+// Hidden files and folders, Mac cache files and system folders
+static bool IsExcludedName(const char* name) {
+    if (name[0] == '.')
+        return true;
+    return strcasecmp(name, "System Volume Information") == 0 ||
+           strcasecmp(name, "$RECYCLE.BIN") == 0 ||
+           strcasecmp(name, "RECYCLER") == 0 ||
+           strcasecmp(name, "lost+found") == 0;
+}
+
+static bool IsListedImage(const char* name) {
+    const char* ext = strrchr(name, '.');
+    if (ext == nullptr)
+        return false;
+    // A .cue even with no same-stem .bin, which also hid split-track rips.
+    // Never a .bin: mounting reads the .cue first, so a .bin is either
+    // unmountable or already represented by that cue.
+    return iequals(ext, ".iso") || iequals(ext, ".mds") ||
+           iequals(ext, ".chd") || iequals(ext, ".toast") ||
+           iequals(ext, ".cue");
+}
+
+// "1:/Games//RPG/" -> "Games/RPG"; false for a path on another volume or one
+// with an excluded folder or name in it.
+static bool ToIndexPath(const char* path, char* out, size_t outSize) {
+    if (path == nullptr || outSize == 0)
+        return false;
+    const char* colon = strchr(path, ':');
+    if (colon != nullptr) {
+        if (colon != path + 1 || path[0] != '1')
+            return false;
+        path = colon + 1;
+    }
+
+    size_t len = 0;
+    const char* component = path;
+    for (const char* p = path; ; ++p) {
+        if (*p == '/' || *p == '\0') {
+            size_t componentLen = p - component;
+            if (componentLen > 0) {
+                if (len + componentLen + 2 > outSize)
+                    return false;
+                if (len > 0)
+                    out[len++] = '/';
+                memcpy(out + len, component, componentLen);
+                out[len + componentLen] = '\0';
+                if (IsExcludedName(out + len))
+                    return false;
+                len += componentLen;
+            }
+            if (*p == '\0')
+                break;
+            component = p + 1;
+        }
+    }
+    out[len] = '\0';
+    return true;
 }
 
-// Sort directories first, then files alphabetically by full path
-int compareFileEntriesDirectoriesFirst(const void* a, const void* b) {
-    const FileEntry* fa = (const FileEntry*)a;
-    const FileEntry* fb = (const FileEntry*)b;
+// A folder's stamp is a hash of every entry f_readdir() returns for it, listed
+// or not, so any file written, added, removed or renamed in it changes it.
+// FAT does not update a folder's own timestamp when its contents change.
+static const u32 StampSeed = 2166136261u;
+
+static u32 StampEntry(u32 stamp, const FILINFO& fno) {
+    auto mix = [&stamp](const void* data, size_t len) {
+        const u8* p = (const u8*)data;
+        for (size_t i = 0; i < len; i++) {
+            stamp ^= p[i];
+            stamp *= 16777619u;  // FNV-1a
+        }
+    };
+    u64 size = fno.fsize;
+    mix(fno.fname, strlen(fno.fname) + 1);
+    mix(&size, sizeof(size));
+    mix(&fno.fdate, sizeof(fno.fdate));
+    mix(&fno.ftime, sizeof(fno.ftime));
+    mix(&fno.fattrib, sizeof(fno.fattrib));
+    return stamp;
+}
 
-    // Directories come first
-    if (fa->isDirectory && !fb->isDirectory) return -1;
-    if (!fa->isDirectory && fb->isDirectory) return 1;
+static bool ReadDirectoryStamp(const char* fullPath, u32* stamp) {
+    DIR dir;
+    if (f_opendir(&dir, fullPath) != FR_OK)
+        return false;
+    FILINFO fno;
+    *stamp = StampSeed;
+    FRESULT fr;
+    while ((fr = f_readdir(&dir, &fno)) == FR_OK && fno.fname[0] != 0)
+        *stamp = StampEntry(*stamp, fno);
+    f_closedir(&dir);
+    return fr == FR_OK;
+}
 
-    // Within same type, sort alphabetically by full path (case-insensitive)
-    return strcasecmp(fa->relativePath, fb->relativePath);
+static const char* NameOf(const char* relativePath) {
+    const char* slash = strrchr(relativePath, '/');
+    return slash != nullptr ? slash + 1 : relativePath;
 }
 
 SCSITBService *SCSITBService::s_pThis = 0;
@@ -84,9 +194,10 @@ SCSITBService::SCSITBService()
     configservice = static_cast<ConfigService*>(CScheduler::Get()->GetTask("configservice"));
     assert(cdromservice != nullptr && "Failed to get cdromservice");
 
-    m_FileEntries = new FileEntry[MAX_FILES]();
     m_CurrentImagePath[0] = '\0';  // Initialize empty path
 
+    CMountManifest::SetDirectory(MOUNT_MANIFEST_DIR);
+
     // Read the persisted eject state once at startup, before anything can mount.
     // If the drive was ejected when last powered off, come up as an empty drive:
     // the remembered image still loads (so the gadget knows the geometry and
@@ -103,45 +214,160 @@ SCSITBService::SCSITBService()
         }
     }
 
-    bool ok = RefreshCache();
-    assert(ok && "Failed to refresh SCSITBService on construction");
+    // The index saved last time makes the library usable at once; Run()
+    // then checks it against the card. Without one, scan it all now.
+    CImageIndex saved;
+    if (LoadIndexCache(saved)) {
+        ApplyIndex(saved);
+        m_bIndexDirty = false;  // it is what is on the card already
+        m_bCheckingIndex = true;
+    } else {
+        bool ok = RefreshCache();
+        assert(ok && "Failed to refresh SCSITBService on construction");
+    }
+    LoadMetadataCache();
 
     SetName("scsitbservice");
 }
 
 SCSITBService::~SCSITBService() {
-    delete[] m_FileEntries;
-    m_FileEntries = nullptr;
+    m_Lock.Acquire();
+    DropStandby(true);
+    m_Lock.Release();
 }
 
 size_t SCSITBService::GetCount() const {
-    return m_FileCount;
+    return m_Index.GetCount();
+}
+
+size_t SCSITBService::GetDirectoryCount() const {
+    return m_Index.GetDirectoryCount();
 }
 
 const char* SCSITBService::GetName(size_t index) const {
-    if (index >= m_FileCount)
-        return nullptr;
-    return m_FileEntries[index].name;
+    return m_Index.GetName(index);
 }
 
 const char* SCSITBService::GetRelativePath(size_t index) const {
-    if (index >= m_FileCount)
-        return nullptr;
-    return m_FileEntries[index].relativePath;
+    return m_Index.GetRelativePath(index);
 }
 
 DWORD SCSITBService::GetSize(size_t index) const {
-    if (index >= m_FileCount)
-        return 0;
-    return m_FileEntries[index].size;
+    return m_Index.GetSize(index);
 }
 
-FileEntry* SCSITBService::begin() { return m_FileEntries; }
-FileEntry* SCSITBService::end() { return m_FileEntries + m_FileCount; }
-const FileEntry* SCSITBService::GetFileEntry(size_t index) const {
-    if (index >= m_FileCount)
-        return nullptr;
-    return &m_FileEntries[index];
+const u32* SCSITBService::GetFolderEntries(const char* folderPath, size_t* count) const {
+    u32 folder = CImageIndex::None;
+    if (folderPath != nullptr && folderPath[0] != '\0') {
+        folder = m_Index.FindFolder(folderPath);
+        if (folder == CImageIndex::None) {
+            *count = 0;
+            return nullptr;
+        }
+    }
+    return m_Index.GetChildren(folder, count);
+}
+
+size_t SCSITBService::Search(const char* query, bool imagesOnly, u32* results, size_t max) const {
+    return m_Index.Search(query, imagesOnly, results, max);
+}
+
+bool SCSITBService::GetImageInfo(size_t index, ImageInfo* info) const {
+    m_Lock.Acquire();
+    const CImageMetadata::TRecord* record = nullptr;
+    if (index < m_Index.GetCount() && !m_Index.IsDirectory(index))
+        record = m_Metadata.Find(m_Index.GetRelativePath(index));
+    bool known = record != nullptr && record->bValid;
+    if (known)
+        *info = record->Info;
+    m_Lock.Release();
+    return known;
+}
+
+bool SCSITBService::UpdateMetadataStep() {
+    char relativePath[MAX_PATH_LEN];
+    CImageMetadata::TRecord record;
+    bool haveRecord = false;
+
+    m_Lock.Acquire();
+    // A saved index still being checked may list images that are gone
+    if (m_bCheckingIndex) {
+        m_Lock.Release();
+        return false;
+    }
+    if (m_nMetadataGeneration != m_nIndexGeneration) {
+        m_nMetadataGeneration = m_nIndexGeneration;
+        m_nMetadataCursor = m_Index.GetDirectoryCount();
+    }
+    while (m_nMetadataCursor < m_Index.GetCount() &&
+           m_Metadata.IsChecked(m_Index.GetRelativePath(m_nMetadataCursor)))
+        m_nMetadataCursor++;
+
+    // All read: save what changed, and what is no longer listed goes
+    if (m_nMetadataCursor >= m_Index.GetCount()) {
+        std::vector<u8> data;
+        bool save = m_bMetadataDirty;
+        if (save) {
+            m_Metadata.Prune(m_Index);
+            m_Metadata.Save(data);
+            m_bMetadataDirty = false;
+        }
+        m_Lock.Release();
+        if (save && WriteCacheFile(METADATA_CACHE_FILE, METADATA_CACHE_TEMP, data))
+            LOGNOTE("SCSITBService: saved metadata, %u bytes", (unsigned)data.size());
+        return false;
+    }
+
+    strncpy(relativePath, m_Index.GetRelativePath(m_nMetadataCursor), sizeof(relativePath) - 1);
+    relativePath[sizeof(relativePath) - 1] = '\0';
+    m_nMetadataCursor++;
+    const CImageMetadata::TRecord* known = m_Metadata.Find(relativePath);
+    if (known != nullptr) {
+        record = *known;
+        haveRecord = true;
+    }
+    m_Lock.Release();
+
+    // Gone since it was listed: the index will catch up
+    char fullPath[MAX_PATH_LEN + 3];
+    snprintf(fullPath, sizeof(fullPath), "1:/%s", relativePath);
+    FILINFO fno;
+    if (f_stat(fullPath, &fno) != FR_OK)
+        return true;
+
+    const u32 fileTime = (u32)fno.fdate << 16 | fno.ftime;
+    if (haveRecord && record.nFileSize == fno.fsize && record.nFileTime == fileTime) {
+        m_Lock.Acquire();
+        m_Metadata.MarkChecked(relativePath);
+        m_Lock.Release();
+        return true;
+    }
+
+    CIOScheduler::Get()->WaitForTurn(IOClassMetadata);
+    memset(&record, 0, sizeof(record));
+    record.nFileSize = fno.fsize;
+    record.nFileTime = fileTime;
+    IImageDevice* device = loadImageDevice(fullPath);
+    if (device != nullptr) {
+        record.bValid = readImageInfo(device, &record.Info);
+        delete device;
+    }
+    // The cue sheet or header and the two sectors read for the label
+    CIOScheduler::Get()->Account(IOClassMetadata, 2 * 2352);
+
+    m_Lock.Acquire();
+    m_Metadata.Set(relativePath, record);
+    m_bMetadataDirty = true;
+    m_Lock.Release();
+
+    if (record.bValid) {
+        LOGNOTE("SCSITBService: %s is %s \"%s\", %d tracks", relativePath,
+                getImagePlatformName(record.Info.platform), record.Info.volumeLabel,
+                (int)record.Info.numTracks);
+    } else {
+        LOGWARN("SCSITBService: can't read metadata of %s", relativePath);
+    }
+    return true;
 }
 
 size_t SCSITBService::GetCurrentCD() {
@@ -149,9 +375,7 @@ size_t SCSITBService::GetCurrentCD() {
 }
 
 bool SCSITBService::IsDirectory(size_t index) const {
-    if (index >= m_FileCount)
-        return false;
-    return m_FileEntries[index].isDirectory;
+    return m_Index.IsDirectory(index);
 }
 
 const char* SCSITBService::GetCurrentCDPath() const {
@@ -186,7 +410,7 @@ const char* SCSITBService::GetCurrentCDFolder() const {
 }
 
 void SCSITBService::GetFullPath(size_t index, char* outPath, size_t maxLen, const char* basePath) const {
-    if (index >= m_FileCount || outPath == nullptr || maxLen == 0) {
+    if (index >= m_Index.GetCount() || outPath == nullptr || maxLen == 0) {
         if (outPath && maxLen > 0)
             outPath[0] = '\0';
         return;
@@ -194,19 +418,24 @@ void SCSITBService::GetFullPath(size_t index, char* outPath, size_t maxLen, cons
 
     // Construct: "1:/" + basePath + name
     if (basePath == nullptr || basePath[0] == '\0') {
-        snprintf(outPath, maxLen, "1:/%s", m_FileEntries[index].name);
+        snprintf(outPath, maxLen, "1:/%s", m_Index.GetName(index));
     } else {
         // Ensure basePath doesn't have leading slash
         while (*basePath == '/')
             basePath++;
-        snprintf(outPath, maxLen, "1:/%s%s", basePath, m_FileEntries[index].name);
+        snprintf(outPath, maxLen, "1:/%s%s", basePath, m_Index.GetName(index));
     }
 }
 
 bool SCSITBService::SetNextCD(size_t cd) {
-    //TODO bounds checking
-    next_cd = cd;
-    return true;
+    // Bounds are checked when the request is taken, against the list as it
+    // is then.
+    EnterCritical();
+    bool queued = m_MountRequests.Put((int)cd);
+    LeaveCritical();
+    if (!queued)
+        LOGWARN("SCSITBService::SetNextCD() dropped request for %u, mount still pending", (unsigned)cd);
+    return queued;
 }
 
 void SCSITBService::SetPendingEject() {
@@ -234,25 +463,19 @@ const char* SCSITBService::GetCurrentCDName() {
 }
 
 bool SCSITBService::SetNextCDByName(const char* file_name) {
-
-	int index = 0;
-        for (const FileEntry* it = begin(); it != end(); ++it, ++index) {
-		//LOGNOTE("SCSITBService::SetNextCDByName testing %s", it->relativePath);
-                // Compare against relativePath to support files in subfolders
-                if (strcmp(file_name, it->relativePath) == 0) {
-                        return SetNextCD(index);
-                }
-        }
-
-	return false;
+    // Compare against the relative path to support files in subfolders
+    u32 index = m_Index.Find(file_name);
+    if (index == CImageIndex::None)
+        return false;
+    return SetNextCD(index);
 }
 
 // SetNextCDByPath removed - use SetNextCDByName with relativePath instead
 
 
-// Recursive scanner that stores full relative paths
-void SCSITBService::ScanDirectoryRecursive(const char* fullPath, const char* relativePath) {
-    LOGNOTE("SCSITBService::ScanDirectoryRecursive() scanning: %s (relative: %s)", fullPath, relativePath);
+// Recursive scanner; the index builds each relative path from the parent's
+void SCSITBService::ScanDirectoryRecursive(CImageIndex& index, const char* fullPath, u32 parent) {
+    LOGNOTE("SCSITBService::ScanDirectoryRecursive() scanning: %s", fullPath);
 
     DIR dir;
     FRESULT fr = f_opendir(&dir, fullPath);
@@ -262,95 +485,60 @@ void SCSITBService::ScanDirectoryRecursive(const char* fullPath, const char* rel
     }
 
     FILINFO fno;
+    u32 stamp = StampSeed;
     while (true) {
         fr = f_readdir(&dir, &fno);
         if (fr != FR_OK || fno.fname[0] == 0)
             break;
+        stamp = StampEntry(stamp, fno);
 
         if (strcmp(fno.fname, ".") == 0 || strcmp(fno.fname, "..") == 0)
             continue;
 
-        // Exclude hidden files/folders
-        if (fno.fname[0] == '.')
+        if (IsExcludedName(fno.fname))
             continue;
 
-        // Exclude Mac cache files
-        if (strncmp(fno.fname, "._", 2) == 0)
-            continue;
-
-        // Exclude system folders
-        if (strcasecmp(fno.fname, "System Volume Information") == 0 ||
-            strcasecmp(fno.fname, "$RECYCLE.BIN") == 0 ||
-            strcasecmp(fno.fname, "RECYCLER") == 0 ||
-            strcasecmp(fno.fname, "lost+found") == 0)
-            continue;
-
-        if (m_FileCount >= MAX_FILES) {
-            LOGERR("SCSITBService: MAX_FILES limit reached!");
-            break;
-        }
-
-        // Build relative path for this entry
-        char entryRelativePath[MAX_PATH_LEN];
-        if (relativePath[0] == '\0') {
-            snprintf(entryRelativePath, sizeof(entryRelativePath), "%s", fno.fname);
-        } else {
-            snprintf(entryRelativePath, sizeof(entryRelativePath), "%s/%s", relativePath, fno.fname);
-        }
-
         if (fno.fattrib & AM_DIR) {
             // Store folder entry
-            size_t len = my_strnlen(fno.fname, MAX_FILENAME_LEN - 1);
-            memcpy(m_FileEntries[m_FileCount].name, fno.fname, len);
-            m_FileEntries[m_FileCount].name[len] = '\0';
-            
-            size_t pathLen = my_strnlen(entryRelativePath, MAX_PATH_LEN - 1);
-            memcpy(m_FileEntries[m_FileCount].relativePath, entryRelativePath, pathLen);
-            m_FileEntries[m_FileCount].relativePath[pathLen] = '\0';
-            
-            m_FileEntries[m_FileCount].size = 0;
-            m_FileEntries[m_FileCount].isDirectory = true;
-            m_FileCount++;
+            u32 folder = index.Add(parent, fno.fname, 0, true);
+            if (folder == CImageIndex::None)
+                continue;
 
             // Recurse into subdirectory
             char subFullPath[MAX_PATH_LEN];
             snprintf(subFullPath, sizeof(subFullPath), "%s/%s", fullPath, fno.fname);
-            ScanDirectoryRecursive(subFullPath, entryRelativePath);
-        } else {
-            // Check for image files
-            const char* ext = strrchr(fno.fname, '.');
-            if (ext != nullptr) {
-                bool listIt = iequals(ext, ".iso") || iequals(ext, ".mds") ||
-                              iequals(ext, ".chd") || iequals(ext, ".toast");
-                if (!listIt && iequals(ext, ".cue")) {
-                    // Even with no same-stem .bin, which also hid split-track rips.
-                    listIt = true;
-                }
-                // Never a .bin: mounting reads the .cue first, so a .bin is either
-                // unmountable or already represented by that cue.
-                if (listIt) {
-                    size_t len = my_strnlen(fno.fname, MAX_FILENAME_LEN - 1);
-                    memcpy(m_FileEntries[m_FileCount].name, fno.fname, len);
-                    m_FileEntries[m_FileCount].name[len] = '\0';
-                    
-                    size_t pathLen = my_strnlen(entryRelativePath, MAX_PATH_LEN - 1);
-                    memcpy(m_FileEntries[m_FileCount].relativePath, entryRelativePath, pathLen);
-                    m_FileEntries[m_FileCount].relativePath[pathLen] = '\0';
-                    
-                    m_FileEntries[m_FileCount].size = fno.fsize;
-                    m_FileEntries[m_FileCount].isDirectory = false;
-                    m_FileCount++;
-                }
-            }
+            ScanDirectoryRecursive(index, subFullPath, folder);
+        } else if (IsListedImage(fno.fname)) {
+            index.Add(parent, fno.fname, (u32)fno.fsize, false);
         }
     }
 
     f_closedir(&dir);
+
+    // A folder that could not be read to the end keeps stamp 0, so the next
+    // check scans it again.
+    index.SetFolderStamp(parent, fr == FR_OK ? stamp : 0);
 }
 
 // Original RefreshCache for backwards compatibility and startup
 bool SCSITBService::RefreshCache() {
     LOGNOTE("SCSITBService::RefreshCache() called");
+
+    // Scan entire tree recursively into a new index. Only swapping it in
+    // needs the lock, so a mount is not held up behind the scan.
+    CImageIndex index;
+    ScanDirectoryRecursive(index, "1:/", CImageIndex::None);
+    index.Finish();
+
+    ApplyIndex(index);
+
+    // A full scan supersedes any check of the saved index
+    m_bCheckingIndex = false;
+    return true;
+}
+
+// Installs a new index and works out which image to mount from it
+void SCSITBService::ApplyIndex(CImageIndex& index) {
     m_Lock.Acquire();
 
     // Get current loaded image from config
@@ -368,50 +556,25 @@ bool SCSITBService::RefreshCache() {
         }
     }
 
-    // Scan entire tree recursively
-    m_FileCount = 0;
-    ScanDirectoryRecursive("1:/", "");
-    
-    // Sort all entries: directories first, then alphabetically
-    if (m_FileCount > 1) {
-        qsort(m_FileEntries, m_FileCount, sizeof(FileEntry), compareFileEntriesDirectoriesFirst);
-    }
-    
-    LOGNOTE("SCSITBService::RefreshCache() Found %d total entries", (int)m_FileCount);
-
-    // The list was just rebuilt, so re-derive current_cd from the mounted path.
-    {
-        int resolved = -1;
-        if (m_MountedRelativePath[0] != '\0') {
-            for (size_t i = 0; i < m_FileCount; ++i) {
-                if (!m_FileEntries[i].isDirectory &&
-                    strcmp(m_FileEntries[i].relativePath, m_MountedRelativePath) == 0) {
-                    resolved = (int)i;
-                    break;
-                }
-            }
-        }
-        if (resolved != current_cd) {
-            LOGNOTE("SCSITBService::RefreshCache() current index %d -> %d after rescan",
-                    current_cd, resolved);
-        }
-        current_cd = resolved;
-    }
+    m_Index.Swap(index);
+
+    LOGNOTE("SCSITBService: index has %d total entries (%u bytes)",
+            (int)m_Index.GetCount(), (unsigned)m_Index.GetMemoryUsage());
+
+    ResolveMountedIndex();
 
     // Find the current image in cache by matching relative path
     const char* searchPath = current_image;
     bool found = false;
     
     if (searchPath && searchPath[0] != '\0') {
-        for (size_t i = 0; i < m_FileCount; ++i) {
-            if (!m_FileEntries[i].isDirectory && strcmp(m_FileEntries[i].relativePath, searchPath) == 0) {
-                if (current_cd < 0) {
-                    next_cd = i;
-                }
-                found = true;
-                LOGNOTE("SCSITBService::RefreshCache() Found current image at index %d", (int)i);
-                break;
+        u32 i = m_Index.Find(searchPath);
+        if (i != CImageIndex::None && !m_Index.IsDirectory(i)) {
+            if (current_cd < 0) {
+                next_cd = i;
             }
+            found = true;
+            LOGNOTE("SCSITBService::RefreshCache() Found current image at index %d", (int)i);
         }
     }
 
@@ -424,16 +587,14 @@ bool SCSITBService::RefreshCache() {
             char cuePath[MAX_PATH_LEN];
             memcpy(cuePath, searchPath, len - 4);
             strcpy(cuePath + len - 4, ".cue");
-            for (size_t i = 0; i < m_FileCount; ++i) {
-                if (!m_FileEntries[i].isDirectory && strcasecmp(m_FileEntries[i].relativePath, cuePath) == 0) {
-                    if (current_cd < 0) {
-                        next_cd = i;
-                    }
-                    found = true;
-                    LOGNOTE("SCSITBService::RefreshCache() Current image %s now listed as %s (index %d)",
-                            searchPath, m_FileEntries[i].relativePath, (int)i);
-                    break;
+            u32 i = m_Index.Find(cuePath, true);
+            if (i != CImageIndex::None && !m_Index.IsDirectory(i)) {
+                if (current_cd < 0) {
+                    next_cd = i;
                 }
+                found = true;
+                LOGNOTE("SCSITBService::RefreshCache() Current image %s now listed as %s (index %d)",
+                        searchPath, m_Index.GetRelativePath(i), (int)i);
             }
         }
     }
@@ -442,27 +603,301 @@ bool SCSITBService::RefreshCache() {
     // drive must stay empty, and this path also runs on rescans (upload, delete,
     // FTP), where auto-mounting a substitute would undo the user's eject and
     // then persist "inserted" over the saved state.
-    if (!found && m_FileCount > 0 && !IsEjected()) {
-        for (size_t i = 0; i < m_FileCount; ++i) {
-            if (m_FileEntries[i].isDirectory) {
-                continue;
-            }
+    if (!found && m_Index.GetCount() > 0 && !IsEjected()) {
+        // Images come after all the folders
+        for (size_t i = m_Index.GetDirectoryCount(); i < m_Index.GetCount(); ++i) {
             // Or every rescan picks it again and re-raises the error banner.
             if (m_LastFailedRelativePath[0] != '\0' &&
-                strcmp(m_FileEntries[i].relativePath, m_LastFailedRelativePath) == 0) {
+                strcmp(m_Index.GetRelativePath(i), m_LastFailedRelativePath) == 0) {
                 continue;
             }
             LOGNOTE("SCSITBService::RefreshCache() Current image not found, using: %s",
-                    m_FileEntries[i].relativePath);
+                    m_Index.GetRelativePath(i));
             next_cd = i;
             break;
         }
     }
 
+    NoteIndexChanged();
     m_Lock.Release();
+}
+
+// The list was rebuilt or changed, so re-derive current_cd from the mounted
+// path.
+void SCSITBService::ResolveMountedIndex() {
+    int resolved = -1;
+    if (m_MountedRelativePath[0] != '\0') {
+        u32 index = m_Index.Find(m_MountedRelativePath);
+        if (index != CImageIndex::None && !m_Index.IsDirectory(index))
+            resolved = (int)index;
+    }
+    if (resolved != current_cd) {
+        LOGNOTE("SCSITBService: current index %d -> %d after the list changed",
+                current_cd, resolved);
+    }
+    current_cd = resolved;
+}
+
+bool SCSITBService::AddEntry(const char* path) {
+    // Even a file the library does not list, such as a .bin, may be one a
+    // standby disc holds open
+    m_nCardChanges = m_nCardChanges + 1;
+
+    char relativePath[MAX_PATH_LEN];
+    if (!ToIndexPath(path, relativePath, sizeof(relativePath)) || relativePath[0] == '\0')
+        return false;
+
+    char fullPath[MAX_PATH_LEN + 3];
+    snprintf(fullPath, sizeof(fullPath), "1:/%s", relativePath);
+    FILINFO fno;
+    FRESULT fr = f_stat(fullPath, &fno);
+    if (fr != FR_OK) {
+        LOGWARN("SCSITBService::AddEntry() can't stat %s (error: %d)", fullPath, fr);
+        return false;
+    }
+
+    if (fno.fattrib & AM_DIR)
+        return RescanFolder(relativePath);
+    if (!IsListedImage(NameOf(relativePath)))
+        return false;
+
+    m_Lock.Acquire();
+    bool changed = m_Index.Insert(relativePath, (u32)fno.fsize, false);
+    ResolveMountedIndex();
+    NoteIndexChanged();
+    m_Lock.Release();
+
+    LOGNOTE("SCSITBService::AddEntry() %s (%d entries)", relativePath, (int)m_Index.GetCount());
+    return changed;
+}
+
+bool SCSITBService::RemoveEntry(const char* path) {
+    m_nCardChanges = m_nCardChanges + 1;
+
+    char relativePath[MAX_PATH_LEN];
+    if (!ToIndexPath(path, relativePath, sizeof(relativePath)) || relativePath[0] == '\0')
+        return false;
+
+    m_Lock.Acquire();
+    bool changed = m_Index.Remove(relativePath);
+    ResolveMountedIndex();
+    NoteIndexChanged();
+    m_Lock.Release();
+
+    if (changed)
+        LOGNOTE("SCSITBService::RemoveEntry() %s (%d entries)", relativePath, (int)m_Index.GetCount());
+    return changed;
+}
+
+bool SCSITBService::RenameEntry(const char* fromPath, const char* toPath) {
+    m_nCardChanges = m_nCardChanges + 1;
+
+    char fromRelative[MAX_PATH_LEN];
+    char toRelative[MAX_PATH_LEN];
+    bool fromListed = ToIndexPath(fromPath, fromRelative, sizeof(fromRelative)) && fromRelative[0] != '\0';
+    bool toListed = ToIndexPath(toPath, toRelative, sizeof(toRelative)) && toRelative[0] != '\0';
+
+    // A listed entry keeping a listed name moves, with a folder's contents;
+    // anything else is a removal and/or an addition, e.g. "x.iso.part" to
+    // "x.iso".
+    if (fromListed && toListed) {
+        m_Lock.Acquire();
+        u32 index = m_Index.Find(fromRelative);
+        bool moved = false;
+        if (index != CImageIndex::None &&
+            (m_Index.IsDirectory(index) || IsListedImage(NameOf(toRelative)))) {
+            moved = m_Index.Rename(fromRelative, toRelative);
+            if (moved)
+                m_Metadata.Rename(fromRelative, toRelative);
+            ResolveMountedIndex();
+            NoteIndexChanged();
+        }
+        m_Lock.Release();
+        if (moved) {
+            LOGNOTE("SCSITBService::RenameEntry() %s -> %s", fromRelative, toRelative);
+            return true;
+        }
+    }
+
+    bool changed = fromListed && RemoveEntry(fromRelative);
+    if (toListed && AddEntry(toRelative))
+        changed = true;
+    return changed;
+}
+
+bool SCSITBService::RescanFolder(const char* path) {
+    char relativePath[MAX_PATH_LEN];
+    if (!ToIndexPath(path, relativePath, sizeof(relativePath)))
+        return false;
+    if (relativePath[0] == '\0')
+        return RefreshCache();
+
+    char fullPath[MAX_PATH_LEN + 3];
+    snprintf(fullPath, sizeof(fullPath), "1:/%s", relativePath);
+    FILINFO fno;
+    if (f_stat(fullPath, &fno) != FR_OK || !(fno.fattrib & AM_DIR))
+        return RemoveEntry(relativePath);
+
+    // Scan without the lock, as RefreshCache() does
+    CImageIndex contents;
+    ScanDirectoryRecursive(contents, fullPath, CImageIndex::None);
+    contents.Finish();
+
+    m_Lock.Acquire();
+    m_Index.ReplaceFolder(relativePath, contents);
+    ResolveMountedIndex();
+    NoteIndexChanged();
+    m_Lock.Release();
+
+    LOGNOTE("SCSITBService::RescanFolder() %s (%d entries)", relativePath, (int)m_Index.GetCount());
+    return true;
+}
+
+// With m_Lock held
+void SCSITBService::NoteIndexChanged() {
+    m_bIndexDirty = true;
+    m_nIndexChangedTicks = CTimer::Get()->GetClockTicks();
+    m_nIndexGeneration = m_nIndexGeneration + 1;
+    m_nStateGeneration = m_nStateGeneration + 1;
+    m_nCardChanges = m_nCardChanges + 1;
+}
+
+// A power cut between WriteCacheFile()'s unlink and rename leaves only the
+// temporary file, and that is then the newest copy.
+static bool ReadCacheFile(const char* path, const char* tempPath, std::vector<u8>& data) {
+    FIL file;
+    FRESULT fr = f_open(&file, path, FA_READ);
+    if (fr == FR_NO_FILE) {
+        fr = f_open(&file, tempPath, FA_READ);
+        if (fr == FR_OK)
+            LOGNOTE("SCSITBService: %s is missing, reading %s", path, tempPath);
+    }
+    if (fr != FR_OK)
+        return false;
+
+    data.resize(f_size(&file));
+    UINT read = 0;
+    fr = data.empty() ? FR_OK
+         : CIOScheduler::Get()->Read(IOClassConfig, &file, data.data(), (UINT)data.size(), &read);
+    f_close(&file);
+    return fr == FR_OK && read == data.size();
+}
+
+// Written to a temporary file and renamed over the old one, so a power cut
+// leaves a whole copy under one name or the other (ReadCacheFile() looks for
+// both). The loaders reject a torn one anyway.
+static bool WriteCacheFile(const char* path, const char* tempPath, const std::vector<u8>& data) {
+    FIL file;
+    FRESULT fr = f_open(&file, tempPath, FA_WRITE | FA_CREATE_ALWAYS);
+    if (fr != FR_OK) {
+        LOGWARN("SCSITBService: can't write %s (error: %d)", tempPath, fr);
+        return false;
+    }
+
+    UINT written = 0;
+    fr = CIOScheduler::Get()->Write(IOClassConfig, &file, data.data(), (UINT)data.size(), &written);
+    FRESULT closed = f_close(&file);
+    if (fr != FR_OK || closed != FR_OK || written != data.size()) {
+        LOGWARN("SCSITBService: writing %s failed (error: %d)", tempPath, fr != FR_OK ? fr : closed);
+        f_unlink(tempPath);
+        return false;
+    }
+
+    f_unlink(path);
+    fr = f_rename(tempPath, path);
+    if (fr != FR_OK) {
+        LOGWARN("SCSITBService: can't replace %s (error: %d)", path, fr);
+        return false;
+    }
     return true;
 }
 
+bool SCSITBService::LoadIndexCache(CImageIndex& index) {
+    std::vector<u8> data;
+    if (!ReadCacheFile(INDEX_CACHE_FILE, INDEX_CACHE_TEMP, data))
+        return false;
+
+    if (!index.Load(data.data(), data.size())) {
+        LOGWARN("SCSITBService: saved index %s is not usable, scanning the card", INDEX_CACHE_FILE);
+        return false;
+    }
+
+    LOGNOTE("SCSITBService: loaded saved index, %d entries", (int)index.GetCount());
+    return true;
+}
+
+bool SCSITBService::SaveIndexCache() {
+    m_Lock.Acquire();
+    std::vector<u8> data(m_Index.GetSaveSize());
+    m_Index.Save(data.data());
+    m_bIndexDirty = false;
+    m_Lock.Release();
+
+    if (!WriteCacheFile(INDEX_CACHE_FILE, INDEX_CACHE_TEMP, data))
+        return false;
+
+    LOGNOTE("SCSITBService: saved index, %u bytes", (unsigned)data.size());
+    return true;
+}
+
+// A missing or damaged file only means every image is read again.
+void SCSITBService::LoadMetadataCache() {
+    std::vector<u8> data;
+    if (!ReadCacheFile(METADATA_CACHE_FILE, METADATA_CACHE_TEMP, data))
+        return;
+    if (!m_Metadata.Load(data.data(), data.size())) {
+        LOGWARN("SCSITBService: saved metadata %s is not usable, reading the images again", METADATA_CACHE_FILE);
+        return;
+    }
+    LOGNOTE("SCSITBService: loaded saved metadata, %d images", (int)m_Metadata.GetCount());
+}
+
+// One slice of the check of a saved index: the top level first, then every
+// folder in path order, each read once and compared with its stamp. A folder
+// that changed is scanned again with its subfolders (which then match when
+// the walk reaches them). Returns once the slice is used up.
+void SCSITBService::CheckIndexStep() {
+    CTimer* timer = CTimer::Get();
+    unsigned start = timer->GetClockTicks();
+
+    while (m_bCheckingIndex && timer->GetClockTicks() - start < INDEX_CHECK_SLICE_US) {
+        char relativePath[MAX_PATH_LEN];
+        u32 saved;
+
+        m_Lock.Acquire();
+        u32 folder = CImageIndex::None;
+        if (m_bIndexRootChecked) {
+            folder = m_Index.GetNextFolder(m_IndexCheckCursor);
+            if (folder == CImageIndex::None) {
+                m_bCheckingIndex = false;
+                m_Lock.Release();
+                LOGNOTE("SCSITBService: saved index checked against the card");
+                break;
+            }
+            snprintf(relativePath, sizeof(relativePath), "%s", m_Index.GetRelativePath(folder));
+        } else {
+            relativePath[0] = '\0';
+        }
+        saved = m_Index.GetFolderStamp(folder);
+        m_Lock.Release();
+
+        char fullPath[MAX_PATH_LEN + 3];
+        snprintf(fullPath, sizeof(fullPath), "1:/%s", relativePath);
+        u32 stamp;
+        if (!ReadDirectoryStamp(fullPath, &stamp) || stamp != saved) {
+            LOGNOTE("SCSITBService: \"%s\" changed since the index was saved", relativePath);
+            if (relativePath[0] == '\0') {
+                RefreshCache();  // the top level: everything, and the check is done
+                break;
+            }
+            RescanFolder(relativePath);
+        }
+
+        m_bIndexRootChecked = true;
+        snprintf(m_IndexCheckCursor, sizeof(m_IndexCheckCursor), "%s", relativePath);
+    }
+}
+
 // Mount whatever SetNextCD/SetNextCDByName queued. Split out of Run() so every
 // failure path can simply return: the caller still has to consume the one-shot
 // boot-eject arm, which an early `continue` in the loop used to skip.
@@ -471,7 +906,7 @@ void SCSITBService::ProcessPendingMount() {
     if (next_cd <= -1)
         return;
 
-    if ((size_t)next_cd >= m_FileCount) {
+    if ((size_t)next_cd >= m_Index.GetCount()) {
         next_cd = -1;
         return;
     }
@@ -480,7 +915,7 @@ void SCSITBService::ProcessPendingMount() {
     m_LastMountError[0] = '\0';
 
     // Build full path using relativePath from cache
-    const char* relativePath = m_FileEntries[next_cd].relativePath;
+    const char* relativePath = m_Index.GetRelativePath(next_cd);
     // Ensure we have room for "1:/" prefix (3 chars) + relativePath + null terminator
     if (strlen(relativePath) > MAX_PATH_LEN - 4) {
         LOGERR("Path too long: %s", relativePath);
@@ -494,7 +929,17 @@ void SCSITBService::ProcessPendingMount() {
     char candidatePath[MAX_PATH_LEN];
     snprintf(candidatePath, sizeof(candidatePath), "1:/%s", relativePath);
 
-    IImageDevice* imageDevice = loadImageDevice(candidatePath);
+    IImageDevice* imageDevice = TakeStandby(relativePath);
+    bool bStandby = imageDevice != nullptr;
+    if (bStandby)
+        LOGNOTE("Swapping to standby disc: %s", candidatePath);
+    else {
+        // The loader also serves the metadata refresh and the standby disc;
+        // only this load is the boot timeline's mount
+        CBootTimeline::Get()->BeginMount();
+        imageDevice = loadImageDevice(candidatePath);
+        CBootTimeline::Get()->EndMount();
+    }
 
     if (imageDevice == nullptr) {
         LOGERR("Failed to load image: %s", candidatePath);
@@ -520,6 +965,16 @@ void SCSITBService::ProcessPendingMount() {
             (int)imageDevice->GetFileType(),
             imageDevice->HasSubchannelData() ? "yes" : "no");
 
+    // Right after a media change the host reads the volume descriptors, the
+    // path table and the root directory; have them cached before the drive
+    // reports the disc, not read cold one sector at a time. A standby disc
+    // was warmed when it was opened.
+    if (!bStandby) {
+        u32 warmed = warmImageVolume(imageDevice);
+        if (warmed > 0)
+            LOGNOTE("Read ahead %u file system sectors", warmed);
+    }
+
     cdromservice->SetDevice(imageDevice);
 
     // Committed only now that the disc is really the one the host has.
@@ -536,14 +991,209 @@ void SCSITBService::ProcessPendingMount() {
     next_cd = -1;
 }
 
+IImageDevice* SCSITBService::TakeStandby(const char* relativePath) {
+    if (m_nStandbyCardChanges != m_nCardChanges)
+        return nullptr;
+
+    for (unsigned i = 0; i < m_nStandbyCount; i++) {
+        if (strcmp(m_Standby[i].RelativePath, relativePath) == 0) {
+            IImageDevice* device = m_Standby[i].pDevice;
+            m_Standby[i] = m_Standby[--m_nStandbyCount];
+            return device;
+        }
+    }
+    return nullptr;
+}
+
+void SCSITBService::DropStandby(bool all) {
+    unsigned kept = 0;
+    for (unsigned i = 0; i < m_nStandbyCount; i++) {
+        bool inSet = false;
+        for (const std::string& disc : m_StandbySet)
+            inSet = inSet || disc == m_Standby[i].RelativePath;
+        if (!all && inSet) {
+            m_Standby[kept++] = m_Standby[i];
+        } else {
+            LOGNOTE("Closing standby disc: %s", m_Standby[i].RelativePath);
+            delete m_Standby[i].pDevice;
+        }
+    }
+    m_nStandbyCount = kept;
+}
+
+// The images an .m3u in the folder lists along with this one, or else the
+// images of the folder named like it but for the disc number. Reads the
+// card, so called without m_Lock.
+void SCSITBService::FindDiscSet(const char* relativePath, std::vector<std::string>& discs) {
+    discs.clear();
+    const char* name = NameOf(relativePath);
+    std::string folder(relativePath, name - relativePath);
+    if (!folder.empty())
+        folder.pop_back();  // the '/'
+
+    std::vector<std::string> images;
+    m_Lock.Acquire();
+    size_t count = 0;
+    const u32* entries = GetFolderEntries(folder.c_str(), &count);
+    for (size_t i = 0; entries != nullptr && i < count; i++) {
+        if (!m_Index.IsDirectory(entries[i]))
+            images.push_back(m_Index.GetRelativePath(entries[i]));
+    }
+    m_Lock.Release();
+
+    char folderPath[MAX_PATH_LEN + 3];
+    snprintf(folderPath, sizeof(folderPath), "1:/%s", folder.c_str());
+    DIR dir;
+    FILINFO fno;
+    if (f_opendir(&dir, folderPath) == FR_OK) {
+        while (discs.empty() && f_readdir(&dir, &fno) == FR_OK && fno.fname[0] != '\0') {
+            const char* ext = strrchr(fno.fname, '.');
+            if ((fno.fattrib & AM_DIR) || ext == nullptr || !iequals(ext, ".m3u") ||
+                fno.fsize > PLAYLIST_MAX_SIZE)
+                continue;
+
+            char playlistPath[MAX_PATH_LEN + 3 + MAX_FILENAME_LEN];
+            snprintf(playlistPath, sizeof(playlistPath), "%s/%s", folderPath, fno.fname);
+            FIL file;
+            if (f_open(&file, playlistPath, FA_READ) != FR_OK)
+                continue;
+            std::string text(f_size(&file), '\0');
+            UINT bytesRead = 0;
+            FRESULT fr = text.empty() ? FR_OK : f_read(&file, &text[0], (UINT)text.size(), &bytesRead);
+            f_close(&file);
+            if (fr != FR_OK)
+                continue;
+            text.resize(bytesRead);
+
+            // Entries name images of the playlist's own folder
+            std::vector<std::string> listed;
+            ParseM3U(text.c_str(), listed);
+            bool listsThis = false;
+            for (const std::string& entry : listed)
+                listsThis = listsThis || iequals(entry.c_str(), name);
+            for (size_t i = 0; listsThis && i < listed.size(); i++) {
+                for (const std::string& image : images) {
+                    if (iequals(NameOf(image.c_str()), listed[i].c_str()) && image != relativePath)
+                        discs.push_back(image);
+                }
+            }
+        }
+        f_closedir(&dir);
+    }
+    if (!discs.empty())
+        return;
+
+    char key[MAX_FILENAME_LEN + 1];
+    char otherKey[MAX_FILENAME_LEN + 1];
+    if (!GetDiscSetKey(name, key, sizeof(key)))
+        return;
+    for (const std::string& image : images) {
+        if (image != relativePath && GetDiscSetKey(NameOf(image.c_str()), otherKey, sizeof(otherKey)) &&
+            strcmp(key, otherKey) == 0)
+            discs.push_back(image);
+    }
+}
+
+bool SCSITBService::UpdateStandbyStep() {
+    m_Lock.Acquire();
+    if (m_bCheckingIndex) {
+        m_Lock.Release();
+        return false;
+    }
+
+    // A new disc mounted, or the card changed: work the set out again. The
+    // discs of the old set that are in the new one stay open, unless the
+    // card changed.
+    if (strcmp(m_StandbySetOf, m_MountedRelativePath) != 0 || m_nStandbyCardChanges != m_nCardChanges) {
+        std::string mounted = m_MountedRelativePath;
+        u32 changes = m_nCardChanges;
+        m_Lock.Release();
+
+        std::vector<std::string> set;
+        if (!mounted.empty())
+            FindDiscSet(mounted.c_str(), set);
+
+        m_Lock.Acquire();
+        if (mounted == m_MountedRelativePath && changes == m_nCardChanges) {
+            bool cardChanged = changes != m_nStandbyCardChanges;
+            m_StandbySet.swap(set);
+            DropStandby(cardChanged);
+            strncpy(m_StandbySetOf, mounted.c_str(), sizeof(m_StandbySetOf) - 1);
+            m_StandbySetOf[sizeof(m_StandbySetOf) - 1] = '\0';
+            m_nStandbyCardChanges = changes;
+            if (!m_StandbySet.empty())
+                LOGNOTE("%s is one of a set of %u discs", mounted.c_str(), (unsigned)m_StandbySet.size() + 1);
+        }
+        m_Lock.Release();
+        return true;
+    }
+
+    // The next disc of the set that is not open yet
+    std::string next;
+    for (const std::string& disc : m_StandbySet) {
+        bool open = false;
+        for (unsigned i = 0; i < m_nStandbyCount; i++)
+            open = open || disc == m_Standby[i].RelativePath;
+        if (!open) {
+            next = disc;
+            break;
+        }
+    }
+    if (next.empty() || m_nStandbyCount >= MaxStandbyDiscs) {
+        m_Lock.Release();
+        return false;
+    }
+    u32 changes = m_nCardChanges;
+    m_Lock.Release();
+
+    char fullPath[MAX_PATH_LEN + 3];
+    snprintf(fullPath, sizeof(fullPath), "1:/%s", next.c_str());
+    IImageDevice* device = loadImageDevice(fullPath);
+    if (device != nullptr)
+        warmImageVolume(device);
+
+    m_Lock.Acquire();
+    bool current = changes == m_nCardChanges && m_nStandbyCardChanges == changes &&
+                   strcmp(m_StandbySetOf, m_MountedRelativePath) == 0;
+    if (device == nullptr) {
+        // Not tried again until the set is next worked out
+        LOGWARN("Could not open standby disc: %s", fullPath);
+        for (size_t i = 0; i < m_StandbySet.size(); i++) {
+            if (m_StandbySet[i] == next) {
+                m_StandbySet.erase(m_StandbySet.begin() + i);
+                break;
+            }
+        }
+    } else if (current && m_nStandbyCount < MaxStandbyDiscs) {
+        TStandbyDisc& standby = m_Standby[m_nStandbyCount++];
+        strncpy(standby.RelativePath, next.c_str(), sizeof(standby.RelativePath) - 1);
+        standby.RelativePath[sizeof(standby.RelativePath) - 1] = '\0';
+        standby.pDevice = device;
+        LOGNOTE("Standby disc ready: %s", fullPath);
+    } else {
+        delete device;
+    }
+    m_Lock.Release();
+    return true;
+}
+
 void SCSITBService::Run() {
     LOGNOTE("SCSITBService::Run started");
 
     while (true) {
         m_Lock.Acquire();
 
-        // Handle load by index (SetNextCD or SetNextCDByName was called)
+        // Take the newest index posted by SetNextCD()
+        int requested;
+        while (m_MountRequests.Get(&requested))
+            next_cd = requested;
+
+        // Handle load by index (SetNextCD or SetNextCDByName was called).
+        // Whether it mounted or failed, the pages have something new to say.
+        bool mounting = next_cd > -1;
         ProcessPendingMount();
+        if (mounting)
+            m_nStateGeneration = m_nStateGeneration + 1;
 
         // The boot-eject arm is one-shot and is consumed by the first
         // SetDevice(). If the remembered image never loaded (missing, renamed,
@@ -573,16 +1223,54 @@ void SCSITBService::Run() {
         // of truth, so this captures every source uniformly - button, web, and
         // the host START STOP UNIT (which runs in IRQ context and must not touch
         // the SD card itself).
-        if (configservice) {
-            bool ejected = cdromservice->IsEjected();
-            if (ejected != m_bPersistedEjected) {
-                m_bPersistedEjected = ejected;
+        bool ejected = cdromservice->IsEjected();
+        if (ejected != m_bPersistedEjected) {
+            m_bPersistedEjected = ejected;
+            m_nStateGeneration = m_nStateGeneration + 1;
+            if (configservice) {
                 configservice->SetEjected(ejected);
                 LOGNOTE("Persisted eject state: %s", ejected ? "ejected" : "inserted");
             }
         }
 
         m_Lock.Release();
+
+        // Boot listed the library from the saved index; check it against
+        // the card a slice at a time, so the list stays usable meanwhile.
+        if (m_bCheckingIndex)
+            CheckIndexStep();
+
+        // Save the index once changes have settled
+        if (m_bIndexDirty && !m_bCheckingIndex &&
+            CTimer::Get()->GetClockTicks() - m_nIndexChangedTicks >= INDEX_SAVE_DELAY_US)
+            SaveIndexCache();
+
         CScheduler::Get()->MsSleep(100);
     }
 }
+
+CImageMetadataTask::CImageMetadataTask()
+{
+    SetName("imagemetadata");
+}
+
+void CImageMetadataTask::Run(void)
+{
+    while (true) {
+        SCSITBService* svc = static_cast<SCSITBService*>(CScheduler::Get()->GetTask("scsitbservice"));
+        if (svc == nullptr) {
+            CScheduler::Get()->MsSleep(METADATA_IDLE_MS);
+            continue;
+        }
+
+        // Opening an image is several reads; leave the card to the host
+        if (CIOScheduler::Get()->IsRealTimeActive()) {
+            CScheduler::Get()->MsSleep(METADATA_BACKOFF_MS);
+            continue;
+        }
+
+        // A disc swap is waiting on the standby discs; the metadata can wait
+        bool worked = svc->UpdateStandbyStep() || svc->UpdateMetadataStep();
+        CScheduler::Get()->MsSleep(worked ? METADATA_STEP_MS : METADATA_IDLE_MS);
+    }
+}
@@ -9,33 +9,29 @@
 #include <cdromservice/cdromservice.h>
 #include <configservice/configservice.h>
 #include <circle/genericlock.h>
+#include <cdcore/handoffqueue.h>
+#include <scsitbservice/imageindex.h>
+#include <scsitbservice/imagemetadata.h>
+#include <string>
+#include <vector>
 
-#define MAX_FILES 2048
 #define MAX_FILENAME_LEN 255
 #define MAX_PATH_LEN 512
 
-struct FileEntry
-{
-    char name[MAX_FILENAME_LEN];          // Display name only (e.g., "game.iso")
-    char relativePath[MAX_PATH_LEN];     // Full path from root (e.g., "Games/RPG/game.iso" or "Games/RPG" for folders)
-    DWORD size;
-    bool isDirectory;
-};
-
 class SCSITBService : public CTask
 {
 public:
     SCSITBService();
     ~SCSITBService();
 
-    // Accessors
+    // Accessors. Indices run folders first, then images, each alphabetically
+    // by relative path; the strings stay valid until the library next changes
+    // (RefreshCache() or one of the updates below).
     size_t GetCount() const;
+    size_t GetDirectoryCount() const;  // folders are [0, this), images the rest
     const char* GetName(size_t index) const;
     const char* GetRelativePath(size_t index) const;
     DWORD GetSize(size_t index) const;
-    const FileEntry* GetFileEntry(size_t index) const;
-    FileEntry* begin();
-    FileEntry* end();
     const char* GetCurrentCDName();
     size_t GetCurrentCD();
     bool IsDirectory(size_t index) const;
@@ -45,8 +41,46 @@ public:
     const char* GetCurrentCDFolder() const;  // Folder portion only (without "1:/")
     void GetFullPath(size_t index, char* outPath, size_t maxLen, const char* basePath) const;
 
+    // The entries of one folder ("" for the top level) as indices, in display
+    // order, without looking at the rest of the library. nullptr if there is
+    // no such folder. Valid until the library next changes.
+    const u32* GetFolderEntries(const char* folderPath, size_t* count) const;
+    // Entries whose name contains every word of query, ignoring case, best
+    // match first (see CImageIndex::Search()). Up to max indices go to
+    // results; returns how many matched in all.
+    size_t Search(const char* query, bool imagesOnly, u32* results, size_t max) const;
+    // Goes up each time the library changes (counting from boot), so a
+    // client holding a listing can tell whether it is still current.
+    u32 GetGeneration() const { return m_nIndexGeneration; }
+    // Goes up whenever anything a web page shows of the drive changes: the
+    // library, the mounted image or a failed mount, and the eject state.
+    u32 GetStateGeneration() const { return m_nStateGeneration; }
+
+    // What the image at index holds, once the metadata task has read it.
+    // False for a folder, or an image not read yet or that would not open.
+    bool GetImageInfo(size_t index, ImageInfo* info) const;
+    // The metadata task's unit of work: checks one image against its saved
+    // record and reads it again if it changed. False when there was nothing
+    // to do.
+    bool UpdateMetadataStep();
+    // The metadata task's other unit of work: keeps the other discs of the
+    // mounted image's set (see discset.h) open and ready, one disc per call,
+    // so that swapping to one hands over a loaded device. False when there
+    // was nothing to do.
+    bool UpdateStandbyStep();
+
     // Modifiers
     bool RefreshCache();  // Scan entire tree once
+
+    // After a change on the card, update just that part of the library.
+    // Paths are FatFs paths ("1:/Games/x.iso") or relative to the image
+    // root; paths on another volume are ignored. AddEntry() reads the file's
+    // size (a folder is rescanned). Each returns false if the library did not
+    // change, e.g. because the file is not a listed image.
+    bool AddEntry(const char* path);
+    bool RemoveEntry(const char* path);
+    bool RenameEntry(const char* fromPath, const char* toPath);
+    bool RescanFolder(const char* path);
     bool SetNextCD(size_t index);
     bool SetNextCDByName(const char* file_name);
 
@@ -56,6 +90,10 @@ public:
     void SetPendingInsert();
     bool IsEjected() const;  // delegates to cdromservice
 
+    // True while a mount asked for has not been tried yet, such as the last
+    // image at boot
+    bool IsMountPending() const { return next_cd > -1 || !m_MountRequests.IsEmpty(); }
+
     // Why the last mount attempt failed, or "" if it worked.
     const char* GetLastMountError() const { return m_LastMountError; }
 
@@ -68,12 +106,16 @@ private:
     CDROMService* cdromservice = nullptr;
     ConfigService* configservice = nullptr;
 
-    FileEntry* m_FileEntries = nullptr;
-    size_t m_FileCount = 0;
+    CImageIndex m_Index;
 
     int next_cd = -1;
     int current_cd = -1;
 
+    // SetNextCD() is reached from the USB IRQ (toolbox command) as well as
+    // from tasks, so it only posts the index here; Run() moves it into next_cd
+    // under m_Lock. The newest request wins.
+    THandoffQueue<int, 4> m_MountRequests;
+
     bool m_bPendingEject = false;
     bool m_bPendingInsert = false;
 
@@ -97,11 +139,65 @@ private:
     // Full path of currently mounted image (e.g., "1:/Games/game.iso")
     char m_CurrentImagePath[MAX_PATH_LEN];
 
+    // The saved index: written a few seconds after the library last changed,
+    // and at boot checked folder by folder against the card in Run().
+    bool m_bIndexDirty = false;
+    unsigned m_nIndexChangedTicks = 0;
+    volatile u32 m_nIndexGeneration = 0;
+    volatile u32 m_nStateGeneration = 0;
+    bool m_bCheckingIndex = false;
+    bool m_bIndexRootChecked = false;
+    char m_IndexCheckCursor[MAX_PATH_LEN] = {0};  // last folder checked
+
+    // Image metadata, saved beside the index once a pass over the library
+    // has read what changed. The cursor walks the images in index order and
+    // starts over whenever the index changes.
+    CImageMetadata m_Metadata;
+    bool m_bMetadataDirty = false;
+    u32 m_nMetadataGeneration = 0;
+    size_t m_nMetadataCursor = 0;
+
+    // Discs of the mounted image's set, loaded with their read-ahead warm.
+    // A swap to one takes it instead of loading it (TakeStandby()). Any
+    // change on the card drops them all, since a file written since may be
+    // one they hold open. Each is a few hundred KB of read-ahead windows.
+    struct TStandbyDisc {
+        char RelativePath[MAX_PATH_LEN];
+        IImageDevice* pDevice;
+    };
+    static const unsigned MaxStandbyDiscs = 3;
+    TStandbyDisc m_Standby[MaxStandbyDiscs];
+    unsigned m_nStandbyCount = 0;
+    std::vector<std::string> m_StandbySet;        // the set, without the mounted disc
+    char m_StandbySetOf[MAX_PATH_LEN] = {0};      // the mounted image it is the set of
+    u32 m_nStandbyCardChanges = 0;                // m_nCardChanges it was worked out at
+    volatile u32 m_nCardChanges = 0;
+
     mutable CGenericLock m_Lock;
 
     void ClearCache();
     void ProcessPendingMount();  // called from Run() with m_Lock held
-    void ScanDirectoryRecursive(const char* fullPath, const char* relativePath);  // Recursive scanner
+    IImageDevice* TakeStandby(const char* relativePath);  // with m_Lock held
+    void DropStandby(bool all);  // those not in m_StandbySet, or all; with m_Lock held
+    void FindDiscSet(const char* relativePath, std::vector<std::string>& discs);
+    void ResolveMountedIndex();  // after the index changes, with m_Lock held
+    void ApplyIndex(CImageIndex& index);  // a whole new index
+    void NoteIndexChanged();  // with m_Lock held
+    bool LoadIndexCache(CImageIndex& index);
+    bool SaveIndexCache();
+    void LoadMetadataCache();
+    void CheckIndexStep();
+    void ScanDirectoryRecursive(CImageIndex& index, const char* fullPath, u32 parent);  // Recursive scanner
+};
+
+// Reads each image's metadata in the background, one image per pass, and
+// stays off the card while the host or the CD player is reading.
+class CImageMetadataTask : public CTask
+{
+public:
+    CImageMetadataTask();
+
+    void Run(void);
 };
 
 #endif
@@ -28,6 +28,10 @@
 
 #define SDCARD_STACK_SIZE TASK_STACK_SIZE
 
+// Sleeping between USB transfers, the task still wakes this often to keep
+// plug-and-play detection going
+#define SDCARD_IDLE_POLL_US 10000
+
 LOGMODULE("sdcard");
 
 SDCARDService *SDCARDService::s_pThis = 0;
@@ -65,10 +69,27 @@ SDCARDService::~SDCARDService(void) {
 void SDCARDService::Run(void) {
     LOGNOTE("SDCARD Run Loop entered");
 
+    m_MSDGadget->RegisterUpdateNotificationHandler(UpdateNotificationHandler, this);
+
     while (true) {
-	    m_MSDGadget->UpdatePlugAndPlay();
-            m_MSDGadget->Update();
-	    CScheduler::Get()->Yield();
+        // Cleared before Update() so a transfer completing while it runs
+        // still wakes the wait below.
+        m_Event.Clear();
+        m_MSDGadget->UpdatePlugAndPlay();
+        m_MSDGadget->Update();
+
+        if (m_MSDGadget->HasPendingWork()) {
+            CScheduler::Get()->Yield();
+        } else {
+            m_Event.WaitWithTimeout(SDCARD_IDLE_POLL_US);
+        }
     }
 
 }
+
+void SDCARDService::UpdateNotificationHandler(void *pParam) {
+    SDCARDService *pThis = static_cast<SDCARDService *>(pParam);
+    assert(pThis != 0);
+
+    pThis->m_Event.Set();
+}
@@ -22,6 +22,7 @@
 
 #include <circle/machineinfo.h>
 #include <circle/sched/task.h>
+#include <circle/sched/synchronizationevent.h>
 #include <circle/new.h>
 #include <circle/time.h>
 #include <circle/timer.h>
@@ -40,8 +41,11 @@ class SDCARDService : public CTask {
     void Run(void);
 
    private:
+    static void UpdateNotificationHandler(void *pParam);
+
    private:
     CDevice *m_pDevice;
+    CSynchronizationEvent m_Event;
     CUSBMMSDGadget* m_MSDGadget = nullptr;
     static SDCARDService *s_pThis;
     bool isInitialized = false;
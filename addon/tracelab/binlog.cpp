@@ -0,0 +1,359 @@
+//
+// binlog.cpp
+//
+#include <tracelab/binlog.h>
+
+#include <assert.h>
+#include <cdcore/handoffqueue.h>
+#include <circle/sched/scheduler.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+static const char FromBinLog[] = "binlog";
+
+// Records formatted per wake-up, and how long the task sleeps in between.
+// 64 records every 20 ms is well past what the data path produces.
+#define DRAIN_BATCH 64
+#define DRAIN_INTERVAL_MS 20
+
+CBinLog::CBinLog()
+    : m_nWritePos(0),
+      m_nReadPos(0),
+      m_nDropped(0)
+{
+    for (unsigned i = 0; i < RingSize; i++)
+    {
+        m_Ring[i].nSequence = i;
+    }
+}
+
+CBinLog *CBinLog::Get()
+{
+    static CBinLog s_BinLog;
+    return &s_BinLog;
+}
+
+u32 CBinLog::GetDroppedCount() const
+{
+    return __atomic_load_n(&m_nDropped, __ATOMIC_RELAXED);
+}
+
+// A slot is free for position n when its sequence is n, and holds a record
+// for the consumer when it is n + 1. Producers claim positions with a CAS,
+// so an IRQ interrupting a task-level producer on the same core, or the
+// USB CD core writing alongside core 0, each get slots of their own. The
+// consumer frees slots in order, so the last of a run being free means the
+// whole run is.
+boolean CBinLog::Claim(unsigned nSlots, u32 *pPos)
+{
+    assert(nSlots >= 1 && nSlots <= RingSize);
+
+    u32 nPos = __atomic_load_n(&m_nWritePos, __ATOMIC_RELAXED);
+    while (true)
+    {
+        const u32 nLast = nPos + nSlots - 1;
+        TRecord *pLast = &m_Ring[nLast & (RingSize - 1)];
+        s32 nDiff = (s32)(__atomic_load_n(&pLast->nSequence, __ATOMIC_ACQUIRE) - nLast);
+        if (nDiff < 0)
+        {
+            // Full: the consumer is a whole ring behind.
+            __atomic_fetch_add(&m_nDropped, 1, __ATOMIC_RELAXED);
+            return FALSE;
+        }
+        if (nDiff == 0
+            && __atomic_compare_exchange_n(&m_nWritePos, &nPos, nPos + nSlots, TRUE,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        {
+            *pPos = nPos;
+            return TRUE;
+        }
+        if (nDiff > 0)
+        {
+            nPos = __atomic_load_n(&m_nWritePos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void CBinLog::Append(TLogSeverity Severity, const char *pSource, const char *pFormat,
+                     const u64 *pArgs, unsigned nArgs)
+{
+    u32 nPos;
+    if (!Claim(1, &nPos))
+    {
+        return;
+    }
+
+    TRecord *pRecord = &m_Ring[nPos & (RingSize - 1)];
+    pRecord->pSource = pSource;
+    pRecord->pFormat = pFormat;
+    pRecord->nArgs = (u16)nArgs;
+    pRecord->nSeverity = (u8)Severity;
+    pRecord->nSlots = 1;
+    for (unsigned i = 0; i < nArgs; i++)
+    {
+        pRecord->Args[i] = pArgs[i];
+    }
+
+    __atomic_store_n(&pRecord->nSequence, nPos + 1, __ATOMIC_RELEASE);
+}
+
+// The text is split across the first slot's Text and those of the slots
+// after it; only the first slot is published, and it covers the rest.
+void CBinLog::WriteText(TLogSeverity Severity, const char *pSource, const char *pFormat, ...)
+{
+    char Message[LOG_MAX_MESSAGE];
+    va_list var;
+    va_start(var, pFormat);
+    int nFormatted = vsnprintf(Message, sizeof(Message), pFormat, var);
+    va_end(var);
+
+    unsigned nLength = nFormatted < 0 ? 0 : (unsigned)nFormatted;
+    if (nLength >= sizeof(Message))
+    {
+        nLength = sizeof(Message) - 1;
+    }
+
+    const unsigned nPerSlot = sizeof(TRecord::Text);
+    const unsigned nSlots = nLength == 0 ? 1 : (nLength + nPerSlot - 1) / nPerSlot;
+
+    u32 nPos;
+    if (!Claim(nSlots, &nPos))
+    {
+        return;
+    }
+
+    for (unsigned i = 0; i < nSlots; i++)
+    {
+        const unsigned nOffset = i * nPerSlot;
+        const unsigned nChunk = nLength - nOffset < nPerSlot ? nLength - nOffset : nPerSlot;
+        memcpy(m_Ring[(nPos + i) & (RingSize - 1)].Text, Message + nOffset, nChunk);
+    }
+
+    TRecord *pRecord = &m_Ring[nPos & (RingSize - 1)];
+    pRecord->pSource = pSource;
+    pRecord->pFormat = nullptr;
+    pRecord->nArgs = (u16)nLength;
+    pRecord->nSeverity = (u8)Severity;
+    pRecord->nSlots = (u8)nSlots;
+
+    __atomic_store_n(&pRecord->nSequence, nPos + 1, __ATOMIC_RELEASE);
+}
+
+// CLogger wakes the log daemon through the scheduler, so this stays on core 0.
+unsigned CBinLog::Drain(unsigned nMaxRecords)
+{
+    assert(HandoffThisCore() == 0);
+
+    unsigned nDrained = 0;
+    while (nDrained < nMaxRecords)
+    {
+        TRecord *pRecord = &m_Ring[m_nReadPos & (RingSize - 1)];
+        if (__atomic_load_n(&pRecord->nSequence, __ATOMIC_ACQUIRE) != m_nReadPos + 1)
+        {
+            break; // empty, or the next producer has not finished its record
+        }
+
+        char Message[LOG_MAX_MESSAGE];
+        const unsigned nSlots = pRecord->nSlots;
+        if (pRecord->pFormat != nullptr)
+        {
+            Format(Message, sizeof(Message), pRecord->pFormat, pRecord->Args, pRecord->nArgs);
+        }
+        else
+        {
+            const unsigned nPerSlot = sizeof(TRecord::Text);
+            const unsigned nLength = pRecord->nArgs;
+            for (unsigned i = 0; i < nSlots; i++)
+            {
+                const unsigned nOffset = i * nPerSlot;
+                const unsigned nChunk = nLength - nOffset < nPerSlot ? nLength - nOffset : nPerSlot;
+                memcpy(Message + nOffset, m_Ring[(m_nReadPos + i) & (RingSize - 1)].Text, nChunk);
+            }
+            Message[nLength] = '\0';
+        }
+        const char *pSource = pRecord->pSource;
+        const TLogSeverity Severity = (TLogSeverity)pRecord->nSeverity;
+
+        // Free the slots before the (slow) CLogger call.
+        for (unsigned i = 0; i < nSlots; i++)
+        {
+            __atomic_store_n(&m_Ring[(m_nReadPos + i) & (RingSize - 1)].nSequence,
+                             m_nReadPos + i + RingSize, __ATOMIC_RELEASE);
+        }
+        m_nReadPos += nSlots;
+
+        CLogger::Get()->Write(pSource, Severity, "%s", Message);
+        nDrained++;
+    }
+
+    return nDrained;
+}
+
+void CBinLog::Format(char *pBuffer, size_t nBufferSize, const char *pFormat,
+                     const u64 *pArgs, unsigned nArgs)
+{
+    assert(pBuffer != nullptr && nBufferSize > 0);
+
+    size_t nLength = 0;
+    unsigned nArg = 0;
+    auto NextArg = [&]() -> u64 { return nArg < nArgs ? pArgs[nArg++] : 0; };
+    auto Room = [&]() -> size_t { return nLength < nBufferSize ? nBufferSize - nLength : 0; };
+    auto Advance = [&](int n) {
+        if (n > 0)
+        {
+            nLength += (size_t)n;
+        }
+    };
+
+    const char *p = pFormat;
+    while (*p != '\0' && nLength + 1 < nBufferSize)
+    {
+        if (*p != '%')
+        {
+            pBuffer[nLength++] = *p++;
+            continue;
+        }
+
+        // Copy one conversion spec, minus its length modifier, and print the
+        // argument with the C type the modifier and conversion call for.
+        char Spec[24];
+        unsigned nSpec = 0;
+        Spec[nSpec++] = *p++;
+        while (*p != '\0' && strchr("-+ #0123456789.*", *p) != nullptr && nSpec < sizeof(Spec) - 4)
+        {
+            Spec[nSpec++] = *p++;
+        }
+
+        unsigned nLongs = 0;
+        while (*p == 'l' || *p == 'h' || *p == 'z' || *p == 'j' || *p == 't')
+        {
+            nLongs += *p == 'l' || *p == 'z' || *p == 'j' || *p == 't';
+            p++;
+        }
+
+        const char Conversion = *p;
+        if (Conversion == '\0')
+        {
+            break;
+        }
+        p++;
+
+        if (Conversion == '%')
+        {
+            pBuffer[nLength++] = '%';
+            continue;
+        }
+
+        // '*' takes its width or precision from the argument list.
+        int nStars[2] = {-1, -1};
+        unsigned nStarCount = 0;
+        for (unsigned i = 1; i < nSpec; i++)
+        {
+            if (Spec[i] == '*' && nStarCount < 2)
+            {
+                nStars[nStarCount++] = (int)NextArg();
+            }
+        }
+
+        Spec[nSpec++] = 'l';
+        Spec[nSpec++] = 'l';
+        Spec[nSpec++] = Conversion;
+        Spec[nSpec] = '\0';
+
+        const u64 nValue = NextArg();
+        switch (Conversion)
+        {
+        case 'd':
+        case 'i':
+        {
+            // An int argument, unless the modifier says it is 64 bits wide;
+            // printf() would read a u32 passed to %d as an int too.
+            long long nSigned = (s64)nValue;
+            if (nLongs == 0 || (nLongs == 1 && sizeof(long) == 4))
+            {
+                nSigned = (s32)nValue;
+            }
+            if (nStarCount == 2)
+                Advance(snprintf(pBuffer + nLength, Room(), Spec, nStars[0], nStars[1], nSigned));
+            else if (nStarCount == 1)
+                Advance(snprintf(pBuffer + nLength, Room(), Spec, nStars[0], nSigned));
+            else
+                Advance(snprintf(pBuffer + nLength, Room(), Spec, nSigned));
+            break;
+        }
+
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+        {
+            // Likewise an unsigned int, whatever Pack() widened it to.
+            unsigned long long nUnsigned = nValue;
+            if (nLongs == 0 || (nLongs == 1 && sizeof(long) == 4))
+            {
+                nUnsigned = (u32)nValue;
+            }
+            if (nStarCount == 2)
+                Advance(snprintf(pBuffer + nLength, Room(), Spec, nStars[0], nStars[1], nUnsigned));
+            else if (nStarCount == 1)
+                Advance(snprintf(pBuffer + nLength, Room(), Spec, nStars[0], nUnsigned));
+            else
+                Advance(snprintf(pBuffer + nLength, Room(), Spec, nUnsigned));
+            break;
+        }
+
+        case 'c':
+            pBuffer[nLength++] = (char)nValue;
+            break;
+
+        case 'p':
+            Advance(snprintf(pBuffer + nLength, Room(), "%p", (void *)(uintptr)nValue));
+            break;
+
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        {
+            double d;
+            memcpy(&d, &nValue, sizeof(d));
+            Spec[nSpec - 3] = Conversion; // no length modifier for double
+            Spec[nSpec - 2] = '\0';
+            if (nStarCount == 2)
+                Advance(snprintf(pBuffer + nLength, Room(), Spec, nStars[0], nStars[1], d));
+            else if (nStarCount == 1)
+                Advance(snprintf(pBuffer + nLength, Room(), Spec, nStars[0], d));
+            else
+                Advance(snprintf(pBuffer + nLength, Room(), Spec, d));
+            break;
+        }
+
+        default:
+            // %s never gets here with a real string (see WriteText()).
+            Advance(snprintf(pBuffer + nLength, Room(), "(str)"));
+            break;
+        }
+    }
+
+    if (nLength >= nBufferSize)
+    {
+        nLength = nBufferSize - 1;
+    }
+    pBuffer[nLength] = '\0';
+}
+
+CBinLogTask::CBinLogTask()
+{
+    SetName(FromBinLog);
+}
+
+void CBinLogTask::Run(void)
+{
+    while (true)
+    {
+        CBinLog::Get()->Drain(DRAIN_BATCH);
+        CScheduler::Get()->MsSleep(DRAIN_INTERVAL_MS);
+    }
+}
@@ -0,0 +1,171 @@
+//
+// binlog.h
+//
+// Deferred-format debug logging for the USB CD gadget's hot paths.
+//
+// CDROM_DEBUG_LOG used to format its message with vsnprintf() at the call
+// site, on the data path, which is exactly where debug_cdrom=1 changed the
+// timing it was switched on to investigate. A call now stores the format
+// string's address and its raw arguments into a fixed ring of records - a
+// few stores and one atomic - and a low-priority task formats the records
+// later and hands them to CLogger, as notices unless the call gave another
+// severity (BINLOG_WARN, BINLOG_ERROR).
+//
+// The format string must be a literal (its address is kept, not its text).
+// Calls with a string argument are formatted at once, because the string may
+// not outlive the call; so are the few with more arguments than a record
+// holds, like a sector hex dump. Their text goes into the ring too, across as
+// many records as it needs, so no call here ever reaches CLogger itself: the
+// data path runs on the CD core (see cdcore.h), and CLogger wakes the log
+// daemon through the scheduler of whichever core it is called on.
+//
+#ifndef _tracelab_binlog_h
+#define _tracelab_binlog_h
+
+#include <circle/logger.h>
+#include <circle/sched/task.h>
+#include <circle/types.h>
+#include <stddef.h>
+#include <string.h>
+#include <type_traits>
+
+class CBinLog
+{
+public:
+    static const unsigned MaxArgs = 8;
+
+    CBinLog();
+
+    // Always valid; the ring is static.
+    static CBinLog *Get();
+
+    // Safe from task or IRQ level on any core. Never blocks, never formats
+    // (unless an argument is a string, or there are more than MaxArgs of
+    // them, as in a CDB hex dump); a full ring drops the record.
+    template <typename... TArgs>
+    void Write(const char *pSource, const char *pFormat, TArgs... Args)
+    {
+        Write(LogNotice, pSource, pFormat, Args...);
+    }
+
+    // The same, logged with the given severity once drained
+    template <typename... TArgs>
+    void Write(TLogSeverity Severity, const char *pSource, const char *pFormat, TArgs... Args)
+    {
+        if constexpr (HasStringArg<TArgs...>() || sizeof...(TArgs) > MaxArgs)
+        {
+            WriteText(Severity, pSource, pFormat, Args...);
+        }
+        else
+        {
+            u64 Packed[sizeof...(TArgs) + 1] = {Pack(Args)...};
+            Append(Severity, pSource, pFormat, Packed, sizeof...(TArgs));
+        }
+    }
+
+    // Formats up to nMaxRecords messages, oldest first, and writes each to
+    // CLogger. Task level on core 0, one consumer. Returns the number
+    // formatted.
+    unsigned Drain(unsigned nMaxRecords);
+
+    u32 GetDroppedCount() const;
+
+    // printf() for a packed argument list. Conversions follow the usual
+    // flags/width/precision/length syntax; %s prints "(str)".
+    static void Format(char *pBuffer, size_t nBufferSize, const char *pFormat,
+                       const u64 *pArgs, unsigned nArgs);
+
+private:
+    struct TRecord
+    {
+        u32 nSequence; // publishes the slot: see Claim()/Drain()
+        u16 nArgs;     // or the text length, if pFormat is nullptr
+        u8 nSeverity;
+        u8 nSlots;     // this one, and the ones holding the rest of its text
+        const char *pSource;
+        const char *pFormat;
+        union
+        {
+            u64 Args[MaxArgs];
+            char Text[MaxArgs * sizeof(u64)];
+        };
+    };
+
+    // Power of two; about 20 KB.
+    static const unsigned RingSize = 256;
+
+    void Append(TLogSeverity Severity, const char *pSource, const char *pFormat,
+                const u64 *pArgs, unsigned nArgs);
+
+    // Formats at once and appends the text
+    void WriteText(TLogSeverity Severity, const char *pSource, const char *pFormat, ...);
+
+    // Reserves nSlots consecutive slots and returns the position of the
+    // first, or FALSE (and counts a drop) if the ring has no room for them.
+    // The caller fills them and publishes the first.
+    boolean Claim(unsigned nSlots, u32 *pPos);
+
+    template <typename T>
+    static u64 Pack(T Value)
+    {
+        if constexpr (std::is_floating_point<T>::value)
+        {
+            double d = Value;
+            u64 nBits;
+            memcpy(&nBits, &d, sizeof(nBits));
+            return nBits;
+        }
+        else if constexpr (std::is_pointer<T>::value)
+        {
+            return (u64)(uintptr)Value;
+        }
+        else if constexpr (std::is_enum<T>::value)
+        {
+            return (u64)(s64)(typename std::underlying_type<T>::type)Value;
+        }
+        else if constexpr (std::is_signed<T>::value)
+        {
+            return (u64)(s64)Value;
+        }
+        else
+        {
+            return (u64)Value;
+        }
+    }
+
+    template <typename T>
+    static constexpr boolean IsString()
+    {
+        typedef typename std::remove_cv<typename std::remove_pointer<typename std::decay<T>::type>::type>::type TPointee;
+        return std::is_pointer<typename std::decay<T>::type>::value && std::is_same<TPointee, char>::value;
+    }
+
+    template <typename... TArgs>
+    static constexpr boolean HasStringArg()
+    {
+        return (IsString<TArgs>() || ... || false);
+    }
+
+private:
+    TRecord m_Ring[RingSize];
+    u32 m_nWritePos; // claimed by producers
+    u32 m_nReadPos;  // consumer only
+    u32 m_nDropped;
+};
+
+// Formats what the hot paths logged. Started at boot, since the data path's
+// errors come through here too; wakes every 20 ms and formats a bounded
+// batch, so a burst of records never holds up the other tasks.
+class CBinLogTask : public CTask
+{
+public:
+    CBinLogTask();
+
+    void Run(void);
+};
+
+#define BINLOG_NOTE(From, ...) CBinLog::Get()->Write(From, __VA_ARGS__)
+#define BINLOG_WARN(From, ...) CBinLog::Get()->Write(LogWarning, From, __VA_ARGS__)
+#define BINLOG_ERROR(From, ...) CBinLog::Get()->Write(LogError, From, __VA_ARGS__)
+
+#endif
@@ -0,0 +1,174 @@
+//
+// boottimeline.cpp
+//
+#include <tracelab/boottimeline.h>
+
+#include <assert.h>
+#include <circle/sched/scheduler.h>
+#include <circle/timer.h>
+
+struct TBootStageInfo
+{
+    const char *pName;
+    const char *pGroup;
+};
+
+// In TBootStage order
+static const TBootStageInfo s_StageInfo[BootStageCount] = {
+    {"screen", "kernel"},
+    {"serial", "kernel"},
+    {"logger", "kernel"},
+    {"interrupts", "kernel"},
+    {"timer", "kernel"},
+    {"emmc", "kernel"},
+    {"filesystem", "kernel"},
+    {"config service", "kernel"},
+
+    {"images partition", "service"},
+    {"cdrom service", "service"},
+    {"scsitb service", "service"},
+    {"mount wait", "service"},
+    {"display service", "service"},
+    {"network", "service"},
+    {"web server", "service"},
+    {"ftp server", "service"},
+
+    {"usb activate", "usb"},
+    {"first cbw", "usb"},
+    {"first csw", "usb"},
+    {"first read", "usb"},
+
+    {"manifest load", "mount"},
+    {"cue parse", "mount"},
+    {"file open", "mount"},
+    {"clmt build", "mount"},
+    {"layout build", "mount"},
+};
+
+CBootTimeline::CBootTimeline()
+    : m_MountScope(MountScopeNone),
+      m_pMountTask(nullptr)
+{
+    for (unsigned i = 0; i < BootStageCount; i++)
+    {
+        m_Slots[i].nStart = 0;
+        m_Slots[i].nEnd = 0;
+        m_Slots[i].State = StateNone;
+    }
+}
+
+CBootTimeline *CBootTimeline::Get()
+{
+    static CBootTimeline s_BootTimeline;
+    return &s_BootTimeline;
+}
+
+void CBootTimeline::Begin(TBootStage Stage)
+{
+    assert(Stage < BootStageCount);
+    volatile TSlot &Slot = m_Slots[Stage];
+    if (!IsStamping(Stage) || Slot.State != StateNone)
+    {
+        return;
+    }
+
+    Slot.nStart = CTimer::Get()->GetClockTicks();
+    Slot.State = StateBegun;
+}
+
+void CBootTimeline::End(TBootStage Stage)
+{
+    assert(Stage < BootStageCount);
+    volatile TSlot &Slot = m_Slots[Stage];
+    if (!IsStamping(Stage) || Slot.State != StateBegun)
+    {
+        return;
+    }
+
+    Slot.nEnd = CTimer::Get()->GetClockTicks();
+    Slot.State = StateEnded;
+}
+
+void CBootTimeline::Mark(TBootStage Stage)
+{
+    assert(Stage < BootStageCount);
+    volatile TSlot &Slot = m_Slots[Stage];
+    if (!IsStamping(Stage) || Slot.State != StateNone)
+    {
+        return;
+    }
+
+    u32 nNow = CTimer::Get()->GetClockTicks();
+    Slot.nStart = nNow;
+    Slot.nEnd = nNow;
+    Slot.State = StateEnded;
+}
+
+void CBootTimeline::BeginMount(void)
+{
+    if (m_MountScope != MountScopeNone)
+    {
+        return;
+    }
+
+    m_pMountTask = CScheduler::Get()->GetCurrentTask();
+    m_MountScope = MountScopeOpen;
+}
+
+void CBootTimeline::EndMount(void)
+{
+    if (m_MountScope != MountScopeOpen || CScheduler::Get()->GetCurrentTask() != m_pMountTask)
+    {
+        return;
+    }
+
+    m_MountScope = MountScopeClosed;
+}
+
+boolean CBootTimeline::HasBegun(TBootStage Stage) const
+{
+    assert(Stage < BootStageCount);
+    return m_Slots[Stage].State != StateNone;
+}
+
+boolean CBootTimeline::HasEnded(TBootStage Stage) const
+{
+    assert(Stage < BootStageCount);
+    return m_Slots[Stage].State == StateEnded;
+}
+
+u32 CBootTimeline::GetStart(TBootStage Stage) const
+{
+    assert(Stage < BootStageCount);
+    return m_Slots[Stage].nStart;
+}
+
+u32 CBootTimeline::GetEnd(TBootStage Stage) const
+{
+    assert(Stage < BootStageCount);
+    return m_Slots[Stage].nEnd;
+}
+
+const char *CBootTimeline::GetName(TBootStage Stage)
+{
+    assert(Stage < BootStageCount);
+    return s_StageInfo[Stage].pName;
+}
+
+const char *CBootTimeline::GetGroup(TBootStage Stage)
+{
+    assert(Stage < BootStageCount);
+    return s_StageInfo[Stage].pGroup;
+}
+
+boolean CBootTimeline::IsStamping(TBootStage Stage) const
+{
+    // Checked first so the stages stamped from IRQ level never reach the
+    // scheduler
+    if (Stage < BootStageMountManifest)
+    {
+        return TRUE;
+    }
+
+    return m_MountScope == MountScopeOpen && CScheduler::Get()->GetCurrentTask() == m_pMountTask;
+}
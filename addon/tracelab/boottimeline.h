@@ -0,0 +1,125 @@
+//
+// boottimeline.h
+//
+// USBODE Trace Lab - where cold boot spends its time.
+//
+// A fixed table with one slot per stage: each CKernel::Initialize() step,
+// each service the kernel constructs, the first USB activation, CBW, CSW
+// and good READ, and the steps of the first image mount. A slot keeps the
+// first time its stage ran and is never overwritten, so the table reads as
+// the boot that produced it. Stamping a slot is a branch and two stores;
+// nothing is allocated, formatted or logged, so the gadget may stamp from
+// IRQ level on either core.
+//
+// Unlike a capture this is always on. /api/trace/boot exports it and the
+// trace page draws it as a waterfall.
+//
+#ifndef _tracelab_boottimeline_h
+#define _tracelab_boottimeline_h
+
+#include <circle/sched/task.h>
+#include <circle/types.h>
+
+enum TBootStage : u8
+{
+    // CKernel::Initialize()
+    BootStageScreen,
+    BootStageSerial,
+    BootStageLogger,
+    BootStageInterrupts,
+    BootStageTimer,
+    BootStageEMMC,
+    BootStageFilesystem,
+    BootStageConfigService,
+
+    // CKernel::Run()
+    BootStageImagesPartition,
+    BootStageCDROMService,
+    BootStageSCSITBService,
+    BootStageMountWait, // until the saved image is in the drive
+    BootStageDisplayService,
+    BootStageNetwork,   // WLAN, network and WPA supplicant
+    BootStageWebServer,
+    BootStageFTPServer,
+
+    // USB CD gadget (instants)
+    BootStageUSBActivate,
+    BootStageFirstCBW,
+    BootStageFirstCSW,
+    BootStageFirstRead, // first READ that completed with good status
+
+    // The first mount ProcessPendingMount() performs (see BeginMount())
+    BootStageMountManifest, // the saved mount manifest, hit or miss
+    BootStageMountCueParse,
+    BootStageMountFileOpen,
+    BootStageMountCLMT, // FatFs fast-seek link map
+    BootStageMountLayout,
+
+    BootStageCount
+};
+
+class CBootTimeline
+{
+public:
+    CBootTimeline();
+
+    // Always valid; the table is static.
+    static CBootTimeline *Get();
+
+    // Stamp the start or end of a stage, or both at once for an instant.
+    // Only the first run of a stage is kept; End() without Begin() is
+    // ignored. Safe from task or IRQ level on any core.
+    void Begin(TBootStage Stage);
+    void End(TBootStage Stage);
+    void Mark(TBootStage Stage);
+
+    // The image loader also runs for the metadata refresh and the standby
+    // disc, so the mount stages are only stamped between these two, by the
+    // task that called BeginMount(), and only the first time: the mount row
+    // is the boot's own mount and nobody else's. Task level only.
+    void BeginMount(void);
+    void EndMount(void);
+
+    // Times in microseconds since power-on (CTimer clock ticks). A stage
+    // that has begun but not ended has no end yet.
+    boolean HasBegun(TBootStage Stage) const;
+    boolean HasEnded(TBootStage Stage) const;
+    u32 GetStart(TBootStage Stage) const;
+    u32 GetEnd(TBootStage Stage) const;
+
+    // "cdrom service", and the row it is drawn in: "kernel", "service",
+    // "usb" or "mount".
+    static const char *GetName(TBootStage Stage);
+    static const char *GetGroup(TBootStage Stage);
+
+private:
+    enum TState : u8
+    {
+        StateNone,
+        StateBegun,
+        StateEnded
+    };
+
+    struct TSlot
+    {
+        u32 nStart;
+        u32 nEnd;
+        TState State;
+    };
+
+    enum TMountScope : u8
+    {
+        MountScopeNone,
+        MountScopeOpen,
+        MountScopeClosed
+    };
+
+    boolean IsStamping(TBootStage Stage) const;
+
+    volatile TSlot m_Slots[BootStageCount];
+
+    volatile TMountScope m_MountScope;
+    CTask *volatile m_pMountTask;
+};
+
+#endif
@@ -359,6 +359,9 @@ u32 CTraceLab::ExportToBuffer(u8 *pBuffer, u32 nMaxLength)
         return 0;
     }
 
+    // Pick up anything the USB CD core recorded since the last core 0 write.
+    m_RingBuffer.FlushStaged();
+
     TraceFileHeader header;
     memcpy(header.magic, TRACE_MAGIC, TRACE_MAGIC_LEN);
     header.formatVersion = TRACE_FORMAT_VERSION;
@@ -428,6 +431,9 @@ boolean CTraceLab::SaveToSD(const char *pFilePath)
         return FALSE;
     }
 
+    // Pick up anything the USB CD core recorded since the last core 0 write.
+    m_RingBuffer.FlushStaged();
+
     TraceFileHeader header;
     memcpy(header.magic, TRACE_MAGIC, TRACE_MAGIC_LEN);
     header.formatVersion = TRACE_FORMAT_VERSION;
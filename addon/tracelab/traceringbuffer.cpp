@@ -14,6 +14,7 @@ CTraceRingBuffer::CTraceRingBuffer()
       m_nRecordCount(0),
       m_nDroppedRecordCount(0),
       m_nLastTimestamp(0),
+      m_nStagedDroppedCount(0),
       m_nReadOffset(0),
       m_nReadRemaining(0)
 {
@@ -54,41 +55,103 @@ boolean CTraceRingBuffer::WriteRecord(u16 eventType, const void *pPayload, u16 n
         return FALSE;
     }
 
-    u32 nRecordSize = sizeof(TraceRecordHeader) + nPayloadLength;
-    if (nRecordSize > m_nCapacity)
+    if (HandoffThisCore() != 0)
     {
-        // Cannot ever fit; drop and report.
-        m_nDroppedRecordCount++;
-        return FALSE;
+        return StageRecord(eventType, pPayload, nPayloadLength);
     }
 
     u64 nNow = CTimer::GetClockTicks();
-    u64 nDelta = nNow - m_nLastTimestamp;
-
-    TraceRecordHeader header;
-    header.deltaTicks = (u32)nDelta;
-    header.eventType = eventType;
-    header.payloadLength = nPayloadLength;
 
     // Short critical section: reserve space and copy the fixed-size header
     // and small payload directly. No formatting, no allocation, no
     // filesystem/network access, no blocking.
-    //
+    EnterCritical();
+
+    // Staged records were taken before this one, so they go in first.
+    DrainStaged();
+    boolean bResult = AppendRecord(nNow, eventType, pPayload, nPayloadLength);
+
+    LeaveCritical();
+
+    return bResult;
+}
+
+void CTraceRingBuffer::FlushStaged()
+{
+    if (m_pBuffer == nullptr)
+    {
+        return;
+    }
+
+    EnterCritical();
+    DrainStaged();
+    LeaveCritical();
+}
+
+boolean CTraceRingBuffer::StageRecord(u16 eventType, const void *pPayload, u16 nPayloadLength)
+{
+    TStagedRecord Record;
+    if (nPayloadLength > MaxStagedPayload)
+    {
+        m_nStagedDroppedCount++;
+        return FALSE;
+    }
+
+    Record.nTimestamp = CTimer::GetClockTicks();
+    Record.eventType = eventType;
+    Record.payloadLength = nPayloadLength;
+    if (nPayloadLength > 0)
+    {
+        memcpy(Record.payload, pPayload, nPayloadLength);
+    }
+
+    if (!m_Staged.Put(Record))
+    {
+        // Core 0 has not written or exported anything for a while; the
+        // oldest records are worth more than the newest ones here.
+        m_nStagedDroppedCount++;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void CTraceRingBuffer::DrainStaged()
+{
+    TStagedRecord Record;
+    while (m_Staged.Get(&Record))
+    {
+        AppendRecord(Record.nTimestamp, Record.eventType, Record.payload, Record.payloadLength);
+    }
+}
+
+boolean CTraceRingBuffer::AppendRecord(u64 nTimestamp, u16 eventType, const void *pPayload, u16 nPayloadLength)
+{
     // Phase 1 supports only manual/bounded capture (not the continuous
     // flight-recorder trigger mode from the proposal), so once the buffer
     // fills we stop accepting new records instead of overwriting old ones.
     // This keeps export a simple linear read and avoids needing to
     // reorder records around a wrap point.
-    EnterCritical();
-
+    u32 nRecordSize = sizeof(TraceRecordHeader) + nPayloadLength;
     if (m_nWriteOffset + nRecordSize > m_nCapacity)
     {
-        LeaveCritical();
         m_nDroppedRecordCount++;
         return FALSE;
     }
 
-    m_nLastTimestamp = nNow;
+    // A record staged on the other core can be a few ticks older than the
+    // last one written here; keep deltas non-negative rather than reorder.
+    u64 nDelta = 0;
+    if (nTimestamp > m_nLastTimestamp)
+    {
+        nDelta = nTimestamp - m_nLastTimestamp;
+        m_nLastTimestamp = nTimestamp;
+    }
+
+    TraceRecordHeader header;
+    header.deltaTicks = (u32)nDelta;
+    header.eventType = eventType;
+    header.payloadLength = nPayloadLength;
 
     memcpy(m_pBuffer + m_nWriteOffset, &header, sizeof(TraceRecordHeader));
     if (nPayloadLength > 0)
@@ -99,8 +162,6 @@ boolean CTraceRingBuffer::WriteRecord(u16 eventType, const void *pPayload, u16 n
     m_nWriteOffset += nRecordSize;
     m_nRecordCount++;
 
-    LeaveCritical();
-
     return TRUE;
 }
 
@@ -113,6 +174,12 @@ void CTraceRingBuffer::Reset()
     m_nDroppedRecordCount = 0;
     m_nLastTimestamp = CTimer::GetClockTicks();
 
+    TStagedRecord Discarded;
+    while (m_Staged.Get(&Discarded))
+    {
+    }
+    m_nStagedDroppedCount = 0;
+
     LeaveCritical();
 }
 
@@ -6,11 +6,18 @@
 // CommitRecord() from task context; a short critical section guards the
 // write index so concurrent producers don't corrupt it.
 //
+// Records written from the dedicated USB CD core (see cdcore/cdcore.h) never
+// touch the buffer directly, because a critical section only masks IRQs on
+// the calling core. They go into a small lock-free staging queue instead and
+// are copied into the buffer by the next core 0 writer, or by FlushStaged()
+// before an export.
+//
 #ifndef _tracelab_traceringbuffer_h
 #define _tracelab_traceringbuffer_h
 
 #include <circle/types.h>
 #include <tracelab/traceformat.h>
+#include <cdcore/handoffqueue.h>
 
 class CTraceRingBuffer
 {
@@ -29,6 +36,10 @@ public:
     // touches the filesystem.
     boolean WriteRecord(u16 eventType, const void *pPayload, u16 nPayloadLength);
 
+    // Moves records staged by the USB CD core into the buffer. Core 0 only;
+    // called before counting or reading records for an export.
+    void FlushStaged();
+
     // Resets read position to the oldest surviving record and returns
     // records in write order via successive calls. Used only during export
     // (SaveToSD), never on the hot path.
@@ -40,10 +51,29 @@ public:
     void Reset();
 
     u32 GetRecordCount() const { return m_nRecordCount; }
-    u32 GetDroppedRecordCount() const { return m_nDroppedRecordCount; }
+    u32 GetDroppedRecordCount() const { return m_nDroppedRecordCount + m_nStagedDroppedCount; }
     u32 GetCapacity() const { return m_nCapacity; }
     u32 GetUsedBytes() const { return m_nWriteOffset; }
 
+private:
+    // Largest payload a staged record can carry (TraceSCSICDBPayload).
+    static const u16 MaxStagedPayload = 20;
+    static const unsigned StagedQueueSize = 64;
+
+    struct TStagedRecord
+    {
+        u64 nTimestamp;
+        u16 eventType;
+        u16 payloadLength;
+        u8 payload[MaxStagedPayload];
+    };
+
+    boolean StageRecord(u16 eventType, const void *pPayload, u16 nPayloadLength);
+    void DrainStaged();
+
+    // Caller holds the critical section.
+    boolean AppendRecord(u64 nTimestamp, u16 eventType, const void *pPayload, u16 nPayloadLength);
+
 private:
     u8 *m_pBuffer;
     u32 m_nCapacity;
@@ -52,6 +82,9 @@ private:
     u32 m_nDroppedRecordCount;
     u64 m_nLastTimestamp;
 
+    THandoffQueue<TStagedRecord, StagedQueueSize> m_Staged;
+    u32 m_nStagedDroppedCount; // written only by the USB CD core
+
     // read-side state, valid only between ResetReadCursor() and export
     // completion
     u32 m_nReadOffset;
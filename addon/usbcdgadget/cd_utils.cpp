@@ -5,6 +5,7 @@
 //
 #include <usbcdgadget/cd_utils.h>
 #include <circle/logger.h>
+#include <tracelab/binlog.h>
 
 #define MLOGNOTE(From, ...) CLogger::Get()->Write(From, LogNotice, __VA_ARGS__)
 #define MLOGDEBUG(From, ...) // CLogger::Get ()->Write (From, LogDebug, __VA_ARGS__)
@@ -14,7 +15,7 @@
     do                                   \
     {                                    \
         if (gadget->m_bDebugLogging)     \
-            MLOGNOTE(From, __VA_ARGS__); \
+            BINLOG_NOTE(From, __VA_ARGS__); \
     } while (0)
 
 // ============================================================================
@@ -329,6 +330,8 @@ u32 CDUtils::GetSessionLeadoutLBA(CUSBCDGadget* gadget, int session)
     return firstOfNext.track_start;
 }
 
+// UpdateDataPath() calls this, possibly on the CD core: it logs through
+// CBinLog only.
 u32 CDUtils::GetLeadoutLBA(CUSBCDGadget* gadget)
 {
     const CUETrackInfo *trackInfo = nullptr;
@@ -370,8 +373,8 @@ u32 CDUtils::GetLeadoutLBA(CUSBCDGadget* gadget)
     // Guard against invalid sector length
     if (sector_length == 0)
     {
-        MLOGERR("CDUtils::GetLeadoutLBA",
-                "sector_length is 0, returning track_start %lu", (unsigned long)track_start);
+        BINLOG_ERROR("CDUtils::GetLeadoutLBA",
+                     "sector_length is 0, returning track_start %lu", (unsigned long)track_start);
         return track_start;
     }
 
@@ -385,8 +388,8 @@ u32 CDUtils::GetLeadoutLBA(CUSBCDGadget* gadget)
     // Ensure the result fits in u32 before casting
     if (lastTrackBlocks > 0xFFFFFFFF)
     {
-        MLOGERR("CDUtils::GetLeadoutLBA",
-                "lastTrackBlocks overflow: %llu, capping to max u32", lastTrackBlocks);
+        BINLOG_ERROR("CDUtils::GetLeadoutLBA",
+                     "lastTrackBlocks overflow: %llu, capping to max u32", lastTrackBlocks);
         lastTrackBlocks = 0xFFFFFFFF;
     }
 
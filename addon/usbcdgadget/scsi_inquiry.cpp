@@ -10,6 +10,7 @@
 #include <cdplayer/cdplayer.h>
 #include <circle/sched/scheduler.h>
 #include <tracelab/tracelab.h>
+#include <tracelab/binlog.h>
 
 #define MLOGNOTE(From, ...) CLogger::Get()->Write(From, LogNotice, __VA_ARGS__)
 #define MLOGDEBUG(From, ...) // CLogger::Get ()->Write (From, LogDebug, __VA_ARGS__)
@@ -19,7 +20,7 @@
     do                                   \
     {                                    \
         if (gadget->m_bDebugLogging)     \
-            MLOGNOTE(From, __VA_ARGS__); \
+            BINLOG_NOTE(From, __VA_ARGS__); \
     } while (0)
 
 void SCSIInquiry::Inquiry(CUSBCDGadget *gadget)
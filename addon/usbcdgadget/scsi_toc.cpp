@@ -9,6 +9,7 @@
 #include <circle/sched/scheduler.h>
 #include <cdplayer/cdplayer.h>
 #include <circle/util.h>
+#include <tracelab/binlog.h>
 
 #define MLOGNOTE(From, ...) CLogger::Get()->Write(From, LogNotice, __VA_ARGS__)
 #define MLOGDEBUG(From, ...) // CLogger::Get ()->Write (From, LogDebug, __VA_ARGS__)
@@ -18,7 +19,7 @@
     do                                   \
     {                                    \
         if (gadget->m_bDebugLogging)     \
-            MLOGNOTE(From, __VA_ARGS__); \
+            BINLOG_NOTE(From, __VA_ARGS__); \
     } while (0)
 
 void SCSITOC::ReadTOC(CUSBCDGadget *gadget)
@@ -6,25 +6,59 @@
 #include <usbcdgadget/usbcdgadget.h>
 #include <cdplayer/cdplayer.h>
 #include <usbcdgadget/cd_utils.h>
+#include <cdcore/handoffqueue.h>
+#include <assert.h>
 #include <circle/logger.h>
 #include <circle/util.h>
 #include <circle/sched/scheduler.h>
 #include <tracelab/tracelab.h>
+#include <tracelab/binlog.h>
+#include <ioscheduler/ioscheduler.h>
 
 #define MLOGNOTE(From, ...) CLogger::Get()->Write(From, LogNotice, __VA_ARGS__)
 #define MLOGDEBUG(From, ...) // CLogger::Get ()->Write (From, LogDebug, __VA_ARGS__)
-#define MLOGERR(From, ...) CLogger::Get()->Write(From, LogError, __VA_ARGS__)
 
 #define CDROM_DEBUG_LOG(From, ...)       \
     do                                   \
     {                                    \
         if (m_bDebugLogging)             \
-            MLOGNOTE(From, __VA_ARGS__); \
+            BINLOG_NOTE(From, __VA_ARGS__); \
     } while (0)
 
 // this function is called periodically from task level for IO
 //(IO must not be attempted in functions called from IRQ)
 void CUSBCDGadget::Update()
+{
+    UpdateTaskLevel();
+    UpdateDataPath();
+}
+
+// Looking up the player walks the scheduler's task list and starting the
+// sound device programs core 0 peripherals, so this half never moves to the
+// CD core.
+void CUSBCDGadget::UpdateTaskLevel()
+{
+    assert(HandoffThisCore() == 0);
+
+    if (m_bNeedsAudioInit == TRUE)
+    {
+        m_bNeedsAudioInit = FALSE;
+        CCDPlayer *cdplayer = (CCDPlayer *)CScheduler::Get()->GetTask("cdplayer");
+        if (cdplayer)
+        {
+            MLOGNOTE("CUSBCDGadget::Update", "Initializing I2S audio after pending flag");
+            cdplayer->EnsureAudioInitialized();
+        }
+        else
+        {
+            MLOGNOTE("CUSBCDGadget::Update", "WARNING: CD Player not found!");
+        }
+    }
+}
+
+// May run on the CD core, so everything it logs, and everything the image
+// device logs under it, goes through CBinLog and never CLogger.
+void CUSBCDGadget::UpdateDataPath()
 {
     if (m_bPendingDiscSwap)
     {
@@ -70,27 +104,12 @@ void CUSBCDGadget::Update()
             default:
                 // Shouldn't happen
                 m_bPendingDiscSwap = false;
-                MLOGERR("CUSBCDGadget::Update",
-                        "Disc swap: Unexpected state %d, aborting", (int)m_mediaState);
+                BINLOG_ERROR("CUSBCDGadget::Update",
+                             "Disc swap: Unexpected state %d, aborting", (int)m_mediaState);
                 break;
             }
         }
     }
-    if (m_bNeedsAudioInit == TRUE)
-    {
-        m_bNeedsAudioInit = FALSE;
-        CCDPlayer *cdplayer = (CCDPlayer *)CScheduler::Get()->GetTask("cdplayer");
-        if (cdplayer)
-        {
-            MLOGNOTE("CUSBCDGadget::Update", "Initializing I2S audio after pending flag");
-            cdplayer->EnsureAudioInitialized();
-        }
-        else
-        {
-            MLOGNOTE("CUSBCDGadget::Update", "WARNING: CD Player not found!");
-        }
-    }
-
     switch (m_nState)
     {
     case TCDState::DataInRead:
@@ -102,8 +121,8 @@ void CUSBCDGadget::Update()
             u32 max_lba = CDUtils::GetLeadoutLBA(this);
             if (m_nblock_address >= max_lba)
             {
-                MLOGERR("UpdateRead", "Current LBA %u exceeds max %u - aborting transfer",
-                        m_nblock_address, max_lba);
+                BINLOG_ERROR("UpdateRead", "Current LBA %u exceeds max %u - aborting transfer",
+                             m_nblock_address, max_lba);
                 setSenseData(0x05, 0x21, 0x00);
                 sendCheckCondition();
                 return;
@@ -157,8 +176,8 @@ void CUSBCDGadget::Update()
 
                 if (total_batch_size > MaxInMessageSize)
                 {
-                    MLOGERR("UpdateRead", "BUFFER OVERFLOW: %u > %u",
-                            total_batch_size, (u32)MaxInMessageSize);
+                    BINLOG_ERROR("UpdateRead", "BUFFER OVERFLOW: %u > %u",
+                                 total_batch_size, (u32)MaxInMessageSize);
                     blocks_to_read_in_batch = MaxInMessageSize / block_size;
                     total_batch_size = blocks_to_read_in_batch * block_size;
                     total_transfer_size = blocks_to_read_in_batch * transfer_block_size;
@@ -166,7 +185,19 @@ void CUSBCDGadget::Update()
                 }
 
                 CTraceLab::Get()->TraceImageReadStart(m_nblock_address, total_batch_size);
+                CIOScheduler::Get()->BeginRealTime(IOClassHostData);
                 readCount = m_pDevice->Read(m_FileChunk, total_batch_size);
+                CIOScheduler::Get()->EndRealTime(IOClassHostData, readCount > 0 ? (u32)readCount : 0);
+                if (readCount > 0)
+                {
+                    unsigned type = (unsigned)m_pDevice->GetFileType();
+                    if (type < NumFileTypes)
+                    {
+                        m_nServedRemainder += (u32)readCount;
+                        __atomic_fetch_add(&m_nServedKiB[type], m_nServedRemainder / 1024, __ATOMIC_RELAXED);
+                        m_nServedRemainder %= 1024;
+                    }
+                }
                 CTraceLab::Get()->TraceImageReadComplete(m_nblock_address,
                                                          readCount > 0 ? (u32)readCount : 0);
 
@@ -205,8 +236,8 @@ void CUSBCDGadget::Update()
 
                 if (readCount <= 0)
                 {
-                    MLOGERR("UpdateRead", "Read failed: returned %d bytes (expected %u) at LBA %u",
-                            readCount, total_batch_size, m_nblock_address - blocks_to_read_in_batch);
+                    BINLOG_ERROR("UpdateRead", "Read failed: returned %d bytes (expected %u) at LBA %u",
+                                 readCount, total_batch_size, m_nblock_address - blocks_to_read_in_batch);
 
                     if (readCount == 0)
                     {
@@ -223,8 +254,8 @@ void CUSBCDGadget::Update()
 
                 if (readCount < static_cast<int>(total_batch_size))
                 {
-                    MLOGERR("UpdateRead", "Partial read: %d/%u bytes at LBA %u",
-                            readCount, total_batch_size, m_nblock_address - blocks_to_read_in_batch);
+                    BINLOG_ERROR("UpdateRead", "Partial read: %d/%u bytes at LBA %u",
+                                 readCount, total_batch_size, m_nblock_address - blocks_to_read_in_batch);
 
                     setSenseData(0x03, 0x11, 0x00);
                     sendCheckCondition();
@@ -426,7 +457,7 @@ void CUSBCDGadget::Update()
 
         if (!m_CDReady || offset == (u64)(-1))
         {
-            MLOGERR("UpdateRead", "Failed: ready=%d, offset=%llu", m_CDReady, offset);
+            BINLOG_ERROR("UpdateRead", "Failed: ready=%d, offset=%llu", m_CDReady, offset);
             CTraceLab::Get()->TraceImageReadError(m_nblock_address, 0);
             setSenseData(0x02, 0x04, 0x00);
             sendCheckCondition();
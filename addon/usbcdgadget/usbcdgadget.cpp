@@ -43,6 +43,8 @@
 #include <usbcdgadget/scsi_toolbox.h>
 #include <usbcdgadget/scsi_misc.h>
 #include <tracelab/tracelab.h>
+#include <tracelab/binlog.h>
+#include <tracelab/boottimeline.h>
 
 #define MLOGNOTE(From, ...) CLogger::Get()->Write(From, LogNotice, __VA_ARGS__)
 #define MLOGDEBUG(From, ...) // CLogger::Get ()->Write (From, LogDebug, __VA_ARGS__)
@@ -53,7 +55,7 @@
     do                                   \
     {                                    \
         if (m_bDebugLogging)             \
-            MLOGNOTE(From, __VA_ARGS__); \
+            BINLOG_NOTE(From, __VA_ARGS__); \
     } while (0)
 
 #define DEFAULT_BLOCKS 16000
@@ -580,6 +582,7 @@ void CUSBCDGadget::SetDevice(IImageDevice *dev)
         m_nDiscSwapStartTick = CTimer::Get()->GetTicks();
         MLOGNOTE("CUSBCDGadget::SetDevice",
                  "Disc swap: Staying in NO_MEDIUM, will transition to UNIT_ATTENTION after delay");
+        NotifyUpdate();
     }
     else
     {
@@ -654,6 +657,7 @@ void CUSBCDGadget::Insert(void)
     m_CDReady = false;
     m_bPendingDiscSwap = true;
     m_nDiscSwapStartTick = CTimer::Get()->GetTicks();
+    NotifyUpdate();
 }
 
 // Arm the boot restore. Called before the first SetDevice(), so the drive is
@@ -739,6 +743,26 @@ int CUSBCDGadget::OnClassOrVendorRequest(const TSetupData *pSetupData, u8 *pData
     return -1;
 }
 
+void CUSBCDGadget::RegisterUpdateNotificationHandler(TUpdateNotificationHandler *pHandler, void *pParam)
+{
+    m_pUpdateNotificationParam = pParam;
+    m_pUpdateNotificationHandler = pHandler;
+}
+
+u32 CUSBCDGadget::GetServedKiB(FileType Type) const
+{
+    unsigned type = (unsigned)Type;
+    return type < NumFileTypes ? __atomic_load_n(&m_nServedKiB[type], __ATOMIC_RELAXED) : 0;
+}
+
+void CUSBCDGadget::NotifyUpdate(void)
+{
+    if (m_pUpdateNotificationHandler != nullptr)
+    {
+        (*m_pUpdateNotificationHandler)(m_pUpdateNotificationParam);
+    }
+}
+
 void CUSBCDGadget::OnTransferComplete(boolean bIn, size_t nLength)
 {
     // CDROM_DEBUG_LOG("OnXferComplete", "state = %i, dir = %s, len=%i ",m_nState,bIn?"IN":"OUT",nLength);
@@ -982,6 +1006,7 @@ void CUSBCDGadget::ProcessOut(size_t nLength)
 void CUSBCDGadget::OnActivate()
 {
     CTraceLab::Get()->TraceUSBActivate();
+    CBootTimeline::Get()->Mark(BootStageUSBActivate);
     CDROM_DEBUG_LOG("CD OnActivate",
                     "=== ENTRY === state=%d, USB=%s, m_CDReady=%d, mediaState=%d",
                     (int)m_nState,
@@ -1022,6 +1047,12 @@ void CUSBCDGadget::SendCSW()
     // never go through sendGoodStatus), so this is the one place that sees
     // all command completions.
     CTraceLab::Get()->TraceCommandComplete(m_CBW.CBWCB[0], m_CSW.bmCSWStatus, m_CSW.dCSWDataResidue);
+    CBootTimeline::Get()->Mark(BootStageFirstCSW);
+    u8 nOpcode = m_CBW.CBWCB[0];
+    if (m_CSW.bmCSWStatus == CD_CSW_STATUS_OK && (nOpcode == 0x28 || nOpcode == 0xA8 || nOpcode == 0xBE))
+    {
+        CBootTimeline::Get()->Mark(BootStageFirstRead);
+    }
 
     memcpy(&m_InBuffer, &m_CSW, SIZE_CSW);
     m_pEP[EPIn]->BeginTransfer(CUSBCDGadgetEndpoint::TransferCSWIn, m_InBuffer, SIZE_CSW);
@@ -1097,6 +1128,7 @@ void CUSBCDGadget::sendGoodStatus()
 void CUSBCDGadget::HandleSCSICommand()
 {
     CTraceLab::Get()->TraceCDBReceived(m_CBW.bCBWLUN, m_CBW.CBWCB, m_CBW.bCBWCBLength);
+    CBootTimeline::Get()->Mark(BootStageFirstCBW);
 
     if (m_CBW.CBWCB[0] != 0x00) // Filter out TEST_UNIT_READY spam
     {
@@ -108,7 +108,38 @@ public:
     void DisarmBootEject(void);
 
     /// \brief Call this periodically from TASK_LEVEL to allow I/O operations!
+    /// Same as UpdateTaskLevel() followed by UpdateDataPath().
     void Update(void);
+
+    /// \brief The part of Update() that needs core 0 services (the scheduler's
+    /// task list, the sound device). Always called from a core 0 task.
+    void UpdateTaskLevel(void);
+
+    /// \brief The part of Update() that serves the host: image reads and the
+    /// disc-swap timer. Runs on core 1 when CCDCore owns the data path.
+    void UpdateDataPath(void);
+
+    /// \brief TRUE when UpdateDataPath() has something to do, so an idle
+    /// poller can skip it (and the storage turn it would otherwise take).
+    boolean HasDataPathWork(void) const
+    {
+        return m_nState == TCDState::DataInRead || m_bPendingDiscSwap;
+    }
+
+    /// \brief Called from IRQ level whenever a transfer completes or the
+    /// endpoints come up, and from task level when a disc swap starts, i.e.
+    /// whenever Update() may have new work. Lets the caller sleep in between.
+    typedef void TUpdateNotificationHandler(void *pParam);
+    void RegisterUpdateNotificationHandler(TUpdateNotificationHandler *pHandler, void *pParam);
+
+    /// \brief Image data served to the host since boot, in KiB, from images
+    /// of the given format. Safe to call from either core.
+    u32 GetServedKiB(FileType Type) const;
+
+    /// \brief TRUE when the host talks to the drive at USB 1.1 full speed,
+    /// whether configured that way or negotiated down.
+    boolean IsFullSpeed(void) const { return IsEffectiveFullSpeed(); }
+
     boolean m_bNeedsAudioInit = FALSE;
 
 protected:
@@ -140,6 +171,7 @@ private:
     // ========================================================================
     friend class CUSBCDGadgetEndpoint;
     void OnTransferComplete(boolean bIn, size_t nLength);
+    void NotifyUpdate(void);
     void OnActivate(); // called from OUT ep
     void ProcessOut(size_t nLength);
     // ========================================================================
@@ -180,6 +212,9 @@ private:
     boolean m_bPendingDiscSwap = false;
     unsigned m_nDiscSwapStartTick = 0;
 
+    TUpdateNotificationHandler *m_pUpdateNotificationHandler = nullptr;
+    void *m_pUpdateNotificationParam = nullptr;
+
     // Eject / medium-removal state. m_bEjected latches an empty drive (the
     // image device stays allocated in m_pDevice; the host just sees NO_MEDIUM).
     // m_bMediumRemovalPrevented mirrors the host's PREVENT ALLOW MEDIUM REMOVAL
@@ -289,6 +324,12 @@ private:
     // Effective speed: configured full-speed OR negotiated down to full-speed
     boolean IsEffectiveFullSpeed(void) const { return m_IsFullSpeed || m_bNegotiatedFullSpeed; }
 
+    // Served bytes by image format, counted in whole KiB so a 32-bit
+    // atomic does; the remainder stays with the data path, the only writer
+    static const unsigned NumFileTypes = (unsigned)FileType::CHD + 1;
+    u32 m_nServedKiB[NumFileTypes] = {0};
+    u32 m_nServedRemainder = 0;
+
     boolean discChanged = false; // Media change flag
     bool m_bDebugLogging;        // Debug flag to enable verbose CD-ROM logging
     // ========================================================================
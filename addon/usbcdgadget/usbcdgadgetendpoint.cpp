@@ -55,6 +55,7 @@ void CUSBCDGadgetEndpoint::OnActivate (void)
 		m_pGadget->OnActivate();
 	}
     m_pGadget->m_bNeedsAudioInit = TRUE;
+    m_pGadget->NotifyUpdate();
 }
 
 void CUSBCDGadgetEndpoint::OnDeactivate (void)
@@ -65,6 +66,7 @@ void CUSBCDGadgetEndpoint::OnTransferComplete (boolean bIn, size_t nLength)
 {
 	MLOGNOTE("CDEndpoint","Transfer complete nlen= %i",nLength);
 	m_pGadget->OnTransferComplete(bIn, nLength);
+	m_pGadget->NotifyUpdate();
 }
 
 /*
@@ -307,6 +307,20 @@ int CUSBMMSDGadget::OnClassOrVendorRequest (const TSetupData *pSetupData, u8 *pD
 	return -1;
 }
 
+void CUSBMMSDGadget::RegisterUpdateNotificationHandler (TUpdateNotificationHandler *pHandler, void *pParam)
+{
+	m_pUpdateNotificationParam = pParam;
+	m_pUpdateNotificationHandler = pHandler;
+}
+
+void CUSBMMSDGadget::NotifyUpdate (void)
+{
+	if (m_pUpdateNotificationHandler != nullptr)
+	{
+		(*m_pUpdateNotificationHandler) (m_pUpdateNotificationParam);
+	}
+}
+
 void CUSBMMSDGadget::OnTransferComplete (boolean bIn, size_t nLength)
 {
 	MLOGDEBUG("OnXferComplete", "state = %i, dir = %s, len=%i ",m_nState,bIn?"IN":"OUT",nLength);
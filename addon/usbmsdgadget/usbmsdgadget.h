@@ -154,6 +154,17 @@ public:
 	/// \brief Call this periodically from TASK_LEVEL to allow I/O operations!
 	void Update (void);
 
+	/// \brief TRUE while Update() has a read or write to carry out
+	boolean HasPendingWork (void) const
+	{
+		return m_nState == TMMSDState::DataInRead || m_nState == TMMSDState::DataOutWrite;
+	}
+
+	/// \brief Called from IRQ level whenever a transfer completes or the
+	/// endpoints come up, i.e. whenever Update() may have new work
+	typedef void TUpdateNotificationHandler (void *pParam);
+	void RegisterUpdateNotificationHandler (TUpdateNotificationHandler *pHandler, void *pParam);
+
 	/// \param nBlocks Capacity of the block device in number of blocks (a 512 bytes)
 	/// \note Used when the block device does not report its size.
 	void SetDeviceBlocks(u64 nBlocks);
@@ -191,6 +202,8 @@ private:
 
 	void OnActivate(); //called from OUT ep
 
+	void NotifyUpdate (void);
+
 private:
 	void HandleSCSICommand();
 
@@ -269,6 +282,9 @@ private:
 	u32 m_nbyteCount;
 	boolean m_MMSDReady=false;
 	boolean m_IsFullSpeed = 0;
+
+	TUpdateNotificationHandler *m_pUpdateNotificationHandler = nullptr;
+	void *m_pUpdateNotificationParam = nullptr;
 };
 
 #endif
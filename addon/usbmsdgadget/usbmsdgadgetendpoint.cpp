@@ -48,6 +48,7 @@ void CUSBMMSDGadgetEndpoint::OnActivate (void)
 	{
 		m_pGadget->OnActivate();
 	}
+	m_pGadget->NotifyUpdate();
 }
 
 void CUSBMMSDGadgetEndpoint::OnDeactivate (void)
@@ -58,6 +59,7 @@ void CUSBMMSDGadgetEndpoint::OnTransferComplete (boolean bIn, size_t nLength)
 {
 	MLOGNOTE("MMSDEndpoint","Transfer complete nlen= %i",nLength);
 	m_pGadget->OnTransferComplete(bIn, nLength);
+	m_pGadget->NotifyUpdate();
 }
 
 
@@ -0,0 +1,298 @@
+#include "downloadserver.h"
+
+#include <assert.h>
+#include <circle/logger.h>
+#include <circle/net/in.h>
+#include <circle/net/ipaddress.h>
+#include <circle/net/netsubsystem.h>
+#include <circle/sched/scheduler.h>
+#include <circle/timer.h>
+#include <discimage/util.h>
+#include <ftpserver/readahead.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "httprange.h"
+
+LOGMODULE("download");
+
+// A client that connects and sends no request gets dropped after this long
+constexpr unsigned RequestTimeoutSecs = 20;
+
+static const char BusyResponse[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Retry-After: 5\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n\r\n";
+
+unsigned CDownloadWorker::s_nInstanceCount = 0;
+
+CDownloadDaemon::CDownloadDaemon()
+    : CTask(TASK_STACK_SIZE, true),
+      m_pListenSocket(nullptr) {
+    SetName("downloadd");
+}
+
+CDownloadDaemon::~CDownloadDaemon() {
+    delete m_pListenSocket;
+}
+
+boolean CDownloadDaemon::Initialize() {
+    m_pListenSocket = new CSocket(CNetSubSystem::Get(), IPPROTO_TCP);
+
+    if (m_pListenSocket->Bind(DOWNLOAD_PORT) != 0) {
+        LOGERR("Couldn't bind to port %d", DOWNLOAD_PORT);
+        return FALSE;
+    }
+
+    if (m_pListenSocket->Listen() != 0) {
+        LOGERR("Failed to listen on port %d", DOWNLOAD_PORT);
+        return FALSE;
+    }
+
+    // Started suspended; run now that the socket is ready
+    Start();
+    return TRUE;
+}
+
+void CDownloadDaemon::Run(void) {
+    assert(m_pListenSocket != nullptr);
+
+    while (true) {
+        CIPAddress ClientIPAddress;
+        u16 nClientPort;
+        CSocket* pConnection = m_pListenSocket->Accept(&ClientIPAddress, &nClientPort);
+        if (pConnection == nullptr) {
+            LOGERR("Unable to accept connection");
+            continue;
+        }
+
+        if (CDownloadWorker::GetInstanceCount() >= MaxConnections) {
+            pConnection->Send(BusyResponse, sizeof(BusyResponse) - 1, 0);
+            delete pConnection;
+            LOGWARN("Maximum number of connections reached");
+            continue;
+        }
+
+        new CDownloadWorker(pConnection);
+    }
+}
+
+CDownloadWorker::CDownloadWorker(CSocket* pSocket)
+    : CTask(TASK_STACK_SIZE),
+      m_pSocket(pSocket),
+      m_nRequestLength(0) {
+    ++s_nInstanceCount;
+    m_Request[0] = '\0';
+    SetName("download");
+}
+
+CDownloadWorker::~CDownloadWorker() {
+    delete m_pSocket;
+    --s_nInstanceCount;
+}
+
+void CDownloadWorker::Run(void) {
+    if (ReceiveRequest())
+        HandleRequest();
+}
+
+boolean CDownloadWorker::ReceiveRequest() {
+    CTimer* const pTimer = CTimer::Get();
+    unsigned nStartTicks = pTimer->GetTicks();
+    u8 Buffer[FRAME_BUFFER_SIZE];
+
+    while (strstr(m_Request, "\r\n\r\n") == nullptr) {
+        int nReceived = m_pSocket->Receive(Buffer, sizeof(Buffer), MSG_DONTWAIT);
+        if (nReceived < 0)
+            return FALSE;
+        if (nReceived == 0) {
+            if (pTimer->GetTicks() - nStartTicks >= RequestTimeoutSecs * HZ)
+                return FALSE;
+            CScheduler::Get()->Yield();
+            continue;
+        }
+
+        if (m_nRequestLength + nReceived > MaxRequestSize) {
+            SendHeader(431, "Request Header Fields Too Large", "Content-Length: 0\r\n");
+            return FALSE;
+        }
+        memcpy(m_Request + m_nRequestLength, Buffer, nReceived);
+        m_nRequestLength += nReceived;
+        m_Request[m_nRequestLength] = '\0';
+    }
+    return TRUE;
+}
+
+// %XX only: a '+' in a path is a plus
+static std::string DecodePath(const char* pFrom, const char* pEnd) {
+    std::string Path;
+    for (const char* p = pFrom; p < pEnd; p++) {
+        if (*p == '%' && pEnd - p > 2) {
+            char Hex[3] = {p[1], p[2], '\0'};
+            Path += (char)strtol(Hex, nullptr, 16);
+            p += 2;
+        } else {
+            Path += *p;
+        }
+    }
+    return Path;
+}
+
+void CDownloadWorker::HandleRequest() {
+    static const char EmptyBody[] = "Content-Length: 0\r\n";
+
+    // "GET /images/Games/game.iso HTTP/1.1"
+    const char* pTarget = strchr(m_Request, ' ');
+    const char* pTargetEnd = pTarget != nullptr ? strchr(pTarget + 1, ' ') : nullptr;
+    if (pTargetEnd == nullptr) {
+        SendHeader(400, "Bad Request", EmptyBody);
+        return;
+    }
+    pTarget++;
+
+    boolean bHead = strncmp(m_Request, "HEAD ", 5) == 0;
+    if (!bHead && strncmp(m_Request, "GET ", 4) != 0) {
+        SendHeader(405, "Method Not Allowed", "Allow: GET, HEAD\r\nContent-Length: 0\r\n");
+        return;
+    }
+
+    const char* pQuery = (const char*)memchr(pTarget, '?', pTargetEnd - pTarget);
+    if (pQuery != nullptr)
+        pTargetEnd = pQuery;
+    if (strncmp(pTarget, "/images/", 8) != 0) {
+        SendHeader(404, "Not Found", EmptyBody);
+        return;
+    }
+
+    // Only files on the images volume, and nothing above it
+    std::string Name = DecodePath(pTarget + 8, pTargetEnd);
+    if (Name.empty() || Name.find("..") != std::string::npos
+        || Name.find('\\') != std::string::npos || Name.find('\0') != std::string::npos) {
+        SendHeader(404, "Not Found", EmptyBody);
+        return;
+    }
+    std::string Path = "1:/" + Name;
+
+    FILINFO FileInfo;
+    if (f_stat(Path.c_str(), &FileInfo) != FR_OK || (FileInfo.fattrib & AM_DIR)) {
+        SendHeader(404, "Not Found", EmptyBody);
+        return;
+    }
+    const u64 nSize = FileInfo.fsize;
+
+    char ETag[40];
+    FormatHTTPETag(nSize, FileInfo.fdate, FileInfo.ftime, ETag, sizeof(ETag));
+
+    char Value[256];
+    if (GetHTTPHeader(m_Request, "If-None-Match", Value, sizeof(Value)) && strcmp(Value, ETag) == 0) {
+        char Fields[64];
+        snprintf(Fields, sizeof(Fields), "ETag: %s\r\n", ETag);
+        SendHeader(304, "Not Modified", Fields);
+        return;
+    }
+
+    // A range of what the client has part of already; if the image has
+    // changed since (If-Range no longer matches) it needs all of it again
+    u64 nFirst = 0;
+    u64 nLast = nSize - 1;
+    THTTPRange Range = HTTPRangeNone;
+    if (GetHTTPHeader(m_Request, "Range", Value, sizeof(Value))) {
+        char IfRange[64];
+        if (!GetHTTPHeader(m_Request, "If-Range", IfRange, sizeof(IfRange)) || strcmp(IfRange, ETag) == 0)
+            Range = ParseHTTPRange(Value, nSize, &nFirst, &nLast);
+    }
+
+    if (Range == HTTPRangeNotSatisfiable) {
+        char Fields[128];
+        snprintf(Fields, sizeof(Fields), "Content-Range: bytes */%llu\r\nContent-Length: 0\r\n",
+                 (unsigned long long)nSize);
+        SendHeader(416, "Range Not Satisfiable", Fields);
+        return;
+    }
+    u64 nLength = nSize == 0 ? 0 : nLast - nFirst + 1;
+
+    FIL File;
+    if (f_open(&File, Path.c_str(), FA_READ) != FR_OK) {
+        SendHeader(404, "Not Found", EmptyBody);
+        return;
+    }
+
+    // Saved under its own name, without the folders
+    size_t nSlash = Name.rfind('/');
+    std::string FileName = nSlash == std::string::npos ? Name : Name.substr(nSlash + 1);
+    for (char& c : FileName) {
+        if (c == '"' || (unsigned char)c < ' ')
+            c = '_';
+    }
+
+    std::string Fields = "Content-Type: application/octet-stream\r\n";
+    char Field[128];
+    snprintf(Field, sizeof(Field), "Content-Length: %llu\r\n", (unsigned long long)nLength);
+    Fields += Field;
+    if (Range == HTTPRangeSatisfiable) {
+        snprintf(Field, sizeof(Field), "Content-Range: bytes %llu-%llu/%llu\r\n",
+                 (unsigned long long)nFirst, (unsigned long long)nLast, (unsigned long long)nSize);
+        Fields += Field;
+    }
+    Fields += "Accept-Ranges: bytes\r\nETag: ";
+    Fields += ETag;
+    Fields += "\r\nContent-Disposition: attachment; filename=\"" + FileName + "\"\r\n";
+
+    boolean bSent = Range == HTTPRangeSatisfiable ? SendHeader(206, "Partial Content", Fields.c_str())
+                                                  : SendHeader(200, "OK", Fields.c_str());
+    if (bSent && !bHead && nLength > 0) {
+        if (SendFile(&File, nFirst, nLength))
+            LOGNOTE("Sent %s, bytes %llu-%llu", Path.c_str(), (unsigned long long)nFirst,
+                    (unsigned long long)nLast);
+        else
+            LOGWARN("Download of %s ended early", Path.c_str());
+    }
+
+    f_close(&File);
+}
+
+boolean CDownloadWorker::SendHeader(unsigned nStatus, const char* pReason, const char* pFields) {
+    std::string Header = "HTTP/1.1 ";
+    char Status[64];
+    snprintf(Status, sizeof(Status), "%u %s\r\n", nStatus, pReason);
+    Header += Status;
+    Header += pFields;
+    Header += "Connection: close\r\n\r\n";
+    return m_pSocket->Send(Header.c_str(), Header.length(), 0) >= 0;
+}
+
+boolean CDownloadWorker::SendFile(FIL* pFile, u64 nFirst, u64 nLength) {
+    // A range deep into a fragmented image would otherwise start with a walk
+    // of the FAT chain up to it
+    DWORD* pCLMT = nullptr;
+    FatFsOptimizer::EnableFastSeek(pFile, &pCLMT, 256, "Download: ");
+    if (f_lseek(pFile, nFirst) != FR_OK) {
+        FatFsOptimizer::DisableFastSeek(&pCLMT);
+        return FALSE;
+    }
+
+    // The read-ahead runs to the end of the file; it is stopped once the
+    // range is sent, having read at most its buffers beyond
+    CReadAhead ReadAhead(pFile);
+    boolean bSuccess = ReadAhead.Start();
+    u64 nRemaining = nLength;
+    while (bSuccess && nRemaining > 0) {
+        unsigned nAvailable;
+        const u8* pData = ReadAhead.GetNext(&nAvailable);
+        if (pData == nullptr) {
+            bSuccess = FALSE;   // read failed, or the file got shorter
+            break;
+        }
+        if (nAvailable > nRemaining)
+            nAvailable = (unsigned)nRemaining;
+        bSuccess = m_pSocket->Send(pData, nAvailable, 0) >= 0;
+        ReadAhead.Release();
+        nRemaining -= nAvailable;
+    }
+    ReadAhead.Stop();
+
+    FatFsOptimizer::DisableFastSeek(&pCLMT);
+    return bSuccess;
+}
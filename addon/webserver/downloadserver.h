@@ -0,0 +1,67 @@
+//
+// downloadserver.h
+//
+// Image downloads over HTTP: GET /images/<path> on DOWNLOAD_PORT serves
+// 1:/<path> with Range support, so download managers can resume a transfer
+// or fetch several parts of one image at once over separate connections.
+//
+// Circle's CHTTPDaemon renders a response into one buffer and hands its
+// handlers neither the request headers nor the socket, so it can take
+// neither a Range header nor a multi-gigabyte image. This is a small server
+// of its own, built like the FTP daemon: a listener task and a worker task
+// per connection, each streaming its file through a CReadAhead.
+//
+#ifndef WS_DOWNLOADSERVER_H
+#define WS_DOWNLOADSERVER_H
+
+#include <circle/net/socket.h>
+#include <circle/sched/task.h>
+#include <circle/types.h>
+#include <fatfs/ff.h>
+
+#define DOWNLOAD_PORT 8080
+
+class CDownloadDaemon : public CTask {
+public:
+    // Parallel downloads of one image open a connection per part
+    static const unsigned MaxConnections = 4;
+
+    CDownloadDaemon();
+    ~CDownloadDaemon();
+
+    // Starts listening; FALSE if the port could not be had
+    boolean Initialize();
+
+    void Run(void);
+
+private:
+    CSocket* m_pListenSocket;
+};
+
+class CDownloadWorker : public CTask {
+public:
+    CDownloadWorker(CSocket* pSocket);
+    ~CDownloadWorker();
+
+    void Run(void);
+
+    static unsigned GetInstanceCount() { return s_nInstanceCount; }
+
+private:
+    // The request line and headers, up to the blank line
+    boolean ReceiveRequest();
+    void HandleRequest();
+    boolean SendHeader(unsigned nStatus, const char* pReason, const char* pFields);
+    // nLength bytes of the file from nFirst on
+    boolean SendFile(FIL* pFile, u64 nFirst, u64 nLength);
+
+    static const unsigned MaxRequestSize = 4096;
+
+    CSocket* m_pSocket;
+    char m_Request[MaxRequestSize + 1];
+    unsigned m_nRequestLength;
+
+    static unsigned s_nInstanceCount;
+};
+
+#endif
@@ -3,7 +3,9 @@
 #include <circle/net/httpdaemon.h>
 #include <string>
 #include <cstring>
+#include <cstdio>
 #include <map>
+#include <vector>
 #include <fstream>
 #include "asset.h"
 #include "../util.h"
@@ -17,26 +19,63 @@
 #include "style.h"
 #include "sysfont-eot.h"
 #include "sysfont-woff.h"
+
+// Gzipped at build time; JPEG and WOFF are compressed already
+#include "style.css.gz.h"
+#include "favicon.ico.gz.h"
+#include "font-eot.eot.gz.h"
+#include "sysfont-eot.eot.gz.h"
 LOGMODULE("assethandler");
 
+// Theme files are kept in memory after the first read, up to this much
+#define THEME_CACHE_LIMIT (512 * 1024)
+
 struct StaticAsset {
     const uint8_t *data;
     size_t length;
     const char *contentType;
+    const uint8_t *gzipData;    // nullptr if not compressed
+    size_t gzipLength;
 };
 
 // route mappings for your assets
 static const std::map<std::string, StaticAsset> g_staticAssets = {
-    { "/logo.jpg",      { assets_logo_jpg, assets_logo_jpg_len, "image/jpeg" } },
-    { "/favicon.ico",   { assets_favicon_ico, assets_favicon_ico_len, "image/x-icon" } },
-    { "/style.css",     { (const uint8_t *)assets_style_css, assets_style_css_len, "text/css" } },
-    { "/font-eot.eot",  { assets_font_eot_eot, assets_font_eot_eot_len, "application/vnd.ms-fontobject" } },
-    { "/font-woff.woff",{ assets_font_woff_woff, assets_font_woff_woff_len, "application/font-woff" } },
-    { "/sysfont-eot.eot",  { assets_sysfont_eot_eot, assets_sysfont_eot_eot_len, "application/vnd.ms-fontobject" } },
-    { "/sysfont-woff.woff",{ assets_sysfont_woff_woff, assets_sysfont_woff_woff_len, "application/font-woff" } },
+    { "/logo.jpg",      { assets_logo_jpg, assets_logo_jpg_len, "image/jpeg", nullptr, 0 } },
+    { "/favicon.ico",   { assets_favicon_ico, assets_favicon_ico_len, "image/x-icon",
+                          assets_favicon_ico_gz, assets_favicon_ico_gz_len } },
+    { "/style.css",     { (const uint8_t *)assets_style_css, assets_style_css_len, "text/css",
+                          assets_style_css_gz, assets_style_css_gz_len } },
+    { "/font-eot.eot",  { assets_font_eot_eot, assets_font_eot_eot_len, "application/vnd.ms-fontobject",
+                          assets_font_eot_eot_gz, assets_font_eot_eot_gz_len } },
+    { "/font-woff.woff",{ assets_font_woff_woff, assets_font_woff_woff_len, "application/font-woff", nullptr, 0 } },
+    { "/sysfont-eot.eot",  { assets_sysfont_eot_eot, assets_sysfont_eot_eot_len, "application/vnd.ms-fontobject",
+                             assets_sysfont_eot_eot_gz, assets_sysfont_eot_eot_gz_len } },
+    { "/sysfont-woff.woff",{ assets_sysfont_woff_woff, assets_sysfont_woff_woff_len, "application/font-woff", nullptr, 0 } },
     // Add more assets here
 };
 
+// What a response sends: the bytes, and the header lines that go with them
+// for a plain URL and for one carrying the boot_id cache buster.
+struct ServedAsset {
+    const uint8_t *data;
+    size_t length;
+    std::string headers;
+    std::string bustedHeaders;
+};
+
+// A theme file as read from the card; absent ones are remembered too, so
+// assets the theme does not replace stop costing a failed open.
+struct ThemeFile {
+    bool found;
+    std::vector<uint8_t> data;
+    std::string headers;
+    std::string bustedHeaders;
+};
+
+static std::map<std::string, ServedAsset> s_servedAssets;
+static std::map<std::string, ThemeFile> s_themeFiles;
+static size_t s_themeCacheBytes = 0;
+
 static const char* GetMimeType(const std::string& path) {
     if (path.find(".css") != std::string::npos) return "text/css";
     if (path.find(".js") != std::string::npos)  return "application/javascript";
@@ -46,6 +85,81 @@ static const char* GetMimeType(const std::string& path) {
     return "text/plain";
 }
 
+// Circle's HTTP daemon only lets a handler choose the Content-Type, which it
+// writes as a header line of its own. The other headers an asset needs ride
+// along after it.
+static std::string MakeHeaders(const char* contentType, const uint8_t* data, size_t length,
+                               bool gzip, bool busted) {
+    u32 hash = 2166136261u;  // FNV-1a: a strong ETag of the bytes sent
+    for (size_t i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    char etag[16];
+    snprintf(etag, sizeof(etag), "\"%08x\"", (unsigned)hash);
+
+    // Pages link their assets with the boot ID in the query, so those URLs
+    // never serve anything else; the rest may change with the theme.
+    std::string headers(contentType);
+    if (gzip)
+        headers += "\r\nContent-Encoding: gzip";
+    headers += busted ? "\r\nCache-Control: public, max-age=31536000, immutable"
+                      : "\r\nCache-Control: public, max-age=86400";
+    headers += "\r\nETag: ";
+    headers += etag;
+    return headers;
+}
+
+// The UI needs a browser with fetch() and async functions, and every one of
+// those takes gzip, so the compressed copy is always the one sent.
+static void PrepareStaticAssets() {
+    for (const auto& entry : g_staticAssets) {
+        const StaticAsset& asset = entry.second;
+        bool gzip = asset.gzipData != nullptr && asset.gzipLength < asset.length;
+
+        ServedAsset& served = s_servedAssets[entry.first];
+        served.data = gzip ? asset.gzipData : asset.data;
+        served.length = gzip ? asset.gzipLength : asset.length;
+        served.headers = MakeHeaders(asset.contentType, served.data, served.length, gzip, false);
+        served.bustedHeaders = MakeHeaders(asset.contentType, served.data, served.length, gzip, true);
+    }
+}
+
+static const ThemeFile& GetThemeFile(const std::string& sdPath) {
+    auto it = s_themeFiles.find(sdPath);
+    if (it != s_themeFiles.end())
+        return it->second;
+
+    ThemeFile file;
+    file.found = false;
+    std::ifstream stream(sdPath.c_str(), std::ios::binary | std::ios::ate);
+    if (stream.good()) {
+        std::streamsize fileSize = stream.tellg();
+        stream.seekg(0, std::ios::beg);
+        if (fileSize > 0) {
+            file.data.resize((size_t)fileSize);
+            file.found = (bool)stream.read((char*)file.data.data(), fileSize);
+        }
+    }
+    if (file.found) {
+        const char* contentType = GetMimeType(sdPath);
+        file.headers = MakeHeaders(contentType, file.data.data(), file.data.size(), false, false);
+        file.bustedHeaders = MakeHeaders(contentType, file.data.data(), file.data.size(), false, true);
+    } else {
+        file.data.clear();
+    }
+
+    // Over the limit the file is served but not kept
+    static ThemeFile s_uncached;
+    if (s_themeCacheBytes + file.data.size() > THEME_CACHE_LIMIT) {
+        LOGNOTE("AssetHandler: Theme cache full, not keeping %s", sdPath.c_str());
+        s_uncached = std::move(file);
+        return s_uncached;
+    }
+    s_themeCacheBytes += file.data.size();
+    return s_themeFiles.emplace(sdPath, std::move(file)).first->second;
+}
+
 THTTPStatus AssetHandler::GetContent (const char  *pPath,
                                    const char  *pParams,
                                    const char  *pFormData,
@@ -69,40 +183,37 @@ THTTPStatus AssetHandler::GetContent (const char  *pPath,
             s_themeBasePath = "0:/themes/";
             s_themeBasePath += themeName;
             LOGNOTE("AssetHandler: Theme active: %s", s_themeBasePath.c_str());
-        } 
+        }
+        PrepareStaticAssets();
         s_isInitialized = true;
     }
 
+    bool busted = pParams != nullptr && strstr(pParams, "boot_id=") != nullptr;
+
     // Check theme
     if (!s_themeBasePath.empty()) {
-        std::string sdPath = s_themeBasePath + pPath;
-        std::ifstream file(sdPath.c_str(), std::ios::binary | std::ios::ate);
-        if (file.good()) {
-            std::streamsize fileSize = file.tellg();
-            file.seekg(0, std::ios::beg);
-            if (fileSize > 0 && (unsigned)fileSize <= *pLength) {
-                if (file.read((char*)pBuffer, fileSize)) {
-                    *pLength = (unsigned)fileSize;
-                    *ppContentType = GetMimeType(sdPath);
-                    return HTTPOK;
-                }
-            }
+        const ThemeFile& file = GetThemeFile(s_themeBasePath + pPath);
+        if (file.found && file.data.size() <= *pLength) {
+            memcpy(pBuffer, file.data.data(), file.data.size());
+            *pLength = (unsigned)file.data.size();
+            *ppContentType = busted ? file.bustedHeaders.c_str() : file.headers.c_str();
+            return HTTPOK;
         }
-    }    
+    }
 
     // Find the asset path, returning 404 if not found
-    auto it = g_staticAssets.find(pPath);
-    if (it == g_staticAssets.end())
+    auto it = s_servedAssets.find(pPath);
+    if (it == s_servedAssets.end())
         return HTTPNotFound;
 
     // Get the asset
-    const StaticAsset &asset = it->second;
+    const ServedAsset &asset = it->second;
     if (*pLength < asset.length)
         return HTTPInternalServerError;
 
     // Serve the asset content
     std::memcpy(pBuffer, asset.data, asset.length);
     *pLength = asset.length;
-    *ppContentType = asset.contentType;
+    *ppContentType = busted ? asset.bustedHeaders.c_str() : asset.headers.c_str();
     return HTTPOK;
 }
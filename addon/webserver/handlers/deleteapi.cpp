@@ -57,7 +57,7 @@ THTTPStatus DeleteImageAPIHandler::GetJson(nlohmann::json& j,
     }
 
     LOGNOTE("Deleted image %s", full.c_str());
-    svc->RefreshCache();
+    svc->RemoveEntry(rel.c_str());
 
     j["status"] = "ok";
     j["deleted"] = rel;
@@ -12,6 +12,7 @@
 #include <algorithm>
 #include <gitinfo/gitinfo.h>
 #include "homepage.h"
+#include "../downloadserver.h"
 #include "../util.h"
 
 using namespace kainjow;
@@ -123,9 +124,6 @@ THTTPStatus HomePageHandler::PopulateContext(kainjow::mustache::data& context,
 
     LOGNOTE("HomePageHandler: Filtering entries for path='%s'", current_path.c_str());
 
-    bool isRoot = current_path.empty();
-    size_t pathLen = current_path.length();
-
     // Set path-related context variables
     bool is_root = current_path.empty();
     context.set("current_path", current_path);
@@ -146,11 +144,15 @@ THTTPStatus HomePageHandler::PopulateContext(kainjow::mustache::data& context,
     
     context.set("image_name", current_image_name);
     context.set("image_path", current_image_path ? current_image_path : "");
+    context.set("download_port", std::to_string(DOWNLOAD_PORT));
 
     // Eject state: drives the Eject/Insert toggle button in the header
     bool ejected = svc->IsEjected();
     context.set("ejected", ejected);
 
+    // The library as listed here, so the page can tell when to reload
+    context.set("generation", std::to_string(svc->GetGeneration()));
+
     // Check if disc art exists for current image
     bool has_disc_art = false;
     if (current_image_path && current_image_path[0] != '\0') {
@@ -168,43 +170,39 @@ THTTPStatus HomePageHandler::PopulateContext(kainjow::mustache::data& context,
     LOGNOTE("HomePageHandler: Building links for path='%s'", current_path.c_str());
     std::vector<kainjow::mustache::data> all_links_vec;
 
-    // Iterate through all cached entries and filter
-    for (const FileEntry* entry = svc->begin(); entry != svc->end(); ++entry) {
-        const char* entryPath = entry->relativePath;
-
-        // Filter logic: show only entries at current depth (unless flat mode is enabled)
-        bool showEntry = false;
-        if (flatFileList) {
-            // Flat mode: show all files (skip directories)
-            showEntry = !entry->isDirectory;
-        } else if (isRoot) {
-            // Root: show entries with no '/' in their path
-            showEntry = (strchr(entryPath, '/') == nullptr);
-        } else {
-            // Subfolder: show entries that start with "path/" and have no additional '/'
-            if (strncmp(entryPath, current_path.c_str(), pathLen) == 0 && entryPath[pathLen] == '/') {
-                const char* remainder = entryPath + pathLen + 1;
-                showEntry = (strchr(remainder, '/') == nullptr);
-            }
-        }
+    // Flat mode shows every image, which all come after the folders;
+    // otherwise show the children of the current folder
+    size_t first = 0;
+    size_t count = 0;
+    const u32* children = nullptr;
+    if (flatFileList) {
+        first = svc->GetDirectoryCount();
+        count = svc->GetCount() - first;
+    } else {
+        children = svc->GetFolderEntries(current_path.c_str(), &count);
+        if (children == nullptr)
+            count = 0;
+    }
 
-        if (!showEntry)
-            continue;
+    for (size_t i = 0; i < count; ++i) {
+        size_t index = children != nullptr ? children[i] : first + i;
+        const char* relativePath = svc->GetRelativePath(index);
+        bool isDirectory = svc->IsDirectory(index);
 
         mustache::data link;
-        std::string name(entry->name);
+        std::string name(svc->GetName(index));
         link.set("file_name", name);
-        link.set("is_folder", entry->isDirectory);
+        link.set("is_folder", isDirectory);
         link.set("flat_display_path", flatFileList);
 
-        if (entry->isDirectory) {
+        if (isDirectory) {
             // Folder: link to /?path=relativePath
-            link.set("folder_path", std::string(entry->relativePath));
+            link.set("folder_path", std::string(relativePath));
             link.set("style", " folder");
             link.set("current", "");
         } else {
             // File: check if it's the currently mounted image (only if we're in the same folder)
-            std::string full_path = "1:/" + std::string(entry->relativePath);
+            std::string full_path = "1:/" + std::string(relativePath);
 
             std::string current_marker = "";
             std::string style = "";
@@ -217,8 +215,8 @@ THTTPStatus HomePageHandler::PopulateContext(kainjow::mustache::data& context,
             link.set("style", style);
 
             // URL-encode the relative path for mount link
-            link.set("file_path", std::string(entry->relativePath));
-            link.set("file_path_encoded", url_encode_path(entry->relativePath));
+            link.set("file_path", std::string(relativePath));
+            link.set("file_path_encoded", url_encode_path(relativePath));
         }
 
         all_links_vec.push_back(link);
@@ -11,5 +11,10 @@ public:
                                    const char  *pParams,
                                    const char  *pFormData);
     std::string GetHTML();
+
+protected:
+    // Everything shown comes from the query, the library and the drive.
+    // Disc art dropped beside the mounted image shows after the next change.
+    bool IsCacheable() const override { return true; }
 };
 #endif
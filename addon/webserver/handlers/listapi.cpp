@@ -1,23 +1,46 @@
 #include <circle/logger.h>
 #include <circle/util.h>
 #include <circle/net/httpdaemon.h>
-#include <json/json.hpp>
 #include <scsitbservice/scsitbservice.h>
 #include <string>
 #include <cstring>
+#include <cstdlib>
 #include <map>
+#include <vector>
+#include <algorithm>
 #include "listapi.h"
+#include "../jsonwriter.h"
 #include "../util.h"
 
 LOGMODULE("listapi");
 
-THTTPStatus ListAPIHandler::GetJson(nlohmann::json& j,
-                const char *pPath,
-                const char *pParams,
-                const char *pFormData)
+// Room kept for what follows the entries: closing the array, nextOffset
+// and the object.
+static const unsigned TAIL_RESERVE = 64;
+
+static unsigned long ParseNumber(const std::map<std::string, std::string>& params,
+                                 const char* name, unsigned long fallback)
 {
-    LOGNOTE("ListAPIHandler::GetJson called");
+    auto it = params.find(name);
+    if (it == params.end() || it->second.empty())
+        return fallback;
+    return strtoul(it->second.c_str(), nullptr, 10);
+}
 
+// /api/list[?path=Games/RPG][&offset=N][&limit=N][&sort=name|size][&order=desc]
+//          [&generation=N]
+//
+// Folders always come first. With no limit, every entry that fits in the
+// response; if they do not all fit, nextOffset says where to carry on. With
+// a generation matching the library's, the entries are left out and
+// "unchanged" is true.
+THTTPStatus ListAPIHandler::GetContent(const char *pPath,
+                const char *pParams,
+                const char *pFormData,
+                u8 *pBuffer,
+                unsigned *pLength,
+                const char **ppContentType)
+{
     SCSITBService* svc = static_cast<SCSITBService*>(CScheduler::Get()->GetTask("scsitbservice"));
     if (!svc) {
         LOGERR("ListAPIHandler: Couldn't fetch SCSITB Service");
@@ -30,54 +53,139 @@ THTTPStatus ListAPIHandler::GetJson(nlohmann::json& j,
     auto it = params.find("path");
     if (it != params.end()) {
         path = it->second;
-        LOGNOTE("ListAPIHandler: path parameter = '%s'", path.c_str());
         // Normalize: remove trailing slash
         while (!path.empty() && path.back() == '/')
             path.pop_back();
     }
 
-    bool isRoot = path.empty();
-    size_t pathLen = path.length();
+    unsigned long offset = ParseNumber(params, "offset", 0);
+    unsigned long limit = ParseNumber(params, "limit", 0);  // 0: no limit
+    it = params.find("sort");
+    bool bySize = it != params.end() && it->second == "size";
+    it = params.find("order");
+    bool descending = it != params.end() && it->second == "desc";
 
-    // Build response
-    j["path"] = path;
-    j["isRoot"] = isRoot;
+    const u32 generation = svc->GetGeneration();
+    it = params.find("generation");
+    bool unchanged = it != params.end() && !it->second.empty()
+                     && strtoul(it->second.c_str(), nullptr, 10) == generation;
 
+    // A copy of the folder's indices: GetImageInfo() below can wait for
+    // m_Lock, and the index may be swapped out meanwhile, freeing the list
+    // GetFolderEntries() points into.
+    size_t count = 0;
+    const u32* children = svc->GetFolderEntries(path.c_str(), &count);
+    std::vector<u32> order;
+    if (children != nullptr)
+        order.assign(children, children + count);
+    count = order.size();
+
+    JsonWriter w(pBuffer, *pLength);
+    w.BeginObject();
+    w.Key("path");
+    w.String(path.c_str());
+    w.Key("isRoot");
+    w.Bool(path.empty());
     const char* currentPath = svc->GetCurrentCDPath();
-    j["currentImage"] = currentPath ? currentPath : "";
-    j["ejected"] = svc->IsEjected();
-
-    // Build entries array - iterate and filter
-    LOGNOTE("ListAPIHandler: Building entries array");
-    nlohmann::json entries = nlohmann::json::array();
-    
-    for (const FileEntry* entry = svc->begin(); entry != svc->end(); ++entry) {
-        const char* entryPath = entry->relativePath;
-        
-        // Filter logic
-        bool showEntry = false;
-        if (isRoot) {
-            showEntry = (strchr(entryPath, '/') == nullptr);
-        } else {
-            if (strncmp(entryPath, path.c_str(), pathLen) == 0 && entryPath[pathLen] == '/') {
-                const char* remainder = entryPath + pathLen + 1;
-                showEntry = (strchr(remainder, '/') == nullptr);
+    w.Key("currentImage");
+    w.String(currentPath ? currentPath : "");
+    w.Key("ejected");
+    w.Bool(svc->IsEjected());
+    w.Key("generation");
+    w.Number(generation);
+    w.Key("total");
+    w.Number(count);
+
+    if (unchanged) {
+        w.Key("unchanged");
+        w.Bool(true);
+    } else {
+        // Name order is display order, so only the other orders need sorting
+        if (count > 0 && (bySize || descending)) {
+            std::stable_sort(order.begin(), order.end(), [svc, bySize, descending](u32 a, u32 b) {
+                bool dirA = svc->IsDirectory(a);
+                bool dirB = svc->IsDirectory(b);
+                if (dirA != dirB)
+                    return dirA;
+                if (bySize && svc->GetSize(a) != svc->GetSize(b))
+                    return descending ? svc->GetSize(a) > svc->GetSize(b) : svc->GetSize(a) < svc->GetSize(b);
+                return descending ? a > b : a < b;
+            });
+        }
+
+        size_t end = count;
+        if (limit > 0 && offset + limit < end)
+            end = offset + limit;
+
+        w.Key("offset");
+        w.Number(offset);
+        w.Key("entries");
+        w.BeginArray();
+        size_t i = offset;
+        for (; i < end; ++i) {
+            size_t index = order[i];
+            JsonWriter::Mark mark = w.GetMark();
+
+            w.BeginObject();
+            w.Key("name");
+            w.String(svc->GetName(index));
+            w.Key("relativePath");
+            w.String(svc->GetRelativePath(index));
+            w.Key("type");
+            w.String(svc->IsDirectory(index) ? "directory" : "file");
+            w.Key("size");
+            w.Number(svc->GetSize(index));
+
+            // Once the metadata task has read the image
+            ImageInfo info;
+            bool known = svc->GetImageInfo(index, &info);
+            // The index changed while waiting for it: the indices left name
+            // other entries now, so stop here and let the client reload
+            if (svc->GetGeneration() != generation) {
+                w.Rewind(mark);
+                break;
+            }
+            if (known) {
+                w.Key("info");
+                w.BeginObject();
+                w.Key("label");
+                w.String(info.volumeLabel);
+                w.Key("platform");
+                w.String(getImagePlatformName(info.platform));
+                w.Key("tracks");
+                w.Number(info.numTracks);
+                w.Key("audioTracks");
+                w.Number(info.numAudioTracks);
+                w.Key("audioSeconds");
+                w.Number(info.audioFrames / 75);
+                w.Key("discSectors");
+                w.Number(info.discFrames);
+                w.EndObject();
+            }
+            w.EndObject();
+
+            if (w.Overflowed() || w.GetLength() + TAIL_RESERVE > *pLength) {
+                w.Rewind(mark);
+                break;
             }
         }
-        
-        if (!showEntry)
-            continue;
-        
-        nlohmann::json item;
-        item["name"] = entry->name;
-        item["relativePath"] = entry->relativePath;
-        item["type"] = entry->isDirectory ? "directory" : "file";
-        item["size"] = entry->size;
-        entries.push_back(item);
+        w.EndArray();
+
+        w.Key("nextOffset");
+        if (i < count)
+            w.Number(i);
+        else
+            w.Null();
+    }
+    w.EndObject();
+
+    *ppContentType = "application/json";
+    if (w.Overflowed()) {
+        LOGERR("Output buffer too small for rendered content.");
+        *pLength = 0;
+        return HTTPInternalServerError;
     }
-    
-    j["entries"] = entries;
 
-    LOGNOTE("ListAPIHandler: GetJson completed successfully");
+    *pLength = w.GetLength();
     return HTTPOK;
 }
@@ -2,13 +2,17 @@
 #ifndef LISTAPI_HANDLER_H
 #define LISTAPI_HANDLER_H
 
-#include "apihandlerbase.h"
+#include "pagehandler.h"
 
-class ListAPIHandler : public APIHandlerBase {
+// Written straight into the response buffer rather than through a
+// nlohmann::json document: a big folder is one object per entry otherwise.
+class ListAPIHandler : public IPageHandler {
 public:
-   THTTPStatus GetJson(nlohmann::json& j,
-		const char *pPath,
-		const char *pParams,
-		const char *pFormData);
+    THTTPStatus GetContent(const char *pPath,
+                           const char *pParams,
+                           const char *pFormData,
+                           u8 *pBuffer,
+                           unsigned *pLength,
+                           const char **ppContentType) override;
 };
 #endif
@@ -21,6 +21,9 @@ using namespace kainjow;
 
 LOGMODULE("logpagehandler");
 
+// How long the page waits for the log daemon to write out what it holds
+#define LOG_PAGE_FLUSH_WAIT_MS 200
+
 char s_Log[] =
 #include "log.h"
 ;
@@ -69,6 +72,10 @@ THTTPStatus LogPageHandler::PopulateContext(kainjow::mustache::data& context,
     char status[256] = {0};
     CFileLogDaemon *pDaemon = CFileLogDaemon::Get();
     if (pDaemon != nullptr) {
+        // The daemon batches its writes; without this the page trails by up
+        // to a second of lines. It does the writing: this task must not
+        // touch its buffer or file while it may be halfway through a write.
+        pDaemon->RequestFlush(LOG_PAGE_FLUSH_WAIT_MS);
         pDaemon->GetStdioPath(path, sizeof(path));
         pDaemon->GetStatusText(status, sizeof(status));
     }
@@ -0,0 +1,199 @@
+#include <circle/logger.h>
+#include <circle/util.h>
+#include <circle/memory.h>
+#include <circle/timer.h>
+#include <circle/net/httpdaemon.h>
+#include <circle/sched/scheduler.h>
+#include <cdcore/cdcore.h>
+#include <cdplayer/cdplayer.h>
+#include <cdromservice/cdromservice.h>
+#include <discimage/util.h>
+#include <ioscheduler/ioscheduler.h>
+#include "metricsapi.h"
+#include "../jsonwriter.h"
+
+LOGMODULE("metricsapi");
+
+static const struct {
+    FileType type;
+    const char* name;
+} s_Formats[] = {
+    { FileType::ISO,    "iso" },
+    { FileType::CUEBIN, "cueBin" },
+    { FileType::MDS,    "mds" },
+    { FileType::CHD,    "chd" },
+};
+
+static void WriteHitRatio(JsonWriter& w, u32 hits, u32 misses)
+{
+    w.Key("hits");
+    w.Number(hits);
+    w.Key("misses");
+    w.Number(misses);
+    // In percent, whole numbers are enough here
+    w.Key("hitPercent");
+    if (hits + misses > 0)
+        w.Number((u64)hits * 100 / ((u64)hits + misses));
+    else
+        w.Null();
+}
+
+static void WriteStorage(JsonWriter& w)
+{
+    CIOScheduler* scheduler = CIOScheduler::Get();
+    w.BeginArray();
+    for (unsigned i = 0; i < IOClassCount; i++) {
+        TIOClass ioClass = (TIOClass)i;
+        TIOClassStats stats;
+        scheduler->GetStats(ioClass, &stats);
+
+        w.BeginObject();
+        w.Key("class");
+        w.String(CIOScheduler::GetClassName(ioClass));
+        w.Key("bytes");
+        w.Number(stats.nBytes);
+        w.Key("requests");
+        w.Number(stats.nRequests);
+        w.Key("throttled");
+        w.Number(stats.nThrottled);
+        w.Key("p50Us");
+        w.Number(CIOScheduler::GetLatencyPercentile(stats, 50));
+        w.Key("p90Us");
+        w.Number(CIOScheduler::GetLatencyPercentile(stats, 90));
+        w.Key("p99Us");
+        w.Number(CIOScheduler::GetLatencyPercentile(stats, 99));
+        w.Key("maxUs");
+        w.Number(stats.nMaxLatencyUs);
+        w.EndObject();
+    }
+    w.EndArray();
+}
+
+static void WriteTasks(JsonWriter& w)
+{
+    // Timed by the CD core's task switch hook; without one there is nothing
+    CCDCore* core = CCDCore::Get();
+    if (core == nullptr) {
+        w.Null();
+        return;
+    }
+
+    static const unsigned MaxTasks = 32;
+    CCDCore::TTaskTime times[MaxTasks];
+    unsigned count = core->GetTaskTimes(times, MaxTasks);
+
+    w.BeginArray();
+    for (unsigned i = 0; i < count; i++) {
+        w.BeginObject();
+        w.Key("name");
+        w.String(times[i].Name);
+        w.Key("runUs");
+        w.Number(times[i].nRunUs);
+        w.Key("switches");
+        w.Number(times[i].nSwitches);
+        w.Key("maxSliceUs");
+        w.Number(times[i].nMaxSliceUs);
+        w.EndObject();
+    }
+    w.EndArray();
+}
+
+static void WriteStorageWait(JsonWriter& w)
+{
+    // Only a CD core waits for storage
+    CCDCore* core = CCDCore::Get();
+    if (core == nullptr || !core->IsActive()) {
+        w.Null();
+        return;
+    }
+
+    CCDCore::TStorageWait wait;
+    core->GetStorageWait(&wait);
+
+    w.BeginObject();
+    w.Key("grants");
+    w.Number(wait.nGrants);
+    w.Key("meanUs");
+    w.Number(wait.nGrants > 0 ? (u32)(wait.nTotalUs / wait.nGrants) : 0);
+    w.Key("maxUs");
+    w.Number(wait.nMaxUs);
+    w.Key("maxHolder");
+    w.String(wait.MaxHolder);
+    w.EndObject();
+}
+
+THTTPStatus MetricsAPIHandler::GetContent(const char *pPath,
+                const char *pParams,
+                const char *pFormData,
+                u8 *pBuffer,
+                unsigned *pLength,
+                const char **ppContentType)
+{
+    JsonWriter w(pBuffer, *pLength);
+    w.BeginObject();
+
+    w.Key("uptimeSeconds");
+    w.Number(CTimer::Get()->GetUptime());
+
+    CDROMService* cdrom = static_cast<CDROMService*>(CScheduler::Get()->GetTask("cdromservice"));
+    w.Key("usbSpeed");
+    if (cdrom != nullptr)
+        w.String(cdrom->IsFullSpeed() ? "full" : "high");
+    else
+        w.Null();
+
+    w.Key("servedKiB");
+    w.BeginObject();
+    for (const auto& format : s_Formats) {
+        w.Key(format.name);
+        w.Number(cdrom != nullptr ? cdrom->GetServedKiB(format.type) : 0);
+    }
+    w.EndObject();
+
+    ImageCacheStats cache;
+    getImageCacheStats(&cache);
+    w.Key("cueBinCache");
+    w.BeginObject();
+    WriteHitRatio(w, cache.cueBinHits, cache.cueBinMisses);
+    w.EndObject();
+    w.Key("chdHunkCache");
+    w.BeginObject();
+    WriteHitRatio(w, cache.chdHunkHits, cache.chdHunkMisses);
+    w.Key("decodeMs");
+    w.Number(cache.chdDecodeMs);
+    w.EndObject();
+
+    CCDPlayer* player = static_cast<CCDPlayer*>(CScheduler::Get()->GetTask("cdplayer"));
+    w.Key("audioUnderruns");
+    if (player != nullptr)
+        w.Number(player->GetUnderrunCount());
+    else
+        w.Null();
+
+    w.Key("storage");
+    WriteStorage(w);
+
+    w.Key("cdCoreStorageWait");
+    WriteStorageWait(w);
+
+    w.Key("tasks");
+    WriteTasks(w);
+
+    CMemorySystem* memory = CMemorySystem::Get();
+    w.Key("heapFreeBytes");
+    w.Number(memory->GetHeapFreeSpace(HEAP_ANY));
+    w.Key("memoryBytes");
+    w.Number(memory->GetMemSize());
+
+    w.EndObject();
+
+    if (w.Overflowed()) {
+        LOGERR("MetricsAPIHandler: Output buffer too small");
+        *pLength = 0;
+        return HTTPInternalServerError;
+    }
+
+    *pLength = w.GetLength();
+    *ppContentType = "application/json";
+    return HTTPOK;
+}
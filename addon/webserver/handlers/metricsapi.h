@@ -0,0 +1,23 @@
+
+#ifndef METRICSAPI_HANDLER_H
+#define METRICSAPI_HANDLER_H
+
+#include "pagehandler.h"
+
+// /api/metrics
+//
+// Counters since boot for diagnosing a slow drive: data served by image
+// format, image cache hits, CHD decode time, audio underruns, SD card
+// latency by I/O class, how long the CD core waited for storage, core 0
+// task run times, heap and USB speed. Each
+// counter lives in the subsystem that owns it; this only reads them.
+class MetricsAPIHandler : public IPageHandler {
+public:
+    THTTPStatus GetContent(const char *pPath,
+                           const char *pParams,
+                           const char *pFormData,
+                           u8 *pBuffer,
+                           unsigned *pLength,
+                           const char **ppContentType) override;
+};
+#endif
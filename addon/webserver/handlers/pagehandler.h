@@ -15,6 +15,9 @@ public:
                                    u8          *pBuffer,
                                    unsigned    *pLength,
                                    const char **ppContentType) = 0;
+
+    // Work a handler can do once, before the first request
+    virtual void Precompile() {}
 };
 
 #endif // IPAGE_HANDLER_H
@@ -22,6 +22,93 @@ char s_Template[] =
 #include "template.h"
 ;
 
+// The same on every page, so put together once
+static std::string s_BuildInfo;
+
+// What a cached page was rendered from: the drive's state in the top half,
+// the config in the bottom. Either going up makes every cached page stale.
+static u64 GetStateGeneration(SCSITBService* svc, ConfigService* config)
+{
+        return (u64)svc->GetStateGeneration() << 32 | config->GetGeneration();
+}
+
+static THTTPStatus SendPage(const std::string& page, u8 *pBuffer, unsigned *pLength,
+                            const char **ppContentType)
+{
+        if (pBuffer && *pLength >= page.length()) {
+            memcpy(pBuffer, page.c_str(), page.length());
+            *pLength = page.length();
+            *ppContentType = "text/html";
+            return HTTPOK;
+        }
+
+        // The provided buffer is too small
+        LOGERR("Output buffer too small for rendered content.");
+        *pLength = 0;
+        *ppContentType = "text/plain";
+        return HTTPInternalServerError;
+}
+
+PageHandlerBase::PageHandlerBase()
+:       m_pTemplate(nullptr),
+        m_nNextSlot(0)
+{
+        for (unsigned i = 0; i < CacheSlots; i++) {
+            m_Cache[i].bValid = false;
+            m_Cache[i].nGeneration = 0;
+        }
+}
+
+PageHandlerBase::~PageHandlerBase()
+{
+        delete m_pTemplate;
+}
+
+// Inlining the page rather than rendering it as a partial means the page is
+// parsed here, once, and not again on every render.
+void PageHandlerBase::Precompile()
+{
+        if (m_pTemplate != nullptr)
+            return;
+
+        static const char content[] = "{{>content}}";
+        std::string source(s_Template);
+        size_t at = source.find(content);
+        if (at != std::string::npos)
+            source.replace(at, sizeof(content) - 1, GetHTML());
+
+        m_pTemplate = new mustache::mustache(source);
+        if (!m_pTemplate->is_valid())
+            LOGERR("Page template: %s", m_pTemplate->error_message().c_str());
+
+        if (s_BuildInfo.empty())
+            s_BuildInfo = std::string(GIT_BRANCH) + " @ " + std::string(GIT_COMMIT) + " | " + __DATE__ + " " + __TIME__ + " | " + CGitInfo::Get()->GetKernelName() + "(AARCH" + CGitInfo::Get()->GetArchBits() + ")";
+}
+
+const PageHandlerBase::TCachedPage* PageHandlerBase::FindCached(const char *pParams, u64 nGeneration) const
+{
+        const char* params = pParams != nullptr ? pParams : "";
+        for (unsigned i = 0; i < CacheSlots; i++) {
+            const TCachedPage& page = m_Cache[i];
+            if (page.bValid && page.nGeneration == nGeneration && page.Params == params)
+                return &page;
+        }
+        return nullptr;
+}
+
+// Round robin: the slots only need to outlast a few browsers refreshing
+void PageHandlerBase::AddCached(const char *pParams, u64 nGeneration, const std::string& body)
+{
+        TCachedPage& page = m_Cache[m_nNextSlot];
+        m_nNextSlot = (m_nNextSlot + 1) % CacheSlots;
+
+        page.bValid = true;
+        page.nGeneration = nGeneration;
+        page.Params = pParams != nullptr ? pParams : "";
+        page.Body = body;
+}
+
+
 THTTPStatus PageHandlerBase::GetContent(const char *pPath,
 		   const char *pParams,
 		   const char *pFormData,
@@ -32,23 +119,34 @@ THTTPStatus PageHandlerBase::GetContent(const char *pPath,
         //Initialize the webglobals
         CWebGlobals::Get()->Initialize();
 
-        // Set up Mustache Template Engine
-        mustache::mustache tmpl{s_Template};
-	if (!tmpl.is_valid())
+        // Normally done at startup, by the registry
+        Precompile();
+	if (!m_pTemplate->is_valid())
 		return HTTPInternalServerError;
 
+        SCSITBService* svc = static_cast<SCSITBService*>(CScheduler::Get()->GetTask("scsitbservice"));
+        if (!svc)
+            return HTTPInternalServerError;
+
+	// Get our config service
+	ConfigService* config = static_cast<ConfigService*>(CScheduler::Get()->GetTask("configservice"));
+
+        // Taken before rendering: if the state moves on meanwhile, the copy
+        // is filed under the old generation and never served.
+        bool cacheable = IsCacheable() && config != nullptr && (pFormData == nullptr || pFormData[0] == '\0');
+        u64 generation = cacheable ? GetStateGeneration(svc, config) : 0;
+        if (cacheable) {
+            const TCachedPage* page = FindCached(pParams, generation);
+            if (page != nullptr)
+                return SendPage(page->Body, pBuffer, pLength, ppContentType);
+        }
+
 	// Set up context
         mustache::data context;
 
 	// Set up context defaults
 	context.set("meta_refresh_timeout", "5");
 
-	// Fetch the page content from the subclass
-	mustache::partial part{[this]() {
-	    return GetHTML();
-	}};
-	context.set("content", mustache::data{part});
-	
 	// Call subclass hook to add page specific context
 	THTTPStatus status = PopulateContext(context, pPath, pParams, pFormData);
 
@@ -57,10 +155,6 @@ THTTPStatus PageHandlerBase::GetContent(const char *pPath,
 		return status;
 	
 	// Get current loaded image
-        SCSITBService* svc = static_cast<SCSITBService*>(CScheduler::Get()->GetTask("scsitbservice"));
-        if (!svc)
-            return HTTPInternalServerError;
-
         // std::string from a null char* is undefined, and this runs for every page.
         const char* current_image_name = svc->GetCurrentCDName();
         std::string current_image = current_image_name != nullptr ? current_image_name : "";
@@ -72,9 +166,6 @@ THTTPStatus PageHandlerBase::GetContent(const char *pPath,
             context.set("mount_error", std::string(mountError));
         }
 
-	// Get our config service
-	ConfigService* config = static_cast<ConfigService*>(CScheduler::Get()->GetTask("configservice"));
-
 	// Get the current mode
         context.set("cdrom", !config->GetMode());
 
@@ -90,24 +181,14 @@ THTTPStatus PageHandlerBase::GetContent(const char *pPath,
 
         // Add build info
         context.set("version", CGitInfo::Get()->GetVersionWithBuildString());
-        context.set("build_info", std::string(GIT_BRANCH) + " @ " + std::string(GIT_COMMIT) + " | " + __DATE__ + " " + __TIME__ + " | " + CGitInfo::Get()->GetKernelName() + "(AARCH" + CGitInfo::Get()->GetArchBits() + ")");
+        context.set("build_info", s_BuildInfo);
 
 	// Render
         LOGDBG("Rendering the template");
-        std::string rendered = tmpl.render(context);
-
-        if (pBuffer && *pLength >= rendered.length()) {
-            memcpy(pBuffer, rendered.c_str(), rendered.length());
-            *pLength = rendered.length();
-            *ppContentType = "text/html";
-            return HTTPOK;
-        }
+        std::string rendered = m_pTemplate->render(context);
 
-        // The provided buffer is too small
-        LOGERR("Output buffer too small for rendered content.");
-        *pLength = 0;
-        *ppContentType = "text/plain";
-        return HTTPInternalServerError;
+        if (cacheable)
+            AddCached(pParams, generation, rendered);
 
+        return SendPage(rendered, pBuffer, pLength, ppContentType);
 }
-
@@ -3,9 +3,13 @@
 #include "pagehandler.h"
 #include <circle/sched/scheduler.h>
 #include <mustache/mustache.hpp>
+#include <string>
 
 class PageHandlerBase : public IPageHandler {
 public:
+    PageHandlerBase();
+    ~PageHandlerBase();
+
     THTTPStatus GetContent(const char *pPath,
                            const char *pParams,
                            const char *pFormData,
@@ -13,6 +17,9 @@ public:
                            unsigned *pLength,
                            const char **ppContentType) override;
 
+    // Parses the site template with the page's HTML in place of {{>content}}
+    void Precompile() override;
+
 protected:
     virtual THTTPStatus PopulateContext(kainjow::mustache::data& context,
                             const char *pPath,
@@ -20,5 +27,26 @@ protected:
                             const char *pFormData) = 0;
 
     virtual std::string GetHTML() = 0;
+
+    // True if, for a GET, the page depends only on its query string, the
+    // drive's state and the config, so a rendered copy can be served again
+    // until one of those changes. PopulateContext() must not act on anything.
+    virtual bool IsCacheable() const { return false; }
+
+private:
+    struct TCachedPage {
+        bool bValid;
+        u64 nGeneration;
+        std::string Params;
+        std::string Body;
+    };
+    static const unsigned CacheSlots = 4;   // a few folders or list pages
+
+    const TCachedPage* FindCached(const char *pParams, u64 nGeneration) const;
+    void AddCached(const char *pParams, u64 nGeneration, const std::string& body);
+
+    kainjow::mustache::mustache* m_pTemplate;
+    TCachedPage m_Cache[CacheSlots];
+    unsigned m_nNextSlot;
 };
 #endif
@@ -0,0 +1,69 @@
+#include <circle/logger.h>
+#include <circle/util.h>
+#include <circle/net/httpdaemon.h>
+#include <json/json.hpp>
+#include <scsitbservice/scsitbservice.h>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <map>
+#include "searchapi.h"
+#include "../util.h"
+
+LOGMODULE("searchapi");
+
+// Type-ahead asks on every keystroke; a page of results is plenty.
+static const size_t DEFAULT_LIMIT = 50;
+static const size_t MAX_LIMIT = 200;
+
+// /api/search?q=words[&limit=N][&images=1]
+THTTPStatus SearchAPIHandler::GetJson(nlohmann::json& j,
+                const char *pPath,
+                const char *pParams,
+                const char *pFormData)
+{
+    SCSITBService* svc = static_cast<SCSITBService*>(CScheduler::Get()->GetTask("scsitbservice"));
+    if (!svc) {
+        LOGERR("SearchAPIHandler: Couldn't fetch SCSITB Service");
+        return HTTPInternalServerError;
+    }
+
+    auto params = parse_query_params(pParams);
+    std::string query;
+    auto it = params.find("q");
+    if (it != params.end())
+        query = it->second;
+
+    size_t limit = DEFAULT_LIMIT;
+    it = params.find("limit");
+    if (it != params.end()) {
+        long value = strtol(it->second.c_str(), nullptr, 10);
+        if (value > 0)
+            limit = (size_t)value < MAX_LIMIT ? (size_t)value : MAX_LIMIT;
+    }
+
+    it = params.find("images");
+    bool imagesOnly = it != params.end() && it->second == "1";
+
+    u32 results[MAX_LIMIT];
+    size_t total = svc->Search(query.c_str(), imagesOnly, results, limit);
+    size_t returned = total < limit ? total : limit;
+
+    j["query"] = query;
+    j["total"] = total;
+
+    nlohmann::json entries = nlohmann::json::array();
+    for (size_t i = 0; i < returned; ++i) {
+        size_t index = results[i];
+
+        nlohmann::json item;
+        item["name"] = svc->GetName(index);
+        item["relativePath"] = svc->GetRelativePath(index);
+        item["type"] = svc->IsDirectory(index) ? "directory" : "file";
+        item["size"] = svc->GetSize(index);
+        entries.push_back(item);
+    }
+    j["results"] = entries;
+
+    return HTTPOK;
+}
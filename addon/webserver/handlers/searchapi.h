@@ -0,0 +1,14 @@
+
+#ifndef SEARCHAPI_HANDLER_H
+#define SEARCHAPI_HANDLER_H
+
+#include "apihandlerbase.h"
+
+class SearchAPIHandler : public APIHandlerBase {
+public:
+   THTTPStatus GetJson(nlohmann::json& j,
+		const char *pPath,
+		const char *pParams,
+		const char *pFormData);
+};
+#endif
@@ -0,0 +1,173 @@
+#include <circle/logger.h>
+#include <circle/util.h>
+#include <circle/net/httpdaemon.h>
+#include <circle/sched/scheduler.h>
+#include <scsitbservice/scsitbservice.h>
+#include <configservice/configservice.h>
+#include <cdplayer/cdplayer.h>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include "statusapi.h"
+#include "../jsonwriter.h"
+#include "../util.h"
+#include "../webglobals.h"
+
+LOGMODULE("statusapi");
+
+// How often a held request looks at the status again, and for how long at
+// most. Each held request keeps one of the daemon's few workers, so at most
+// half of them are held; the rest stay free for pages and uploads.
+static const unsigned POLL_MS = 250;
+static const unsigned MAX_WAIT_SECONDS = 25;
+static const unsigned MAX_WAITING = HTTP_MAX_CLIENTS / 2;
+static const unsigned RETRY_SECONDS = 5;
+
+static unsigned s_nWaiting = 0;
+
+static const char* GetAudioStateName(unsigned state)
+{
+    switch (state) {
+        case CCDPlayer::PLAYING:         return "playing";
+        case CCDPlayer::SEEKING:
+        case CCDPlayer::SEEKING_PLAYING: return "seeking";
+        case CCDPlayer::PAUSED:          return "paused";
+        case CCDPlayer::STOPPED_OK:      return "stopped";
+        case CCDPlayer::STOPPED_ERROR:   return "error";
+        default:                         return "none";
+    }
+}
+
+// Everything but the version, which is a hash of what is written here
+static void WriteStatus(JsonWriter& w, SCSITBService* svc)
+{
+    w.BeginObject();
+
+    // Relative, as /api/list and /mount name images
+    const char* path = svc->GetCurrentCDPath();
+    if (path != nullptr && strncmp(path, "1:/", 3) == 0)
+        path += 3;
+    const char* name = svc->GetCurrentCDName();
+    w.Key("image");
+    w.String(name != nullptr ? name : "");
+    w.Key("imagePath");
+    w.String(path != nullptr ? path : "");
+    w.Key("ejected");
+    w.Bool(svc->IsEjected());
+    w.Key("mountError");
+    const char* mountError = svc->GetLastMountError();
+    w.String(mountError != nullptr ? mountError : "");
+    w.Key("generation");
+    w.Number(svc->GetGeneration());
+
+    ConfigService* config = static_cast<ConfigService*>(CScheduler::Get()->GetTask("configservice"));
+    w.Key("cdrom");
+    w.Bool(config == nullptr || !config->GetMode());
+
+    // Only the state: the play position would change the version 75 times
+    // a second
+    CCDPlayer* player = static_cast<CCDPlayer*>(CScheduler::Get()->GetTask("cdplayer"));
+    w.Key("audio");
+    if (player != nullptr)
+        w.String(GetAudioStateName(player->PeekState()));
+    else
+        w.Null();
+
+    std::string uploadName;
+    u64 received, size;
+    boolean done;
+    w.Key("upload");
+    if (CWebGlobals::Get()->GetUpload(&uploadName, &received, &size, &done)) {
+        w.BeginObject();
+        w.Key("name");
+        w.String(uploadName.c_str());
+        w.Key("received");
+        w.Number(received);
+        w.Key("size");
+        w.Number(size);
+        w.Key("done");
+        w.Bool(done);
+        w.EndObject();
+    } else {
+        w.Null();
+    }
+}
+
+static u32 HashStatus(const u8* pData, unsigned nLength)
+{
+    u32 hash = 2166136261u;  // FNV-1a
+    for (unsigned i = 0; i < nLength; i++) {
+        hash ^= pData[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+THTTPStatus StatusAPIHandler::GetContent(const char *pPath,
+                const char *pParams,
+                const char *pFormData,
+                u8 *pBuffer,
+                unsigned *pLength,
+                const char **ppContentType)
+{
+    SCSITBService* svc = static_cast<SCSITBService*>(CScheduler::Get()->GetTask("scsitbservice"));
+    if (!svc) {
+        LOGERR("StatusAPIHandler: Couldn't fetch SCSITB Service");
+        return HTTPInternalServerError;
+    }
+
+    auto params = parse_query_params(pParams);
+    auto it = params.find("since");
+    bool haveSince = it != params.end() && !it->second.empty();
+    u32 since = haveSince ? (u32)strtoul(it->second.c_str(), nullptr, 16) : 0;
+    it = params.find("wait");
+    unsigned long wait = it != params.end() ? strtoul(it->second.c_str(), nullptr, 10) : 0;
+    if (wait > MAX_WAIT_SECONDS)
+        wait = MAX_WAIT_SECONDS;
+
+    // Past the limit a request is answered at once, and told when to come
+    // back, so a page does not ask again straight away
+    bool holding = haveSince && wait > 0 && s_nWaiting < MAX_WAITING;
+    bool refused = haveSince && wait > 0 && !holding;
+    if (holding)
+        s_nWaiting++;
+
+    unsigned waitedMs = 0;
+    JsonWriter w(pBuffer, *pLength);
+    u32 version;
+    while (true) {
+        w = JsonWriter(pBuffer, *pLength);
+        WriteStatus(w, svc);
+        version = HashStatus(pBuffer, w.GetLength());
+        if (!holding || version != since || waitedMs >= wait * 1000)
+            break;
+
+        CScheduler::Get()->MsSleep(POLL_MS);
+        waitedMs += POLL_MS;
+    }
+
+    if (holding)
+        s_nWaiting--;
+
+    char versionText[12];
+    snprintf(versionText, sizeof(versionText), "%08x", (unsigned)version);
+    w.Key("version");
+    w.String(versionText);
+    if (refused) {
+        w.Key("retryAfter");
+        w.Number(RETRY_SECONDS);
+    }
+    w.EndObject();
+
+    if (w.Overflowed()) {
+        LOGERR("StatusAPIHandler: Output buffer too small");
+        *pLength = 0;
+        return HTTPInternalServerError;
+    }
+
+    *pLength = w.GetLength();
+    *ppContentType = "application/json";
+    return HTTPOK;
+}
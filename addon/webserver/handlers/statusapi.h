@@ -0,0 +1,25 @@
+
+#ifndef STATUSAPI_HANDLER_H
+#define STATUSAPI_HANDLER_H
+
+#include "pagehandler.h"
+
+// /api/status[?since=VERSION][&wait=SECONDS]
+//
+// What a page shows of the drive: the mounted image, eject state, the last
+// mount error, the library generation, audio playback and any upload. With
+// since and wait, the reply is held until the status no longer matches that
+// version (or the wait runs out), so a page can keep one request open
+// instead of reloading itself. When too many are held already it is
+// answered at once with retryAfter, the seconds to leave before asking
+// again.
+class StatusAPIHandler : public IPageHandler {
+public:
+    THTTPStatus GetContent(const char *pPath,
+                           const char *pParams,
+                           const char *pFormData,
+                           u8 *pBuffer,
+                           unsigned *pLength,
+                           const char **ppContentType) override;
+};
+#endif
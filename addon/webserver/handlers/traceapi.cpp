@@ -3,6 +3,7 @@
 #include <circle/net/httpdaemon.h>
 #include <json/json.hpp>
 #include <tracelab/tracelab.h>
+#include <tracelab/boottimeline.h>
 #include <string>
 #include <cstring>
 #include <map>
@@ -24,6 +25,27 @@ THTTPStatus TraceAPIHandler::GetJson(nlohmann::json& j,
         return HTTPNotFound;
 
     std::string path(pPath);
+
+    // The boot timeline is always recorded, capture or not
+    if (path == "/api/trace/boot") {
+        CBootTimeline *pTimeline = CBootTimeline::Get();
+        j["stages"] = nlohmann::json::array();
+        for (unsigned i = 0; i < BootStageCount; i++) {
+            TBootStage stage = (TBootStage)i;
+            if (!pTimeline->HasBegun(stage))
+                continue;
+
+            nlohmann::json entry;
+            entry["name"] = CBootTimeline::GetName(stage);
+            entry["group"] = CBootTimeline::GetGroup(stage);
+            entry["start_us"] = pTimeline->GetStart(stage);
+            if (pTimeline->HasEnded(stage))
+                entry["end_us"] = pTimeline->GetEnd(stage);
+            j["stages"].push_back(entry);
+        }
+        return HTTPOK;
+    }
+
     CTraceLab *pTraceLab = CTraceLab::Get();
     if (pTraceLab == nullptr) {
         j["status"] = "error";
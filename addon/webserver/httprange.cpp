@@ -0,0 +1,92 @@
+#include "httprange.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+boolean GetHTTPHeader(const char* pRequest, const char* pName, char* pValue, size_t nValueSize) {
+    size_t nNameLength = strlen(pName);
+    const char* pLine = strstr(pRequest, "\r\n");
+    while (pLine != nullptr) {
+        pLine += 2;
+        if (pLine[0] == '\r' || pLine[0] == '\0')
+            break;  // end of the headers
+
+        if (strncasecmp(pLine, pName, nNameLength) == 0 && pLine[nNameLength] == ':') {
+            const char* pFrom = pLine + nNameLength + 1;
+            while (*pFrom == ' ' || *pFrom == '\t')
+                pFrom++;
+            const char* pEnd = strstr(pFrom, "\r\n");
+            if (pEnd == nullptr)
+                pEnd = pFrom + strlen(pFrom);
+            while (pEnd > pFrom && (pEnd[-1] == ' ' || pEnd[-1] == '\t'))
+                pEnd--;
+
+            size_t nLength = pEnd - pFrom;
+            if (nLength >= nValueSize)
+                return FALSE;
+            memcpy(pValue, pFrom, nLength);
+            pValue[nLength] = '\0';
+            return TRUE;
+        }
+
+        pLine = strstr(pLine, "\r\n");
+    }
+    return FALSE;
+}
+
+// Digits only; no sign, no blanks, nothing that overflows
+static const char* ParseNumber(const char* p, u64* pValue) {
+    if (!isdigit((unsigned char)*p))
+        return nullptr;
+    u64 nValue = 0;
+    for (; isdigit((unsigned char)*p); p++) {
+        if (nValue > (~(u64)0 - 9) / 10)
+            return nullptr;
+        nValue = nValue * 10 + (*p - '0');
+    }
+    *pValue = nValue;
+    return p;
+}
+
+THTTPRange ParseHTTPRange(const char* pValue, u64 nSize, u64* pFirst, u64* pLast) {
+    if (strncasecmp(pValue, "bytes=", 6) != 0 || strchr(pValue, ',') != nullptr)
+        return HTTPRangeNone;
+    const char* p = pValue + 6;
+
+    // The last N bytes
+    if (*p == '-') {
+        u64 nSuffix;
+        p = ParseNumber(p + 1, &nSuffix);
+        if (p == nullptr || *p != '\0')
+            return HTTPRangeNone;
+        if (nSuffix == 0 || nSize == 0)
+            return HTTPRangeNotSatisfiable;
+        *pFirst = nSuffix >= nSize ? 0 : nSize - nSuffix;
+        *pLast = nSize - 1;
+        return HTTPRangeSatisfiable;
+    }
+
+    u64 nFirst;
+    u64 nLast = nSize - 1;
+    p = ParseNumber(p, &nFirst);
+    if (p == nullptr || *p++ != '-')
+        return HTTPRangeNone;
+    if (*p != '\0') {
+        p = ParseNumber(p, &nLast);
+        if (p == nullptr || *p != '\0' || nLast < nFirst)
+            return HTTPRangeNone;
+    }
+
+    if (nFirst >= nSize)
+        return HTTPRangeNotSatisfiable;
+    *pFirst = nFirst;
+    *pLast = nLast < nSize ? nLast : nSize - 1;
+    return HTTPRangeSatisfiable;
+}
+
+void FormatHTTPETag(u64 nSize, u16 nDate, u16 nTime, char* pBuffer, size_t nBufferSize) {
+    snprintf(pBuffer, nBufferSize, "\"%llx-%04x%04x\"", (unsigned long long)nSize,
+             (unsigned)nDate, (unsigned)nTime);
+}
@@ -0,0 +1,34 @@
+//
+// httprange.h
+//
+// The parts of an HTTP request the image download server looks at: header
+// lines, a Range header (RFC 9110, section 14) and the ETag it answers
+// If-Range and If-None-Match with. Plain string handling, nothing here
+// touches the network or the card.
+//
+#ifndef WS_HTTPRANGE_H
+#define WS_HTTPRANGE_H
+
+#include <circle/types.h>
+#include <stddef.h>
+
+enum THTTPRange {
+    HTTPRangeNone,              // no usable range: send the whole file
+    HTTPRangeSatisfiable,       // send *pFirst..*pLast as 206
+    HTTPRangeNotSatisfiable     // 416
+};
+
+// Copies the value of header pName (any case) from the header lines of
+// pRequest, which begin after its request line. FALSE if it is not there
+// or does not fit.
+boolean GetHTTPHeader(const char* pRequest, const char* pName, char* pValue, size_t nValueSize);
+
+// A single range of a file nSize bytes long. A list of ranges, or one that
+// does not parse, is ignored and the whole file sent, as the RFC allows.
+THTTPRange ParseHTTPRange(const char* pValue, u64 nSize, u64* pFirst, u64* pLast);
+
+// A strong ETag from the file's size and FAT modification time; an image
+// rewritten in place keeps neither.
+void FormatHTTPETag(u64 nSize, u16 nDate, u16 nTime, char* pBuffer, size_t nBufferSize);
+
+#endif
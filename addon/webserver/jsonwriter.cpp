@@ -0,0 +1,142 @@
+#include "jsonwriter.h"
+
+#include <stdio.h>
+#include <string.h>
+
+JsonWriter::JsonWriter(u8* pBuffer, unsigned nCapacity)
+    : m_pBuffer(pBuffer),
+      m_nCapacity(pBuffer != nullptr ? nCapacity : 0),
+      m_nLength(0),
+      m_bOverflowed(false),
+      m_nDepth(0),
+      m_bAfterKey(false) {
+    m_bNeedComma[0] = false;
+}
+
+// Nothing more goes in after a write that did not fit, until Rewind()
+void JsonWriter::Put(char c) {
+    if (m_bOverflowed || m_nLength >= m_nCapacity) {
+        m_bOverflowed = true;
+        return;
+    }
+    m_pBuffer[m_nLength++] = (u8)c;
+}
+
+void JsonWriter::Put(const char* pText, size_t nLength) {
+    if (m_bOverflowed || nLength > m_nCapacity - m_nLength) {
+        m_bOverflowed = true;
+        return;
+    }
+    memcpy(m_pBuffer + m_nLength, pText, nLength);
+    m_nLength += nLength;
+}
+
+// A value after a key follows its colon; any other one may need a comma.
+void JsonWriter::BeforeValue() {
+    if (m_bAfterKey) {
+        m_bAfterKey = false;
+        return;
+    }
+    if (m_bNeedComma[m_nDepth])
+        Put(',');
+    m_bNeedComma[m_nDepth] = true;
+}
+
+void JsonWriter::BeginObject() {
+    BeforeValue();
+    Put('{');
+    if (m_nDepth + 1 < MaxDepth)
+        m_nDepth++;
+    m_bNeedComma[m_nDepth] = false;
+}
+
+void JsonWriter::EndObject() {
+    if (m_nDepth > 0)
+        m_nDepth--;
+    Put('}');
+}
+
+void JsonWriter::BeginArray() {
+    BeforeValue();
+    Put('[');
+    if (m_nDepth + 1 < MaxDepth)
+        m_nDepth++;
+    m_bNeedComma[m_nDepth] = false;
+}
+
+void JsonWriter::EndArray() {
+    if (m_nDepth > 0)
+        m_nDepth--;
+    Put(']');
+}
+
+void JsonWriter::Key(const char* pName) {
+    String(pName);
+    Put(':');
+    m_bAfterKey = true;
+}
+
+void JsonWriter::String(const char* pValue) {
+    BeforeValue();
+    Put('"');
+
+    // Runs that need no escaping go in with one copy
+    const char* pRun = pValue != nullptr ? pValue : "";
+    const char* p = pRun;
+    for (; *p != '\0'; p++) {
+        const unsigned char c = (unsigned char)*p;
+        if (c >= 0x20 && c != '"' && c != '\\')
+            continue;
+
+        Put(pRun, p - pRun);
+        char Escape[8];
+        if (c == '"' || c == '\\') {
+            Escape[0] = '\\';
+            Escape[1] = (char)c;
+            Put(Escape, 2);
+        } else {
+            snprintf(Escape, sizeof(Escape), "\\u%04x", c);
+            Put(Escape, 6);
+        }
+        pRun = p + 1;
+    }
+    Put(pRun, p - pRun);
+
+    Put('"');
+}
+
+void JsonWriter::Number(u64 nValue) {
+    BeforeValue();
+    char Digits[24];
+    int n = snprintf(Digits, sizeof(Digits), "%llu", (unsigned long long)nValue);
+    Put(Digits, n);
+}
+
+void JsonWriter::Bool(bool bValue) {
+    BeforeValue();
+    if (bValue)
+        Put("true", 4);
+    else
+        Put("false", 5);
+}
+
+void JsonWriter::Null() {
+    BeforeValue();
+    Put("null", 4);
+}
+
+JsonWriter::Mark JsonWriter::GetMark() const {
+    Mark Result;
+    Result.length = m_nLength;
+    Result.depth = m_nDepth;
+    Result.needComma = m_bNeedComma[m_nDepth];
+    return Result;
+}
+
+void JsonWriter::Rewind(const Mark& rMark) {
+    m_nLength = rMark.length;
+    m_nDepth = rMark.depth;
+    m_bNeedComma[m_nDepth] = rMark.needComma;
+    m_bAfterKey = false;
+    m_bOverflowed = false;
+}
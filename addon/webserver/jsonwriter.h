@@ -0,0 +1,64 @@
+//
+// jsonwriter.h
+//
+// Writes JSON straight into a response buffer, for replies too big to build
+// as a nlohmann::json document first (one heap object per value, then a
+// second copy as a std::string). Commas and escaping are taken care of; a
+// write that does not fit sets a flag instead, and Mark()/Rewind() drop a
+// half-written value so a long array can stop at the last entry that fit.
+//
+#ifndef WS_JSONWRITER_H
+#define WS_JSONWRITER_H
+
+#include <circle/types.h>
+#include <stddef.h>
+
+class JsonWriter {
+public:
+    struct Mark {
+        unsigned length;
+        unsigned depth;
+        bool needComma;
+    };
+
+    JsonWriter(u8* pBuffer, unsigned nCapacity);
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+
+    // The name of the next member of an object
+    void Key(const char* pName);
+
+    void String(const char* pValue);
+    void Number(u64 nValue);
+    void Bool(bool bValue);
+    void Null();
+
+    unsigned GetLength() const { return m_nLength; }
+    bool Overflowed() const { return m_bOverflowed; }
+
+    // Between values of the same array or object only
+    Mark GetMark() const;
+    void Rewind(const Mark& rMark);
+
+private:
+    static const unsigned MaxDepth = 16;
+
+    void BeforeValue();
+    void Put(char c);
+    void Put(const char* pText, size_t nLength);
+
+private:
+    u8* m_pBuffer;
+    unsigned m_nCapacity;
+    unsigned m_nLength;
+    bool m_bOverflowed;
+
+    unsigned m_nDepth;
+    bool m_bNeedComma[MaxDepth];
+    bool m_bAfterKey;
+};
+
+#endif // WS_JSONWRITER_H
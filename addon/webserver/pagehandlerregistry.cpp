@@ -18,6 +18,7 @@
 // includes for your api handlers
 #include "handlers/mountapi.h"
 #include "handlers/listapi.h"
+#include "handlers/searchapi.h"
 #include "handlers/shutdownapi.h"
 #include "handlers/imagenameapi.h"
 #include "handlers/traceapi.h"
@@ -25,6 +26,8 @@
 #include "handlers/discarthandler.h"
 #include "handlers/deleteapi.h"
 #include "handlers/ejectapi.h"
+#include "handlers/statusapi.h"
+#include "handlers/metricsapi.h"
 
 // instances of your page handlers
 static HomePageHandler s_homePageHandler;
@@ -38,6 +41,7 @@ static ShutdownPageHandler s_shutdownPageHandler;
 // instances of your API handlers
 static MountAPIHandler s_mountAPIHandler;
 static ListAPIHandler s_listAPIHandler;
+static SearchAPIHandler s_searchAPIHandler;
 static ShutdownAPIHandler s_shutdownAPIHandler;
 static ImageNameAPIHandler s_imageNameAPIHandler;
 static TraceAPIHandler s_traceAPIHandler;
@@ -46,6 +50,8 @@ static TracePageHandler s_tracePageHandler;
 static DiscArtHandler s_discArtHandler;
 static DeleteImageAPIHandler s_deleteImageAPIHandler;
 static EjectAPIHandler s_ejectAPIHandler;
+static StatusAPIHandler s_statusAPIHandler;
+static MetricsAPIHandler s_metricsAPIHandler;
 
 // routes for your handlers
 static const std::map<std::string, IPageHandler*> g_pageHandlers = {
@@ -61,7 +67,10 @@ static const std::map<std::string, IPageHandler*> g_pageHandlers = {
     // API
     { "/api/mount", &s_mountAPIHandler },
     { "/api/eject", &s_ejectAPIHandler },
+    { "/api/status", &s_statusAPIHandler },
+    { "/api/metrics", &s_metricsAPIHandler },
     { "/api/list", &s_listAPIHandler },
+    { "/api/search", &s_searchAPIHandler },
     { "/api/shutdown", &s_shutdownAPIHandler },
     { "/api/reboot", &s_shutdownAPIHandler },
     { "/api/imagename", &s_imageNameAPIHandler },
@@ -69,6 +78,7 @@ static const std::map<std::string, IPageHandler*> g_pageHandlers = {
     { "/api/trace/start", &s_traceAPIHandler },
     { "/api/trace/stop", &s_traceAPIHandler },
     { "/api/trace/save", &s_traceAPIHandler },
+    { "/api/trace/boot", &s_traceAPIHandler },
     { "/usbode.utrace", &s_traceDownloadHandler },
     { "/trace", &s_tracePageHandler },
     // /api/images/upload is dispatched directly in CWebServer::GetContent
@@ -94,3 +104,8 @@ IPageHandler* PageHandlerRegistry::getHandler(const char* path) {
     return &s_assetHandler;
 }
 
+void PageHandlerRegistry::precompile() {
+    // A handler routed twice (/shutdown, /reboot) only does its work once
+    for (const auto& route : g_pageHandlers)
+        route.second->Precompile();
+}
@@ -17,6 +17,7 @@ struct PageHandlerEntry {
 class PageHandlerRegistry {
 public:
     static IPageHandler* getHandler(const char* path);
+    static void precompile();
 
 private:
     static const PageHandlerEntry s_pathHandlers[];
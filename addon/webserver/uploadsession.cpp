@@ -0,0 +1,316 @@
+#include "uploadsession.h"
+
+#include <circle/logger.h>
+#include <circle/sched/scheduler.h>
+#include <circle/timer.h>
+#include <discimage/util.h>
+#include <ioscheduler/ioscheduler.h>
+#include <string.h>
+
+LOGMODULE("upload");
+
+// A block goes to the card in pieces this big, so the network task can take
+// in the next chunk between them
+#define UPLOAD_WRITE_SLICE (128 * 1024)
+// How often the flush task looks for work when it found none
+#define UPLOAD_FLUSH_IDLE_MS 10
+
+CUploadSessions::CUploadSessions() {
+}
+
+CUploadSessions::~CUploadSessions() {
+    while (!m_Sessions.empty())
+        Close(m_Sessions.back(), FALSE);
+}
+
+CUploadSessions* CUploadSessions::Get() {
+    static CUploadSessions s_Sessions;
+    return &s_Sessions;
+}
+
+CUploadSessions::TSession* CUploadSessions::Find(const char* pPartPath) const {
+    for (TSession* pSession : m_Sessions) {
+        if (pSession->Path == pPartPath)
+            return pSession;
+    }
+    return nullptr;
+}
+
+CUploadSessions::TSession* CUploadSessions::Open(const char* pPartPath, u64 nOffset, u64 nTotalSize) {
+    // Make room by ending the session that has waited longest for a chunk,
+    // of those no other request is writing to
+    if (m_Sessions.size() >= MaxSessions) {
+        unsigned nNow = CTimer::Get()->GetTicks();
+        TSession* pOldest = nullptr;
+        for (TSession* pSession : m_Sessions) {
+            if (!pSession->bBusy && (pOldest == nullptr
+                    || nNow - pSession->nLastUsedTicks > nNow - pOldest->nLastUsedTicks))
+                pOldest = pSession;
+        }
+        if (pOldest == nullptr)
+            return nullptr;
+        LOGNOTE("Upload %s: too many uploads, closing it", pOldest->Path.c_str());
+        Close(pOldest, pOldest->Error != FR_OK);
+    }
+
+    TSession* pSession = new TSession;
+    FRESULT Result;
+    if (nOffset == 0) {
+        Result = f_open(&pSession->File, pPartPath, FA_WRITE | FA_CREATE_ALWAYS);
+        // In one run of clusters if the card has one, so the image reads
+        // like one copied on a PC; otherwise grown a large extent at a time
+        if (Result == FR_OK)
+            FatFsOptimizer::Preallocate(&pSession->File, nTotalSize, "Upload: ");
+    } else {
+        Result = f_open(&pSession->File, pPartPath, FA_WRITE | FA_OPEN_EXISTING);
+        if (Result == FR_OK && f_size(&pSession->File) == nOffset)
+            Result = f_lseek(&pSession->File, nOffset);
+    }
+    if (Result != FR_OK) {
+        delete pSession;
+        return nullptr;
+    }
+
+    u64 nHave = f_size(&pSession->File);
+    pSession->Path = pPartPath;
+    pSession->nTotalSize = nTotalSize;
+    pSession->nReceived = nOffset == 0 ? 0 : nHave;
+    pSession->nWritten = pSession->nReceived;
+    pSession->pFill = new u8[BlockSize];
+    pSession->nFill = 0;
+    pSession->nFillLimit = BlockSize - (unsigned)(pSession->nReceived % BlockSize);
+    pSession->pQueued = nullptr;
+    pSession->nQueued = 0;
+    pSession->pSpare = new u8[BlockSize];
+    pSession->bWriting = FALSE;
+    pSession->bBusy = FALSE;
+    pSession->Error = FR_OK;
+    pSession->nLastUsedTicks = CTimer::Get()->GetTicks();
+    m_Sessions.push_back(pSession);
+    return pSession;
+}
+
+// Another request for this upload may still be in Write(), parked while a
+// block goes to the card: most likely the browser retrying a chunk whose
+// answer it gave up on. Whether this one repeats that chunk, follows it or
+// starts over is only known once it is in, so wait for it. The session can
+// be gone by then, closed after a failed write.
+CUploadSessions::TSession* CUploadSessions::FindIdle(const char* pPartPath) const {
+    TSession* pSession = Find(pPartPath);
+    while (pSession != nullptr && pSession->bBusy) {
+        CScheduler::Get()->Yield();
+        pSession = Find(pPartPath);
+    }
+    return pSession;
+}
+
+CUploadSessions::TResult CUploadSessions::Write(const char* pPartPath, u64 nOffset, u64 nTotalSize,
+                                                const void* pData, unsigned nLength, u64* pReceived) {
+    TSession* pSession = FindIdle(pPartPath);
+
+    // Starting over; the file is created anew
+    if (pSession != nullptr && nOffset == 0) {
+        Close(pSession, FALSE);
+        pSession = nullptr;
+    }
+
+    boolean bOpened = pSession == nullptr;
+    if (bOpened) {
+        pSession = Open(pPartPath, nOffset, nTotalSize);
+        if (pSession == nullptr)
+            return ResultOpenFailed;
+    }
+    pSession->nLastUsedTicks = CTimer::Get()->GetTicks();
+    *pReceived = pSession->nReceived;
+
+    // An earlier block did not make it to the card
+    if (pSession->Error != FR_OK) {
+        LOGERR("Upload %s: write failed before offset %llu (res=%d)",
+               pPartPath, (unsigned long long)pSession->nReceived, (int)pSession->Error);
+        Close(pSession, TRUE);
+        return ResultWriteFailed;
+    }
+
+    if (pSession->nReceived != nOffset) {
+        // Retry of a chunk that was already taken but whose response got
+        // lost; anything else means the uploader has to restart
+        TResult Result = pSession->nReceived == nOffset + nLength ? ResultAlreadyHave : ResultOutOfSequence;
+        if (bOpened)
+            Close(pSession, FALSE);
+        return Result;
+    }
+
+    // QueueFill() can yield, so the session must stay open and be left
+    // alone by other requests until this chunk is in
+    pSession->bBusy = TRUE;
+    const u8* pFrom = (const u8*)pData;
+    unsigned nRemaining = nLength;
+    while (nRemaining > 0) {
+        unsigned nCopy = pSession->nFillLimit - pSession->nFill;
+        if (nCopy > nRemaining)
+            nCopy = nRemaining;
+        memcpy(pSession->pFill + pSession->nFill, pFrom, nCopy);
+        pSession->nFill += nCopy;
+        pFrom += nCopy;
+        nRemaining -= nCopy;
+
+        if (pSession->nFill == pSession->nFillLimit)
+            QueueFill(pSession);
+    }
+    pSession->nReceived += nLength;
+    pSession->bBusy = FALSE;
+
+    if (pSession->Error != FR_OK) {
+        LOGERR("Upload %s: write failed at offset %llu (res=%d)",
+               pPartPath, (unsigned long long)nOffset, (int)pSession->Error);
+        Close(pSession, TRUE);
+        return ResultWriteFailed;
+    }
+
+    *pReceived = pSession->nReceived;
+    return ResultOK;
+}
+
+CUploadSessions::TResult CUploadSessions::Finish(const char* pPartPath) {
+    TSession* pSession = FindIdle(pPartPath);
+    if (pSession == nullptr)
+        return ResultOK;
+
+    u64 nLength = pSession->nReceived;
+    FRESULT Result = Close(pSession, FALSE);
+    if (Result != FR_OK) {
+        LOGERR("Upload %s: finishing at %llu bytes failed (res=%d)", pPartPath,
+               (unsigned long long)nLength, (int)Result);
+        f_unlink(pPartPath);
+        return ResultWriteFailed;
+    }
+    return ResultOK;
+}
+
+boolean CUploadSessions::Flush() {
+    for (TSession* pSession : m_Sessions) {
+        if (pSession->pQueued != nullptr && !pSession->bWriting) {
+            WriteQueued(pSession);
+            return TRUE;
+        }
+    }
+
+    unsigned nNow = CTimer::Get()->GetTicks();
+    for (TSession* pSession : m_Sessions) {
+        if (!pSession->bWriting && !pSession->bBusy
+                && nNow - pSession->nLastUsedTicks >= IdleTimeoutSecs * HZ) {
+            LOGNOTE("Upload %s: no chunk for %u s, closing it", pSession->Path.c_str(), IdleTimeoutSecs);
+            Close(pSession, pSession->Error != FR_OK);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+// The gathered block is full: hand it to the flush task. It may still be
+// busy with the one before, which holds the uploader back to one block
+// ahead of the card.
+void CUploadSessions::QueueFill(TSession* pSession) {
+    while (pSession->bWriting)
+        CScheduler::Get()->Yield();
+    if (pSession->pQueued != nullptr)
+        WriteQueued(pSession);  // the flush task has not got to it
+
+    pSession->pQueued = pSession->pFill;
+    pSession->nQueued = pSession->nFill;
+    pSession->pFill = pSession->pSpare;
+    pSession->pSpare = nullptr;
+    pSession->nFill = 0;
+    pSession->nFillLimit = BlockSize;
+}
+
+void CUploadSessions::WriteQueued(TSession* pSession) {
+    pSession->bWriting = TRUE;
+    WriteBlock(pSession, pSession->pQueued, pSession->nQueued);
+    pSession->pSpare = pSession->pQueued;
+    pSession->pQueued = nullptr;
+    pSession->nQueued = 0;
+    pSession->bWriting = FALSE;
+}
+
+// After a failed write the rest of the upload is dropped; the next request
+// reports it
+void CUploadSessions::WriteBlock(TSession* pSession, const u8* pData, unsigned nLength) {
+    if (pSession->Error != FR_OK)
+        return;
+
+    FatFsOptimizer::ReserveExtent(&pSession->File, pSession->nWritten + nLength, pSession->nTotalSize);
+
+    for (unsigned nDone = 0; nDone < nLength; ) {
+        unsigned nSlice = nLength - nDone < UPLOAD_WRITE_SLICE ? nLength - nDone : UPLOAD_WRITE_SLICE;
+        UINT nWritten = 0;
+        // Sliced further by the I/O scheduler while the host is reading
+        FRESULT Result = CIOScheduler::Get()->Write(IOClassUpload, &pSession->File,
+                                                    pData + nDone, nSlice, &nWritten);
+        pSession->nWritten += nWritten;
+        if (Result == FR_OK && nWritten != nSlice)
+            Result = FR_DENIED;     // card full
+        if (Result != FR_OK) {
+            pSession->Error = Result;
+            return;
+        }
+        nDone += nSlice;
+        CScheduler::Get()->Yield();
+    }
+}
+
+FRESULT CUploadSessions::Close(TSession* pSession, boolean bDelete) {
+    while (pSession->bWriting)
+        CScheduler::Get()->Yield();
+
+    // Out of the list before anything yields, so neither the flush task nor
+    // a request for the same upload picks it up again
+    for (size_t i = 0; i < m_Sessions.size(); i++) {
+        if (m_Sessions[i] == pSession) {
+            m_Sessions.erase(m_Sessions.begin() + i);
+            break;
+        }
+    }
+
+    FRESULT Result = FR_OK;
+    if (!bDelete) {
+        if (pSession->pQueued != nullptr)
+            WriteQueued(pSession);
+        if (pSession->nFill > 0)
+            WriteBlock(pSession, pSession->pFill, pSession->nFill);
+        // Give back what was reserved beyond the last byte. If that fails
+        // the file goes: closed as it is, its directory entry would claim
+        // the reserved clusters as data, and a later chunk would resume
+        // from there.
+        Result = pSession->Error;
+        if (Result == FR_OK)
+            Result = FatFsOptimizer::TrimToLength(&pSession->File, pSession->nWritten);
+        if (Result != FR_OK)
+            bDelete = TRUE;
+    }
+
+    FRESULT CloseResult = f_close(&pSession->File);
+    if (Result == FR_OK)
+        Result = CloseResult;
+    if (bDelete)
+        f_unlink(pSession->Path.c_str());
+
+    delete[] pSession->pFill;
+    delete[] pSession->pQueued;
+    delete[] pSession->pSpare;
+    delete pSession;
+    return Result;
+}
+
+CUploadFlushTask::CUploadFlushTask() {
+    SetName("uploadflush");
+}
+
+void CUploadFlushTask::Run(void) {
+    while (true) {
+        if (CUploadSessions::Get()->Flush())
+            CScheduler::Get()->Yield();
+        else
+            CScheduler::Get()->MsSleep(UPLOAD_FLUSH_IDLE_MS);
+    }
+}
@@ -0,0 +1,114 @@
+//
+// uploadsession.h
+//
+// Image uploads in progress (/api/images/upload). The browser sends an image
+// as a run of 1 MB chunks, one request each. Opening the .part file for every
+// chunk costs a directory lookup, a seek that walks the FAT chain from the
+// start of the file (further for every chunk of a DVD image) and a directory
+// entry update on close. A session keeps the file open from chunk to chunk
+// instead, and gathers the data into whole blocks that the flush task writes
+// while the next chunk is on its way.
+//
+// A session ends, its .part file trimmed to the bytes that reached the card,
+// when its upload is done or has gone quiet for IdleTimeoutSecs; if it
+// cannot be trimmed, the file is removed. A session never syncs the file, so
+// the directory entry on the card only ever holds a trimmed size. A chunk
+// for an upload without a session opens the .part file and carries on from
+// its size: after an idle close that is what arrived, and after a reboot
+// mid-upload it is the size the file was created with, so the uploader is
+// told to start over rather than handed the reservation as data.
+//
+// Task context on core 0 only. Tasks switch only where this code yields, so
+// there is no locking. Write() can yield while a block goes to the card;
+// until it returns, its session is busy: not evicted, not closed when idle,
+// and another request for the same upload waits for it before it is looked
+// at, so a retry of that chunk is answered as one.
+//
+#ifndef WS_UPLOADSESSION_H
+#define WS_UPLOADSESSION_H
+
+#include <circle/sched/task.h>
+#include <circle/types.h>
+#include <fatfs/ff.h>
+#include <string>
+#include <vector>
+
+class CUploadSessions {
+public:
+    enum TResult {
+        ResultOK,
+        ResultAlreadyHave,      // a retry of the chunk that was taken last
+        ResultOutOfSequence,
+        ResultOpenFailed,
+        ResultWriteFailed       // the .part file is gone; the upload starts over
+    };
+
+    // Writes go to the card in blocks this big, at offsets that are a
+    // multiple of it, so every one covers whole sectors and clusters
+    static const unsigned BlockSize = 1024 * 1024;
+    static const unsigned MaxSessions = 4;
+    // Longer than the browser's retries of one chunk take
+    static const unsigned IdleTimeoutSecs = 60;
+
+    CUploadSessions();
+    ~CUploadSessions();
+
+    static CUploadSessions* Get();
+
+    // Takes nLength bytes at nOffset of the upload to pPartPath; offset 0
+    // starts it over. nTotalSize is the size of the whole image, 0 if not
+    // known. *pReceived is set to how much of the upload has arrived.
+    TResult Write(const char* pPartPath, u64 nOffset, u64 nTotalSize,
+                  const void* pData, unsigned nLength, u64* pReceived);
+
+    // Everything received goes to the card and the .part file is closed.
+    // Like Write(), waits for a request still in Write() for the same upload.
+    TResult Finish(const char* pPartPath);
+
+    // For the flush task: writes one waiting block, or ends one idle
+    // session. FALSE if there was nothing to do.
+    boolean Flush();
+
+    unsigned GetCount() const { return (unsigned)m_Sessions.size(); }
+
+private:
+    struct TSession {
+        std::string Path;
+        FIL File;
+        u64 nTotalSize;
+        u64 nReceived;          // acknowledged to the uploader
+        u64 nWritten;           // on the card
+        u8* pFill;              // block being gathered
+        unsigned nFill;
+        unsigned nFillLimit;    // takes the file to a multiple of BlockSize
+        u8* pQueued;            // full block for the flush task, or nullptr
+        unsigned nQueued;
+        u8* pSpare;
+        boolean bWriting;       // the flush task is writing pQueued
+        boolean bBusy;          // a request's Write() is in it; not to be closed
+        FRESULT Error;          // of the first write that failed
+        unsigned nLastUsedTicks;
+    };
+
+    TSession* Find(const char* pPartPath) const;
+    // Find(), once no other request is in Write() for it; yields until then
+    TSession* FindIdle(const char* pPartPath) const;
+    TSession* Open(const char* pPartPath, u64 nOffset, u64 nTotalSize);
+    void QueueFill(TSession* pSession);
+    void WriteQueued(TSession* pSession);
+    void WriteBlock(TSession* pSession, const u8* pData, unsigned nLength);
+    // Ends the session; bDelete removes the .part file too
+    FRESULT Close(TSession* pSession, boolean bDelete);
+
+    std::vector<TSession*> m_Sessions;
+};
+
+// Writes the blocks upload sessions gather, and ends idle sessions
+class CUploadFlushTask : public CTask {
+public:
+    CUploadFlushTask();
+
+    void Run(void);
+};
+
+#endif
@@ -1,6 +1,7 @@
 #include "webglobals.h"
 #include <circle/logger.h>
 #include <circle/bcmrandom.h>
+#include <circle/timer.h>
 #include <circle/util.h>
 #include <fatfs/ff.h>
 #include <cstring>
@@ -11,7 +12,11 @@ CWebGlobals *CWebGlobals::s_pThis = nullptr;
 
 CWebGlobals::CWebGlobals (void)
 :   m_nBootID (0),
-    m_bInitialized (FALSE)
+    m_bInitialized (FALSE),
+    m_nUploadReceived (0),
+    m_nUploadSize (0),
+    m_bUploadDone (FALSE),
+    m_nUploadTicks (0)
 {
     s_pThis = this;
 }
@@ -79,4 +84,28 @@ u32 CWebGlobals::GetBootID(void) const
 const std::vector<std::string>& CWebGlobals::GetThemes(void) const
 {
     return m_Themes;
-}
\ No newline at end of file
+}
+
+void CWebGlobals::NoteUpload (const char *pName, u64 nReceived, u64 nSize, boolean bDone)
+{
+    m_UploadName = pName;
+    m_nUploadReceived = nReceived;
+    m_nUploadSize = nSize;
+    m_bUploadDone = bDone;
+    m_nUploadTicks = CTimer::Get ()->GetClockTicks ();
+}
+
+boolean CWebGlobals::GetUpload (std::string *pName, u64 *pReceived, u64 *pSize, boolean *pDone) const
+{
+    if (m_UploadName.empty ()
+        || CTimer::Get ()->GetClockTicks () - m_nUploadTicks > 60 * CLOCKHZ)
+    {
+        return FALSE;
+    }
+
+    *pName = m_UploadName;
+    *pReceived = m_nUploadReceived;
+    *pSize = m_nUploadSize;
+    *pDone = m_bUploadDone;
+    return TRUE;
+}
@@ -5,6 +5,10 @@
 #include <vector>
 #include <circle/types.h>
 
+// Connections Circle's CHTTPDaemon serves at once: MAX_CLIENTS in its
+// httpdaemon.cpp, which it does not export. One more is dropped on accept.
+#define HTTP_MAX_CLIENTS 4
+
 class CWebGlobals
 {
 public:
@@ -13,6 +17,11 @@ public:
     u32 GetBootID (void) const;
     const std::vector<std::string>& GetThemes(void) const;
 
+    // The image upload in progress, for /api/status. nSize is 0 if the
+    // uploader did not say; an upload not heard from for a minute is over.
+    void NoteUpload (const char *pName, u64 nReceived, u64 nSize, boolean bDone);
+    boolean GetUpload (std::string *pName, u64 *pReceived, u64 *pSize, boolean *pDone) const;
+
 private:
     CWebGlobals(void);
     ~CWebGlobals(void);
@@ -23,6 +32,12 @@ private:
     u32 m_nBootID;
     std::vector<std::string> m_Themes;
     boolean m_bInitialized;
+
+    std::string m_UploadName;
+    u64 m_nUploadReceived;
+    u64 m_nUploadSize;
+    boolean m_bUploadDone;
+    unsigned m_nUploadTicks;
 };
 
 #endif
\ No newline at end of file
@@ -24,11 +24,15 @@
 #include <circle/logger.h>
 #include <circle/string.h>
 #include <scsitbservice/scsitbservice.h>
+#include <ioscheduler/ioscheduler.h>
 #include <cstdio>
 #include <cstdlib>
 #include <string>
+#include "downloadserver.h"
 #include "pagehandlerregistry.h"
+#include "uploadsession.h"
 #include "util.h"
+#include "webglobals.h"
 
 // Large enough for a Trace Lab capture up to trace_buffer_kb=1024 (plus
 // file header) to be downloaded via /usbode.utrace in a single response.
@@ -51,6 +55,21 @@ CWebServer::CWebServer (CNetSubSystem *pNetSubSystem, CActLED *pActLED, CSocket
 {
     cdromservice = static_cast<CDROMService*>(CScheduler::Get()->GetTask("cdromservice"));
     assert(cdromservice != nullptr && "Failed to get cdromservice");
+
+    // Only the listening daemon has no socket; its workers share the pages,
+    // the upload sessions and the download server
+    if (pSocket == 0)
+    {
+        PageHandlerRegistry::precompile();
+        new CUploadFlushTask();
+
+        CDownloadDaemon *pDownloads = new CDownloadDaemon();
+        if (!pDownloads->Initialize())
+        {
+            LOGERR("Failed to start the download server");
+            delete pDownloads;
+        }
+    }
 }
 
 CWebServer::~CWebServer (void)
@@ -108,6 +127,8 @@ THTTPStatus CWebServer::HandleImageUpload (const char *pParams,
     unsigned long long offset = params.count("offset")
         ? strtoull(params["offset"].c_str(), nullptr, 10) : 0;
     boolean bDone = params.count("done") && params["done"] == "1";
+    unsigned long long totalSize = params.count("size")
+        ? strtoull(params["size"].c_str(), nullptr, 10) : 0;
 
     // Uploads land in the root of the images volume; reject anything that
     // could escape it or collide with in-progress upload temp files.
@@ -130,57 +151,39 @@ THTTPStatus CWebServer::HandleImageUpload (const char *pParams,
         nDataLength = 0; // final rename-only request or empty file
     }
 
-    FIL file;
-    FRESULT res;
-    if (offset == 0)
+    // The .part file stays open from chunk to chunk, and the data goes to
+    // the card in the background while the next chunk comes in
+    CUploadSessions *pUploads = CUploadSessions::Get();
+    u64 received = 0;
+    CUploadSessions::TResult result = pUploads->Write(partPath.c_str(), offset, totalSize,
+                                                      pData, nDataLength, &received);
+    if (bDone && result == CUploadSessions::ResultOK)
+        result = pUploads->Finish(partPath.c_str());
+    if (result == CUploadSessions::ResultAlreadyHave && !bDone)
     {
-        res = f_open(&file, partPath.c_str(), FA_WRITE | FA_CREATE_ALWAYS);
+        // Retry of a chunk that was already written but whose response got
+        // lost - acknowledge it instead of failing.
+        char reply[96];
+        snprintf(reply, sizeof(reply),
+                 "{\"status\":\"ok\",\"received\":%u,\"size\":%llu}",
+                 nDataLength, (unsigned long long)received);
+        return UploadReply(pBuffer, pLength, ppContentType, reply);
     }
-    else
+    if (result == CUploadSessions::ResultAlreadyHave || result == CUploadSessions::ResultOutOfSequence)
     {
-        res = f_open(&file, partPath.c_str(), FA_WRITE | FA_OPEN_EXISTING);
-        if (res == FR_OK && f_size(&file) != offset)
-        {
-            unsigned long long haveSize = f_size(&file);
-            f_close(&file);
-            if (haveSize == offset + nDataLength && !bDone)
-            {
-                // Retry of a chunk that was already written but whose
-                // response got lost - acknowledge it instead of failing.
-                char reply[96];
-                snprintf(reply, sizeof(reply),
-                         "{\"status\":\"ok\",\"received\":%u,\"size\":%llu}",
-                         nDataLength, haveSize);
-                return UploadReply(pBuffer, pLength, ppContentType, reply);
-            }
-            // Chunk out of sequence; the uploader must restart.
-            LOGERR("Upload %s: offset %llu != file size %llu",
-                   name.c_str(), offset, haveSize);
-            return UploadReply(pBuffer, pLength, ppContentType,
-                               "{\"status\":\"error\",\"error\":\"chunk out of sequence, restart upload\"}");
-        }
-        if (res == FR_OK)
-            res = f_lseek(&file, offset);
+        // Chunk out of sequence; the uploader must restart.
+        LOGERR("Upload %s: offset %llu != file size %llu",
+               name.c_str(), offset, (unsigned long long)received);
+        return UploadReply(pBuffer, pLength, ppContentType,
+                           "{\"status\":\"error\",\"error\":\"chunk out of sequence, restart upload\"}");
     }
-    if (res != FR_OK)
+    if (result == CUploadSessions::ResultOpenFailed)
         return UploadReply(pBuffer, pLength, ppContentType,
                            "{\"status\":\"error\",\"error\":\"cannot open file on images volume\"}");
 
-    if (nDataLength > 0)
-    {
-        UINT written = 0;
-        res = f_write(&file, pData, nDataLength, &written);
-        if (res != FR_OK || written != nDataLength)
-        {
-            f_close(&file);
-            f_unlink(partPath.c_str());
-            LOGERR("Upload %s: write failed at offset %llu (res=%d, wrote %u/%u)",
-                   name.c_str(), offset, (int)res, written, nDataLength);
-            return UploadReply(pBuffer, pLength, ppContentType,
-                               "{\"status\":\"error\",\"error\":\"write failed (card full?)\"}");
-        }
-    }
-    f_close(&file);
+    if (result == CUploadSessions::ResultWriteFailed)
+        return UploadReply(pBuffer, pLength, ppContentType,
+                           "{\"status\":\"error\",\"error\":\"write failed (card full?)\"}");
 
     if (bDone)
     {
@@ -196,7 +199,7 @@ THTTPStatus CWebServer::HandleImageUpload (const char *pParams,
         }
 
         f_unlink(finalPath.c_str()); // ignore result; may not exist
-        res = f_rename(partPath.c_str(), finalPath.c_str());
+        FRESULT res = f_rename(partPath.c_str(), finalPath.c_str());
         if (res != FR_OK)
         {
             LOGERR("Upload %s: rename failed (res=%d)", name.c_str(), (int)res);
@@ -207,9 +210,11 @@ THTTPStatus CWebServer::HandleImageUpload (const char *pParams,
         LOGNOTE("Upload complete: %s (%llu bytes)",
                 finalPath.c_str(), offset + nDataLength);
         if (svc)
-            svc->RefreshCache();
+            svc->AddEntry(finalPath.c_str());
     }
 
+    CWebGlobals::Get()->NoteUpload(name.c_str(), offset + nDataLength, totalSize, bDone);
+
     char reply[96];
     snprintf(reply, sizeof(reply),
              "{\"status\":\"ok\",\"received\":%u,\"size\":%llu}",
@@ -11,7 +11,12 @@
 
 #include "fatfs_host.h"
 
+#include <errno.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 namespace {
 
@@ -20,6 +25,8 @@ constexpr size_t kNoWriteLimit = (size_t)-1;
 size_t s_WriteLimit = kNoWriteLimit;
 size_t s_BytesAccepted = 0;
 bool s_SyncFails = false;
+bool s_ExpandFails = false;
+bool s_TruncateFails = false;
 unsigned s_LinkmapCount = 0;
 
 }  // namespace
@@ -35,11 +42,23 @@ void FatFsHostFailSync(bool bFail)
     s_SyncFails = bFail;
 }
 
+void FatFsHostFailExpand(bool bFail)
+{
+    s_ExpandFails = bFail;
+}
+
+void FatFsHostFailTruncate(bool bFail)
+{
+    s_TruncateFails = bFail;
+}
+
 void FatFsHostClearFaults(void)
 {
     s_WriteLimit = kNoWriteLimit;
     s_BytesAccepted = 0;
     s_SyncFails = false;
+    s_ExpandFails = false;
+    s_TruncateFails = false;
 }
 
 void FatFsHostResetLinkmapCount(void)
@@ -101,9 +120,12 @@ FRESULT f_open(FIL* fp, const TCHAR* path, BYTE mode)
     }
     rewind(f);
 
+    struct stat st;
+    fp->obj.sclust = fstat(fileno(f), &st) == 0 ? (DWORD)st.st_ino : 0;
     fp->obj.objsize = (FSIZE_t)size;
     fp->fptr = 0;
     fp->cltbl = nullptr;
+    fp->flag = (mode & (FA_WRITE | FA_CREATE_ALWAYS | FA_CREATE_NEW | FA_OPEN_ALWAYS)) ? FA_WRITE : 0;
     fp->host_fp = f;
     return FR_OK;
 }
@@ -193,6 +215,19 @@ FRESULT f_lseek(FIL* fp, FSIZE_t ofs)
         s_LinkmapCount++;
         return FR_OK;
     }
+    // As in FatFs, seeking past the end of a writable file extends it;
+    // a read-only one stops at the end.
+    if (ofs > fp->obj.objsize) {
+        if (!(fp->flag & FA_WRITE)) {
+            ofs = fp->obj.objsize;
+        } else {
+            fflush((FILE*)fp->host_fp);
+            if (ftruncate(fileno((FILE*)fp->host_fp), (off_t)ofs) != 0) {
+                return FR_DISK_ERR;
+            }
+            fp->obj.objsize = ofs;
+        }
+    }
     if (fseeko((FILE*)fp->host_fp, (off_t)ofs, SEEK_SET) != 0) {
         return FR_DISK_ERR;
     }
@@ -200,6 +235,84 @@ FRESULT f_lseek(FIL* fp, FSIZE_t ofs)
     return FR_OK;
 }
 
+FRESULT f_truncate(FIL* fp)
+{
+    if (!fp || !fp->host_fp || !(fp->flag & FA_WRITE)) {
+        return FR_INVALID_OBJECT;
+    }
+    if (s_TruncateFails) {
+        return FR_DISK_ERR;
+    }
+    fflush((FILE*)fp->host_fp);
+    if (ftruncate(fileno((FILE*)fp->host_fp), (off_t)fp->fptr) != 0) {
+        return FR_DISK_ERR;
+    }
+    fp->obj.objsize = fp->fptr;
+    return FR_OK;
+}
+
+// Contiguity means nothing on the host; only the size and the real f_expand()
+// preconditions (an empty file open for writing) are kept.
+FRESULT f_expand(FIL* fp, FSIZE_t fsz, BYTE opt)
+{
+    if (!fp || !fp->host_fp) {
+        return FR_INVALID_OBJECT;
+    }
+    if (!(fp->flag & FA_WRITE) || fp->obj.objsize != 0 || fsz == 0) {
+        return FR_DENIED;
+    }
+    if (s_ExpandFails) {
+        return FR_DENIED;
+    }
+    if (opt) {
+        fflush((FILE*)fp->host_fp);
+        if (ftruncate(fileno((FILE*)fp->host_fp), (off_t)fsz) != 0) {
+            return FR_DISK_ERR;
+        }
+        fp->obj.objsize = fsz;
+    }
+    return FR_OK;
+}
+
+FRESULT f_unlink(const TCHAR* path)
+{
+    if (!path) {
+        return FR_INVALID_NAME;
+    }
+    return remove(path) == 0 ? FR_OK : FR_NO_FILE;
+}
+
+// Host mtime in FAT's packed local date and time, two-second resolution
+FRESULT f_stat(const TCHAR* path, FILINFO* fno)
+{
+    struct stat st;
+    if (!path || stat(path, &st) != 0) {
+        return FR_NO_FILE;
+    }
+    if (fno) {
+        struct tm tm;
+        localtime_r(&st.st_mtime, &tm);
+        fno->fsize = S_ISDIR(st.st_mode) ? 0 : (FSIZE_t)st.st_size;
+        fno->fdate = (WORD)(((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday);
+        fno->ftime = (WORD)((tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2));
+        fno->fattrib = S_ISDIR(st.st_mode) ? AM_DIR : 0;
+        const char* name = strrchr(path, '/');
+        snprintf(fno->fname, sizeof(fno->fname), "%s", name ? name + 1 : path);
+    }
+    return FR_OK;
+}
+
+FRESULT f_mkdir(const TCHAR* path)
+{
+    if (!path) {
+        return FR_INVALID_NAME;
+    }
+    if (mkdir(path, 0755) == 0) {
+        return FR_OK;
+    }
+    return errno == EEXIST ? FR_EXIST : FR_NO_PATH;
+}
+
 // Directory walk: intentionally unbacked. Only mdsfile.cpp calls these, and
 // MDS images are not exercised by the tests; these exist so the loader links.
 // f_opendir reports "no path" so any accidental MDS load fails cleanly rather
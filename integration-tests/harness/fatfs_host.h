@@ -16,6 +16,12 @@ void FatFsHostSetWriteLimit(size_t nBytes);
 // Make every f_sync() report FR_DISK_ERR.
 void FatFsHostFailSync(bool bFail);
 
+// Make f_expand() find no contiguous run, as on a fragmented card.
+void FatFsHostFailExpand(bool bFail);
+
+// Make every f_truncate() report FR_DISK_ERR.
+void FatFsHostFailTruncate(bool bFail);
+
 // Back to a healthy card; the state is process-wide, so injectors must reset it.
 void FatFsHostClearFaults(void);
 
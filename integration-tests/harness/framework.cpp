@@ -61,6 +61,18 @@ namespace
         {"test_multisession", "Multi-session and CD Extra"},
         {"test_logdaemon", "File log daemon"},
         {"test_fatfsseam", "FatFs host seam"},
+        {"test_ioscheduler", "SD card I/O scheduler"},
+        {"test_preallocate", "Upload preallocation"},
+        {"test_uploadsession", "Web upload sessions"},
+        {"test_httprange", "HTTP range downloads"},
+        {"test_binlog", "Deferred-format debug log"},
+        {"test_imageindex", "Image library index"},
+        {"test_jsonwriter", "Streaming JSON writer"},
+        {"test_imagemetadata", "Image metadata"},
+        {"test_mountmanifest", "Mount manifests"},
+        {"test_discset", "Multi-disc sets"},
+        {"test_boottimeline", "Boot timeline"},
+        {"test_volumewarmup", "File system warmup"},
     };
 
     // "test-suite/test_read10.cpp" -> "SCSI read commands"
@@ -0,0 +1,57 @@
+//
+// scratchfile.cpp
+//
+#include "scratchfile.h"
+
+#include <fatfs/ff.h>
+
+#include <stdio.h>
+#include <string.h>
+
+static std::string TestDataDir()
+{
+#ifdef USBODE_TESTDATA
+    return USBODE_TESTDATA;
+#else
+    return "out/images";
+#endif
+}
+
+CScratchFile::CScratchFile(const char *pName)
+    : m_Path(TestDataDir() + "/" + pName)
+{
+    remove(m_Path.c_str());
+}
+
+CScratchFile::~CScratchFile(void)
+{
+    remove(m_Path.c_str());
+}
+
+bool CScratchFile::Exists(void) const
+{
+    FILE *f = fopen(m_Path.c_str(), "rb");
+    if (f != nullptr)
+        fclose(f);
+    return f != nullptr;
+}
+
+bool CScratchFile::Matches(const std::vector<u8> &expected) const
+{
+    FIL File;
+    if (f_open(&File, m_Path.c_str(), FA_READ) != FR_OK)
+        return false;
+    std::vector<u8> actual(expected.size() + 1);
+    UINT nRead = 0;
+    f_read(&File, actual.data(), (UINT)actual.size(), &nRead);
+    f_close(&File);
+    return nRead == expected.size() && memcmp(actual.data(), expected.data(), nRead) == 0;
+}
+
+std::vector<u8> ScratchPattern(size_t nBytes, unsigned nStep)
+{
+    std::vector<u8> data(nBytes);
+    for (size_t i = 0; i < nBytes; i++)
+        data[i] = (u8)(i * nStep + (i >> 11));
+    return data;
+}
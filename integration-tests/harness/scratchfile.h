@@ -0,0 +1,41 @@
+//
+// scratchfile.h
+//
+// Files the write-path tests make through the FatFs seam in fatfs_host.cpp:
+// a name under the test-data directory that starts out absent and is gone
+// again when the test ends, a pattern to fill it with, and a byte-for-byte
+// check of what it ended up holding.
+//
+#ifndef _harness_scratchfile_h
+#define _harness_scratchfile_h
+
+#include <circle/types.h>
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+class CScratchFile
+{
+public:
+    explicit CScratchFile(const char *pName);
+    ~CScratchFile(void);
+
+    const std::string &Path(void) const { return m_Path; }
+    const char *c_str(void) const { return m_Path.c_str(); }
+
+    bool Exists(void) const;
+
+    // Read back through f_read(), so it sees what the code under test wrote
+    bool Matches(const std::vector<u8> &expected) const;
+
+private:
+    std::string m_Path;
+};
+
+// nBytes that differ from block to block, so a chunk written at the wrong
+// offset shows up. nStep picks one of several such patterns.
+std::vector<u8> ScratchPattern(size_t nBytes, unsigned nStep = 7);
+
+#endif
@@ -15,10 +15,12 @@
 #include <circle/usb/gadget/dwusbgadgetendpoint.h>
 #include <configservice/configservice.h>
 
+#include <assert.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ucontext.h>
 
 #include <string>
 #include <vector>
@@ -199,6 +201,98 @@ void CScheduler::TestClearTasks(void)
 namespace
 {
 unsigned g_nSleepCount = 0;
+void (*g_pYieldHandler)(void) = nullptr;
+
+// The one extra task: the context to go back to when it yields, its own
+void (*g_pTaskEntry)(void) = nullptr;
+bool g_bTaskStarting = false;
+bool g_bTaskRunning = false;
+bool g_bInTask = false;
+ucontext_t g_YieldedContext;
+ucontext_t g_TaskContext;
+std::vector<char> g_TaskStack(256 * 1024);
+CTask g_ExtraTask;
+
+void TaskEntry(void)
+{
+    g_pTaskEntry();
+    g_bTaskRunning = false;
+    // Returning resumes uc_link: where it was last resumed from
+}
+
+void ResumeTask(void)
+{
+    g_bInTask = true;
+    swapcontext(&g_YieldedContext, &g_TaskContext);
+    g_bInTask = false;
+}
+
+void StartTask(void)
+{
+    g_bTaskStarting = false;
+    g_bTaskRunning = true;
+    getcontext(&g_TaskContext);
+    g_TaskContext.uc_stack.ss_sp = g_TaskStack.data();
+    g_TaskContext.uc_stack.ss_size = g_TaskStack.size();
+    g_TaskContext.uc_link = &g_YieldedContext;
+    makecontext(&g_TaskContext, TaskEntry, 0);
+    ResumeTask();
+}
+}
+
+CTask *CScheduler::GetCurrentTask(void)
+{
+    return g_bInTask ? &g_ExtraTask : nullptr;
+}
+
+void CScheduler::Yield(void)
+{
+    if (g_bInTask)
+    {
+        swapcontext(&g_TaskContext, &g_YieldedContext);
+        return;
+    }
+
+    void (*pHandler)(void) = g_pYieldHandler;
+    g_pYieldHandler = nullptr;
+    if (pHandler != nullptr)
+    {
+        pHandler();
+    }
+
+    if (g_bTaskStarting)
+    {
+        StartTask();
+    }
+    else if (g_bTaskRunning)
+    {
+        ResumeTask();
+    }
+}
+
+void CScheduler::TestOnNextYield(void (*pHandler)(void))
+{
+    g_pYieldHandler = pHandler;
+}
+
+void CScheduler::TestStartTaskAtNextYield(void (*pEntry)(void))
+{
+    assert(!g_bTaskRunning && !g_bTaskStarting);
+    g_pTaskEntry = pEntry;
+    g_bTaskStarting = true;
+}
+
+boolean CScheduler::TestFinishTask(void)
+{
+    if (g_bTaskStarting)
+    {
+        StartTask();
+    }
+    for (unsigned nTurn = 0; g_bTaskRunning && nTurn < 100000; nTurn++)
+    {
+        ResumeTask();
+    }
+    return !g_bTaskRunning;
 }
 
 void CScheduler::TestNoteSleep(void)
@@ -16,13 +16,19 @@ public:
     static CScheduler *Get(void);
 
     CTask *GetTask(const char *pTaskName);
+    // nullptr for the test itself, which is no CTask; one fixed CTask while
+    // the extra task below runs, so code can tell the two apart
+    CTask *GetCurrentTask(void);
 
     // Sleeping cannot happen on a single-threaded host, but it is counted: on a
     // real Pi a sleep on a per-event path costs the whole system.
     void Sleep(unsigned nSeconds) { TestNoteSleep(); }
     void MsSleep(unsigned nMilliSeconds) { TestNoteSleep(); }
     void usSleep(unsigned nMicroSeconds) { TestNoteSleep(); }
-    void Yield(void) {}
+    // No other task runs on the host; a test can run its own code at the
+    // next yield instead, once, to play one getting in there, or start a
+    // task there that runs until it yields itself (see TestStartTaskAtNextYield()).
+    void Yield(void);
 
     // Test control
     void TestRegisterTask(const char *pName, CTask *pTask);
@@ -30,6 +36,16 @@ public:
     static void TestNoteSleep(void);
     static unsigned TestSleepCount(void);
     static void TestResetSleepCount(void);
+    static void TestOnNextYield(void (*pHandler)(void));
+
+    // One more task, on a stack of its own: it starts at the next yield and
+    // runs until it yields, which goes back to where that yield was; every
+    // later yield outside it lets it go on. Its code must not CHECK (a
+    // failure throws, and cannot unwind off its stack). TestFinishTask()
+    // starts it if no yield has, lets it run to its end, and returns FALSE if
+    // it still had not ended after many turns.
+    static void TestStartTaskAtNextYield(void (*pEntry)(void));
+    static boolean TestFinishTask(void);
 };
 
 #endif
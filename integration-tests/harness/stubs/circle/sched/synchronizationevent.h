@@ -13,6 +13,8 @@ public:
     void Set(void) { m_bState = true; }
     void Clear(void) { m_bState = false; }
     void Wait(void) {}
+    // TRUE on timeout, as in Circle.
+    bool WaitWithTimeout(unsigned nMicroSeconds) { return !m_bState; }
     bool GetState(void) const { return m_bState; }
 
 private:
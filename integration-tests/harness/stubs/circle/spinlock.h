@@ -0,0 +1,25 @@
+//
+// Host-build stub for <circle/spinlock.h>.
+// The host tests are single-threaded, so there is nothing to lock.
+//
+#ifndef _circle_spinlock_h
+#define _circle_spinlock_h
+
+#include <circle/synchronize.h>
+
+#ifndef TASK_LEVEL
+#define TASK_LEVEL 0
+#define IRQ_LEVEL 1
+#define FIQ_LEVEL 2
+#endif
+
+class CSpinLock
+{
+public:
+    CSpinLock(unsigned nTargetLevel = IRQ_LEVEL) {}
+
+    void Acquire(void) {}
+    void Release(void) {}
+};
+
+#endif
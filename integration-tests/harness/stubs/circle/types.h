@@ -37,6 +37,8 @@ typedef int16_t s16;
 typedef int32_t s32;
 typedef int64_t s64;
 
+typedef uintptr_t uintptr;
+
 typedef bool boolean;
 #ifndef TRUE
 #define TRUE true
@@ -51,9 +51,11 @@ typedef enum {
     FR_INVALID_PARAMETER
 } FRESULT;
 
-// Object identifier: the readers only ever read obj.objsize (via f_size()).
+// Object identifier: the readers read obj.objsize (via f_size()), and the
+// mount manifest obj.sclust to tell a file from another put in its place.
 typedef struct {
     FSIZE_t objsize;
+    DWORD   sclust;   // host inode number standing in for the first cluster
 } FFOBJID;
 
 // Directory attribute bits (only AM_DIR is referenced).
@@ -85,6 +87,7 @@ typedef struct {
     FFOBJID  obj;      // object.objsize -> file size (f_size)
     FSIZE_t  fptr;     // current file pointer (f_tell)
     DWORD*   cltbl;    // fast-seek cluster link map (set by FatFsOptimizer)
+    BYTE     flag;     // FA_WRITE if open for writing
     void*    host_fp;  // backing host FILE* (opaque to firmware code)
 } FIL;
 
@@ -102,6 +105,9 @@ typedef struct {
 // no-op and the readers proceed with ordinary seeks.
 #define CREATE_LINKMAP  ((FSIZE_t)0 - 1)
 
+// The firmware's ffconf.h enables f_expand() (patches/circle)
+#define FF_USE_EXPAND   1
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -112,6 +118,11 @@ FRESULT f_read  (FIL* fp, void* buff, UINT btr, UINT* br);
 FRESULT f_write (FIL* fp, const void* buff, UINT btw, UINT* bw);
 FRESULT f_sync  (FIL* fp);
 FRESULT f_lseek (FIL* fp, FSIZE_t ofs);
+FRESULT f_truncate (FIL* fp);
+FRESULT f_expand (FIL* fp, FSIZE_t fsz, BYTE opt);
+FRESULT f_unlink (const TCHAR* path);
+FRESULT f_stat (const TCHAR* path, FILINFO* fno);
+FRESULT f_mkdir (const TCHAR* path);
 
 // Directory walk: link-only stubs for mdsfile.cpp (MDS is not under test).
 FRESULT f_opendir  (DIR* dp, const TCHAR* path);
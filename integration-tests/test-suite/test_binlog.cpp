@@ -0,0 +1,211 @@
+//
+// test_binlog.cpp
+//
+// Deferred-format logging: CDROM_DEBUG_LOG and the data path's errors record
+// raw arguments (or text) on the data path, and nothing reaches CLogger until
+// the log task drains the ring. The ring is a process-wide singleton, so every test starts
+// by draining whatever an earlier one left behind.
+//
+#include "framework.h"
+
+#include <circle/logger.h>
+#include <tracelab/binlog.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+static void ResetBinLog()
+{
+    while (CBinLog::Get()->Drain(1000) > 0)
+    {
+    }
+    CLogger::TestClearEvents();
+}
+
+static std::string NextLoggedMessage(std::string *pSource = nullptr)
+{
+    TLogSeverity severity;
+    char source[LOG_MAX_SOURCE];
+    char message[LOG_MAX_MESSAGE];
+    time_t when;
+    unsigned hundredths;
+    int zone;
+    if (!CLogger::Get()->ReadEvent(&severity, source, message, &when, &hundredths, &zone))
+    {
+        return "(nothing logged)";
+    }
+    if (pSource != nullptr)
+    {
+        *pSource = source;
+    }
+    return message;
+}
+
+// Records through the ring and formats on drain; must read as printf() would.
+template <typename... TArgs>
+static bool FormatsLikePrintf(const char *pFormat, TArgs... args)
+{
+    char expected[LOG_MAX_MESSAGE];
+    snprintf(expected, sizeof(expected), pFormat, args...);
+
+    ResetBinLog();
+    CBinLog::Get()->Write("test", pFormat, args...);
+    CBinLog::Get()->Drain(1);
+    const std::string actual = NextLoggedMessage();
+    if (actual != expected)
+    {
+        printf("    \"%s\": expected \"%s\", got \"%s\"\n", pFormat, expected, actual.c_str());
+        return false;
+    }
+    return true;
+}
+
+TEST(binlog_formats_nothing_until_drained)
+{
+    ResetBinLog();
+
+    BINLOG_NOTE("SCSIRead::DoRead", "LBA=%u, cnt=%u, max_lba=%u", 16u, 32u, 333000u);
+    CHECK_EQ(CLogger::TestQueuedEventCount(), 0u);
+
+    CHECK_EQ(CBinLog::Get()->Drain(10), 1u);
+    std::string source;
+    CHECK(NextLoggedMessage(&source) == "LBA=16, cnt=32, max_lba=333000");
+    CHECK(source == "SCSIRead::DoRead");
+}
+
+TEST(binlog_formats_like_printf)
+{
+    const u32 nAllOnes = 0xFFFFFFFFu;
+    const u8 nByte = 0xAB;
+    const int nNegative = -5;
+    const unsigned long nLong = 123456789UL;
+    const long long nHuge = -1234567890123LL;
+    const u64 nWide = 0x123456789ABCULL;
+
+    CHECK(FormatsLikePrintf("plain text, no arguments"));
+    CHECK(FormatsLikePrintf("%d and %i", nNegative, 42));
+    CHECK(FormatsLikePrintf("%u", nAllOnes));
+    CHECK(FormatsLikePrintf("%d", nAllOnes));      // a u32 through %d reads as an int
+    CHECK(FormatsLikePrintf("%x", nNegative));     // and an int through %x as unsigned
+    CHECK(FormatsLikePrintf("[%02x] [%02X] [%4x]", nByte, nByte, nByte));
+    CHECK(FormatsLikePrintf("%lu %ld", nLong, -(long)nLong));
+    CHECK(FormatsLikePrintf("%lld %llx", nHuge, (unsigned long long)nWide));
+    CHECK(FormatsLikePrintf("%-6d|%+d|% d", 7, 7, 7));
+    CHECK(FormatsLikePrintf("%*d|%-*u", 5, 3, 4, 9u));
+    CHECK(FormatsLikePrintf("%.2f %5.1f", 3.14159, 2.5f));
+    CHECK(FormatsLikePrintf("100%% at %c%c", 'o', 'k'));
+}
+
+// A string may not outlive the call, so it is formatted at once - but it
+// still waits in the ring, since the caller may be on the CD core.
+TEST(binlog_string_arguments_are_formatted_immediately)
+{
+    ResetBinLog();
+
+    char target[16];
+    strcpy(target, "macos");
+    BINLOG_NOTE("CDUtils", "target=%s", target);
+    strcpy(target, "changed");
+
+    CHECK_EQ(CLogger::TestQueuedEventCount(), 0u);
+    CHECK_EQ(CBinLog::Get()->Drain(10), 1u);
+    CHECK(NextLoggedMessage() == "target=macos");
+}
+
+// A sector hex dump has more arguments than a record holds, and its text is
+// longer than one record's: it spans several, and comes out whole and in
+// order with what follows it, wherever in the ring it lands.
+TEST(binlog_long_text_spans_records_in_order)
+{
+    ResetBinLog();
+
+    u8 sector[16];
+    for (unsigned i = 0; i < sizeof(sector); i++)
+    {
+        sector[i] = (u8)(0xA0 + i);
+    }
+
+    // Two slots for the dump and one for the note after it: three a round,
+    // so over 256 rounds the dump starts at every place in the ring,
+    // including the last, where it wraps round to the first.
+    for (unsigned nRound = 0; nRound < 256; nRound++)
+    {
+        BINLOG_NOTE("UpdateRead", "LBA 16, first 16 bytes of the sector: %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x",
+                    sector[0], sector[1], sector[2], sector[3], sector[4], sector[5], sector[6], sector[7],
+                    sector[8], sector[9], sector[10], sector[11], sector[12], sector[13], sector[14], sector[15]);
+        BINLOG_NOTE("UpdateRead", "round=%u", nRound);
+        CHECK_EQ(CLogger::TestQueuedEventCount(), 0u);
+
+        CHECK_EQ(CBinLog::Get()->Drain(10), 2u);
+        CHECK(NextLoggedMessage() == "LBA 16, first 16 bytes of the sector: "
+                                     "a0 a1 a2 a3 a4 a5 a6 a7 a8 a9 aa ab ac ad ae af");
+        CHECK(NextLoggedMessage() == "round=" + std::to_string(nRound));
+    }
+}
+
+// The data path's errors come through the ring too, and keep their severity.
+TEST(binlog_keeps_the_severity)
+{
+    ResetBinLog();
+
+    BINLOG_ERROR("UpdateRead", "Partial read: %d/%u bytes at LBA %u", 2048, 4096u, 16u);
+    BINLOG_WARN("chdfile", "hunk %u", 3u);
+    BINLOG_ERROR("CCueBinFileDevice", "Read at offset %llu past end of image in %s",
+                 (unsigned long long)1234, "game.bin");
+    CHECK_EQ(CLogger::TestQueuedEventCount(), 0u);
+
+    CHECK_EQ(CBinLog::Get()->Drain(10), 3u);
+
+    const TLogSeverity expected[] = {LogError, LogWarning, LogError};
+    const char *messages[] = {"Partial read: 2048/4096 bytes at LBA 16", "hunk 3",
+                              "Read at offset 1234 past end of image in game.bin"};
+    for (unsigned i = 0; i < 3; i++)
+    {
+        TLogSeverity severity;
+        char source[LOG_MAX_SOURCE];
+        char message[LOG_MAX_MESSAGE];
+        time_t when;
+        unsigned hundredths;
+        int zone;
+        CHECK(CLogger::Get()->ReadEvent(&severity, source, message, &when, &hundredths, &zone));
+        CHECK_EQ(severity, expected[i]);
+        CHECK(strcmp(message, messages[i]) == 0);
+    }
+}
+
+// A stalled log task must not stall the data path: a full ring drops and
+// counts, and what it kept comes out oldest first.
+TEST(binlog_full_ring_drops_instead_of_blocking)
+{
+    ResetBinLog();
+    const u32 nDroppedBefore = CBinLog::Get()->GetDroppedCount();
+
+    for (unsigned i = 0; i < 300; i++)
+    {
+        BINLOG_NOTE("test", "n=%u", i);
+    }
+
+    CHECK_EQ(CBinLog::Get()->GetDroppedCount() - nDroppedBefore, 300u - 256u);
+
+    // Bounded batches, as the task drains them
+    CHECK_EQ(CBinLog::Get()->Drain(64), 64u);
+    CHECK(NextLoggedMessage() == "n=0");
+    CLogger::TestClearEvents();
+
+    unsigned nRest = 0;
+    unsigned nBatch;
+    while ((nBatch = CBinLog::Get()->Drain(64)) > 0)
+    {
+        nRest += nBatch;
+    }
+    CHECK_EQ(nRest, 256u - 64u);
+
+    // Room again
+    BINLOG_NOTE("test", "after=%u", 1u);
+    CHECK_EQ(CBinLog::Get()->GetDroppedCount() - nDroppedBefore, 300u - 256u);
+    CLogger::TestClearEvents();
+    CHECK_EQ(CBinLog::Get()->Drain(64), 1u);
+    CHECK(NextLoggedMessage() == "after=1");
+}
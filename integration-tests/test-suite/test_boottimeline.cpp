@@ -0,0 +1,147 @@
+//
+// test_boottimeline.cpp
+//
+// The boot timeline (tracelab/boottimeline.cpp): a stage keeps its first
+// run only, the mount stages are stamped only inside the boot mount's scope,
+// and the gadget and the image loader stamp the stages they own.
+//
+#include "bench.h"
+#include "framework.h"
+
+#include <circle/sched/scheduler.h>
+#include <circle/timer.h>
+#include <discimage/util.h>
+#include <tracelab/boottimeline.h>
+
+#include <string>
+
+static std::string TestDataDir()
+{
+#ifdef USBODE_TESTDATA
+    return USBODE_TESTDATA;
+#else
+    return "out/images";
+#endif
+}
+
+TEST(boot_timeline_keeps_the_first_run_of_a_stage)
+{
+    CBootTimeline timeline;
+    CHECK(!timeline.HasBegun(BootStageCDROMService));
+
+    u32 nStart = CTimer::Get()->GetClockTicks();
+    timeline.Begin(BootStageCDROMService);
+    CTimer::Get()->TestAdvanceTicks(3);
+    timeline.End(BootStageCDROMService);
+    CHECK(timeline.HasEnded(BootStageCDROMService));
+    CHECK_EQ(timeline.GetStart(BootStageCDROMService), nStart);
+    CHECK_EQ(timeline.GetEnd(BootStageCDROMService), nStart + 3 * (CLOCKHZ / 100));
+
+    // A second run leaves the first in place
+    CTimer::Get()->TestAdvanceTicks(5);
+    timeline.Begin(BootStageCDROMService);
+    timeline.End(BootStageCDROMService);
+    CHECK_EQ(timeline.GetStart(BootStageCDROMService), nStart);
+    CHECK_EQ(timeline.GetEnd(BootStageCDROMService), nStart + 3 * (CLOCKHZ / 100));
+}
+
+TEST(boot_timeline_marks_and_unfinished_stages)
+{
+    CBootTimeline timeline;
+
+    // An end with no start is not a stage
+    timeline.End(BootStageNetwork);
+    CHECK(!timeline.HasBegun(BootStageNetwork));
+
+    timeline.Begin(BootStageNetwork);
+    CHECK(timeline.HasBegun(BootStageNetwork));
+    CHECK(!timeline.HasEnded(BootStageNetwork));
+
+    timeline.Mark(BootStageFirstCBW);
+    CHECK(timeline.HasEnded(BootStageFirstCBW));
+    CHECK_EQ(timeline.GetStart(BootStageFirstCBW), timeline.GetEnd(BootStageFirstCBW));
+
+    CHECK(std::string(CBootTimeline::GetName(BootStageMountCLMT)) == "clmt build");
+    CHECK(std::string(CBootTimeline::GetGroup(BootStageFirstRead)) == "usb");
+}
+
+TEST(boot_timeline_records_the_first_usb_traffic)
+{
+    CFakeImageDevice *disc = MakeDataISO(1200);
+    CGadgetTestBench bench(disc);
+    bench.Activate();
+    bench.RequestSense();
+
+    const u8 read10[10] = {0x28, 0, 0, 0, 0, 16, 0, 0, 1, 0};
+    auto r = bench.SendCommand(read10, sizeof(read10), 2048);
+    CHECK_EQ(r.csw.bmCSWStatus, 0);
+
+    CBootTimeline *pTimeline = CBootTimeline::Get();
+    CHECK(pTimeline->HasEnded(BootStageUSBActivate));
+    CHECK(pTimeline->HasEnded(BootStageFirstCBW));
+    CHECK(pTimeline->HasEnded(BootStageFirstCSW));
+    CHECK(pTimeline->HasEnded(BootStageFirstRead));
+    CHECK(pTimeline->GetStart(BootStageFirstCBW) >= pTimeline->GetStart(BootStageUSBActivate));
+    CHECK(pTimeline->GetStart(BootStageFirstRead) >= pTimeline->GetStart(BootStageFirstCSW));
+}
+
+static CBootTimeline *s_pOtherTaskTimeline;
+
+static void StampFromAnotherTask(void)
+{
+    s_pOtherTaskTimeline->Begin(BootStageMountFileOpen);
+}
+
+TEST(boot_timeline_stamps_mount_stages_only_for_the_boot_mount)
+{
+    CBootTimeline timeline;
+
+    // A load for metadata or the standby disc, before the boot mount
+    timeline.Begin(BootStageMountCueParse);
+    CHECK(!timeline.HasBegun(BootStageMountCueParse));
+
+    timeline.BeginMount();
+    timeline.Begin(BootStageMountCueParse);
+    CHECK(timeline.HasBegun(BootStageMountCueParse));
+
+    // Another task loading while the boot mount has yielded
+    s_pOtherTaskTimeline = &timeline;
+    CScheduler::TestStartTaskAtNextYield(StampFromAnotherTask);
+    CHECK(CScheduler::TestFinishTask());
+    CHECK(!timeline.HasBegun(BootStageMountFileOpen));
+
+    timeline.End(BootStageMountCueParse);
+    timeline.EndMount();
+    CHECK(timeline.HasEnded(BootStageMountCueParse));
+
+    // A later mount, even by the same task, is not the boot's
+    timeline.BeginMount();
+    timeline.Begin(BootStageMountFileOpen);
+    timeline.EndMount();
+    CHECK(!timeline.HasBegun(BootStageMountFileOpen));
+
+    // Stages outside the mount row need no scope
+    timeline.Mark(BootStageFirstCBW);
+    CHECK(timeline.HasEnded(BootStageFirstCBW));
+}
+
+TEST(boot_timeline_records_the_mount_steps)
+{
+    // The boot mount's own scope, as ProcessPendingMount() opens it. No other
+    // test opens it, and the loads outside it stamp nothing.
+    CBootTimeline *pTimeline = CBootTimeline::Get();
+    CHECK(!pTimeline->HasBegun(BootStageMountCueParse));
+    pTimeline->BeginMount();
+    IImageDevice *device = loadImageDevice((TestDataDir() + "/splitaudio.cue").c_str());
+    pTimeline->EndMount();
+    CHECK(device != nullptr);
+    delete device;
+
+    CHECK(pTimeline->HasEnded(BootStageMountManifest));
+    CHECK(pTimeline->HasEnded(BootStageMountCueParse));
+    CHECK(pTimeline->HasEnded(BootStageMountFileOpen));
+    CHECK(pTimeline->HasEnded(BootStageMountCLMT));
+    CHECK(pTimeline->HasEnded(BootStageMountLayout));
+    CHECK(std::string(CBootTimeline::GetName(BootStageMountManifest)) == "manifest load");
+    CHECK(std::string(CBootTimeline::GetGroup(BootStageMountManifest)) == "mount");
+}
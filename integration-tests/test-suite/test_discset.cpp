@@ -0,0 +1,79 @@
+//
+// test_discset.cpp
+//
+// How SCSITBService tells which images are discs of one game
+// (scsitbservice/discset.cpp): names that differ only in the disc number,
+// and the entries of an .m3u playlist.
+//
+#include "framework.h"
+
+#include <scsitbservice/discset.h>
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+static std::string Key(const char* name)
+{
+    char key[256];
+    return GetDiscSetKey(name, key, sizeof(key)) ? key : "";
+}
+
+TEST(discset_key_drops_the_disc_number)
+{
+    CHECK(Key("Final Fantasy VII (USA) (Disc 1).cue") == "final fantasy vii (usa) (disc #).cue");
+    CHECK(Key("Final Fantasy VII (USA) (Disc 1).cue") == Key("final fantasy vii (usa) (DISC 3).cue"));
+    CHECK(Key("Riven (Disc 1 of 5).iso") == Key("Riven (Disc 5 of 5).iso"));
+    CHECK(Key("Myst_CD1.chd") == Key("Myst_CD2.chd"));
+    CHECK(Key("Game Disk-1.cue") == Key("Game Disk-2.cue"));
+    CHECK(Key("Saga [Disc10].cue") == Key("Saga [Disc9].cue"));
+}
+
+TEST(discset_key_tells_other_games_and_formats_apart)
+{
+    CHECK(Key("Game A (Disc 1).cue") != Key("Game B (Disc 2).cue"));
+    CHECK(Key("Game (Disc 1).cue") != Key("Game (Disc 2).chd"));
+}
+
+TEST(discset_key_needs_a_disc_word_and_number)
+{
+    CHECK(Key("Doom.iso") == "");
+    CHECK(Key("Track 1.cue") == "");
+    CHECK(Key("Abcd2.iso") == "");       // not a word of its own
+    CHECK(Key("Disc.iso") == "");        // no number
+    CHECK(Key("CD2X Demo.iso") == "");   // a name, not a disc number
+    CHECK(Key("Disc 123.iso") == "");    // no game has that many
+
+    char small[8];
+    CHECK(!GetDiscSetKey("Game (Disc 1).cue", small, sizeof(small)));
+}
+
+TEST(discset_key_uses_the_last_disc_number)
+{
+    // "CD32" names the console; the disc number comes after it
+    CHECK(Key("Amiga CD32 Game (Disc 1).iso") == "amiga cd32 game (disc #).iso");
+}
+
+TEST(discset_m3u_lists_entries_in_order)
+{
+    std::vector<std::string> entries;
+    ParseM3U("\xEF\xBB\xBF#EXTM3U\r\n"
+             "Game (Disc 1).cue\r\n"
+             "\r\n"
+             "   Game (Disc 2).cue  \n"
+             "# a comment\n"
+             "discs\\Game (Disc 3).cue",
+             entries);
+    CHECK_EQ(entries.size(), (size_t)3);
+    if (entries.size() == 3) {
+        CHECK(entries[0] == "Game (Disc 1).cue");
+        CHECK(entries[1] == "Game (Disc 2).cue");
+        CHECK(entries[2] == "discs/Game (Disc 3).cue");
+    }
+
+    ParseM3U("", entries);
+    CHECK(entries.empty());
+    ParseM3U("\n\n# only comments\n", entries);
+    CHECK(entries.empty());
+}
@@ -0,0 +1,93 @@
+//
+// test_httprange.cpp
+//
+// What the image download server makes of a request: header lookup, the
+// Range forms download managers send, and the ETag If-Range compares.
+//
+#include "framework.h"
+
+#include <webserver/httprange.h>
+
+#include <string.h>
+
+static const char kRequest[] =
+    "GET /images/Games/game.iso HTTP/1.1\r\n"
+    "Host: usbode.local:8080\r\n"
+    "range:  bytes=100-199 \r\n"
+    "If-Range: \"1000-5a2b6000\"\r\n"
+    "\r\n";
+
+TEST(httprange_finds_headers_in_any_case_and_trims_them)
+{
+    char value[64];
+    CHECK(GetHTTPHeader(kRequest, "Range", value, sizeof(value)));
+    CHECK(strcmp(value, "bytes=100-199") == 0);
+    CHECK(GetHTTPHeader(kRequest, "if-range", value, sizeof(value)));
+    CHECK(strcmp(value, "\"1000-5a2b6000\"") == 0);
+
+    // Not a header: the request line, a prefix of a name, one too long
+    CHECK(!GetHTTPHeader(kRequest, "GET /images/Games/game.iso HTTP/1.1", value, sizeof(value)));
+    CHECK(!GetHTTPHeader(kRequest, "If", value, sizeof(value)));
+    CHECK(!GetHTTPHeader(kRequest, "Host", value, 8));
+}
+
+TEST(httprange_parses_the_three_single_range_forms)
+{
+    u64 first = 0, last = 0;
+    CHECK_EQ(ParseHTTPRange("bytes=100-199", 1000, &first, &last), HTTPRangeSatisfiable);
+    CHECK_EQ(first, 100u);
+    CHECK_EQ(last, 199u);
+
+    // Open-ended, and an end past the file cut back to its last byte
+    CHECK_EQ(ParseHTTPRange("bytes=900-", 1000, &first, &last), HTTPRangeSatisfiable);
+    CHECK_EQ(first, 900u);
+    CHECK_EQ(last, 999u);
+    CHECK_EQ(ParseHTTPRange("bytes=900-5000", 1000, &first, &last), HTTPRangeSatisfiable);
+    CHECK_EQ(last, 999u);
+
+    // The last N bytes, all of them if N is more than the file
+    CHECK_EQ(ParseHTTPRange("bytes=-100", 1000, &first, &last), HTTPRangeSatisfiable);
+    CHECK_EQ(first, 900u);
+    CHECK_EQ(last, 999u);
+    CHECK_EQ(ParseHTTPRange("bytes=-5000", 1000, &first, &last), HTTPRangeSatisfiable);
+    CHECK_EQ(first, 0u);
+}
+
+TEST(httprange_handles_offsets_past_4gb)
+{
+    const u64 size = 8ull * 1024 * 1024 * 1024;     // a dual-layer DVD image
+    u64 first = 0, last = 0;
+    CHECK_EQ(ParseHTTPRange("bytes=6442450944-", size, &first, &last), HTTPRangeSatisfiable);
+    CHECK(first == 6442450944ull);
+    CHECK(last == size - 1);
+}
+
+TEST(httprange_refuses_ranges_past_the_end)
+{
+    u64 first = 0, last = 0;
+    CHECK_EQ(ParseHTTPRange("bytes=1000-", 1000, &first, &last), HTTPRangeNotSatisfiable);
+    CHECK_EQ(ParseHTTPRange("bytes=-0", 1000, &first, &last), HTTPRangeNotSatisfiable);
+    CHECK_EQ(ParseHTTPRange("bytes=0-", 0, &first, &last), HTTPRangeNotSatisfiable);
+}
+
+TEST(httprange_ignores_what_it_does_not_serve)
+{
+    u64 first = 0, last = 0;
+    CHECK_EQ(ParseHTTPRange("bytes=0-99,200-299", 1000, &first, &last), HTTPRangeNone);
+    CHECK_EQ(ParseHTTPRange("items=0-9", 1000, &first, &last), HTTPRangeNone);
+    CHECK_EQ(ParseHTTPRange("bytes=200-100", 1000, &first, &last), HTTPRangeNone);
+    CHECK_EQ(ParseHTTPRange("bytes=-", 1000, &first, &last), HTTPRangeNone);
+    CHECK_EQ(ParseHTTPRange("bytes= 1-2", 1000, &first, &last), HTTPRangeNone);
+    CHECK_EQ(ParseHTTPRange("bytes=99999999999999999999-", 1000, &first, &last), HTTPRangeNone);
+}
+
+TEST(httprange_etag_changes_with_size_and_time)
+{
+    char a[40], b[40], c[40];
+    FormatHTTPETag(4096, 0x5a2b, 0x6000, a, sizeof(a));
+    FormatHTTPETag(4097, 0x5a2b, 0x6000, b, sizeof(b));
+    FormatHTTPETag(4096, 0x5a2b, 0x6001, c, sizeof(c));
+    CHECK(strcmp(a, "\"1000-5a2b6000\"") == 0);
+    CHECK(strcmp(a, b) != 0);
+    CHECK(strcmp(a, c) != 0);
+}
@@ -0,0 +1,473 @@
+//
+// test_imageindex.cpp
+//
+// The image library index SCSITBService lists from. Entries keep the order
+// the flat list always had (folders, then images, each by relative path),
+// since that order is the index the web UI, display and toolbox mount by;
+// each folder's children come back in the same order, and there is no cap
+// on the number of entries.
+//
+#include "framework.h"
+
+#include <scsitbservice/imageindex.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+// Games/, Games/RPG/, Music/; images at every level, added in the order a
+// directory scan might return them rather than sorted.
+static void BuildLibrary(CImageIndex& index)
+{
+    index.Add(CImageIndex::None, "zork.iso", 100, false);
+    u32 games = index.Add(CImageIndex::None, "Games", 0, true);
+    index.Add(games, "doom.cue", 200, false);
+    u32 rpg = index.Add(games, "RPG", 0, true);
+    index.Add(rpg, "Final Fantasy.cue", 300, false);
+    index.Add(games, "Alpha.iso", 400, false);
+    index.Add(CImageIndex::None, "Music", 0, true);
+    index.Add(CImageIndex::None, "apple.iso", 500, false);
+    index.Finish();
+}
+
+static std::string ChildNames(const CImageIndex& index, u32 folder)
+{
+    size_t count = 0;
+    const u32* children = index.GetChildren(folder, &count);
+    if (children == nullptr)
+        return "(not a folder)";
+    std::string names;
+    for (size_t i = 0; i < count; i++) {
+        if (!names.empty())
+            names += ",";
+        names += index.GetName(children[i]);
+    }
+    return names;
+}
+
+TEST(entries_are_numbered_folders_first_then_by_path)
+{
+    CImageIndex index;
+    BuildLibrary(index);
+
+    CHECK_EQ(index.GetCount(), (size_t)8);
+    CHECK_EQ(index.GetDirectoryCount(), (size_t)3);
+
+    const char* expected[] = {
+        "Games", "Games/RPG", "Music",
+        "apple.iso", "Games/Alpha.iso", "Games/doom.cue",
+        "Games/RPG/Final Fantasy.cue", "zork.iso",
+    };
+    for (size_t i = 0; i < 8; i++) {
+        CHECK(strcmp(index.GetRelativePath(i), expected[i]) == 0);
+        CHECK_EQ(index.IsDirectory(i), i < 3);
+    }
+
+    // The name is the tail of the path
+    CHECK(strcmp(index.GetName(6), "Final Fantasy.cue") == 0);
+    CHECK_EQ(index.GetSize(6), (u32)300);
+    CHECK_EQ(index.GetSize(0), (u32)0);
+    CHECK(index.GetName(8) == nullptr);
+}
+
+TEST(folder_children_come_back_in_display_order)
+{
+    CImageIndex index;
+    BuildLibrary(index);
+
+    CHECK(ChildNames(index, CImageIndex::None) == "Games,Music,apple.iso,zork.iso");
+    CHECK(ChildNames(index, index.FindFolder("Games")) == "RPG,Alpha.iso,doom.cue");
+    CHECK(ChildNames(index, index.FindFolder("Games/RPG")) == "Final Fantasy.cue");
+
+    // An empty folder has an empty list, not a missing one
+    size_t count = 99;
+    CHECK(index.GetChildren(index.FindFolder("Music"), &count) != nullptr);
+    CHECK_EQ(count, (size_t)0);
+
+    // An image has no children
+    CHECK(ChildNames(index, index.Find("zork.iso")) == "(not a folder)");
+
+    CHECK_EQ(index.GetParent(index.Find("Games/RPG/Final Fantasy.cue")), index.FindFolder("Games/RPG"));
+    CHECK_EQ(index.GetParent(index.FindFolder("Games")), CImageIndex::None);
+}
+
+TEST(find_matches_exactly_or_ignoring_case)
+{
+    CImageIndex index;
+    BuildLibrary(index);
+
+    CHECK_EQ(index.Find("Games/doom.cue"), (u32)5);
+    CHECK_EQ(index.Find("games/DOOM.CUE"), CImageIndex::None);
+    CHECK_EQ(index.Find("games/DOOM.CUE", true), (u32)5);
+
+    CHECK_EQ(index.Find("Games/RPG/Final Fantasy.cue"), (u32)6);
+    CHECK_EQ(index.Find("Games/RPG/Final"), CImageIndex::None);
+    CHECK_EQ(index.Find("Games/RPG/Final Fantasy.cue.bak"), CImageIndex::None);
+    CHECK_EQ(index.Find("Games//doom.cue"), CImageIndex::None);
+    CHECK_EQ(index.Find(""), CImageIndex::None);
+
+    // FindFolder() only finds folders; "" is the top level
+    CHECK_EQ(index.FindFolder("Games/RPG"), (u32)1);
+    CHECK_EQ(index.FindFolder("zork.iso"), CImageIndex::None);
+    CHECK_EQ(index.FindFolder(""), CImageIndex::None);
+}
+
+TEST(holds_more_than_the_old_fixed_limit)
+{
+    // The flat list stopped at 2048 entries.
+    CImageIndex index;
+    const unsigned kFolders = 10;
+    const unsigned kPerFolder = 500;
+    for (unsigned f = 0; f < kFolders; f++) {
+        char name[32];
+        snprintf(name, sizeof(name), "Set %02u", f);
+        u32 folder = index.Add(CImageIndex::None, name, 0, true);
+        for (unsigned i = 0; i < kPerFolder; i++) {
+            snprintf(name, sizeof(name), "disc %04u.iso", i);
+            index.Add(folder, name, i, false);
+        }
+    }
+    index.Finish();
+
+    CHECK_EQ(index.GetCount(), (size_t)(kFolders + kFolders * kPerFolder));
+
+    u32 found = index.Find("Set 07/disc 0321.iso");
+    CHECK(found != CImageIndex::None);
+    CHECK_EQ(index.GetSize(found), (u32)321);
+
+    size_t count = 0;
+    const u32* children = index.GetChildren(index.FindFolder("Set 09"), &count);
+    CHECK_EQ(count, (size_t)kPerFolder);
+    CHECK(strcmp(index.GetRelativePath(children[kPerFolder - 1]), "Set 09/disc 0499.iso") == 0);
+
+    // Far below the 767 bytes per entry of the fixed array
+    CHECK(index.GetMemoryUsage() < index.GetCount() * 64);
+}
+
+TEST(swap_replaces_the_whole_index)
+{
+    CImageIndex index;
+    BuildLibrary(index);
+
+    CImageIndex fresh;
+    fresh.Add(CImageIndex::None, "only.iso", 1, false);
+    fresh.Finish();
+    index.Swap(fresh);
+
+    CHECK_EQ(index.GetCount(), (size_t)1);
+    CHECK_EQ(index.GetDirectoryCount(), (size_t)0);
+    CHECK(ChildNames(index, CImageIndex::None) == "only.iso");
+    CHECK_EQ(fresh.GetCount(), (size_t)8);
+
+    fresh.Clear();
+    CHECK_EQ(fresh.GetCount(), (size_t)0);
+    CHECK(ChildNames(fresh, CImageIndex::None) == "");
+}
+
+// The updates must leave exactly what a full rescan of the changed card
+// would have built.
+static std::string AllPaths(const CImageIndex& index)
+{
+    std::string paths;
+    for (size_t i = 0; i < index.GetCount(); i++) {
+        if (!paths.empty())
+            paths += ",";
+        paths += index.GetRelativePath(i);
+    }
+    return paths;
+}
+
+TEST(insert_adds_an_entry_and_any_missing_folders)
+{
+    CImageIndex index;
+    BuildLibrary(index);
+
+    CHECK(index.Insert("Games/RPG/Chrono.cue", 600, false));
+    CHECK(index.Insert("New/Sub/disc.iso", 700, false));
+    CHECK(AllPaths(index) ==
+          "Games,Games/RPG,Music,New,New/Sub,"
+          "apple.iso,Games/Alpha.iso,Games/doom.cue,Games/RPG/Chrono.cue,"
+          "Games/RPG/Final Fantasy.cue,New/Sub/disc.iso,zork.iso");
+    CHECK(ChildNames(index, index.FindFolder("Games/RPG")) == "Chrono.cue,Final Fantasy.cue");
+    CHECK_EQ(index.GetSize(index.Find("New/Sub/disc.iso")), (u32)700);
+
+    // Already listed: only the size changes, and nothing moves
+    u32 before = index.Find("zork.iso");
+    CHECK(index.Insert("zork.iso", 101, false));
+    CHECK_EQ(index.Find("zork.iso"), before);
+    CHECK_EQ(index.GetSize(before), (u32)101);
+    CHECK(!index.Insert("zork.iso", 101, false));
+}
+
+TEST(remove_takes_a_folder_with_its_entries)
+{
+    CImageIndex index;
+    BuildLibrary(index);
+
+    CHECK(index.Remove("apple.iso"));
+    CHECK(!index.Remove("apple.iso"));
+    CHECK(index.Remove("Games/RPG"));
+    CHECK(AllPaths(index) == "Games,Music,Games/Alpha.iso,Games/doom.cue,zork.iso");
+    CHECK(ChildNames(index, index.FindFolder("Games")) == "Alpha.iso,doom.cue");
+    CHECK(ChildNames(index, CImageIndex::None) == "Games,Music,zork.iso");
+}
+
+TEST(rename_moves_an_entry_or_a_whole_folder)
+{
+    CImageIndex index;
+    BuildLibrary(index);
+
+    CHECK(index.Rename("zork.iso", "Music/zork.iso"));
+    CHECK(index.Find("zork.iso") == CImageIndex::None);
+    CHECK(ChildNames(index, index.FindFolder("Music")) == "zork.iso");
+
+    CHECK(index.Rename("Games", "Old Games"));
+    CHECK(AllPaths(index) ==
+          "Music,Old Games,Old Games/RPG,"
+          "apple.iso,Music/zork.iso,Old Games/Alpha.iso,Old Games/doom.cue,"
+          "Old Games/RPG/Final Fantasy.cue");
+    CHECK_EQ(index.GetSize(index.Find("Old Games/RPG/Final Fantasy.cue")), (u32)300);
+
+    // Not into itself, and not from nowhere
+    CHECK(!index.Rename("Old Games", "Old Games/RPG/Old Games"));
+    CHECK(!index.Rename("missing.iso", "found.iso"));
+}
+
+TEST(rename_over_a_folder_the_entry_is_in_changes_nothing)
+{
+    CImageIndex index;
+    BuildLibrary(index);
+    const std::string before = AllPaths(index);
+
+    // Replacing the folder would remove the entry being moved with it
+    CHECK(!index.Rename("Games/Alpha.iso", "Games"));
+    CHECK(!index.Rename("Games/RPG/Final Fantasy.cue", "Games"));
+    CHECK(!index.Rename("Games/RPG", "Games"));
+    CHECK(AllPaths(index) == before);
+    CHECK_EQ(index.GetSize(index.Find("Games/RPG/Final Fantasy.cue")), (u32)300);
+
+    // A folder whose name merely starts the same is not one it is in
+    CHECK(index.Rename("Games/RPG/Final Fantasy.cue", "Gam"));
+    CHECK(index.Find("Gam") != CImageIndex::None);
+}
+
+TEST(replace_folder_swaps_in_a_rescan_of_one_folder)
+{
+    CImageIndex index;
+    BuildLibrary(index);
+
+    CImageIndex contents;
+    contents.Add(CImageIndex::None, "doom.cue", 200, false);
+    u32 sports = contents.Add(CImageIndex::None, "Sports", 0, true);
+    contents.Add(sports, "fifa.iso", 800, false);
+    contents.Finish();
+
+    index.ReplaceFolder("Games", contents);
+    CHECK_EQ(contents.GetCount(), (size_t)0);
+    CHECK(AllPaths(index) ==
+          "Games,Games/Sports,Music,"
+          "apple.iso,Games/doom.cue,Games/Sports/fifa.iso,zork.iso");
+
+    // A folder the index did not have yet is added
+    CImageIndex more;
+    more.Add(CImageIndex::None, "a.iso", 1, false);
+    more.Finish();
+    index.ReplaceFolder("Music/Live", more);
+    CHECK(ChildNames(index, index.FindFolder("Music/Live")) == "a.iso");
+}
+
+TEST(a_saved_index_loads_back_the_same)
+{
+    CImageIndex index;
+    BuildLibrary(index);
+    index.SetFolderStamp(CImageIndex::None, 0x1234);
+    index.SetFolderStamp(index.FindFolder("Games/RPG"), 0x5678);
+
+    std::vector<u8> block(index.GetSaveSize());
+    index.Save(block.data());
+
+    CImageIndex loaded;
+    CHECK(loaded.Load(block.data(), block.size()));
+    CHECK(AllPaths(loaded) == AllPaths(index));
+    CHECK_EQ(loaded.GetDirectoryCount(), (size_t)3);
+    CHECK(ChildNames(loaded, loaded.FindFolder("Games")) == "RPG,Alpha.iso,doom.cue");
+    CHECK_EQ(loaded.GetSize(loaded.Find("apple.iso")), (u32)500);
+    CHECK_EQ(loaded.GetFolderStamp(CImageIndex::None), (u32)0x1234);
+    CHECK_EQ(loaded.GetFolderStamp(loaded.FindFolder("Games/RPG")), (u32)0x5678);
+
+    // A folder's stamp is not its size
+    CHECK_EQ(loaded.GetSize(loaded.FindFolder("Games/RPG")), (u32)0);
+
+    // And the loaded index takes changes like a scanned one
+    CHECK(loaded.Insert("Music/live.iso", 9, false));
+    CHECK(ChildNames(loaded, loaded.FindFolder("Music")) == "live.iso");
+}
+
+TEST(a_damaged_or_foreign_block_is_rejected)
+{
+    CImageIndex index;
+    BuildLibrary(index);
+    std::vector<u8> block(index.GetSaveSize());
+    index.Save(block.data());
+
+    CImageIndex loaded;
+    CHECK(!loaded.Load(block.data(), block.size() - 1));  // torn write
+    CHECK_EQ(loaded.GetCount(), (size_t)0);
+
+    std::vector<u8> flipped(block);
+    flipped[block.size() / 2] ^= 0x40;
+    CHECK(!loaded.Load(flipped.data(), flipped.size()));
+
+    const char text[] = "not an index at all, just some text";
+    CHECK(!loaded.Load(text, sizeof(text)));
+    CHECK(!loaded.Load(nullptr, 0));
+
+    CHECK(loaded.Load(block.data(), block.size()));
+}
+
+TEST(stamps_survive_changes_and_rescans)
+{
+    CImageIndex index;
+    BuildLibrary(index);
+    index.SetFolderStamp(index.FindFolder("Games"), 11);
+    index.SetFolderStamp(index.FindFolder("Games/RPG"), 22);
+
+    // Moving a folder keeps what it held, so its stamp still holds
+    CHECK(index.Rename("Games/RPG", "Games/Role"));
+    CHECK_EQ(index.GetFolderStamp(index.FindFolder("Games/Role")), (u32)22);
+    CHECK_EQ(index.GetFolderStamp(index.FindFolder("Games")), (u32)11);
+
+    // A folder only created by an insert has never been read
+    CHECK(index.Insert("New/disc.iso", 1, false));
+    CHECK_EQ(index.GetFolderStamp(index.FindFolder("New")), (u32)0);
+
+    // A rescan brings the folder's new stamp with it
+    CImageIndex contents;
+    contents.Add(CImageIndex::None, "doom.cue", 200, false);
+    contents.SetFolderStamp(CImageIndex::None, 33);
+    contents.Finish();
+    index.ReplaceFolder("Games", contents);
+    CHECK_EQ(index.GetFolderStamp(index.FindFolder("Games")), (u32)33);
+}
+
+TEST(the_top_level_stamp_survives_changes_and_a_save)
+{
+    CImageIndex index;
+    BuildLibrary(index);
+    index.SetFolderStamp(CImageIndex::None, 999);
+
+    CHECK(index.Insert("Games/upload.iso", 1, false));
+    CHECK(index.Rename("zork.iso", "Music/zork.iso"));
+    CHECK(index.Remove("apple.iso"));
+    CImageIndex contents;
+    contents.Finish();
+    index.ReplaceFolder("Games/RPG", contents);
+    CHECK_EQ(index.GetFolderStamp(CImageIndex::None), (u32)999);
+
+    // What the next boot checks the card against
+    std::vector<u8> block(index.GetSaveSize());
+    index.Save(block.data());
+    CImageIndex loaded;
+    CHECK(loaded.Load(block.data(), block.size()));
+    CHECK_EQ(loaded.GetFolderStamp(CImageIndex::None), (u32)999);
+}
+
+TEST(next_folder_walks_the_folders_in_path_order)
+{
+    CImageIndex index;
+    BuildLibrary(index);
+    index.Insert("Games A/x.iso", 1, false);
+
+    std::string walked;
+    char cursor[256] = "";
+    for (u32 folder = index.GetNextFolder(cursor); folder != CImageIndex::None;
+         folder = index.GetNextFolder(cursor)) {
+        snprintf(cursor, sizeof(cursor), "%s", index.GetRelativePath(folder));
+        walked += std::string(walked.empty() ? "" : ",") + cursor;
+    }
+    CHECK(walked == "Games,Games A,Games/RPG,Music");
+
+    // From a folder that has since gone, the walk carries on after it
+    CHECK(strcmp(index.GetRelativePath(index.GetNextFolder("Games B")), "Games/RPG") == 0);
+}
+
+static std::string SearchNames(const CImageIndex& index, const char* query, bool imagesOnly = false,
+                               size_t max = 16, size_t* total = nullptr)
+{
+    u32 results[16];
+    size_t found = index.Search(query, imagesOnly, results, max);
+    if (total != nullptr)
+        *total = found;
+    std::string names;
+    for (size_t i = 0; i < found && i < max; i++) {
+        if (!names.empty())
+            names += ",";
+        names += index.GetName(results[i]);
+    }
+    return names;
+}
+
+TEST(search_ranks_name_starts_before_word_starts_before_the_rest)
+{
+    CImageIndex index;
+    index.Add(CImageIndex::None, "Metal Gear.iso", 1, false);
+    index.Add(CImageIndex::None, "Gear Up.iso", 1, false);
+    index.Add(CImageIndex::None, "Biogears.iso", 1, false);
+    index.Add(CImageIndex::None, "Top-Gear.iso", 1, false);
+    index.Finish();
+
+    CHECK(SearchNames(index, "gear") == "Gear Up.iso,Metal Gear.iso,Top-Gear.iso,Biogears.iso");
+
+    // Only the best go back, but the total counts them all
+    size_t total = 0;
+    CHECK(SearchNames(index, "GEAR", false, 2, &total) == "Gear Up.iso,Metal Gear.iso");
+    CHECK_EQ(total, (size_t)4);
+
+    CHECK(SearchNames(index, "gearz").empty());
+    CHECK(SearchNames(index, "").empty());
+    CHECK(SearchNames(index, "   ").empty());
+}
+
+TEST(search_needs_every_word_and_handles_short_ones)
+{
+    CImageIndex index;
+    BuildLibrary(index);
+
+    CHECK(SearchNames(index, "fantasy final") == "Final Fantasy.cue");
+    CHECK(SearchNames(index, "final doom").empty());
+
+    // Too short for a trigram: every name is looked at
+    CHECK(SearchNames(index, "oo") == "doom.cue");
+    CHECK(SearchNames(index, "z") == "zork.iso");
+    CHECK(SearchNames(index, "rp") == "RPG");
+    CHECK(SearchNames(index, "rp", true).empty());
+    CHECK(SearchNames(index, "iso", true) == "apple.iso,Alpha.iso,zork.iso");
+}
+
+TEST(search_follows_changes_to_the_index)
+{
+    CImageIndex index;
+    BuildLibrary(index);
+
+    CHECK(SearchNames(index, "doom") == "doom.cue");
+    index.Insert("Games/Doom II.iso", 1, false);
+    CHECK(SearchNames(index, "doom") == "Doom II.iso,doom.cue");
+    index.Rename("Games/doom.cue", "Games/Quake.cue");
+    CHECK(SearchNames(index, "doom") == "Doom II.iso");
+    CHECK(SearchNames(index, "quak") == "Quake.cue");
+
+    // And after a round trip through a saved block
+    std::vector<u8> block(index.GetSaveSize());
+    index.Save(block.data());
+    CImageIndex loaded;
+    CHECK(loaded.Load(block.data(), block.size()));
+    size_t unsearched = loaded.GetMemoryUsage();
+    CHECK(SearchNames(loaded, "quak") == "Quake.cue");
+
+    // Built by a search, and let go of by the next change
+    CHECK(loaded.GetMemoryUsage() > unsearched);
+    CHECK(loaded.Load(block.data(), block.size()));
+    CHECK_EQ(loaded.GetMemoryUsage(), unsearched);
+}
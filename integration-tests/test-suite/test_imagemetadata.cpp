@@ -0,0 +1,247 @@
+//
+// test_imagemetadata.cpp
+//
+// What the metadata task reads out of an image (discimage/imageinfo.cpp),
+// from real images on disk and from synthetic ones carrying the boot
+// sectors of the platforms it recognises, and the store SCSITBService keeps
+// it in by relative path.
+//
+#include "fakedisc.h"
+#include "framework.h"
+
+#include <discimage/imageinfo.h>
+#include <discimage/util.h>
+#include <scsitbservice/imageindex.h>
+#include <scsitbservice/imagemetadata.h>
+
+#include <string.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+
+static std::string TestDataDir()
+{
+#ifdef USBODE_TESTDATA
+    return USBODE_TESTDATA;
+#else
+    return "out/images";
+#endif
+}
+
+static u64 FileSize(const std::string& path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return 0;
+    return (u64)st.st_size;
+}
+
+static bool ReadInfo(const std::string& path, ImageInfo* info)
+{
+    IImageDevice* device = loadImageDevice(path.c_str());
+    CHECK(device != nullptr);
+    if (device == nullptr)
+        return false;
+    bool ok = readImageInfo(device, info);
+    delete device;
+    return ok;
+}
+
+// One data track of `sectors` sectors; `build` fills in user data by LBA.
+static CFakeImageDevice* MakeDataDisc(const char* mode, u32 sectorSize, u32 userOffset, u32 sectors,
+                                      void (*build)(u32 lba, u8* user))
+{
+    std::vector<u8> image((size_t)sectors * sectorSize, 0);
+    for (u32 lba = 0; lba < sectors; lba++)
+        build(lba, image.data() + (size_t)lba * sectorSize + userOffset);
+    std::string cue = std::string("FILE \"image.bin\" BINARY\n  TRACK 01 ") + mode +
+                      "\n    INDEX 01 00:00:00\n";
+    return new CFakeImageDevice(cue, image, sectorSize);
+}
+
+static void WriteDescriptor(u8* user, const char* system, const char* volume)
+{
+    user[0] = 1;
+    memcpy(user + 1, "CD001", 5);
+    memset(user + 8, ' ', 64);
+    memcpy(user + 8, system, strlen(system));
+    memcpy(user + 40, volume, strlen(volume));
+}
+
+TEST(imageinfo_reads_a_real_iso9660_disc)
+{
+    const std::string iso = TestDataDir() + "/freedos-test.iso";
+    CHECK(FileSize(iso) > 0);
+
+    ImageInfo info;
+    CHECK(ReadInfo(iso, &info));
+    CHECK(info.platform == ImagePlatform::PC);
+    CHECK(strcmp(info.volumeLabel, "FREEDOS_TEST") == 0);
+    CHECK_EQ(info.numTracks, 1);
+    CHECK_EQ(info.numAudioTracks, 0);
+    CHECK_EQ(info.discFrames, (u32)(FileSize(iso) / 2048));
+    CHECK_EQ(info.audioFrames, (u32)0);
+}
+
+TEST(imageinfo_times_the_tracks_of_audio_and_mixed_discs)
+{
+    const std::string dir = TestDataDir();
+
+    ImageInfo audio;
+    CHECK(ReadInfo(dir + "/audiocd.cue", &audio));
+    CHECK(audio.platform == ImagePlatform::AUDIO);
+    CHECK_EQ(audio.numTracks, 3);
+    CHECK_EQ(audio.numAudioTracks, 3);
+    CHECK_EQ(audio.discFrames, (u32)(FileSize(dir + "/audiocd.bin") / 2352));
+    CHECK_EQ(audio.audioFrames, audio.discFrames);
+    CHECK(audio.volumeLabel[0] == '\0');
+
+    // A MODE1/2048 data track of 100 sectors, then two audio tracks. The
+    // data is a test pattern rather than a file system.
+    ImageInfo mixed;
+    CHECK(ReadInfo(dir + "/mixed.cue", &mixed));
+    CHECK(mixed.platform == ImagePlatform::UNKNOWN);
+    CHECK_EQ(mixed.numTracks, 3);
+    CHECK_EQ(mixed.numAudioTracks, 2);
+    CHECK_EQ(mixed.discFrames, (u32)(100 + (FileSize(dir + "/mixed.bin") - 100 * 2048) / 2352));
+    CHECK_EQ(mixed.audioFrames, mixed.discFrames - 100);
+}
+
+TEST(imageinfo_recognises_console_boot_sectors)
+{
+    // Mode 2, user data 24 bytes into each raw sector
+    CFakeImageDevice* playstation = MakeDataDisc("MODE2/2352", 2352, 24, 20, [](u32 lba, u8* user) {
+        if (lba == 16)
+            WriteDescriptor(user, "PLAYSTATION", "SLUS_00001");
+    });
+    ImageInfo info;
+    CHECK(readImageInfo(playstation, &info));
+    CHECK(info.platform == ImagePlatform::PLAYSTATION);
+    CHECK(strcmp(info.volumeLabel, "SLUS_00001") == 0);
+    delete playstation;
+
+    CFakeImageDevice* saturn = MakeDataDisc("MODE1/2352", 2352, 16, 20, [](u32 lba, u8* user) {
+        if (lba == 0)
+            memcpy(user, "SEGA SEGASATURN SEGA ENTERPRISES", 32);
+        if (lba == 16)
+            WriteDescriptor(user, "SEGA SEGASATURN", "NIGHTS");
+    });
+    CHECK(readImageInfo(saturn, &info));
+    CHECK(info.platform == ImagePlatform::SATURN);
+    CHECK(strcmp(info.volumeLabel, "NIGHTS") == 0);
+    delete saturn;
+
+    CFakeImageDevice* threedo = MakeDataDisc("MODE1/2048", 2048, 0, 20, [](u32 lba, u8* user) {
+        static const u8 opera[7] = {0x01, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x01};
+        if (lba == 0)
+            memcpy(user, opera, sizeof(opera));
+    });
+    CHECK(readImageInfo(threedo, &info));
+    CHECK(info.platform == ImagePlatform::THREEDO);
+    delete threedo;
+}
+
+TEST(imageinfo_tells_mac_hybrid_and_pc_discs_apart)
+{
+    // An HFS master directory block 1024 bytes into the disc
+    CFakeImageDevice* mac = MakeDataDisc("MODE1/2048", 2048, 0, 20, [](u32 lba, u8* user) {
+        if (lba == 0) {
+            user[1024] = 'B';
+            user[1025] = 'D';
+            user[1024 + 36] = 7;
+            memcpy(user + 1024 + 37, "MacDisc", 7);
+        }
+    });
+    ImageInfo info;
+    CHECK(readImageInfo(mac, &info));
+    CHECK(info.platform == ImagePlatform::MAC);
+    CHECK(strcmp(info.volumeLabel, "MacDisc") == 0);
+    delete mac;
+
+    // Apple partition map and an ISO 9660 descriptor: the ISO label wins
+    CFakeImageDevice* hybrid = MakeDataDisc("MODE1/2048", 2048, 0, 20, [](u32 lba, u8* user) {
+        if (lba == 0)
+            memcpy(user, "ER", 2);
+        if (lba == 16)
+            WriteDescriptor(user, "", "HYBRID_CD");
+    });
+    CHECK(readImageInfo(hybrid, &info));
+    CHECK(info.platform == ImagePlatform::HYBRID);
+    CHECK(strcmp(info.volumeLabel, "HYBRID_CD") == 0);
+    CHECK(strcmp(getImagePlatformName(info.platform), "PC/Mac") == 0);
+    delete hybrid;
+}
+
+static CImageMetadata::TRecord MakeRecord(u64 size, const char* label)
+{
+    CImageMetadata::TRecord record;
+    memset(&record, 0, sizeof(record));
+    record.nFileSize = size;
+    record.nFileTime = 0x5A210000 | (u32)size;
+    record.bValid = true;
+    record.Info.platform = ImagePlatform::PC;
+    record.Info.numTracks = 1;
+    record.Info.discFrames = (u32)size / 2048;
+    strncpy(record.Info.volumeLabel, label, sizeof(record.Info.volumeLabel) - 1);
+    return record;
+}
+
+TEST(metadata_store_saves_and_loads_back_unchecked)
+{
+    CImageMetadata store;
+    store.Set("a.iso", MakeRecord(6000000000ull, "BIG_DVD"));
+    store.Set("Games/b.iso", MakeRecord(4096, "SMALL"));
+    CHECK(store.IsChecked("a.iso"));
+
+    std::vector<u8> block;
+    store.Save(block);
+
+    CImageMetadata loaded;
+    CHECK(loaded.Load(block.data(), block.size()));
+    CHECK_EQ(loaded.GetCount(), (size_t)2);
+    const CImageMetadata::TRecord* record = loaded.Find("a.iso");
+    CHECK(record != nullptr);
+    if (record != nullptr) {
+        CHECK_EQ(record->nFileSize, 6000000000ull);
+        CHECK(strcmp(record->Info.volumeLabel, "BIG_DVD") == 0);
+        CHECK(record->Info.platform == ImagePlatform::PC);
+    }
+
+    // Loaded records still have to be checked against the card
+    CHECK(!loaded.IsChecked("a.iso"));
+    loaded.MarkChecked("a.iso");
+    CHECK(loaded.IsChecked("a.iso"));
+
+    // A damaged block leaves the store empty
+    block[block.size() - 3] ^= 0x55;
+    CHECK(!loaded.Load(block.data(), block.size()));
+    CHECK_EQ(loaded.GetCount(), (size_t)0);
+}
+
+TEST(metadata_store_follows_renames_and_prunes_unlisted_images)
+{
+    CImageMetadata store;
+    store.Set("Games/x.iso", MakeRecord(1, "X"));
+    store.Set("Games/RPG/y.cue", MakeRecord(2, "Y"));
+    store.Set("Games A/z.iso", MakeRecord(3, "Z"));
+    store.Set("Games.iso", MakeRecord(4, "G"));
+
+    store.Rename("Games", "Old Games");
+    CHECK(store.Find("Old Games/x.iso") != nullptr);
+    CHECK(store.Find("Old Games/RPG/y.cue") != nullptr);
+    CHECK(store.Find("Games/x.iso") == nullptr);
+    CHECK(store.Find("Games A/z.iso") != nullptr);
+    CHECK(store.Find("Games.iso") != nullptr);
+
+    CImageIndex index;
+    index.Add(CImageIndex::None, "Games.iso", 4, false);
+    u32 games = index.Add(CImageIndex::None, "Old Games", 0, true);
+    index.Add(games, "x.iso", 1, false);
+    index.Finish();
+
+    store.Prune(index);
+    CHECK_EQ(store.GetCount(), (size_t)2);
+    CHECK(store.Find("Old Games/x.iso") != nullptr);
+    CHECK(store.Find("Games.iso") != nullptr);
+}
@@ -0,0 +1,167 @@
+//
+// test_ioscheduler.cpp
+//
+// The SD card I/O scheduler: background writes are sliced while the host is
+// reading and go through whole otherwise, without losing or reordering a
+// byte either way. The scheduler is a process-wide singleton, so every check
+// is against a before/after snapshot of its counters.
+//
+#include "framework.h"
+#include "fatfs_host.h"
+#include "scratchfile.h"
+
+#include <circle/timer.h>
+#include <fatfs/ff.h>
+#include <ioscheduler/ioscheduler.h>
+
+#include <vector>
+
+// Past the real-time holdoff (20 ms; one virtual tick is 10 ms).
+static void LetRealTimeExpire()
+{
+    CTimer::Get()->TestAdvanceTicks(3);
+}
+
+TEST(ioscheduler_background_write_is_sliced_while_host_reads)
+{
+    CIOScheduler *pScheduler = CIOScheduler::Get();
+    LetRealTimeExpire();
+
+    const CScratchFile file("ioscheduler-sliced.bin");
+    const std::vector<u8> data = ScratchPattern(100000);
+
+    TIOClassStats before;
+    pScheduler->GetStats(IOClassUpload, &before);
+
+    // A host read in flight
+    pScheduler->BeginRealTime(IOClassHostData);
+    CHECK(pScheduler->IsRealTimeActive());
+
+    FIL File;
+    CHECK_EQ(f_open(&File, file.c_str(), FA_CREATE_ALWAYS | FA_WRITE), FR_OK);
+    UINT nWritten = 0;
+    CHECK_EQ(pScheduler->Write(IOClassUpload, &File, data.data(), (UINT)data.size(), &nWritten), FR_OK);
+    CHECK_EQ(nWritten, (UINT)data.size());
+    f_close(&File);
+
+    pScheduler->EndRealTime(IOClassHostData, 2048);
+
+    TIOClassStats after;
+    pScheduler->GetStats(IOClassUpload, &after);
+    CHECK_EQ(after.nBytes - before.nBytes, (u64)data.size());
+    CHECK_EQ(after.nRequests - before.nRequests, 1u);
+    CHECK_EQ(after.nThrottled - before.nThrottled, 1u);
+
+    CHECK(file.Matches(data));
+}
+
+TEST(ioscheduler_background_write_goes_through_whole_when_idle)
+{
+    CIOScheduler *pScheduler = CIOScheduler::Get();
+    LetRealTimeExpire();
+    CHECK(!pScheduler->IsRealTimeActive());
+
+    const CScratchFile file("ioscheduler-idle.bin");
+    const std::vector<u8> data = ScratchPattern(100000);
+
+    TIOClassStats before;
+    pScheduler->GetStats(IOClassLog, &before);
+
+    FIL File;
+    CHECK_EQ(f_open(&File, file.c_str(), FA_CREATE_ALWAYS | FA_WRITE), FR_OK);
+    UINT nWritten = 0;
+    CHECK_EQ(pScheduler->Write(IOClassLog, &File, data.data(), (UINT)data.size(), &nWritten), FR_OK);
+    CHECK_EQ(nWritten, (UINT)data.size());
+    f_close(&File);
+
+    TIOClassStats after;
+    pScheduler->GetStats(IOClassLog, &after);
+    CHECK_EQ(after.nThrottled, before.nThrottled);
+    CHECK_EQ(after.nBytes - before.nBytes, (u64)data.size());
+
+    CHECK(file.Matches(data));
+}
+
+// Real-time work counts as active for a short while after it completes, so
+// the gap between two host READs does not let a big write in.
+TEST(ioscheduler_realtime_holdoff_outlives_the_read)
+{
+    CIOScheduler *pScheduler = CIOScheduler::Get();
+    LetRealTimeExpire();
+
+    TIOClassStats before;
+    pScheduler->GetStats(IOClassAudio, &before);
+
+    pScheduler->BeginRealTime(IOClassAudio);
+    pScheduler->EndRealTime(IOClassAudio, 37632);
+    CHECK(pScheduler->IsRealTimeActive());
+
+    LetRealTimeExpire();
+    CHECK(!pScheduler->IsRealTimeActive());
+
+    TIOClassStats after;
+    pScheduler->GetStats(IOClassAudio, &after);
+    CHECK_EQ(after.nBytes - before.nBytes, (u64)37632);
+    CHECK_EQ(after.nRequests - before.nRequests, 1u);
+}
+
+// A short write (full card) stops the slicing loop instead of spinning on it.
+TEST(ioscheduler_sliced_write_stops_at_a_full_card)
+{
+    CIOScheduler *pScheduler = CIOScheduler::Get();
+    LetRealTimeExpire();
+
+    const CScratchFile file("ioscheduler-full.bin");
+    const std::vector<u8> data = ScratchPattern(50000);
+
+    FIL File;
+    CHECK_EQ(f_open(&File, file.c_str(), FA_CREATE_ALWAYS | FA_WRITE), FR_OK);
+
+    FatFsHostSetWriteLimit(10000);
+    pScheduler->BeginRealTime(IOClassHostData);
+    UINT nWritten = 0;
+    CHECK_EQ(pScheduler->Write(IOClassUpload, &File, data.data(), (UINT)data.size(), &nWritten), FR_OK);
+    pScheduler->EndRealTime(IOClassHostData, 0);
+    FatFsHostClearFaults();
+
+    CHECK_EQ(nWritten, 10000u);
+    f_close(&File);
+}
+
+// Each request lands in the power-of-two bucket of its duration, and the
+// percentiles read back the bucket bounds.
+TEST(ioscheduler_realtime_latency_is_bucketed)
+{
+    CIOScheduler *pScheduler = CIOScheduler::Get();
+    LetRealTimeExpire();
+
+    TIOClassStats before;
+    pScheduler->GetStats(IOClassHostData, &before);
+
+    // Nine reads inside one tick, one that spans three (30 ms)
+    for (unsigned i = 0; i < 9; i++)
+    {
+        pScheduler->BeginRealTime(IOClassHostData);
+        pScheduler->EndRealTime(IOClassHostData, 2048);
+    }
+    pScheduler->BeginRealTime(IOClassHostData);
+    CTimer::Get()->TestAdvanceTicks(3);
+    pScheduler->EndRealTime(IOClassHostData, 2048);
+
+    TIOClassStats after;
+    pScheduler->GetStats(IOClassHostData, &after);
+    TIOClassStats delta = after;
+    for (unsigned i = 0; i < IO_LATENCY_BUCKETS; i++)
+        delta.nLatency[i] -= before.nLatency[i];
+    delta.nMaxLatencyUs = 30000;
+
+    CHECK_EQ(delta.nLatency[0], 9u);
+    CHECK_EQ(delta.nLatency[15], 1u);  // 16384 <= 30000 < 32768
+    CHECK(after.nMaxLatencyUs >= 30000u);
+    CHECK_EQ(CIOScheduler::GetLatencyPercentile(delta, 50), 1u);
+    CHECK_EQ(CIOScheduler::GetLatencyPercentile(delta, 90), 1u);
+    CHECK_EQ(CIOScheduler::GetLatencyPercentile(delta, 99), 30000u);
+
+    TIOClassStats none = {};
+    CHECK_EQ(CIOScheduler::GetLatencyPercentile(none, 50), 0u);
+}
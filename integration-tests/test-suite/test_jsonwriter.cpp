@@ -0,0 +1,85 @@
+//
+// test_jsonwriter.cpp
+//
+// The writer the image listing API streams its reply with: commas and
+// escaping, and what happens when the response buffer runs out.
+//
+#include "framework.h"
+
+#include <webserver/jsonwriter.h>
+
+#include <string>
+
+static std::string Text(const u8* buffer, const JsonWriter& w)
+{
+    return std::string((const char*)buffer, w.GetLength());
+}
+
+TEST(jsonwriter_writes_nested_values_with_commas)
+{
+    u8 buffer[256];
+    JsonWriter w(buffer, sizeof(buffer));
+    w.BeginObject();
+    w.Key("path");
+    w.String("Games");
+    w.Key("total");
+    w.Number(4294967296ull);
+    w.Key("entries");
+    w.BeginArray();
+    w.BeginObject();
+    w.Key("dir");
+    w.Bool(true);
+    w.EndObject();
+    w.Null();
+    w.BeginArray();
+    w.EndArray();
+    w.EndArray();
+    w.Key("ok");
+    w.Bool(false);
+    w.EndObject();
+
+    CHECK(!w.Overflowed());
+    CHECK(Text(buffer, w) ==
+          "{\"path\":\"Games\",\"total\":4294967296,\"entries\":[{\"dir\":true},null,[]],\"ok\":false}");
+}
+
+TEST(jsonwriter_escapes_quotes_backslashes_and_control_characters)
+{
+    u8 buffer[128];
+    JsonWriter w(buffer, sizeof(buffer));
+    w.String("a\"b\\c\td\x01" "\xc3\xa9");
+
+    CHECK(Text(buffer, w) == "\"a\\\"b\\\\c\\u0009d\\u0001\xc3\xa9\"");
+}
+
+TEST(jsonwriter_rewinds_to_the_last_value_that_fit)
+{
+    u8 buffer[24];
+    JsonWriter w(buffer, sizeof(buffer));
+    w.BeginArray();
+    w.String("first");
+
+    JsonWriter::Mark mark = w.GetMark();
+    w.String("a string too long for the buffer");
+    CHECK(w.Overflowed());
+
+    w.Rewind(mark);
+    CHECK(!w.Overflowed());
+    w.String("two");
+    w.EndArray();
+
+    CHECK(!w.Overflowed());
+    CHECK(Text(buffer, w) == "[\"first\",\"two\"]");
+}
+
+TEST(jsonwriter_writes_nothing_more_after_an_overflow)
+{
+    u8 buffer[8];
+    JsonWriter w(buffer, sizeof(buffer));
+    w.String("123456789");
+    CHECK(w.Overflowed());
+    unsigned length = w.GetLength();
+    w.Null();
+    CHECK_EQ(w.GetLength(), length);
+    CHECK(w.Overflowed());
+}
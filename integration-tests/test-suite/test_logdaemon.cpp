@@ -3,15 +3,18 @@
 //
 // The file log daemon on the host FatFs seam, mostly about what it does when the
 // file it was told to open is not there. Run() never returns, so the tests drive
-// DrainOnce(), one pass of its loop.
+// DrainOnce(), one pass of its loop. Entries are buffered and written on a
+// timer, so tests that need them on the card advance virtual time first.
 //
 #include "framework.h"
 #include "fatfs_host.h"
 
 #include <circle/logger.h>
 #include <circle/sched/scheduler.h>
+#include <circle/timer.h>
 #include <fatfs/ff.h>
 #include <filelogdaemon/filelogdaemon.h>
+#include <ioscheduler/ioscheduler.h>
 
 #include <stdio.h>
 #include <string.h>
@@ -63,6 +66,19 @@ static void RemoveFile(const std::string &path)
     remove(path.c_str());
 }
 
+// Past both the flush (1 s) and the sync (5 s) interval; a tick is 10 ms.
+static void LetTimersExpire()
+{
+    CTimer::Get()->TestAdvanceTicks(501);
+}
+
+static u32 LogWriteRequests()
+{
+    TIOClassStats stats;
+    CIOScheduler::Get()->GetStats(IOClassLog, &stats);
+    return stats.nRequests;
+}
+
 // The rest of the suite logs freely into this same queue, so start each test clean.
 static void ResetLogging()
 {
@@ -280,6 +296,8 @@ TEST(logdaemon_treats_a_short_write_as_a_failure)
 
         QueueEvents(3);
         daemon.DrainOnce();
+        LetTimersExpire();
+        daemon.DrainOnce();
 
         FatFsHostClearFaults();
 
@@ -291,7 +309,7 @@ TEST(logdaemon_treats_a_short_write_as_a_failure)
     RemoveFile(path);
 }
 
-// A full card fails every write, so 20 ms per event is the same starvation an
+// A full card fails every write, so 20 ms per attempt is the same starvation an
 // unopenable path used to cause. It gives up on the file instead, and says so.
 TEST(logdaemon_stops_writing_when_the_card_stays_full)
 {
@@ -307,8 +325,12 @@ TEST(logdaemon_stops_writing_when_the_card_stays_full)
         ResetLogging();
         FatFsHostSetWriteLimit(4);
 
-        QueueEvents(60);
-        daemon.DrainOnce();
+        // One write attempt per flush, and every one of them fails.
+        for (unsigned i = 0; i < 12; i++) {
+            QueueEvents(5);
+            LetTimersExpire();
+            daemon.DrainOnce();
+        }
 
         FatFsHostClearFaults();
 
@@ -345,6 +367,8 @@ TEST(logdaemon_treats_a_failed_sync_as_a_failure)
 
         QueueEvents(2);
         daemon.DrainOnce();
+        LetTimersExpire();
+        daemon.DrainOnce();
 
         FatFsHostClearFaults();
 
@@ -354,3 +378,150 @@ TEST(logdaemon_treats_a_failed_sync_as_a_failure)
 
     RemoveFile(path);
 }
+
+// Debug logging on the read path used to cost a write and a sync per line.
+// A burst now sits in memory until its timer, then goes out as one write.
+TEST(logdaemon_batches_a_burst_into_one_write)
+{
+    ResetLogging();
+
+    const std::string path = TestDataDir() + "/logdaemon-batch.txt";
+    RemoveFile(path);
+
+    {
+        CFileLogDaemon daemon(path.c_str(), 5);
+        CHECK(daemon.IsFileLogging());
+        ResetLogging();
+        LetTimersExpire();
+
+        const u32 before = LogWriteRequests();
+        QueueEvents(50, LogDebug);
+        daemon.DrainOnce();
+        CHECK_EQ(LogWriteRequests(), before);
+
+        LetTimersExpire();
+        daemon.DrainOnce();
+        CHECK_EQ(LogWriteRequests(), before + 1);
+        CHECK_EQ(CScheduler::TestSleepCount(), 0u);
+    }
+
+    const std::string contents = ReadWholeFile(path);
+    CHECK(contents.find("event 0\n") != std::string::npos);
+    CHECK(contents.find("event 49\n") != std::string::npos);
+
+    RemoveFile(path);
+}
+
+// Past the size threshold the buffer is written before its timer, but only up
+// to a sector boundary of the file; the tail waits for more to join it.
+TEST(logdaemon_size_triggered_writes_end_on_a_sector_boundary)
+{
+    ResetLogging();
+
+    const std::string path = TestDataDir() + "/logdaemon-sectors.txt";
+    RemoveFile(path);
+
+    {
+        CFileLogDaemon daemon(path.c_str(), 5);
+        CHECK(daemon.IsFileLogging());
+        ResetLogging();
+        LetTimersExpire();
+
+        // Comfortably past 4 KB, and all of it new, so no timer is due.
+        const u32 before = LogWriteRequests();
+        QueueEvents(300, LogDebug);
+        daemon.DrainOnce();
+        CHECK_EQ(LogWriteRequests(), before + 1);
+
+        const std::string written = ReadWholeFile(path);
+        CHECK(written.size() >= 4096);
+        CHECK_EQ(written.size() % 512, (size_t)0);
+        CHECK(written.find("event 299\n") == std::string::npos);
+
+        // The tail goes out on request (the log viewer asks first).
+        CHECK(daemon.Flush());
+        CHECK(ReadWholeFile(path).find("event 299\n") != std::string::npos);
+    }
+
+    RemoveFile(path);
+}
+
+// A panic is the last thing this boot will log; it is written and synced at
+// once, not a second later that never comes.
+TEST(logdaemon_panic_is_written_immediately)
+{
+    ResetLogging();
+
+    const std::string path = TestDataDir() + "/logdaemon-panic.txt";
+    RemoveFile(path);
+
+    {
+        CFileLogDaemon daemon(path.c_str(), 5);
+        CHECK(daemon.IsFileLogging());
+        ResetLogging();
+
+        CLogger::TestQueueEvent(LogDebug, "src", "just before");
+        CLogger::TestQueueEvent(LogPanic, "src", "the end");
+        daemon.DrainOnce();
+
+        // Read while the daemon is still alive: the destructor would flush too.
+        const std::string contents = ReadWholeFile(path);
+        CHECK(contents.find("just before") != std::string::npos);
+        CHECK(contents.find("the end") != std::string::npos);
+    }
+
+    RemoveFile(path);
+}
+
+// The log page asks for a flush from another task. One that arrives while the
+// daemon's own write is yielded in the I/O scheduler must not write the same
+// bytes again under it.
+static CFileLogDaemon *s_pYieldedDaemon;
+static boolean s_bFlushedWhileYielded;
+
+static void FlushWhileYielded(void)
+{
+    s_bFlushedWhileYielded = s_pYieldedDaemon->Flush();
+}
+
+TEST(logdaemon_flush_while_a_write_is_yielded_leaves_it_to_the_daemon)
+{
+    ResetLogging();
+
+    const std::string path = TestDataDir() + "/logdaemon-yielded.txt";
+    RemoveFile(path);
+
+    {
+        CFileLogDaemon daemon(path.c_str(), 5);
+        CHECK(daemon.IsFileLogging());
+        ResetLogging();
+        LetTimersExpire();
+
+        // A host read in flight: the log write yields before its first slice
+        CIOScheduler::Get()->BeginRealTime(IOClassHostData);
+        QueueEvents(200, LogDebug);  // past 4 KB, within the queue
+        s_pYieldedDaemon = &daemon;
+        s_bFlushedWhileYielded = TRUE;
+        CScheduler::TestOnNextYield(FlushWhileYielded);
+        daemon.DrainOnce();
+        CIOScheduler::Get()->EndRealTime(IOClassHostData, 0);
+        CHECK(!s_bFlushedWhileYielded);
+
+        // Every line once, in order, and the rest still there to write
+        CHECK(daemon.Flush());
+        const std::string contents = ReadWholeFile(path);
+        size_t at = 0;
+        bool inOrder = true;
+        for (unsigned i = 0; i < 200 && inOrder; i++) {
+            char line[32];
+            snprintf(line, sizeof(line), "event %u\n", i);
+            size_t found = contents.find(line, at);
+            inOrder = found != std::string::npos;
+            at = inOrder ? found + strlen(line) : at;
+        }
+        CHECK(inOrder);
+        CHECK_EQ(contents.find("event 0\n", at), std::string::npos);
+    }
+
+    RemoveFile(path);
+}
@@ -176,3 +176,33 @@ TEST(gesn_async_notification_unsupported)
     CHECK_EQ(s.data[12], 0x24); // INVALID FIELD IN CDB
     CHECK_EQ(s.data[13], 0x00);
 }
+
+// CDROMService sleeps between transfers, so the start of a disc swap has to
+// wake it: the settle timer only advances while Update() is being called.
+static unsigned s_nUpdateNotifications = 0;
+
+static void CountUpdateNotification(void *pParam)
+{
+    (void)pParam;
+    s_nUpdateNotifications++;
+}
+
+TEST(disc_swap_wakes_update_task)
+{
+    CFakeImageDevice *discA = MakeDataISO(500);
+    CGadgetTestBench bench(discA);
+    bench.gadget->RegisterUpdateNotificationHandler(CountUpdateNotification, nullptr);
+    bench.Activate();
+    bench.RequestSense();
+
+    s_nUpdateNotifications = 0;
+    bench.gadget->SetDevice(MakeDataISO(1500));
+    CHECK_EQ(s_nUpdateNotifications, 1u);
+    CHECK(bench.gadget->HasDataPathWork());
+
+    // NO_MEDIUM -> UNIT ATTENTION, then one more window to finish
+    SettleDiscSwap(bench);
+    CHECK(bench.gadget->HasDataPathWork());
+    SettleDiscSwap(bench);
+    CHECK(!bench.gadget->HasDataPathWork());
+}
@@ -0,0 +1,269 @@
+//
+// test_mountmanifest.cpp
+//
+// The mount manifest (discimage/mountmanifest.cpp): the saved block itself,
+// and the production loader mounting a split rip from it the second time,
+// with the same bytes at the same offsets, and not once a data file changed.
+// The images are copied to a scratch directory first so a test can change
+// them without disturbing the shared test data.
+//
+#include "framework.h"
+
+#include <discimage/cuebinfile.h>
+#include <discimage/mountmanifest.h>
+#include <discimage/util.h>
+
+#include "fatfs_host.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+
+static std::string TestDataDir()
+{
+#ifdef USBODE_TESTDATA
+    return USBODE_TESTDATA;
+#else
+    return "out/images";
+#endif
+}
+
+static bool CopyFile(const std::string& from, const std::string& to)
+{
+    FILE* in = fopen(from.c_str(), "rb");
+    FILE* out = in ? fopen(to.c_str(), "wb") : nullptr;
+    bool ok = in && out;
+    char buf[65536];
+    size_t n;
+    while (ok && (n = fread(buf, 1, sizeof(buf), in)) > 0)
+        ok = fwrite(buf, 1, n, out) == n;
+    if (in)
+        fclose(in);
+    if (out)
+        fclose(out);
+    return ok;
+}
+
+// A scratch copy of the named files, with a manifest directory that the
+// loader is pointed at until the fixture goes away. A previous run's
+// manifest of the cue is replaced by one that matches nothing.
+class CManifestFixture
+{
+public:
+    CManifestFixture(const char* name, const std::vector<std::string>& files, const char* cue)
+        : m_Dir(TestDataDir() + "/" + name), m_ManifestDir(m_Dir + "/manifests")
+    {
+        mkdir(m_Dir.c_str(), 0755);
+        m_bCopied = true;
+        for (const std::string& file : files)
+            m_bCopied &= CopyFile(TestDataDir() + "/" + file, m_Dir + "/" + file);
+
+        CMountManifest::SetDirectory(m_ManifestDir.c_str());
+        CMountManifest stale;
+        stale.ImagePath = Path(cue);
+        stale.Write();
+    }
+
+    ~CManifestFixture() { CMountManifest::SetDirectory(nullptr); }
+
+    std::string Path(const char* file) const { return m_Dir + "/" + file; }
+    bool Copied() const { return m_bCopied; }
+
+    size_t ManifestFiles(const char* cue) const
+    {
+        CMountManifest manifest;
+        return manifest.Read(Path(cue).c_str()) ? manifest.Files.size() : 0;
+    }
+
+private:
+    std::string m_Dir;
+    std::string m_ManifestDir;
+    bool m_bCopied;
+};
+
+static std::vector<u8> ReadAll(IImageDevice* device)
+{
+    std::vector<u8> data((size_t)device->GetSize());
+    device->Seek(0);
+    int n = device->Read(data.data(), data.size());
+    data.resize(n > 0 ? (size_t)n : 0);
+    return data;
+}
+
+TEST(mount_manifest_round_trips_through_one_block)
+{
+    CMountManifest saved;
+    saved.ImagePath = "1:/Games/disc.cue";
+    saved.nCueSize = 321;
+    saved.nCueTime = 0x5A211234;
+    saved.CueSheet = "FILE \"a.bin\" BINARY\n  TRACK 01 AUDIO\n    INDEX 01 00:00:00\n";
+    saved.Files.resize(2);
+    saved.Files[0] = {"1:/Games/a.bin", 0x123456789ull, 0x5A210001, 1234, 0, {5, 100, 7, 0, 0}};
+    saved.Files[1] = {"1:/Games/b.bin", 2352, 0x5A210002, 99, 0x123456789ull + 4704, {}};
+    saved.Holes.resize(1);
+    saved.Holes[0] = {1000, 1002, 0x123456789ull, 4704, 2352};
+    saved.nVirtualSize = 0x123456789ull + 4704 + 2352;
+
+    std::vector<u8> block;
+    saved.Save(block);
+
+    CMountManifest loaded;
+    CHECK(loaded.Load(block.data(), block.size()));
+    CHECK(loaded.ImagePath == saved.ImagePath);
+    CHECK(loaded.CueSheet == saved.CueSheet);
+    CHECK_EQ(loaded.nCueSize, saved.nCueSize);
+    CHECK_EQ(loaded.nCueTime, saved.nCueTime);
+    CHECK_EQ(loaded.nVirtualSize, saved.nVirtualSize);
+    CHECK_EQ(loaded.Files.size(), (size_t)2);
+    CHECK_EQ(loaded.Holes.size(), (size_t)1);
+    if (loaded.Files.size() == 2 && loaded.Holes.size() == 1) {
+        CHECK(loaded.Files[0].Path == "1:/Games/a.bin");
+        CHECK_EQ(loaded.Files[0].nSize, 0x123456789ull);
+        CHECK_EQ(loaded.Files[0].nFirstCluster, 1234u);
+        CHECK(loaded.Files[0].LinkMap == saved.Files[0].LinkMap);
+        CHECK(loaded.Files[1].LinkMap.empty());
+        CHECK_EQ(loaded.Files[1].nBase, saved.Files[1].nBase);
+        CHECK_EQ(loaded.Files[1].nFileTime, 0x5A210002u);
+        CHECK_EQ(loaded.Holes[0].nStartLBA, 1000u);
+        CHECK_EQ(loaded.Holes[0].nLength, (u64)4704);
+    }
+
+    // A flipped byte anywhere after the header, or a short block, is no manifest
+    block[block.size() - 3] ^= 0x20;
+    CHECK(!loaded.Load(block.data(), block.size()));
+    CHECK(loaded.Files.empty());
+    block[block.size() - 3] ^= 0x20;
+    CHECK(!loaded.Load(block.data(), block.size() - 1));
+    CHECK(loaded.Load(block.data(), block.size()));
+}
+
+TEST(mount_manifest_is_off_until_given_a_directory)
+{
+    CMountManifest::SetDirectory(nullptr);
+    CHECK(!CMountManifest::IsEnabled());
+
+    CMountManifest manifest;
+    CHECK(!manifest.Read((TestDataDir() + "/splitaudio.cue").c_str()));
+    manifest.ImagePath = "unused.cue";
+    CHECK(!manifest.Write());
+}
+
+TEST(second_mount_of_a_split_rip_comes_from_its_manifest)
+{
+    CManifestFixture fixture("manifest-split",
+                             {"splitaudio.cue", "splitaudio-t1.bin", "splitaudio-t2.bin", "splitaudio-t3.bin"},
+                             "splitaudio.cue");
+    CHECK(fixture.Copied());
+    const std::string cue = fixture.Path("splitaudio.cue");
+
+    FatFsHostResetLinkmapCount();
+    IImageDevice* first = loadCueBinIsoFileDevice(cue.c_str());
+    CHECK(first != nullptr);
+    CHECK_EQ(FatFsHostLinkmapCount(), 3u);
+    CHECK_EQ(fixture.ManifestFiles("splitaudio.cue"), (size_t)3);
+
+    // No link map built and no cue parsed: all of it comes from the manifest
+    FatFsHostResetLinkmapCount();
+    IImageDevice* second = loadCueBinIsoFileDevice(cue.c_str());
+    CHECK(second != nullptr);
+    CHECK_EQ(FatFsHostLinkmapCount(), 0u);
+    if (!first || !second) {
+        delete first;
+        delete second;
+        return;
+    }
+
+    CHECK_EQ(second->GetSize(), first->GetSize());
+    CHECK_EQ(second->GetDataFileCount(), 3);
+    CHECK(second->GetFileType() == FileType::CUEBIN);
+    CHECK(strcmp(second->GetCueSheet(), first->GetCueSheet()) == 0);
+    CHECK_EQ(second->GetNumTracks(), first->GetNumTracks());
+    for (u32 lba : {0u, 149u, 150u, 299u, 300u, 437u})
+        CHECK_EQ(second->GetByteOffsetForLBA(lba), first->GetByteOffsetForLBA(lba));
+
+    std::vector<u8> a = ReadAll(first);
+    std::vector<u8> b = ReadAll(second);
+    CHECK_EQ(a.size(), (size_t)first->GetSize());
+    CHECK(a == b);
+
+    delete first;
+    delete second;
+}
+
+TEST(mount_manifest_is_ignored_once_a_data_file_changes)
+{
+    CManifestFixture fixture("manifest-stale",
+                             {"splitaudio.cue", "splitaudio-t1.bin", "splitaudio-t2.bin", "splitaudio-t3.bin"},
+                             "splitaudio.cue");
+    CHECK(fixture.Copied());
+    const std::string cue = fixture.Path("splitaudio.cue");
+
+    IImageDevice* first = loadCueBinIsoFileDevice(cue.c_str());
+    CHECK(first != nullptr);
+    u64 nSize = first ? first->GetSize() : 0;
+    delete first;
+
+    // One more frame on the last file
+    FILE* f = fopen(fixture.Path("splitaudio-t3.bin").c_str(), "ab");
+    CHECK(f != nullptr);
+    if (f) {
+        std::vector<u8> frame(2352, 0);
+        fwrite(frame.data(), 1, frame.size(), f);
+        fclose(f);
+    }
+
+    FatFsHostResetLinkmapCount();
+    IImageDevice* second = loadCueBinIsoFileDevice(cue.c_str());
+    CHECK(second != nullptr);
+    CHECK_EQ(FatFsHostLinkmapCount(), 3u);
+    if (second)
+        CHECK_EQ(second->GetSize(), nSize + 2352);
+    delete second;
+
+    // Written again for the files as they are now
+    FatFsHostResetLinkmapCount();
+    IImageDevice* third = loadCueBinIsoFileDevice(cue.c_str());
+    CHECK(third != nullptr);
+    CHECK_EQ(FatFsHostLinkmapCount(), 0u);
+    if (third)
+        CHECK_EQ(third->GetSize(), nSize + 2352);
+    delete third;
+}
+
+TEST(mount_manifest_keeps_the_hole_between_sessions)
+{
+    CManifestFixture fixture("manifest-session",
+                             {"splitsession.cue", "splitaudio-t1.bin", "splitsession-t2.bin"},
+                             "splitsession.cue");
+    CHECK(fixture.Copied());
+    const std::string cue = fixture.Path("splitsession.cue");
+
+    IImageDevice* first = loadCueBinIsoFileDevice(cue.c_str());
+    FatFsHostResetLinkmapCount();
+    IImageDevice* second = loadCueBinIsoFileDevice(cue.c_str());
+    CHECK(first != nullptr);
+    CHECK(second != nullptr);
+    CHECK_EQ(FatFsHostLinkmapCount(), 0u);
+    if (!first || !second) {
+        delete first;
+        delete second;
+        return;
+    }
+
+    // Session 2 starts at LBA 11550, far past the 150 frames file 1 stores
+    CHECK_EQ(second->GetSize(), first->GetSize());
+    CHECK(second->GetSize() > (u64)(150 + 40) * 2352);
+    for (u32 lba : {0u, 149u, 11550u, 11566u, 11589u})
+        CHECK_EQ(second->GetByteOffsetForLBA(lba), first->GetByteOffsetForLBA(lba));
+
+    std::vector<u8> a = ReadAll(first);
+    std::vector<u8> b = ReadAll(second);
+    CHECK_EQ(a.size(), (size_t)first->GetSize());
+    CHECK(a == b);
+
+    delete first;
+    delete second;
+}
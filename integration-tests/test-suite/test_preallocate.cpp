@@ -0,0 +1,91 @@
+//
+// test_preallocate.cpp
+//
+// Upload preallocation (FatFsOptimizer in discimage/util.cpp): a file sized
+// ahead of its data, written front to back and trimmed to what was written,
+// ends up byte-identical to one written by plain appends, whether or not
+// the card had a contiguous run for it.
+//
+#include "framework.h"
+#include "fatfs_host.h"
+#include "scratchfile.h"
+
+#include <discimage/util.h>
+#include <fatfs/ff.h>
+
+#include <vector>
+
+// Chunk by chunk, as an upload arrives, growing the file first
+static bool WriteInChunks(FIL *pFile, const std::vector<u8> &data, size_t nChunk, u64 nLimit)
+{
+    for (size_t offset = 0; offset < data.size(); offset += nChunk)
+    {
+        size_t n = data.size() - offset < nChunk ? data.size() - offset : nChunk;
+        if (f_lseek(pFile, offset) != FR_OK)
+            return false;
+        FatFsOptimizer::ReserveExtent(pFile, offset + n, nLimit);
+        if (f_tell(pFile) != offset)
+            return false;
+        UINT nWritten = 0;
+        if (f_write(pFile, data.data() + offset, (UINT)n, &nWritten) != FR_OK || nWritten != n)
+            return false;
+    }
+    return true;
+}
+
+TEST(preallocate_sizes_the_file_up_front_and_trims_to_the_data)
+{
+    const CScratchFile file("prealloc-contiguous.bin");
+    const std::vector<u8> data = ScratchPattern(300000, 13);
+
+    FIL File;
+    CHECK_EQ(f_open(&File, file.c_str(), FA_CREATE_ALWAYS | FA_WRITE), FR_OK);
+    CHECK(FatFsOptimizer::Preallocate(&File, data.size()));
+    CHECK_EQ(f_size(&File), (FSIZE_t)data.size());
+
+    // Already big enough: nothing grows past the announced size
+    CHECK(WriteInChunks(&File, data, 65536, data.size()));
+    CHECK_EQ(f_size(&File), (FSIZE_t)data.size());
+    CHECK_EQ(FatFsOptimizer::TrimToLength(&File, data.size()), FR_OK);
+    f_close(&File);
+
+    CHECK(file.Matches(data));
+}
+
+TEST(preallocate_without_a_contiguous_run_grows_in_extents_up_to_the_size)
+{
+    const CScratchFile file("prealloc-extents.bin");
+    const std::vector<u8> data = ScratchPattern(200000, 13);
+
+    FIL File;
+    CHECK_EQ(f_open(&File, file.c_str(), FA_CREATE_ALWAYS | FA_WRITE), FR_OK);
+    FatFsHostFailExpand(true);
+    CHECK(!FatFsOptimizer::Preallocate(&File, data.size()));
+    FatFsHostClearFaults();
+    CHECK_EQ(f_size(&File), (FSIZE_t)0);
+
+    // The first chunk claims the whole announced size, not a full extent
+    CHECK(WriteInChunks(&File, data, 50000, data.size()));
+    CHECK_EQ(f_size(&File), (FSIZE_t)data.size());
+    f_close(&File);
+
+    CHECK(file.Matches(data));
+}
+
+TEST(preallocate_of_an_unknown_size_runs_ahead_and_is_trimmed)
+{
+    const CScratchFile file("prealloc-unknown.bin");
+    const std::vector<u8> data = ScratchPattern(100000, 13);
+
+    FIL File;
+    CHECK_EQ(f_open(&File, file.c_str(), FA_CREATE_ALWAYS | FA_WRITE), FR_OK);
+    CHECK(!FatFsOptimizer::Preallocate(&File, 0));
+
+    CHECK(WriteInChunks(&File, data, 40000, 0));
+    CHECK(f_size(&File) > (FSIZE_t)data.size());
+    CHECK_EQ(FatFsOptimizer::TrimToLength(&File, data.size()), FR_OK);
+    CHECK_EQ(f_size(&File), (FSIZE_t)data.size());
+    f_close(&File);
+
+    CHECK(file.Matches(data));
+}
@@ -59,6 +59,11 @@ TEST(read10_multi_chunk_high_speed)
     CHECK_EQ(r.dataChunks, 2);
     auto expected = ExpectedSectors(0, 64);
     CHECK_BYTES(r.data.data(), r.data.size(), expected.data(), expected.size());
+
+    // Counted against the image's format for the metrics page
+    CHECK_EQ(bench.gadget->GetServedKiB(FileType::CUEBIN), 128u);
+    CHECK_EQ(bench.gadget->GetServedKiB(FileType::CHD), 0u);
+    CHECK(!bench.gadget->IsFullSpeed());
 }
 
 TEST(read10_multi_chunk_full_speed)
@@ -174,6 +174,9 @@ TEST(real_iso_reads_through_cuebin_reader)
 
     // READ(10) one sector, twice: the real file read path returns a full
     // sector with GOOD status, zero residue, and is stable across reads.
+    // The second comes out of the read-ahead cache.
+    ImageCacheStats before, after;
+    getImageCacheStats(&before);
     const u8 rdCdb[10] = {0x28, 0, 0, 0, 0, 10, 0, 0, 1, 0}; // LBA 10, 1 block
     auto r1 = bench.SendCommand(rdCdb, sizeof(rdCdb), 2048);
     CHECK_EQ(r1.csw.bmCSWStatus, 0);
@@ -181,6 +184,9 @@ TEST(real_iso_reads_through_cuebin_reader)
     CHECK_EQ(r1.data.size(), (size_t)2048);
     auto r2 = bench.SendCommand(rdCdb, sizeof(rdCdb), 2048);
     CHECK_BYTES(r2.data.data(), r2.data.size(), r1.data.data(), r1.data.size());
+    getImageCacheStats(&after);
+    CHECK_EQ(after.cueBinHits + after.cueBinMisses - before.cueBinHits - before.cueBinMisses, 2u);
+    CHECK(after.cueBinHits > before.cueBinHits);
 
     // Independent content oracle: LBA 16 of any ISO9660 disc is the Primary
     // Volume Descriptor, whose byte 0 is 0x01 and bytes 1..5 are the "CD001"
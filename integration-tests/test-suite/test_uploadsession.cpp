@@ -0,0 +1,245 @@
+//
+// test_uploadsession.cpp
+//
+// Web upload sessions (webserver/uploadsession.cpp): chunks gathered into
+// whole blocks and written behind the uploader end up as the same file a
+// chunk-at-a-time write made, and retries, restarts, idle uploads and a full
+// card are answered as /api/images/upload always answered them.
+//
+#include "framework.h"
+#include "fatfs_host.h"
+#include "scratchfile.h"
+
+#include <webserver/uploadsession.h>
+#include <circle/sched/scheduler.h>
+#include <circle/timer.h>
+
+#include <vector>
+
+static CUploadSessions::TResult SendChunk(const CScratchFile &file, const std::vector<u8> &data,
+                                          size_t offset, size_t nChunk, u64 *pReceived)
+{
+    size_t n = data.size() - offset < nChunk ? data.size() - offset : nChunk;
+    return CUploadSessions::Get()->Write(file.c_str(), offset, data.size(),
+                                         data.data() + offset, (unsigned)n, pReceived);
+}
+
+TEST(upload_session_gathers_chunks_into_blocks_written_behind)
+{
+    const CScratchFile file("upload-blocks.part");
+    const std::vector<u8> data = ScratchPattern(CUploadSessions::BlockSize * 2 + 300000);
+    CUploadSessions *pUploads = CUploadSessions::Get();
+
+    // Chunks that do not line up with the blocks
+    u64 nReceived = 0;
+    CHECK_EQ(SendChunk(file, data, 0, 700000, &nReceived), CUploadSessions::ResultOK);
+    CHECK(!pUploads->Flush());
+    CHECK_EQ(SendChunk(file, data, 700000, 700000, &nReceived), CUploadSessions::ResultOK);
+    CHECK_EQ(nReceived, (u64)1400000);
+    CHECK_EQ(pUploads->GetCount(), 1u);
+
+    // A whole block waits for the flush task, and only one
+    CHECK(pUploads->Flush());
+    CHECK(!pUploads->Flush());
+
+    for (size_t offset = 1400000; offset < data.size(); offset += 700000)
+        CHECK_EQ(SendChunk(file, data, offset, 700000, &nReceived), CUploadSessions::ResultOK);
+    CHECK_EQ(nReceived, (u64)data.size());
+    CHECK_EQ(pUploads->Finish(file.c_str()), CUploadSessions::ResultOK);
+    CHECK_EQ(pUploads->GetCount(), 0u);
+
+    CHECK(file.Matches(data));
+}
+
+TEST(upload_session_answers_retries_and_restarts_like_the_file_did)
+{
+    const CScratchFile file("upload-retry.part");
+    const std::vector<u8> data = ScratchPattern(500000);
+    CUploadSessions *pUploads = CUploadSessions::Get();
+
+    u64 nReceived = 0;
+    CHECK_EQ(SendChunk(file, data, 0, 100000, &nReceived), CUploadSessions::ResultOK);
+    CHECK_EQ(SendChunk(file, data, 100000, 100000, &nReceived), CUploadSessions::ResultOK);
+
+    // The response to the last chunk got lost
+    CHECK_EQ(SendChunk(file, data, 100000, 100000, &nReceived), CUploadSessions::ResultAlreadyHave);
+    CHECK_EQ(nReceived, (u64)200000);
+    // A gap
+    CHECK_EQ(SendChunk(file, data, 300000, 100000, &nReceived), CUploadSessions::ResultOutOfSequence);
+
+    // Offset 0 starts the file over
+    for (size_t offset = 0; offset < data.size(); offset += 100000)
+        CHECK_EQ(SendChunk(file, data, offset, 100000, &nReceived), CUploadSessions::ResultOK);
+    CHECK_EQ(pUploads->Finish(file.c_str()), CUploadSessions::ResultOK);
+
+    CHECK(file.Matches(data));
+}
+
+TEST(upload_session_ends_when_idle_and_resumes_from_the_file)
+{
+    const CScratchFile file("upload-idle.part");
+    const std::vector<u8> data = ScratchPattern(600000);
+    CUploadSessions *pUploads = CUploadSessions::Get();
+
+    u64 nReceived = 0;
+    CHECK_EQ(SendChunk(file, data, 0, 125000, &nReceived), CUploadSessions::ResultOK);
+    CHECK_EQ(SendChunk(file, data, 125000, 125000, &nReceived), CUploadSessions::ResultOK);
+    CTimer::Get()->TestAdvanceTicks(CUploadSessions::IdleTimeoutSecs * HZ - 1);
+    CHECK(!pUploads->Flush());
+    CTimer::Get()->TestAdvanceTicks(1);
+    CHECK(pUploads->Flush());
+    CHECK_EQ(pUploads->GetCount(), 0u);
+
+    // Closed with its data on the card and the reservation trimmed off, so
+    // the next chunk finds the file as long as what arrived
+    CHECK_EQ(SendChunk(file, data, 125000, 125000, &nReceived), CUploadSessions::ResultAlreadyHave);
+    CHECK_EQ(SendChunk(file, data, 500000, 250000, &nReceived), CUploadSessions::ResultOutOfSequence);
+    CHECK_EQ(nReceived, (u64)250000);
+    CHECK_EQ(pUploads->GetCount(), 0u);
+
+    CHECK_EQ(SendChunk(file, data, 250000, 350000, &nReceived), CUploadSessions::ResultOK);
+    CHECK_EQ(pUploads->Finish(file.c_str()), CUploadSessions::ResultOK);
+
+    CHECK(file.Matches(data));
+}
+
+TEST(upload_session_on_a_full_card_fails_and_removes_the_file)
+{
+    const CScratchFile file("upload-full.part");
+    const std::vector<u8> data = ScratchPattern(CUploadSessions::BlockSize + 200000);
+    CUploadSessions *pUploads = CUploadSessions::Get();
+
+    FatFsHostSetWriteLimit(300000);
+    u64 nReceived = 0;
+    CHECK_EQ(SendChunk(file, data, 0, CUploadSessions::BlockSize, &nReceived), CUploadSessions::ResultOK);
+    CHECK(pUploads->Flush());
+
+    // Reported with the next chunk, as the upload cannot go on
+    CHECK_EQ(SendChunk(file, data, CUploadSessions::BlockSize, 200000, &nReceived),
+             CUploadSessions::ResultWriteFailed);
+    FatFsHostClearFaults();
+    CHECK_EQ(pUploads->GetCount(), 0u);
+    CHECK(!file.Exists());
+}
+
+TEST(upload_session_that_cannot_be_trimmed_removes_the_file)
+{
+    const CScratchFile file("upload-untrimmed.part");
+    const std::vector<u8> data = ScratchPattern(600000);
+    CUploadSessions *pUploads = CUploadSessions::Get();
+
+    u64 nReceived = 0;
+    CHECK_EQ(SendChunk(file, data, 0, 250000, &nReceived), CUploadSessions::ResultOK);
+    FatFsHostFailTruncate(true);
+    CTimer::Get()->TestAdvanceTicks(CUploadSessions::IdleTimeoutSecs * HZ);
+    CHECK(pUploads->Flush());
+    FatFsHostClearFaults();
+    CHECK_EQ(pUploads->GetCount(), 0u);
+
+    // Kept, the file would be as long as the reservation and the next chunk
+    // would carry on from there; gone, the uploader has to start over
+    CHECK(!file.Exists());
+    CHECK_EQ(SendChunk(file, data, 250000, 250000, &nReceived), CUploadSessions::ResultOpenFailed);
+}
+
+// What other requests got while the first was parked in its Write()
+static const CScratchFile *s_pBusyFile;
+static const std::vector<u8> *s_pBusyData;
+static CUploadSessions::TResult s_RetryResult, s_RestartResult, s_FinishResult;
+static u64 s_nRetryReceived;
+static bool s_bWriterReturned, s_bAnsweredAfterWriter;
+static unsigned s_nSessionsAfterEviction;
+
+// Enough other uploads to need room; the busy one is the oldest
+static void EvictWhileBusy(void)
+{
+    CUploadSessions *pUploads = CUploadSessions::Get();
+    u64 nReceived = 0;
+    CTimer::Get()->TestAdvanceTicks(HZ);
+    const CScratchFile others[CUploadSessions::MaxSessions] = {
+        CScratchFile("upload-other0.part"), CScratchFile("upload-other1.part"),
+        CScratchFile("upload-other2.part"), CScratchFile("upload-other3.part")};
+    const std::vector<u8> small = ScratchPattern(1000);
+    for (const CScratchFile &other : others)
+        SendChunk(other, small, 0, small.size(), &nReceived);
+    s_nSessionsAfterEviction = pUploads->GetCount();
+    for (const CScratchFile &other : others)
+        pUploads->Finish(other.c_str());
+}
+
+// The same chunk again, before the first got its answer, then the end
+static void RetryWhileBusy(void)
+{
+    const size_t nBlock = CUploadSessions::BlockSize;
+    s_RetryResult = SendChunk(*s_pBusyFile, *s_pBusyData, nBlock, nBlock, &s_nRetryReceived);
+    s_bAnsweredAfterWriter = s_bWriterReturned;
+    s_FinishResult = CUploadSessions::Get()->Finish(s_pBusyFile->c_str());
+}
+
+static void RestartWhileBusy(void)
+{
+    u64 nReceived = 0;
+    s_RestartResult = SendChunk(*s_pBusyFile, *s_pBusyData, 0, 1000, &nReceived);
+    s_bAnsweredAfterWriter = s_bWriterReturned;
+}
+
+TEST(upload_session_stays_with_the_request_writing_to_it)
+{
+    const CScratchFile file("upload-busy.part");
+    const std::vector<u8> data = ScratchPattern(CUploadSessions::BlockSize * 2);
+    CUploadSessions *pUploads = CUploadSessions::Get();
+    s_pBusyFile = &file;
+    s_pBusyData = &data;
+    s_bWriterReturned = false;
+    s_bAnsweredAfterWriter = false;
+
+    // The second block has to wait for the first to reach the card, and
+    // that write yields
+    u64 nReceived = 0;
+    CHECK_EQ(SendChunk(file, data, 0, CUploadSessions::BlockSize, &nReceived), CUploadSessions::ResultOK);
+    CScheduler::TestOnNextYield(EvictWhileBusy);
+    CScheduler::TestStartTaskAtNextYield(RetryWhileBusy);
+    CHECK_EQ(SendChunk(file, data, CUploadSessions::BlockSize, CUploadSessions::BlockSize, &nReceived),
+             CUploadSessions::ResultOK);
+    s_bWriterReturned = true;
+    CHECK(CScheduler::TestFinishTask());
+
+    CHECK_EQ(s_nSessionsAfterEviction, CUploadSessions::MaxSessions);
+
+    // The retry waited for the chunk to be in, and was told it already was
+    CHECK(s_bAnsweredAfterWriter);
+    CHECK_EQ(s_RetryResult, CUploadSessions::ResultAlreadyHave);
+    CHECK_EQ(s_nRetryReceived, (u64)data.size());
+
+    // Every chunk in it once
+    CHECK_EQ(nReceived, (u64)data.size());
+    CHECK_EQ(s_FinishResult, CUploadSessions::ResultOK);
+    CHECK_EQ(pUploads->GetCount(), 0u);
+    CHECK(file.Matches(data));
+}
+
+TEST(upload_restart_waits_for_the_chunk_in_flight)
+{
+    const CScratchFile file("upload-busy-restart.part");
+    const std::vector<u8> data = ScratchPattern(CUploadSessions::BlockSize * 2);
+    CUploadSessions *pUploads = CUploadSessions::Get();
+    s_pBusyFile = &file;
+    s_pBusyData = &data;
+    s_bWriterReturned = false;
+    s_bAnsweredAfterWriter = false;
+
+    u64 nReceived = 0;
+    CHECK_EQ(SendChunk(file, data, 0, CUploadSessions::BlockSize, &nReceived), CUploadSessions::ResultOK);
+    CScheduler::TestStartTaskAtNextYield(RestartWhileBusy);
+    CHECK_EQ(SendChunk(file, data, CUploadSessions::BlockSize, CUploadSessions::BlockSize, &nReceived),
+             CUploadSessions::ResultOK);
+    s_bWriterReturned = true;
+    CHECK(CScheduler::TestFinishTask());
+
+    // The session was closed under no one, and the file started over
+    CHECK(s_bAnsweredAfterWriter);
+    CHECK_EQ(s_RestartResult, CUploadSessions::ResultOK);
+    CHECK_EQ(pUploads->GetCount(), 1u);
+    CHECK_EQ(pUploads->Finish(file.c_str()), CUploadSessions::ResultOK);
+    CHECK(file.Matches(std::vector<u8>(data.begin(), data.begin() + 1000)));
+}
@@ -0,0 +1,75 @@
+//
+// test_volumewarmup.cpp
+//
+// The mount-time read-ahead of a disc's file system (discimage/
+// volumewarmup.cpp), against the real ISO 9660 test image: which sectors
+// it reads, and that the host's first reads after it are cache hits.
+//
+#include "framework.h"
+
+#include <discimage/util.h>
+#include <discimage/volumewarmup.h>
+
+#include <string>
+
+static std::string TestDataDir()
+{
+#ifdef USBODE_TESTDATA
+    return USBODE_TESTDATA;
+#else
+    return "out/images";
+#endif
+}
+
+static bool ReadSector(IImageDevice *device, u32 lba)
+{
+    u8 sector[2048];
+    u64 offset = device->GetByteOffsetForLBA(lba);
+    return device->Seek(offset) == offset && device->Read(sector, sizeof(sector)) == (int)sizeof(sector);
+}
+
+TEST(warmup_reads_descriptors_path_tables_and_roots)
+{
+    IImageDevice *device = loadImageDevice((TestDataDir() + "/image.iso").c_str());
+    CHECK(device != nullptr);
+    if (!device)
+        return;
+
+    // LBA 0; the primary, Joliet and terminator descriptors at 16-18; then
+    // one path table and one root directory sector for each volume
+    CHECK_EQ(warmImageVolume(device), 8u);
+    delete device;
+}
+
+TEST(warmup_leaves_the_first_listing_in_the_cache)
+{
+    IImageDevice *device = loadImageDevice((TestDataDir() + "/image.iso").c_str());
+    CHECK(device != nullptr);
+    if (!device)
+        return;
+
+    warmImageVolume(device);
+
+    ImageCacheStats before;
+    getImageCacheStats(&before);
+    for (u32 lba : {16u, 17u, 18u, 20u, 21u, 23u, 24u})
+        CHECK(ReadSector(device, lba));
+    ImageCacheStats after;
+    getImageCacheStats(&after);
+
+    CHECK_EQ(after.cueBinMisses, before.cueBinMisses);
+    CHECK_EQ(after.cueBinHits - before.cueBinHits, 7u);
+    delete device;
+}
+
+TEST(warmup_skips_audio_discs)
+{
+    IImageDevice *device = loadImageDevice((TestDataDir() + "/audiocd.cue").c_str());
+    CHECK(device != nullptr);
+    if (!device)
+        return;
+
+    CHECK_EQ(warmImageVolume(device), 0u);
+    delete device;
+    CHECK_EQ(warmImageVolume(nullptr), 0u);
+}
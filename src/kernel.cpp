@@ -33,9 +33,13 @@
 #include <configservice/configservice.h>
 #include <setupstatus/setupstatus.h>
 #include <upgradestatus/upgradestatus.h>
+#include <cdcore/cdcore.h>
+#include <tracelab/binlog.h>
+#include <tracelab/boottimeline.h>
 #include <circle/memory.h>
 #include <circle/machineinfo.h>
 
+#include <circle/sched/task.h>
 #include <circle/time.h>
 
 #define ROOTDRIVE "0:"
@@ -49,10 +53,24 @@
 // Define the images directory
 #define IMAGES_DIR IMAGESDRIVE "/"
 
+// How long boot waits for the last image to mount before bringing up the
+// rest; a scan of a large library without a saved index can take longer
+#define STARTUP_MOUNT_TIMEOUT_MS 5000
+
+// The network used to come up on the main task's stack, which is larger
+// than a task's default; CNetworkTask keeps that headroom
+#define NETWORK_STACK_SIZE KERNEL_STACK_SIZE
+
 LOGMODULE("kernel");
 
 static CKernel *g_pKernel = nullptr;
 
+// Milliseconds since power-on, so the log shows where boot spends its time
+static void LogBootStage(const char *pStage)
+{
+    LOGNOTE("Boot: %s at %u ms", pStage, CTimer::Get()->GetClockTicks() / 1000);
+}
+
 CKernel::CKernel(void)
     : m_Screen(m_Options.GetWidth(), m_Options.GetHeight()),
       m_Timer(&m_Interrupt),
@@ -62,7 +80,8 @@ CKernel::CKernel(void)
       m_Net(0, 0, 0, 0, HOSTNAME, NetDeviceTypeWLAN),
       m_WPASupplicant(SUPPLICANT_CONFIG_FILE),
       m_pSPIMaster(nullptr),
-      m_pConfigService(nullptr) // Initialize to nullptr
+      m_pConfigService(nullptr), // Initialize to nullptr
+      m_bNetworkAvailable(FALSE)
 {
     // Initialize the global kernel pointer
     g_pKernel = this;
@@ -86,13 +105,17 @@ boolean CKernel::Initialize(void)
 
     if (bOK)
     {
+        CBootTimeline::Get()->Begin(BootStageScreen);
         bOK = m_Screen.Initialize();
+        CBootTimeline::Get()->End(BootStageScreen);
         LOGNOTE("Initialized screen");
     }
 
     if (bOK)
     {
+        CBootTimeline::Get()->Begin(BootStageSerial);
         bOK = m_Serial.Initialize(115200);
+        CBootTimeline::Get()->End(BootStageSerial);
         LOGNOTE("Initialized serial");
     }
 
@@ -104,41 +127,54 @@ boolean CKernel::Initialize(void)
             pTarget = &m_Screen;
         }
 
+        CBootTimeline::Get()->Begin(BootStageLogger);
         bOK = m_Logger.Initialize(pTarget);
+        CBootTimeline::Get()->End(BootStageLogger);
         LOGNOTE("Initialized logger");
     }
 
     if (bOK)
     {
+        CBootTimeline::Get()->Begin(BootStageInterrupts);
         bOK = m_Interrupt.Initialize();
+        CBootTimeline::Get()->End(BootStageInterrupts);
         LOGNOTE("Initialized interrupts");
     }
 
     if (bOK)
     {
+        CBootTimeline::Get()->Begin(BootStageTimer);
         bOK = m_Timer.Initialize();
+        CBootTimeline::Get()->End(BootStageTimer);
         LOGNOTE("Initialized timer");
     }
 
     if (bOK)
     {
+        CBootTimeline::Get()->Begin(BootStageEMMC);
         bOK = m_EMMC.Initialize();
+        CBootTimeline::Get()->End(BootStageEMMC);
         LOGNOTE("Initialized eMMC");
     }
 
     if (bOK)
     {
+        CBootTimeline::Get()->Begin(BootStageFilesystem);
         if (f_mount(&m_RootFileSystem, ROOTDRIVE, 1) != FR_OK)
         {
             LOGERR("Cannot mount drive: %s", ROOTDRIVE);
             bOK = FALSE;
         }
+        CBootTimeline::Get()->End(BootStageFilesystem);
         LOGNOTE("Initialized filesystem");
+        LogBootStage("filesystem mounted");
 
         // Initialize ConfigService immediately after filesystem mount
         if (bOK)
         {
+            CBootTimeline::Get()->Begin(BootStageConfigService);
             m_pConfigService = new ConfigService();
+            CBootTimeline::Get()->End(BootStageConfigService);
             LOGNOTE("Initialized Config service");
 
             // The daemon runs either way, so a bad path otherwise leaves a system
@@ -159,55 +195,151 @@ boolean CKernel::Initialize(void)
             }
         }
     }
-    if (bOK)
+    return bOK;
+}
+
+CKernel *CKernel::Get()
+{
+    return g_pKernel;
+}
+
+// Brings up the network and the servers on it from a task of its own, so
+// the main task reaches its loop (and the drive, the display and the rest
+// of boot are not held up) while WLAN loads its firmware off the card and
+// DHCP and WPA take seconds to settle. Ends once everything is started.
+class CNetworkTask : public CTask
+{
+public:
+    CNetworkTask(CKernel *pKernel)
+        : CTask(NETWORK_STACK_SIZE),
+          m_pKernel(pKernel)
     {
-        // Don't start network if we're doing an upgrade, since this will cause a
-        UpgradeStatus *upgradeCheck = UpgradeStatus::Get();
+        SetName("network");
+    }
 
-        if (!m_WLAN.Initialize() || upgradeCheck->isUpgradeRequired())
-        {
-            LOGWARN("WLAN not available - continuing without network");
-            m_bNetworkAvailable = FALSE;
-        }
-        else
-        {
-            LOGNOTE("Initialized WLAN");
-            m_bNetworkAvailable = TRUE;
-        }
+    void Run(void) override
+    {
+        m_pKernel->RunNetwork();
+    }
+
+private:
+    CKernel *m_pKernel;
+};
+
+// WLAN, then the network, then WPA
+void CKernel::StartNetwork(void)
+{
+    CBootTimeline::Get()->Begin(BootStageNetwork);
+    if (!m_WLAN.Initialize())
+    {
+        LOGWARN("WLAN not available - continuing without network");
+        CBootTimeline::Get()->End(BootStageNetwork);
+        return;
     }
+    LOGNOTE("Initialized WLAN");
+    LogBootStage("WLAN up");
 
-    if (bOK && m_bNetworkAvailable)
+    if (!m_Net.Initialize(FALSE))
     {
-        if (!m_Net.Initialize(FALSE))
+        LOGWARN("Network initialization failed - continuing without network");
+        CBootTimeline::Get()->End(BootStageNetwork);
+        return;
+    }
+    LOGNOTE("Initialized network");
+
+    if (!m_WPASupplicant.Initialize())
+    {
+        LOGWARN("WPA supplicant initialization failed - continuing without network");
+        CBootTimeline::Get()->End(BootStageNetwork);
+        return;
+    }
+    LOGNOTE("Initialized WPA supplicant");
+    CBootTimeline::Get()->End(BootStageNetwork);
+    LogBootStage("network started");
+    m_bNetworkAvailable = TRUE;
+}
+
+// Runs in CNetworkTask. The servers start once the network is running,
+// which after StartNetwork() still waits for the access point and DHCP.
+void CKernel::RunNetwork(void)
+{
+    StartNetwork();
+    if (!m_bNetworkAvailable)
+    {
+        return;
+    }
+
+    static const char ServiceName[] = HOSTNAME;
+    CmDNSPublisher *pmDNSPublisher = nullptr;
+    CWebServer *pCWebServer = nullptr;
+    CFTPDaemon *pFTPDaemon = nullptr;
+    bool ntpInitialized = false;
+
+    while (!pCWebServer || !ntpInitialized || !pmDNSPublisher || !pFTPDaemon)
+    {
+        if (!m_Net.IsRunning())
         {
-            LOGWARN("Network initialization failed - continuing without network");
-            m_bNetworkAvailable = FALSE;
+            CScheduler::Get()->MsSleep(100);
+            continue;
         }
-        else
+
+        // Start the Web Server
+        if (!pCWebServer)
         {
-            LOGNOTE("Initialized network");
+            // Create the web server
+            CBootTimeline::Get()->Begin(BootStageWebServer);
+            pCWebServer = new CWebServer(&m_Net, &m_ActLED);
+            CBootTimeline::Get()->End(BootStageWebServer);
+
+            LOGNOTE("Started Webserver service");
+            LogBootStage("web server started");
         }
-    }
 
-    if (bOK && m_bNetworkAvailable)
-    {
-        if (!m_WPASupplicant.Initialize())
+        // Run NTP
+        if (!ntpInitialized)
         {
-            LOGWARN("WPA supplicant initialization failed - continuing without network");
-            m_bNetworkAvailable = FALSE;
+            // Read timezone from config.txt
+            const char *timezone = m_pConfigService->GetTimezone();
+
+            // Initialize NTP with the timezone
+            InitializeNTP(timezone);
+            ntpInitialized = true;
         }
-        else
+
+        // Publish mDNS
+        if (!pmDNSPublisher)
         {
-            LOGNOTE("Initialized WPA supplicant");
+            static const char *ppText[] = {"path=/index.html", nullptr};
+            pmDNSPublisher = new CmDNSPublisher(&m_Net);
+            if (!pmDNSPublisher->PublishService(ServiceName, "_http._tcp", 80, ppText))
+            {
+                LOGNOTE("Cannot publish service");
+            }
+            LOGNOTE("Started mDNS service");
         }
-    }
 
-    return bOK;
-}
+        // Start the FTP Server
+        if (!pFTPDaemon)
+        {
+            CBootTimeline::Get()->Begin(BootStageFTPServer);
+            pFTPDaemon = new CFTPDaemon("cdrom", "cdrom");
+            boolean bFTPStarted = pFTPDaemon->Initialize();
+            CBootTimeline::Get()->End(BootStageFTPServer);
+            if (!bFTPStarted)
+            {
+                LOGERR("Failed to init FTP daemon");
+                delete pFTPDaemon;
+                pFTPDaemon = nullptr;
+            }
+            else
+            {
+                LOGNOTE("Started FTP service");
+                LogBootStage("FTP server started");
+            }
+        }
 
-CKernel *CKernel::Get()
-{
-    return g_pKernel;
+        CScheduler::Get()->MsSleep(100);
+    }
 }
 
 TShutdownMode CKernel::Run(void)
@@ -326,11 +458,13 @@ TShutdownMode CKernel::Run(void)
     }
 
     // Mount images partition for normal operation
+    CBootTimeline::Get()->Begin(BootStageImagesPartition);
     if (f_mount(&m_ImagesFileSystem, IMAGESDRIVE, 1) != FR_OK)
     {
         LOGERR("Failed to mount images partition %s", IMAGESDRIVE);
         return ShutdownHalt;
     }
+    CBootTimeline::Get()->End(BootStageImagesPartition);
     LOGNOTE("Partition 1 (data/images) mounted successfully");
 
     // Read VID/PID from config (with defaults)
@@ -353,87 +487,71 @@ TShutdownMode CKernel::Run(void)
         LOGNOTE("USB Target OS: DOSWIN - VID:0x%04x PID:0x%04x", vendorId, productId);
     }
 
+    // Give the USB CD data path its own core where the board has one, so
+    // host reads stop queueing behind the web server and the display.
+    // cd_core=0 keeps everything on core 0 as before.
+    if (config->GetProperty("cd_core", 1U) != 0)
+    {
+        CCDCore *pCDCore = new CCDCore(CMemorySystem::Get());
+        pCDCore->Initialize();
+    }
+
     // Create CDROM service with runtime VID/PID
+    CBootTimeline::Get()->Begin(BootStageCDROMService);
     new CDROMService(vendorId, productId);
+    CBootTimeline::Get()->End(BootStageCDROMService);
+    LogBootStage("CD drive created");
+
+    // The data path's messages (its errors always, debug_cdrom's when set)
+    // are recorded unformatted there and formatted here, off it.
+    new CBinLogTask();
 
-    new SCSITBService();
+    CBootTimeline::Get()->Begin(BootStageSCSITBService);
+    SCSITBService *pSCSITBService = new SCSITBService();
+    CBootTimeline::Get()->End(BootStageSCSITBService);
     LOGNOTE("Started SCSITB service");
 
+    // Some BIOSes boot from the drive and give up if it is still empty, so
+    // the last image goes in (and the gadget enumerates with it) before
+    // anything that can wait: the display, the metadata task and the network
+    CBootTimeline::Get()->Begin(BootStageMountWait);
+    unsigned nMountStart = CTimer::Get()->GetClockTicks();
+    while (pSCSITBService->IsMountPending()
+           && CTimer::Get()->GetClockTicks() - nMountStart < STARTUP_MOUNT_TIMEOUT_MS * 1000)
+    {
+        CScheduler::Get()->MsSleep(10);
+    }
+    CBootTimeline::Get()->End(BootStageMountWait);
+    LogBootStage(pSCSITBService->IsMountPending() ? "image still mounting" : "drive ready");
+
+    // Reads each image's label, platform and tracks in the background
+    new CImageMetadataTask();
+
     // Start display services for normal running mode
     const char *displayType = config->GetDisplayHat();
     if (strcmp(displayType, "none") != 0)
     {
+        CBootTimeline::Get()->Begin(BootStageDisplayService);
         new DisplayService(displayType);
+        CBootTimeline::Get()->End(BootStageDisplayService);
         LOGNOTE("Started DisplayService service");
+        LogBootStage("display started");
     }
 
+    // WLAN firmware, DHCP and WPA take seconds; they and the servers on the
+    // network come up in CNetworkTask while the main loop runs
+    new CNetworkTask(this);
+
     // Definitive startup checkpoint: every service that can start without the
     // network is up and the main loop is about to begin. The QEMU boot test
     // (tests/qemu-boot/) keys on this exact line - keep format changes in sync
     // with validate_boot_log.py.
     LOGNOTE("USBODE %s ready", CGitInfo::Get()->GetVersionString());
 
-    static const char ServiceName[] = HOSTNAME;
-    CmDNSPublisher *pmDNSPublisher = nullptr;
-    CWebServer *pCWebServer = nullptr;
-    CFTPDaemon *m_pFTPDaemon = nullptr;
-
-    // Previous IP tracking
-    bool ntpInitialized = false;
-
     // Main Loop
     // int counter = 0;
     for (;;)
     {
-
-        // Start the Web Server
-        if (m_Net.IsRunning() && !pCWebServer)
-        {
-            // Create the web server
-            pCWebServer = new CWebServer(&m_Net, &m_ActLED);
-
-            LOGNOTE("Started Webserver service");
-        }
-
-        // Run NTP
-        if (m_Net.IsRunning() && !ntpInitialized)
-        {
-            // Read timezone from config.txt
-            const char *timezone = config->GetTimezone();
-
-            // Initialize NTP with the timezone
-            InitializeNTP(timezone);
-            ntpInitialized = true;
-        }
-
-        // Publish mDNS
-        if (m_Net.IsRunning() && !pmDNSPublisher)
-        {
-            static const char *ppText[] = {"path=/index.html", nullptr};
-            pmDNSPublisher = new CmDNSPublisher(&m_Net);
-            if (!pmDNSPublisher->PublishService(ServiceName, "_http._tcp", 80, ppText))
-            {
-                LOGNOTE("Cannot publish service");
-            }
-            LOGNOTE("Started mDNS service");
-        }
-
-        // Start the FTP Server
-        if (m_Net.IsRunning() && !m_pFTPDaemon)
-        {
-            m_pFTPDaemon = new CFTPDaemon("cdrom", "cdrom");
-            if (!m_pFTPDaemon->Initialize())
-            {
-                LOGERR("Failed to init FTP daemon");
-                delete m_pFTPDaemon;
-                m_pFTPDaemon = nullptr;
-            }
-            else
-            {
-                LOGNOTE("Started FTP service");
-            }
-        }
-
         // Check if we should shutdown or halt
         if (DeviceState::Get().getShutdownMode() != ShutdownNone)
         {
@@ -100,6 +100,9 @@ private:
 
 	CSPIMaster* m_pSPIMaster;
 	void InitializeNTP(const char* timezone);
+	void StartNetwork(void);
+	void RunNetwork(void);
+	friend class CNetworkTask;
 	static const char ConfigOptionTimeZone[];
 
 	// Setup functions
@@ -112,9 +112,6 @@ def build_events(exp):
         ev(r"^kernel: Initialized filesystem$", "root FAT mounted"),
         ev(r"^kernel: Initialized Config service$", "config.txt + cmdline.txt parsed"),
         ev(rf"^gitinfo: Version: {V}, Short: .*\(AARCH{BITS}\)", f"gitinfo reports {exp['version']} / AARCH{BITS}"),
-        # lossy: observed dropped from the file log's burst window on raspi0
-        # (present in serial capture in every run) - required on serial only
-        ev(r"^kernel: WLAN not available - continuing without network$", "WLAN degraded gracefully", lossy=True),
     ]
     banner = [
         ev(r"^kernel: Welcome to USBODE$", "banner", lossy=True),
@@ -148,6 +145,7 @@ def build_events(exp):
             ev(r"^CUSBCDGadget::ArmBootEject: Drive will come up empty", "boot eject armed"),
             ev(r"^scsitbservice: SCSITBService::RefreshCache\(\) Found 0 total entries$", "image scan: none (by design)"),
             ev(r"^kernel: Started SCSITB service$", "all services constructed"),
+            ev(r"^kernel: Boot: drive ready at \d+ ms$", "drive settled before the network"),
         ],
         "unordered": [
             ev(r"^scsitbservice: SCSITBService::Run started$", "scsitb task scheduled"),
@@ -161,6 +159,12 @@ def build_events(exp):
     if exp["require_ready"]:
         session2["ordered"].append(
             ev(rf"^kernel: USBODE {V} ready$", f"USBODE {exp['version']} ready"))
+    # The network comes up in its own task once the drive has its image, so
+    # after the ready line; setup never starts it. lossy: observed dropped
+    # from the file log's burst window on raspi0 (present in serial capture
+    # in every run)
+    session2["ordered"].append(
+        ev(r"^kernel: WLAN not available - continuing without network$", "WLAN degraded gracefully", lossy=True))
     return [session1, session2]
 
 